@@ -1,62 +1,5175 @@
+#define _GNU_SOURCE  // O_DIRECT
 #include <stdio.h>
+#include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
 
-void save_large_array_to_file(const char *filename, const uint8_t *arr, size_t size) {
-    FILE *file = fopen(filename, "wb");
-    if (!file) {
-        perror("Failed to open file");
-        return;
-    }
+#include "dna_array.h"
+
+#ifdef DNA_USE_ZSTD
+#include <zstd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define DNA_X86 1
+#endif
+
+#define BASES_PER_BYTE 4
+#define IO_BUFFER_BYTES (8u << 20)  // Largest staging buffer, one write()/read() each
+#define IO_ALIGN 4096               // Buffer, offset and length alignment for O_DIRECT
+#define PARALLEL_MIN_BASES (4u << 20)  // Smaller pack/unpack calls stay on one thread
+#define PARALLEL_CHUNK (1u << 20)      // Bases per parallel task, a multiple of 4
+
+// Pack kernels take `n` codes from `src` and write (n + 3) / 4 bytes to `dst`,
+// returning the OR of all input bytes so callers can reject codes above 3
+// without a second pass. Unpack kernels read (n + 3) / 4 bytes from `src` and
+// write `n` codes. Every kernel keeps the on-disk layout: the first base sits
+// in the two most significant bits of a byte (`6 - bit_position`).
+typedef uint8_t (*pack_kernel_fn)(const uint8_t *src, size_t n, uint8_t *dst);
+typedef void (*unpack_kernel_fn)(const uint8_t *src, size_t n, uint8_t *dst);
 
+// Reference kernels: one base at a time. Every other kernel hands its tail to these.
+static uint8_t pack_scalar(const uint8_t *src, size_t n, uint8_t *dst) {
     uint8_t buffer = 0;  // Buffer for packed bits
     int bit_position = 0; // Tracks current bit position in the buffer
+    uint8_t seen = 0;
 
-    for (size_t i = 0; i < size; ++i) {
-        // Pack 2 bits of the current element into the buffer
-        buffer |= (arr[i] & 0x03) << (6 - bit_position);
+    for (size_t i = 0; i < n; ++i) {
+        seen |= src[i];
+        buffer |= (src[i] & 0x03) << (6 - bit_position);
         bit_position += 2;
 
-        // Write buffer when full
         if (bit_position == 8) {
-            fwrite(&buffer, 1, 1, file);
+            *dst++ = buffer;
             buffer = 0;
             bit_position = 0;
         }
     }
 
-    // Write remaining bits
     if (bit_position > 0) {
-        fwrite(&buffer, 1, 1, file);
+        *dst = buffer;
     }
-
-    fclose(file);
+    return seen;
 }
 
-void read_large_array_from_file(const char *filename, uint8_t *arr, size_t size) {
-    FILE *file = fopen(filename, "rb");
-    if (!file) {
-        perror("Failed to open file");
-        return;
-    }
-
-    uint8_t buffer = 0;  // Buffer for packed bits
-    int bit_position = 0; // Tracks current bit position in the buffer
+static void unpack_scalar(const uint8_t *src, size_t n, uint8_t *dst) {
+    uint8_t buffer = 0;
+    int bit_position = 0;
 
-    for (size_t i = 0; i < size; ++i) {
-        // Read a new byte when needed
+    for (size_t i = 0; i < n; ++i) {
         if (bit_position == 0) {
-            fread(&buffer, 1, 1, file);
+            buffer = *src++;
         }
 
-        // Extract the next 2 bits
-        arr[i] = (buffer >> (6 - bit_position)) & 0x03;
+        dst[i] = (buffer >> (6 - bit_position)) & 0x03;
         bit_position += 2;
 
-        // Reset bit position when byte is consumed
         if (bit_position == 8) {
             bit_position = 0;
         }
     }
+}
+
+// 64-bit word kernels: 8 codes per load for packing, a 4-byte table entry per
+// packed byte for unpacking.
+static uint8_t unpack_lut[256][BASES_PER_BYTE];
+
+static uint8_t pack_word(const uint8_t *src, size_t n, uint8_t *dst) {
+    size_t i = 0;
+    uint64_t seen = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x;
+        memcpy(&x, src + i, 8);
+        seen |= x;
+        x &= 0x0303030303030303ULL;
+        // Fold neighbouring codes together: pairs into nibbles, then nibbles into bytes.
+        x = ((x & 0x00FF00FF00FF00FFULL) << 2) | ((x >> 8) & 0x00FF00FF00FF00FFULL);
+        x = ((x & 0x0000FFFF0000FFFFULL) << 4) | ((x >> 16) & 0x0000FFFF0000FFFFULL);
+        dst[i / 4] = (uint8_t)x;
+        dst[i / 4 + 1] = (uint8_t)(x >> 32);
+    }
+#endif
+    seen |= seen >> 32;
+    seen |= seen >> 16;
+    seen |= seen >> 8;
+    return (uint8_t)seen | pack_scalar(src + i, n - i, dst + i / 4);
+}
+
+static void unpack_word(const uint8_t *src, size_t n, uint8_t *dst) {
+    size_t i = 0;
+    for (; i + BASES_PER_BYTE <= n; i += BASES_PER_BYTE) {
+        memcpy(dst + i, unpack_lut[*src++], BASES_PER_BYTE);
+    }
+    unpack_scalar(src, n - i, dst + i);
+}
+
+#ifdef DNA_X86
+// SSE2: 32 codes -> 8 bytes per step. Same folding as pack_word, then the
+// resulting bytes are narrowed out of their 32-bit lanes.
+__attribute__((target("sse2")))
+static uint8_t pack_sse2(const uint8_t *src, size_t n, uint8_t *dst) {
+    const __m128i m3 = _mm_set1_epi8(0x03);
+    const __m128i m16 = _mm_set1_epi16(0x00FF);
+    const __m128i m32 = _mm_set1_epi32(0x0000FFFF);
+    __m128i seen = _mm_setzero_si128();
+    size_t i = 0;
+
+    for (; i + 32 <= n; i += 32) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + i + 16));
+        seen = _mm_or_si128(seen, _mm_or_si128(a, b));
+        a = _mm_and_si128(a, m3);
+        b = _mm_and_si128(b, m3);
+        a = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(a, m16), 2), _mm_srli_epi16(a, 8));
+        b = _mm_or_si128(_mm_slli_epi16(_mm_and_si128(b, m16), 2), _mm_srli_epi16(b, 8));
+        a = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(a, m32), 4), _mm_srli_epi32(a, 16));
+        b = _mm_or_si128(_mm_slli_epi32(_mm_and_si128(b, m32), 4), _mm_srli_epi32(b, 16));
+        __m128i p = _mm_packs_epi32(a, b);  // every lane is < 256, no saturation
+        _mm_storel_epi64((__m128i *)(dst + i / 4), _mm_packus_epi16(p, p));
+    }
+    // Any byte with high bits set shows up in the compare mask.
+    int high = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(seen, _mm_set1_epi8((char)0xFC)), _mm_setzero_si128()));
+    return (high != 0xFFFF ? 0xFC : 0) | pack_scalar(src + i, n - i, dst + i / 4);
+}
+
+// SSE2: 16 bytes -> 64 codes per step. Each shift extracts one base position
+// from all bytes at once; the unpacks interleave them back into base order.
+__attribute__((target("sse2")))
+static void unpack_sse2(const uint8_t *src, size_t n, uint8_t *dst) {
+    const __m128i m3 = _mm_set1_epi8(0x03);
+    size_t i = 0;
+
+    for (; i + 64 <= n; i += 64) {
+        __m128i x = _mm_loadu_si128((const __m128i *)(src + i / 4));
+        __m128i a0 = _mm_and_si128(_mm_srli_epi16(x, 6), m3);
+        __m128i a1 = _mm_and_si128(_mm_srli_epi16(x, 4), m3);
+        __m128i a2 = _mm_and_si128(_mm_srli_epi16(x, 2), m3);
+        __m128i a3 = _mm_and_si128(x, m3);
+        __m128i t0 = _mm_unpacklo_epi8(a0, a1);
+        __m128i t1 = _mm_unpackhi_epi8(a0, a1);
+        __m128i t2 = _mm_unpacklo_epi8(a2, a3);
+        __m128i t3 = _mm_unpackhi_epi8(a2, a3);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_unpacklo_epi16(t0, t2));
+        _mm_storeu_si128((__m128i *)(dst + i + 16), _mm_unpackhi_epi16(t0, t2));
+        _mm_storeu_si128((__m128i *)(dst + i + 32), _mm_unpacklo_epi16(t1, t3));
+        _mm_storeu_si128((__m128i *)(dst + i + 48), _mm_unpackhi_epi16(t1, t3));
+    }
+    unpack_word(src + i / 4, n - i, dst + i);
+}
+
+// AVX2: as SSE2 but 64 codes <-> 16 bytes. The in-lane packs/unpacks leave
+// 128-bit halves out of order, which the permutes put right.
+__attribute__((target("avx2")))
+static uint8_t pack_avx2(const uint8_t *src, size_t n, uint8_t *dst) {
+    const __m256i m3 = _mm256_set1_epi8(0x03);
+    const __m256i m16 = _mm256_set1_epi16(0x00FF);
+    const __m256i m32 = _mm256_set1_epi32(0x0000FFFF);
+    __m256i seen = _mm256_setzero_si256();
+    size_t i = 0;
+
+    for (; i + 64 <= n; i += 64) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + i + 32));
+        seen = _mm256_or_si256(seen, _mm256_or_si256(a, b));
+        a = _mm256_and_si256(a, m3);
+        b = _mm256_and_si256(b, m3);
+        a = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(a, m16), 2), _mm256_srli_epi16(a, 8));
+        b = _mm256_or_si256(_mm256_slli_epi16(_mm256_and_si256(b, m16), 2), _mm256_srli_epi16(b, 8));
+        a = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(a, m32), 4), _mm256_srli_epi32(a, 16));
+        b = _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(b, m32), 4), _mm256_srli_epi32(b, 16));
+        __m256i p = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), 0xD8);
+        __m128i q = _mm_packus_epi16(_mm256_castsi256_si128(p), _mm256_extracti128_si256(p, 1));
+        _mm_storeu_si128((__m128i *)(dst + i / 4), q);
+    }
+    int high = !_mm256_testz_si256(seen, _mm256_set1_epi8((char)0xFC));
+    return (high ? 0xFC : 0) | pack_sse2(src + i, n - i, dst + i / 4);
+}
+
+__attribute__((target("avx2")))
+static void unpack_avx2(const uint8_t *src, size_t n, uint8_t *dst) {
+    const __m256i m3 = _mm256_set1_epi8(0x03);
+    size_t i = 0;
+
+    for (; i + 128 <= n; i += 128) {
+        __m256i x = _mm256_loadu_si256((const __m256i *)(src + i / 4));
+        __m256i a0 = _mm256_and_si256(_mm256_srli_epi16(x, 6), m3);
+        __m256i a1 = _mm256_and_si256(_mm256_srli_epi16(x, 4), m3);
+        __m256i a2 = _mm256_and_si256(_mm256_srli_epi16(x, 2), m3);
+        __m256i a3 = _mm256_and_si256(x, m3);
+        __m256i t0 = _mm256_unpacklo_epi8(a0, a1);
+        __m256i t1 = _mm256_unpackhi_epi8(a0, a1);
+        __m256i t2 = _mm256_unpacklo_epi8(a2, a3);
+        __m256i t3 = _mm256_unpackhi_epi8(a2, a3);
+        __m256i r0 = _mm256_unpacklo_epi16(t0, t2);
+        __m256i r1 = _mm256_unpackhi_epi16(t0, t2);
+        __m256i r2 = _mm256_unpacklo_epi16(t1, t3);
+        __m256i r3 = _mm256_unpackhi_epi16(t1, t3);
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_permute2x128_si256(r0, r1, 0x20));
+        _mm256_storeu_si256((__m256i *)(dst + i + 32), _mm256_permute2x128_si256(r2, r3, 0x20));
+        _mm256_storeu_si256((__m256i *)(dst + i + 64), _mm256_permute2x128_si256(r0, r1, 0x31));
+        _mm256_storeu_si256((__m256i *)(dst + i + 96), _mm256_permute2x128_si256(r2, r3, 0x31));
+    }
+    unpack_sse2(src + i / 4, n - i, dst + i);
+}
+#endif
+
+// Reverse-complement kernels take `n` packed bytes from `src` and write them
+// to `dst` in reverse order with each byte's four bases reversed and
+// complemented (XOR 3): dst[i] = rc(src[n - 1 - i]). Both ends are loaded
+// before either is stored, so `dst` may equal `src`.
+typedef void (*revcomp_kernel_fn)(const uint8_t *src, size_t n, uint8_t *dst);
+
+static uint8_t revcomp_lut[256];
+
+static void revcomp_scalar(const uint8_t *src, size_t n, uint8_t *dst) {
+    size_t i = 0, j = n;
+    for (; j - i >= 2; ++i) {
+        --j;
+        uint8_t a = src[i], b = src[j];
+        dst[i] = revcomp_lut[b];
+        dst[j] = revcomp_lut[a];
+    }
+    if (j - i == 1) {
+        dst[i] = revcomp_lut[src[i]];
+    }
+}
+
+#ifdef DNA_X86
+// A byte's reverse complement from its nibbles: each nibble's two bases are
+// swapped and complemented, and the nibbles trade places.
+static const uint8_t revcomp_nibble_low[16] = {
+    0xF0, 0xB0, 0x70, 0x30, 0xE0, 0xA0, 0x60, 0x20, 0xD0, 0x90, 0x50, 0x10, 0xC0, 0x80, 0x40, 0x00};
+static const uint8_t revcomp_nibble_high[16] = {
+    0x0F, 0x0B, 0x07, 0x03, 0x0E, 0x0A, 0x06, 0x02, 0x0D, 0x09, 0x05, 0x01, 0x0C, 0x08, 0x04, 0x00};
+
+// SSSE3: 16 bytes from each end per step, two table lookups per byte and a
+// shuffle to reverse the byte order.
+__attribute__((target("ssse3")))
+static void revcomp_ssse3(const uint8_t *src, size_t n, uint8_t *dst) {
+    const __m128i lo = _mm_loadu_si128((const __m128i *)revcomp_nibble_low);
+    const __m128i hi = _mm_loadu_si128((const __m128i *)revcomp_nibble_high);
+    const __m128i m4 = _mm_set1_epi8(0x0F);
+    const __m128i rev = _mm_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    size_t i = 0;
+
+    for (; n - 2 * i >= 32; i += 16) {
+        __m128i a = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i b = _mm_loadu_si128((const __m128i *)(src + n - i - 16));
+        a = _mm_or_si128(_mm_shuffle_epi8(lo, _mm_and_si128(a, m4)),
+                         _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(a, 4), m4)));
+        b = _mm_or_si128(_mm_shuffle_epi8(lo, _mm_and_si128(b, m4)),
+                         _mm_shuffle_epi8(hi, _mm_and_si128(_mm_srli_epi16(b, 4), m4)));
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_shuffle_epi8(b, rev));
+        _mm_storeu_si128((__m128i *)(dst + n - i - 16), _mm_shuffle_epi8(a, rev));
+    }
+    revcomp_scalar(src + i, n - 2 * i, dst + i);
+}
+
+// AVX2: as SSSE3 with 32 bytes per end; the shuffle reverses within lanes
+// and the permute swaps the lanes.
+__attribute__((target("avx2")))
+static void revcomp_avx2(const uint8_t *src, size_t n, uint8_t *dst) {
+    const __m256i lo = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)revcomp_nibble_low));
+    const __m256i hi = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)revcomp_nibble_high));
+    const __m256i m4 = _mm256_set1_epi8(0x0F);
+    const __m256i rev = _mm256_setr_epi8(15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0,
+                                         15, 14, 13, 12, 11, 10, 9, 8, 7, 6, 5, 4, 3, 2, 1, 0);
+    size_t i = 0;
+
+    for (; n - 2 * i >= 64; i += 32) {
+        __m256i a = _mm256_loadu_si256((const __m256i *)(src + i));
+        __m256i b = _mm256_loadu_si256((const __m256i *)(src + n - i - 32));
+        a = _mm256_or_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(a, m4)),
+                            _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(a, 4), m4)));
+        b = _mm256_or_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(b, m4)),
+                            _mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi16(b, 4), m4)));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_permute4x64_epi64(_mm256_shuffle_epi8(b, rev), 0x4E));
+        _mm256_storeu_si256((__m256i *)(dst + n - i - 32), _mm256_permute4x64_epi64(_mm256_shuffle_epi8(a, rev), 0x4E));
+    }
+    revcomp_ssse3(src + i, n - 2 * i, dst + i);
+}
+#endif
+
+// Base counting kernels add the codes held in `n` whole packed bytes to
+// counts[A, C, G, T]. With a code's bits as hi and lo, T is hi & lo, G is
+// hi & ~lo and C is ~hi & lo: three popcounts per 32 bases.
+typedef void (*count_kernel_fn)(const uint8_t *src, size_t n, uint64_t counts[4]);
+
+static inline void count_words(const uint8_t *src, size_t n, uint64_t counts[4]) {
+    const uint64_t m = 0x5555555555555555ULL;
+    uint64_t c = 0, g = 0, t = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t x;
+        memcpy(&x, src + i, 8);
+        uint64_t lo = x & m, hi = (x >> 1) & m;
+        uint64_t both = (uint64_t)__builtin_popcountll(lo & hi);
+        t += both;
+        g += (uint64_t)__builtin_popcountll(hi) - both;
+        c += (uint64_t)__builtin_popcountll(lo) - both;
+    }
+    for (; i < n; ++i) {
+        uint64_t lo = src[i] & m, hi = (src[i] >> 1) & m;
+        uint64_t both = (uint64_t)__builtin_popcountll(lo & hi);
+        t += both;
+        g += (uint64_t)__builtin_popcountll(hi) - both;
+        c += (uint64_t)__builtin_popcountll(lo) - both;
+    }
+    counts[0] += (uint64_t)n * BASES_PER_BYTE - c - g - t;
+    counts[1] += c;
+    counts[2] += g;
+    counts[3] += t;
+}
+
+static void count_scalar(const uint8_t *src, size_t n, uint64_t counts[4]) {
+    count_words(src, n, counts);
+}
+
+#ifdef DNA_X86
+__attribute__((target("popcnt")))
+static void count_popcnt(const uint8_t *src, size_t n, uint64_t counts[4]) {
+    count_words(src, n, counts);
+}
+#endif
+
+// Pattern search kernels test candidate starts [first, last) of the `nbytes`
+// packed bytes at `src` and append the matches, plus `base`, to `hits`. The
+// 64-bit big-endian word at a byte holds its bases in order, so shifting it
+// (and the next byte) left by 0, 2, 4 or 6 bits lines the four candidates
+// starting in that byte up with the packed pattern. XOR, folding each base's
+// two bits together and a popcount then give the mismatches.
+typedef struct {
+    uint64_t word;  // Pattern packed from the most significant bits
+    uint64_t mask;  // High bit of each of its m bases
+    unsigned m;
+    unsigned max_mismatches;
+} search_pattern_t;
+
+typedef struct {
+    uint64_t *pos;
+    size_t count;
+    size_t cap;
+    int failed;
+} hit_list_t;
+
+typedef void (*search_kernel_fn)(const uint8_t *src, size_t nbytes, uint64_t first, uint64_t last,
+                                 const search_pattern_t *pat, uint64_t base, hit_list_t *hits);
+
+static void hit_push(hit_list_t *l, uint64_t pos) {
+    if (l->count == l->cap) {
+        size_t cap = l->cap ? 2 * l->cap : 256;
+        uint64_t *p = realloc(l->pos, cap * sizeof(*p));
+        if (!p) {
+            l->failed = 1;
+            return;
+        }
+        l->pos = p;
+        l->cap = cap;
+    }
+    l->pos[l->count++] = pos;
+}
+
+static int pattern_matches(const search_pattern_t *pat, uint64_t window) {
+    uint64_t x = window ^ pat->word;
+    return (unsigned)__builtin_popcountll((x | (x << 1)) & pat->mask) <= pat->max_mismatches;
+}
+
+static void search_scalar(const uint8_t *src, size_t nbytes, uint64_t first, uint64_t last,
+                          const search_pattern_t *pat, uint64_t base, hit_list_t *hits) {
+    for (uint64_t p = first; p < last;) {
+        size_t j = (size_t)(p / BASES_PER_BYTE);
+        uint64_t word = 0;
+        uint8_t next = 0;
+        if (j + 9 <= nbytes) {
+            memcpy(&word, src + j, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            word = __builtin_bswap64(word);
+#endif
+            next = src[j + 8];
+        } else {
+            // Near the end: zero past the last byte, which no candidate reaches.
+            for (size_t b = 0; b < 8; ++b) {
+                word = (word << 8) | (j + b < nbytes ? src[j + b] : 0);
+            }
+            next = j + 8 < nbytes ? src[j + 8] : 0;
+        }
+        for (unsigned a = p % BASES_PER_BYTE; a < BASES_PER_BYTE && p < last; ++a, ++p) {
+            uint64_t window = a ? (word << (2 * a)) | (next >> (8 - 2 * a)) : word;
+            if (pattern_matches(pat, window)) {
+                hit_push(hits, base + p);
+            }
+        }
+    }
+}
+
+#ifdef DNA_X86
+// AVX2: the words of four consecutive bytes are shuffled out of one 16-byte
+// load, so 16 candidates are tested per step. Any step with a match is redone
+// by the scalar kernel, which emits the hits in order.
+__attribute__((target("avx2")))
+static void search_avx2(const uint8_t *src, size_t nbytes, uint64_t first, uint64_t last,
+                        const search_pattern_t *pat, uint64_t base, hit_list_t *hits) {
+    const __m256i sel0 = _mm256_setr_epi8(7, 6, 5, 4, 3, 2, 1, 0, 8, 7, 6, 5, 4, 3, 2, 1,
+                                          9, 8, 7, 6, 5, 4, 3, 2, 10, 9, 8, 7, 6, 5, 4, 3);
+    const __m256i sel1 = _mm256_setr_epi8(8, 7, 6, 5, 4, 3, 2, 1, 9, 8, 7, 6, 5, 4, 3, 2,
+                                          10, 9, 8, 7, 6, 5, 4, 3, 11, 10, 9, 8, 7, 6, 5, 4);
+    const __m256i lut = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                         0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i m4 = _mm256_set1_epi8(0x0F);
+    const __m256i word = _mm256_set1_epi64x((long long)pat->word);
+    const __m256i mask = _mm256_set1_epi64x((long long)pat->mask);
+    const __m256i limit = _mm256_set1_epi64x((long long)pat->max_mismatches + 1);
+    const __m256i zero = _mm256_setzero_si256();
+    const int exact = pat->max_mismatches == 0;
+
+    uint64_t j = (first + BASES_PER_BYTE - 1) / BASES_PER_BYTE;
+    uint64_t head = j * BASES_PER_BYTE < last ? j * BASES_PER_BYTE : last;
+    search_scalar(src, nbytes, first, head, pat, base, hits);
+    for (; j * BASES_PER_BYTE + 16 <= last && j + 16 <= nbytes; j += 4) {
+        __m256i bytes = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i *)(src + j)));
+        __m256i w0 = _mm256_shuffle_epi8(bytes, sel0);
+        __m256i w1 = _mm256_shuffle_epi8(bytes, sel1);
+        int any = 0;
+        for (int a = 0; a < BASES_PER_BYTE; ++a) {
+            __m256i x = w0;
+            if (a) {
+                __m128i left = _mm_cvtsi32_si128(2 * a), right = _mm_cvtsi32_si128(8 - 2 * a);
+                __m256i low = _mm256_set1_epi64x((1LL << (2 * a)) - 1);
+                x = _mm256_or_si256(_mm256_sll_epi64(w0, left), _mm256_and_si256(_mm256_srl_epi64(w1, right), low));
+            }
+            x = _mm256_xor_si256(x, word);
+            __m256i d = _mm256_and_si256(_mm256_or_si256(x, _mm256_slli_epi64(x, 1)), mask);
+            __m256i match;
+            if (exact) {
+                match = _mm256_cmpeq_epi64(d, zero);
+            } else {
+                // Per-lane popcount: nibble table lookups summed by SAD.
+                __m256i cnt = _mm256_add_epi8(_mm256_shuffle_epi8(lut, _mm256_and_si256(d, m4)),
+                                              _mm256_shuffle_epi8(lut, _mm256_and_si256(_mm256_srli_epi16(d, 4), m4)));
+                match = _mm256_cmpgt_epi64(limit, _mm256_sad_epu8(cnt, zero));
+            }
+            any |= _mm256_movemask_pd(_mm256_castsi256_pd(match));
+        }
+        if (any) {
+            search_scalar(src, nbytes, j * BASES_PER_BYTE, j * BASES_PER_BYTE + 16, pat, base, hits);
+        }
+    }
+    if (j * BASES_PER_BYTE < last) {
+        search_scalar(src, nbytes, j * BASES_PER_BYTE, last, pat, base, hits);
+    }
+}
+#endif
+
+// CRC-32C (Castagnoli) over packed bytes: the SSE4.2 instruction where
+// available, slicing-by-8 tables otherwise.
+typedef uint32_t (*crc_kernel_fn)(uint32_t crc, const uint8_t *p, size_t n);
+
+static uint32_t crc32c_table[8][256];
+
+static uint32_t crc32c_sw(uint32_t crc, const uint8_t *p, size_t n) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        w ^= crc;
+        crc = crc32c_table[7][w & 0xFF] ^ crc32c_table[6][(w >> 8) & 0xFF] ^
+              crc32c_table[5][(w >> 16) & 0xFF] ^ crc32c_table[4][(w >> 24) & 0xFF] ^
+              crc32c_table[3][(w >> 32) & 0xFF] ^ crc32c_table[2][(w >> 40) & 0xFF] ^
+              crc32c_table[1][(w >> 48) & 0xFF] ^ crc32c_table[0][w >> 56];
+    }
+#endif
+    while (n--) {
+        crc = crc32c_table[0][(crc ^ *p++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+#ifdef DNA_X86
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_hw(uint32_t crc, const uint8_t *p, size_t n) {
+#ifdef __x86_64__
+    uint64_t c = crc;
+    for (; n >= 8; n -= 8, p += 8) {
+        uint64_t w;
+        memcpy(&w, p, 8);
+        c = _mm_crc32_u64(c, w);
+    }
+    crc = (uint32_t)c;
+#endif
+    while (n--) {
+        crc = _mm_crc32_u8(crc, *p++);
+    }
+    return crc;
+}
+#endif
+
+static pack_kernel_fn pack_kernel = pack_scalar;
+static unpack_kernel_fn unpack_kernel = unpack_scalar;
+static crc_kernel_fn crc_kernel = crc32c_sw;
+static revcomp_kernel_fn revcomp_kernel = revcomp_scalar;
+static count_kernel_fn count_kernel = count_scalar;
+static search_kernel_fn search_kernel = search_scalar;
+static const char *kernel_name = "scalar";  // Of the pack and unpack kernels
+
+// Block codec DNA_CODEC_CM: every base is coded as two binary decisions by
+// a carry-less 32-bit arithmetic coder. Each decision's probability mixes an
+// order-10 and an order-3 context model in the logistic domain with weights
+// learned online, one weight set per decision node. Blocks are coded
+// independently, the model starting fresh for each.
+#define CM_HIGH_ORDER 10
+#define CM_LOW_ORDER 3
+
+typedef struct {
+    uint16_t high[(1u << 2 * CM_HIGH_ORDER) * 3];
+    uint16_t low[(1u << 2 * CM_LOW_ORDER) * 3];
+    int32_t weights[3][3];  // Per node: high, low, bias; 16.16 fixed point
+} cm_model_t;
+
+static int16_t cm_stretch[4096];
+
+// 4096 / (1 + e^-(d / 256)), interpolated
+static int cm_squash(int d) {
+    static const int t[33] = {1, 2, 3, 6, 10, 16, 27, 45, 73, 120, 194, 310, 488, 747, 1101, 1546, 2047,
+                              2549, 2994, 3348, 3607, 3785, 3901, 3975, 4022, 4050, 4068, 4079, 4085, 4089, 4092, 4093, 4094};
+    if (d > 2047) {
+        return 4095;
+    }
+    if (d < -2047) {
+        return 1;
+    }
+    int w = d & 127;
+    d = (d >> 7) + 16;
+    return (t[d] * (128 - w) + t[d + 1] * w + 64) >> 7;
+}
+
+static void init_cm_tables(void) {
+    int pi = 0;
+    for (int x = -2047; x <= 2047; ++x) {
+        int v = cm_squash(x);
+        for (int i = pi; i <= v; ++i) {
+            cm_stretch[i] = (int16_t)x;
+        }
+        pi = v + 1;
+    }
+    for (int i = pi; i < 4096; ++i) {
+        cm_stretch[i] = 2047;
+    }
+}
+
+static cm_model_t *cm_model_new(void) {
+    cm_model_t *m = malloc(sizeof(*m));
+    if (!m) {
+        return NULL;
+    }
+    for (size_t i = 0; i < sizeof(m->high) / sizeof(m->high[0]); ++i) {
+        m->high[i] = 1u << 15;
+    }
+    for (size_t i = 0; i < sizeof(m->low) / sizeof(m->low[0]); ++i) {
+        m->low[i] = 1u << 15;
+    }
+    for (int n = 0; n < 3; ++n) {
+        m->weights[n][0] = 45000;
+        m->weights[n][1] = 25000;
+        m->weights[n][2] = 0;
+    }
+    return m;
+}
+
+typedef struct {
+    uint32_t x1, x2, x;
+    uint8_t *out;
+    size_t out_len, out_cap;
+    const uint8_t *in, *in_end;
+    int overflow;
+} cm_coder_t;
+
+// Probability that the bit at `node` is 1, in 12 bits, and its mixer inputs.
+static int cm_predict(const cm_model_t *m, const uint16_t *ph, const uint16_t *pl, int node, int st[3]) {
+    st[0] = cm_stretch[*ph >> 4];
+    st[1] = cm_stretch[*pl >> 4];
+    st[2] = 256;
+    int64_t dot = 0;
+    for (int i = 0; i < 3; ++i) {
+        dot += (int64_t)m->weights[node][i] * st[i];
+    }
+    int p = cm_squash((int)(dot >> 16));
+    return p < 1 ? 1 : p > 4095 ? 4095 : p;
+}
+
+static void cm_update(cm_model_t *m, uint16_t *ph, uint16_t *pl, int node, const int st[3], int p, int bit) {
+    int err = (bit << 12) - p;
+    for (int i = 0; i < 3; ++i) {
+        m->weights[node][i] += (st[i] * err) >> 14;
+    }
+    if (bit) {
+        *ph += (65535 - *ph) >> 4;
+        *pl += (65535 - *pl) >> 5;
+    } else {
+        *ph -= *ph >> 4;
+        *pl -= *pl >> 5;
+    }
+}
+
+static void cm_put(cm_coder_t *c, uint8_t byte) {
+    if (c->out_len == c->out_cap) {
+        c->overflow = 1;
+        return;
+    }
+    c->out[c->out_len++] = byte;
+}
+
+static void cm_encode_bit(cm_coder_t *c, int p, int bit) {
+    uint32_t xmid = c->x1 + (uint32_t)(((uint64_t)(c->x2 - c->x1) * (uint32_t)p) >> 12);
+    if (bit) {
+        c->x2 = xmid;
+    } else {
+        c->x1 = xmid + 1;
+    }
+    while (((c->x1 ^ c->x2) & 0xff000000u) == 0) {
+        cm_put(c, (uint8_t)(c->x2 >> 24));
+        c->x1 <<= 8;
+        c->x2 = (c->x2 << 8) | 255;
+    }
+}
+
+static int cm_decode_bit(cm_coder_t *c, int p) {
+    uint32_t xmid = c->x1 + (uint32_t)(((uint64_t)(c->x2 - c->x1) * (uint32_t)p) >> 12);
+    int bit = c->x <= xmid;
+    if (bit) {
+        c->x2 = xmid;
+    } else {
+        c->x1 = xmid + 1;
+    }
+    while (((c->x1 ^ c->x2) & 0xff000000u) == 0) {
+        c->x1 <<= 8;
+        c->x2 = (c->x2 << 8) | 255;
+        c->x = (c->x << 8) | (c->in < c->in_end ? *c->in++ : 0);
+    }
+    return bit;
+}
+
+// Codes the `n` bases packed in `packed` into at most `cap` bytes of `out`.
+// Returns the coded size, or 0 if it would not fit.
+static size_t cm_compress(cm_model_t *m, const uint8_t *packed, size_t n, uint8_t *out, size_t cap) {
+    cm_coder_t c = {0, 0xffffffffu, 0, out, 0, cap, NULL, NULL, 0};
+    uint32_t hi_ctx = 0, lo_ctx = 0;
+    for (size_t i = 0; i < n && !c.overflow; ++i) {
+        int code = (packed[i / 4] >> (6 - 2 * (i % 4))) & 0x03;
+        uint16_t *hi = &m->high[hi_ctx * 3], *lo = &m->low[lo_ctx * 3];
+        int st[3];
+        int b1 = code >> 1, b0 = code & 1;
+        int p = cm_predict(m, &hi[0], &lo[0], 0, st);
+        cm_encode_bit(&c, p, b1);
+        cm_update(m, &hi[0], &lo[0], 0, st, p, b1);
+        p = cm_predict(m, &hi[1 + b1], &lo[1 + b1], 1 + b1, st);
+        cm_encode_bit(&c, p, b0);
+        cm_update(m, &hi[1 + b1], &lo[1 + b1], 1 + b1, st, p, b0);
+        hi_ctx = ((hi_ctx << 2) | (uint32_t)code) & ((1u << 2 * CM_HIGH_ORDER) - 1);
+        lo_ctx = ((lo_ctx << 2) | (uint32_t)code) & ((1u << 2 * CM_LOW_ORDER) - 1);
+    }
+    for (int i = 0; i < 4; ++i) {
+        cm_put(&c, (uint8_t)(c.x1 >> 24));
+        c.x1 <<= 8;
+    }
+    return c.overflow ? 0 : c.out_len;
+}
+
+// Decodes the first `n` bases of a coded block into one code per byte.
+static void cm_decompress(cm_model_t *m, const uint8_t *in, size_t in_len, size_t n, uint8_t *out) {
+    cm_coder_t c = {0, 0xffffffffu, 0, NULL, 0, 0, in, in + in_len, 0};
+    for (int i = 0; i < 4; ++i) {
+        c.x = (c.x << 8) | (c.in < c.in_end ? *c.in++ : 0);
+    }
+    uint32_t hi_ctx = 0, lo_ctx = 0;
+    for (size_t i = 0; i < n; ++i) {
+        // The order-10 table does not fit in cache and the next contexts depend
+        // on bases not decoded yet: fetch all 16 candidates two bases ahead.
+        const uint16_t *ahead = &m->high[((hi_ctx << 4) & ((1u << 2 * CM_HIGH_ORDER) - 1)) * 3];
+        __builtin_prefetch(ahead);
+        __builtin_prefetch(ahead + 32);
+        __builtin_prefetch(ahead + 16 * 3 - 1);
+        uint16_t *hi = &m->high[hi_ctx * 3], *lo = &m->low[lo_ctx * 3];
+        int st[3];
+        int p = cm_predict(m, &hi[0], &lo[0], 0, st);
+        int b1 = cm_decode_bit(&c, p);
+        cm_update(m, &hi[0], &lo[0], 0, st, p, b1);
+        p = cm_predict(m, &hi[1 + b1], &lo[1 + b1], 1 + b1, st);
+        int b0 = cm_decode_bit(&c, p);
+        cm_update(m, &hi[1 + b1], &lo[1 + b1], 1 + b1, st, p, b0);
+        int code = b1 << 1 | b0;
+        out[i] = (uint8_t)code;
+        hi_ctx = ((hi_ctx << 2) | (uint32_t)code) & ((1u << 2 * CM_HIGH_ORDER) - 1);
+        lo_ctx = ((lo_ctx << 2) | (uint32_t)code) & ((1u << 2 * CM_LOW_ORDER) - 1);
+    }
+}
+
+// Builds the lookup tables and picks the widest kernels the running CPU supports.
+__attribute__((constructor))
+static void select_kernels(void) {
+    for (int b = 0; b < 256; ++b) {
+        for (int j = 0; j < BASES_PER_BYTE; ++j) {
+            unpack_lut[b][j] = (b >> (6 - 2 * j)) & 0x03;
+        }
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = (c >> 1) ^ (0x82F63B78u & (0u - (c & 1)));
+        }
+        crc32c_table[0][i] = c;
+    }
+    for (int t = 1; t < 8; ++t) {
+        for (int i = 0; i < 256; ++i) {
+            uint32_t c = crc32c_table[t - 1][i];
+            crc32c_table[t][i] = (c >> 8) ^ crc32c_table[0][c & 0xFF];
+        }
+    }
+    for (int b = 0; b < 256; ++b) {
+        int r = 0;
+        for (int j = 0; j < BASES_PER_BYTE; ++j) {
+            r |= (3 - ((b >> (2 * j)) & 0x03)) << (6 - 2 * j);
+        }
+        revcomp_lut[b] = (uint8_t)r;
+    }
+    init_cm_tables();
+    dna_use_kernels(DNA_KERNELS_BEST);
+}
+
+int dna_use_kernels(int set) {
+    if (set != DNA_KERNELS_SCALAR && set != DNA_KERNELS_BEST) {
+        return -1;
+    }
+    pack_kernel = pack_scalar;
+    unpack_kernel = unpack_scalar;
+    crc_kernel = crc32c_sw;
+    revcomp_kernel = revcomp_scalar;
+    count_kernel = count_scalar;
+    search_kernel = search_scalar;
+    kernel_name = "scalar";
+    if (set == DNA_KERNELS_SCALAR) {
+        return 0;
+    }
+    pack_kernel = pack_word;
+    unpack_kernel = unpack_word;
+    kernel_name = "word";
+
+#ifdef DNA_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse4.2")) {
+        crc_kernel = crc32c_hw;
+    }
+    if (__builtin_cpu_supports("popcnt")) {
+        count_kernel = count_popcnt;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        search_kernel = search_avx2;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        revcomp_kernel = revcomp_avx2;
+    } else if (__builtin_cpu_supports("ssse3")) {
+        revcomp_kernel = revcomp_ssse3;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        pack_kernel = pack_avx2;
+        unpack_kernel = unpack_avx2;
+        kernel_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        pack_kernel = pack_sse2;
+        unpack_kernel = unpack_sse2;
+        kernel_name = "sse2";
+    }
+#endif
+    return 0;
+}
+
+const char *dna_kernel_name(void) {
+    return kernel_name;
+}
+
+// Threading. Work is cut into independent tasks that write disjoint output;
+// the tasks run on short-lived pthreads, or on the caller's pool when one is
+// registered with dna_set_executor().
+static int num_threads = 1;
+static dna_executor_fn executor = NULL;
+static void *executor_pool = NULL;
+static _Thread_local int in_parallel = 0;  // Nested calls run serially
+
+void dna_set_num_threads(int n) {
+    if (n <= 0) {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        n = cpus > 0 ? (int)cpus : 1;
+    }
+    num_threads = n;
+}
+
+int dna_get_num_threads(void) {
+    return num_threads;
+}
+
+void dna_set_executor(dna_executor_fn run, void *pool) {
+    executor = run;
+    executor_pool = pool;
+}
+
+typedef struct {
+    dna_task_fn fn;
+    void *arg;
+    size_t num_tasks;
+    atomic_size_t next;
+} task_queue_t;
+
+static void task_trampoline(void *q_, size_t task) {
+    task_queue_t *q = q_;
+    int outer = in_parallel;
+    in_parallel = 1;
+    q->fn(q->arg, task);
+    in_parallel = outer;
+}
+
+static void *task_worker(void *q_) {
+    task_queue_t *q = q_;
+    for (size_t t; (t = atomic_fetch_add(&q->next, 1)) < q->num_tasks;) {
+        task_trampoline(q, t);
+    }
+    return NULL;
+}
+
+static void parallel_for(size_t num_tasks, dna_task_fn fn, void *arg) {
+    if (num_tasks <= 1 || num_threads <= 1 || in_parallel) {
+        for (size_t t = 0; t < num_tasks; ++t) {
+            fn(arg, t);
+        }
+        return;
+    }
+
+    task_queue_t q = {fn, arg, num_tasks, 0};
+    if (executor) {
+        executor(executor_pool, num_tasks, task_trampoline, &q);
+        return;
+    }
+
+    // The calling thread works too; if a thread cannot be created the
+    // remaining ones simply take more tasks.
+    size_t workers = (size_t)num_threads < num_tasks ? (size_t)num_threads - 1 : num_tasks - 1;
+    pthread_t *tids = malloc(workers * sizeof(*tids));
+    size_t started = 0;
+    while (tids && started < workers && pthread_create(&tids[started], NULL, task_worker, &q) == 0) {
+        ++started;
+    }
+    task_worker(&q);
+    for (size_t i = 0; i < started; ++i) {
+        pthread_join(tids[i], NULL);
+    }
+    free(tids);
+}
+
+void dna_parallel_for(size_t num_tasks, dna_task_fn fn, void *arg) {
+    parallel_for(num_tasks, fn, arg);
+}
+
+static void unpack_at(const uint8_t *src, size_t offset, size_t n, uint8_t *dst) {
+    src += offset / BASES_PER_BYTE;
+
+    // Finish the partially consumed first byte, then run the kernel byte-aligned.
+    unsigned skip = offset % BASES_PER_BYTE;
+    if (skip && n > 0) {
+        uint8_t buffer = *src++;
+        for (; skip < BASES_PER_BYTE && n > 0; ++skip, --n) {
+            *dst++ = (buffer >> (6 - 2 * skip)) & 0x03;
+        }
+    }
+    unpack_kernel(src, n, dst);
+}
+
+typedef struct {
+    const uint8_t *src;
+    uint8_t *dst;
+    size_t offset;
+    size_t n;
+    uint8_t seen;  // OR of every packed code
+} codec_job_t;
+
+static void pack_task(void *arg, size_t task) {
+    codec_job_t *job = arg;
+    size_t i = task * PARALLEL_CHUNK;
+    size_t n = job->n - i < PARALLEL_CHUNK ? job->n - i : PARALLEL_CHUNK;
+    uint8_t seen = pack_kernel(job->src + i, n, job->dst + i / BASES_PER_BYTE);
+    __atomic_fetch_or(&job->seen, seen, __ATOMIC_RELAXED);
+}
+
+static void unpack_task(void *arg, size_t task) {
+    const codec_job_t *job = arg;
+    size_t i = task * PARALLEL_CHUNK;
+    size_t n = job->n - i < PARALLEL_CHUNK ? job->n - i : PARALLEL_CHUNK;
+    unpack_at(job->src, job->offset + i, n, job->dst + i);
+}
+
+// Returns the OR of the packed codes.
+static uint8_t pack_codes(const uint8_t *src, size_t n, uint8_t *dst) {
+    if (n < PARALLEL_MIN_BASES || num_threads <= 1) {
+        return pack_kernel(src, n, dst);
+    }
+    codec_job_t job = {src, dst, 0, n, 0};
+    parallel_for((n + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK, pack_task, &job);
+    return job.seen;
+}
+
+void dna_pack(const uint8_t *src, size_t n, uint8_t *dst) {
+    pack_codes(src, n, dst);
+}
+
+int dna_pack_checked(const uint8_t *src, size_t n, uint8_t *dst) {
+    return pack_codes(src, n, dst) & ~0x03 ? -1 : 0;
+}
+
+void dna_unpack(const uint8_t *src, size_t offset, size_t n, uint8_t *dst) {
+    if (n < PARALLEL_MIN_BASES || num_threads <= 1) {
+        unpack_at(src, offset, n, dst);
+        return;
+    }
+    codec_job_t job = {src, dst, offset, n, 0};
+    parallel_for((n + PARALLEL_CHUNK - 1) / PARALLEL_CHUNK, unpack_task, &job);
+}
+
+uint32_t dna_crc32c(uint32_t crc, const void *buf, size_t n) {
+    return ~crc_kernel(~crc, buf, n);
+}
+
+// Undoes a dna_crc32c() step over the `n` bytes at `p`: given the CRC after
+// them, returns the CRC before them. Each table entry has a distinct top
+// byte, which identifies the entry a step mixed in.
+static uint32_t crc32c_rewind(uint32_t crc, const uint8_t *p, size_t n) {
+    uint8_t entry[256];
+    for (int i = 0; i < 256; ++i) {
+        entry[crc32c_table[0][i] >> 24] = (uint8_t)i;
+    }
+    uint32_t x = ~crc;
+    while (n--) {
+        uint8_t i = entry[x >> 24];
+        x = ((x ^ crc32c_table[0][i]) << 8) | (uint8_t)(i ^ p[n]);
+    }
+    return ~x;
+}
+
+// Reverse complement of packed data. Reversing whole bytes moves a range that
+// ends on a byte boundary to the start of the output, so that case is a single
+// kernel pass. Otherwise the reversed bytes start with the 4 - end % 4 bases
+// that follow the range, and are shifted left by that many bases on the way
+// out, one staging chunk at a time.
+#define REVCOMP_CHUNK 4096
+
+void dna_revcomp(const uint8_t *src, size_t offset, size_t n, uint8_t *dst) {
+    if (n == 0) {
+        return;
+    }
+    size_t end = offset + n;
+    size_t out_bytes = (n + 3) / BASES_PER_BYTE;
+    unsigned shift = 2 * ((BASES_PER_BYTE - end % BASES_PER_BYTE) % BASES_PER_BYTE);
+    if (shift == 0) {
+        revcomp_kernel(src + offset / BASES_PER_BYTE, out_bytes, dst);
+    } else {
+        // Output byte j takes what follows the shift from reversed bytes j and j + 1.
+        size_t first = offset / BASES_PER_BYTE, last = (end - 1) / BASES_PER_BYTE;
+        uint8_t stage[REVCOMP_CHUNK + 1];
+        for (size_t j = 0; j < out_bytes; j += REVCOMP_CHUNK) {
+            size_t len = out_bytes - j < REVCOMP_CHUNK ? out_bytes - j : REVCOMP_CHUNK;
+            size_t avail = last - first + 1 - j;  // reversed bytes from j on
+            size_t take = avail < len + 1 ? avail : len + 1;
+            revcomp_kernel(src + last - j - (take - 1), take, stage);
+            if (take == len) {
+                stage[len] = 0;
+            }
+            size_t b = 0;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            for (; b + 8 < len; b += 8) {
+                uint64_t w;
+                memcpy(&w, stage + b, 8);
+                w = (__builtin_bswap64(w) << shift) | (stage[b + 8] >> (8 - shift));
+                w = __builtin_bswap64(w);
+                memcpy(dst + j + b, &w, 8);
+            }
+#endif
+            for (; b < len; ++b) {
+                dst[j + b] = (uint8_t)((stage[b] << shift) | (stage[b + 1] >> (8 - shift)));
+            }
+        }
+    }
+    if (n % BASES_PER_BYTE) {
+        dst[out_bytes - 1] &= (uint8_t)(0xFF << (2 * (BASES_PER_BYTE - n % BASES_PER_BYTE)));
+    }
+}
+
+void dna_revcomp_inplace(uint8_t *buf, size_t n) {
+    if (n == 0) {
+        return;
+    }
+    size_t nbytes = (n + 3) / BASES_PER_BYTE;
+    revcomp_kernel(buf, nbytes, buf);
+    // The zero padding of the last byte is now complemented at the front.
+    unsigned shift = 2 * ((BASES_PER_BYTE - n % BASES_PER_BYTE) % BASES_PER_BYTE);
+    if (shift) {
+        for (size_t b = 0; b + 1 < nbytes; ++b) {
+            buf[b] = (uint8_t)((buf[b] << shift) | (buf[b + 1] >> (8 - shift)));
+        }
+        buf[nbytes - 1] = (uint8_t)(buf[nbytes - 1] << shift);
+    }
+}
+
+// Counts the `n` bases from base `offset` of a packed buffer: the partial
+// bytes at either end one base at a time, whole bytes with the kernel.
+static void count_packed(const uint8_t *src, size_t offset, size_t n, uint64_t counts[4]) {
+    for (; n > 0 && offset % BASES_PER_BYTE; ++offset, --n) {
+        counts[(src[offset / BASES_PER_BYTE] >> (6 - 2 * (offset % BASES_PER_BYTE))) & 0x03]++;
+    }
+    count_kernel(src + offset / BASES_PER_BYTE, n / BASES_PER_BYTE, counts);
+    for (size_t b = offset + n / BASES_PER_BYTE * BASES_PER_BYTE; b < offset + n; ++b) {
+        counts[(src[b / BASES_PER_BYTE] >> (6 - 2 * (b % BASES_PER_BYTE))) & 0x03]++;
+    }
+}
+
+// Canonical k-mers roll the forward k-mer and its reverse complement along
+// the packed bases: two shifts, an OR and a mask per base, no unpacking.
+size_t dna_canonical_kmers(const uint8_t *src, size_t offset, size_t n, unsigned k, uint64_t *out) {
+    if (k == 0 || k > 32 || n < k) {
+        return 0;
+    }
+    const uint64_t mask = k == 32 ? ~0ULL : (1ULL << (2 * k)) - 1;
+    const unsigned top = 2 * (k - 1);
+    uint64_t fwd = 0, rev = 0;
+    for (size_t i = 0; i < n; ++i) {
+        size_t b = offset + i;
+        uint64_t code = (src[b / BASES_PER_BYTE] >> (6 - 2 * (b % BASES_PER_BYTE))) & 0x03;
+        fwd = ((fwd << 2) | code) & mask;
+        rev = (rev >> 2) | ((code ^ 3) << top);
+        if (i + 1 >= k) {
+            out[i + 1 - k] = fwd < rev ? fwd : rev;
+        }
+    }
+    return n - k + 1;
+}
+
+// File header. Everything is little-endian; see dna_array.h for the fields.
+#define HEADER_MAGIC "DNA2"
+#define HEADER_VERSION 1
+
+static void put_le16(uint8_t *p, uint16_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    put_le16(p, (uint16_t)v);
+    put_le16(p + 2, (uint16_t)(v >> 16));
+}
+
+static void put_le64(uint8_t *p, uint64_t v) {
+    put_le32(p, (uint32_t)v);
+    put_le32(p + 4, (uint32_t)(v >> 32));
+}
 
-    fclose(file);
+static uint16_t get_le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t get_le32(const uint8_t *p) {
+    return get_le16(p) | (uint32_t)get_le16(p + 2) << 16;
+}
+
+static uint64_t get_le64(const uint8_t *p) {
+    return get_le32(p) | (uint64_t)get_le32(p + 4) << 32;
+}
+
+// Header plus the location of the section table, which readers of the
+// public dna_meta_t never need.
+typedef struct {
+    dna_meta_t meta;
+    uint64_t sections_offset;
+    uint32_t num_sections;
+} file_header_t;
+
+static void encode_header(uint8_t *p, const file_header_t *hdr) {
+    const dna_meta_t *meta = &hdr->meta;
+    memset(p, 0, DNA_HEADER_SIZE);
+    memcpy(p, HEADER_MAGIC, 4);
+    put_le16(p + 4, HEADER_VERSION);
+    put_le16(p + 6, DNA_HEADER_SIZE);
+    put_le32(p + 8, meta->flags);
+    put_le32(p + 12, meta->block_size);
+    put_le64(p + 16, meta->num_bases);
+    put_le64(p + 24, meta->num_reads);
+    put_le64(p + 32, meta->read_length);
+    put_le32(p + 40, meta->checksum);
+    put_le32(p + 44, hdr->num_sections);
+    put_le64(p + 48, hdr->sections_offset);
+}
+
+// Returns 1 and fills `hdr` if `p` starts with a header this code understands.
+static int decode_header(const uint8_t *p, size_t len, file_header_t *hdr) {
+    if (len < DNA_HEADER_SIZE || memcmp(p, HEADER_MAGIC, 4) != 0 ||
+        get_le16(p + 4) != HEADER_VERSION || get_le16(p + 6) != DNA_HEADER_SIZE) {
+        return 0;
+    }
+    dna_meta_t *meta = &hdr->meta;
+    meta->flags = get_le32(p + 8);
+    meta->block_size = get_le32(p + 12);
+    meta->num_bases = get_le64(p + 16);
+    meta->num_reads = get_le64(p + 24);
+    meta->read_length = get_le64(p + 32);
+    meta->checksum = get_le32(p + 40);
+    hdr->num_sections = get_le32(p + 44);
+    hdr->sections_offset = get_le64(p + 48);
+    return 1;
+}
+
+// Trailing sections. The table holds num_sections entries of SECTION_ENTRY_SIZE
+// bytes: u32 kind, u32 CRC-32C of the section bytes, u64 file offset, u64 length
+// in bytes, u64 item count. Readers skip kinds they do not know.
+#define SECTION_ENTRY_SIZE 32
+#define BLOCK_ENTRY_SIZE 24  // u64 offset, u32 bases, u32 stored bytes, u32 CRC-32C, u32 codec
+#define N_RUN_ENTRY_SIZE 12  // u64 start, u32 length; longer runs take several entries
+#define BLOCK_STATS_ENTRY_SIZE 16  // u32 count of A, C, G and T
+#define READ_OFFSETS_GROUP_BYTES (8 + 4 * DNA_READ_OFFSETS_GROUP)
+
+// Bytes of a read offsets section with `count` entries
+static uint64_t read_offsets_bytes(uint64_t count) {
+    uint64_t groups = (count + DNA_READ_OFFSETS_GROUP - 1) / DNA_READ_OFFSETS_GROUP;
+    return groups * 8 + count * 4;
+}
+
+typedef struct {
+    uint32_t kind;
+    uint32_t crc;
+    uint64_t offset;
+    uint64_t length;
+    uint64_t count;
+} section_t;
+
+static void encode_section(uint8_t *p, const section_t *sec) {
+    put_le32(p, sec->kind);
+    put_le32(p + 4, sec->crc);
+    put_le64(p + 8, sec->offset);
+    put_le64(p + 16, sec->length);
+    put_le64(p + 24, sec->count);
+}
+
+static void decode_section(const uint8_t *p, section_t *sec) {
+    sec->kind = get_le32(p);
+    sec->crc = get_le32(p + 4);
+    sec->offset = get_le64(p + 8);
+    sec->length = get_le64(p + 16);
+    sec->count = get_le64(p + 24);
+}
+
+static void encode_block(uint8_t *p, const dna_block_t *blk) {
+    put_le64(p, blk->offset);
+    put_le32(p + 8, blk->num_bases);
+    put_le32(p + 12, blk->stored_bytes);
+    put_le32(p + 16, blk->crc);
+    put_le32(p + 20, blk->codec);
+}
+
+static void decode_block(const uint8_t *p, dna_block_t *blk) {
+    blk->offset = get_le64(p);
+    blk->num_bases = get_le32(p + 8);
+    blk->stored_bytes = get_le32(p + 12);
+    blk->crc = get_le32(p + 16);
+    blk->codec = get_le32(p + 20);
+}
+
+// Block I/O layer: callers pack into (or unpack from) one aligned staging
+// buffer and move it with a single pwrite()/pread().
+static int direct_io = 0;
+
+void dna_set_direct_io(int enable) {
+    direct_io = enable != 0;
+}
+
+static size_t round_up(size_t n, size_t align) {
+    return (n + align - 1) / align * align;
+}
+
+// Opens with O_DIRECT when enabled, falling back to buffered I/O on filesystems
+// that refuse it (tmpfs, some network mounts).
+static int io_open(const char *filename, int flags, int *is_direct) {
+    *is_direct = 0;
+#ifdef O_DIRECT
+    if (direct_io) {
+        int fd = open(filename, flags | O_DIRECT, 0644);
+        if (fd >= 0) {
+            *is_direct = 1;
+            return fd;
+        }
+        if (errno != EINVAL) {
+            return -1;
+        }
+    }
+#endif
+    return open(filename, flags, 0644);
+}
+
+// Allocates a staging buffer for `nbytes` packed bytes, capped at IO_BUFFER_BYTES.
+static uint8_t *io_stage_alloc(size_t nbytes, size_t *capacity) {
+    size_t cap = round_up(nbytes ? nbytes : 1, IO_ALIGN);
+    if (cap > IO_BUFFER_BYTES) {
+        cap = IO_BUFFER_BYTES;
+    }
+    void *buf = NULL;
+    if (posix_memalign(&buf, IO_ALIGN, cap) != 0) {
+        return NULL;
+    }
+    *capacity = cap;
+    return buf;
+}
+
+static int io_write_full(int fd, const uint8_t *buf, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t w = pwrite(fd, buf, len, offset);
+        if (w < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buf += w;
+        len -= (size_t)w;
+        offset += w;
+    }
+    return 0;
+}
+
+// Returns the number of bytes read, short only at end of file, or -1.
+static ssize_t io_read_full(int fd, uint8_t *buf, size_t len, off_t offset) {
+    size_t total = 0;
+    while (total < len) {
+        ssize_t r = pread(fd, buf + total, len - total, offset + (off_t)total);
+        if (r < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        if (r == 0) {
+            break;
+        }
+        total += (size_t)r;
+    }
+    return (ssize_t)total;
+}
+
+// Writes `prefix` followed by `size` packed codes, staging both in one
+// buffer, and accumulates the CRC-32C of the packed bytes into `crc`. With
+// `block_crcs`, also keeps a separate CRC per `block_bytes` of payload, and
+// with `block_stats` the count of each code per block, taken from the packed
+// bytes. The OR of all codes is accumulated into `*seen`.
+static int write_packed(int fd, int direct, const uint8_t *prefix, size_t prefix_len,
+                        const uint8_t *arr, size_t size, uint32_t *crc,
+                        uint32_t *block_crcs, uint32_t (*block_stats)[4], size_t block_bytes, uint8_t *seen) {
+    size_t cap;
+    uint8_t *buffer = io_stage_alloc(prefix_len + (size + 3) / 4, &cap);
+    if (!buffer) {
+        perror("Failed to allocate staging buffer");
+        return -1;
+    }
+
+    if (prefix_len) {
+        memcpy(buffer, prefix, prefix_len);
+    }
+    size_t pos = prefix_len;
+    off_t offset = 0;
+    size_t payload = 0;  // Packed bytes before this chunk
+    size_t i = 0;
+    int status = 0;
+    do {
+        size_t room = (cap - pos) * BASES_PER_BYTE;
+        size_t n = size - i < room ? size - i : room;
+        size_t len = (n + 3) / 4;
+        *seen |= pack_codes(arr + i, n, buffer + pos);
+        *crc = dna_crc32c(*crc, buffer + pos, len);
+        for (size_t b = payload, end = payload + len; block_crcs && b < end;) {
+            size_t blk = b / block_bytes;
+            size_t stop = (blk + 1) * block_bytes < end ? (blk + 1) * block_bytes : end;
+            block_crcs[blk] = dna_crc32c(block_crcs[blk], buffer + pos + (b - payload), stop - b);
+            if (block_stats) {
+                uint64_t counts[4] = {0, 0, 0, 0};
+                count_kernel(buffer + pos + (b - payload), stop - b, counts);
+                for (int c = 0; c < 4; ++c) {
+                    block_stats[blk][c] += (uint32_t)counts[c];
+                }
+            }
+            b = stop;
+        }
+        payload += len;
+
+        // O_DIRECT wants whole blocks; the padding is cut off again below.
+        size_t total = pos + len;
+        size_t wlen = direct ? round_up(total, IO_ALIGN) : total;
+        memset(buffer + total, 0, wlen - total);
+        if (io_write_full(fd, buffer, wlen, offset) != 0) {
+            perror("Failed to write file");
+            status = -1;
+            break;
+        }
+        offset += (off_t)total;
+        i += n;
+        pos = 0;
+    } while (i < size);
+
+    if (status == 0 && direct && ftruncate(fd, offset) != 0) {
+        perror("Failed to truncate file");
+        status = -1;
+    }
+    if (block_stats && size % BASES_PER_BYTE) {
+        block_stats[(payload - 1) / block_bytes][0] -= BASES_PER_BYTE - size % BASES_PER_BYTE;  // Padding counted as A
+    }
+    free(buffer);
+    return status;
+}
+
+// Unpacks `size` codes stored from byte `data_offset` on, accumulating the
+// CRC-32C of the packed bytes into `crc`. Under O_DIRECT each read is widened
+// to whole blocks and the first `lead` bytes are skipped.
+static int read_packed(int fd, int direct, off_t data_offset, const char *filename,
+                       uint8_t *arr, size_t size, uint32_t *crc) {
+    size_t cap;
+    uint8_t *buffer = io_stage_alloc((size + 3) / 4 + IO_ALIGN, &cap);
+    if (!buffer) {
+        perror("Failed to allocate staging buffer");
+        return -1;
+    }
+
+    const size_t chunk = (cap - IO_ALIGN) * BASES_PER_BYTE;
+    off_t offset = data_offset;
+    int status = 0;
+    for (size_t i = 0; i < size; i += chunk) {
+        size_t n = size - i < chunk ? size - i : chunk;
+        size_t len = (n + 3) / 4;
+        size_t lead = direct ? (size_t)offset % IO_ALIGN : 0;
+        size_t rlen = direct ? round_up(lead + len, IO_ALIGN) : len;
+        ssize_t got = io_read_full(fd, buffer, rlen, offset - (off_t)lead);
+        if (got < 0) {
+            perror("Failed to read file");
+            status = -1;
+            break;
+        }
+        if ((size_t)got < lead + len) {
+            fprintf(stderr, "Unexpected end of file: %s\n", filename);
+            status = -1;
+            break;
+        }
+        dna_unpack(buffer + lead, 0, n, arr + i);
+        *crc = dna_crc32c(*crc, buffer + lead, len);
+        offset += (off_t)len;
+    }
+
+    free(buffer);
+    return status;
+}
+
+// Reads and decodes the header of an open file; see dna_read_header(). Reads a
+// whole aligned block so that it also works on O_DIRECT descriptors.
+static int read_header_fd(int fd, file_header_t *hdr) {
+    _Alignas(IO_ALIGN) uint8_t raw[IO_ALIGN];
+    ssize_t got = io_read_full(fd, raw, sizeof(raw), 0);
+    if (got < 0) {
+        return -1;
+    }
+    if (decode_header(raw, (size_t)got, hdr)) {
+        return 1;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        return -1;
+    }
+    memset(hdr, 0, sizeof(*hdr));
+    hdr->meta.num_bases = (uint64_t)st.st_size * BASES_PER_BYTE;
+    return 0;
+}
+
+int dna_read_header(const char *filename, dna_meta_t *meta) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open file");
+        return -1;
+    }
+    file_header_t hdr;
+    int status = read_header_fd(fd, &hdr);
+    if (status < 0) {
+        perror("Failed to read header");
+    } else {
+        *meta = hdr.meta;
+    }
+    close(fd);
+    return status;
+}
+
+static int save_headerless(const char *filename, const uint8_t *arr, size_t size, uint8_t *seen) {
+    int direct;
+    int fd = io_open(filename, O_WRONLY | O_CREAT | O_TRUNC, &direct);
+    if (fd < 0) {
+        perror("Failed to open file");
+        return -1;
+    }
+
+    uint32_t crc = 0;
+    int status = write_packed(fd, direct, NULL, 0, arr, size, &crc, NULL, NULL, 0, seen);
+    close(fd);
+    return status;
+}
+
+void save_large_array_to_file(const char *filename, const uint8_t *arr, size_t size) {
+    uint8_t seen = 0;
+    save_headerless(filename, arr, size, &seen);
+}
+
+// Trailing sections go out one after another behind the payload, followed by
+// the section table and finally the header, which points at the table.
+#define MAX_SECTIONS 8
+
+typedef struct {
+    int fd;
+    uint64_t base;    // Where the file starts in `fd` (archive samples), 0 otherwise
+    uint64_t offset;  // File offset of the next section byte
+    section_t sections[MAX_SECTIONS];
+    uint32_t num_sections;
+    int status;
+} trailer_t;
+
+static void trailer_init(trailer_t *t, int fd, uint64_t offset) {
+    memset(t, 0, sizeof(*t));
+    t->fd = fd;
+    t->offset = offset;
+}
+
+static void section_begin(trailer_t *t, uint32_t kind) {
+    section_t *sec = &t->sections[t->num_sections];
+    memset(sec, 0, sizeof(*sec));
+    sec->kind = kind;
+    sec->offset = t->offset;
+}
+
+static void section_append(trailer_t *t, const void *bytes, size_t len) {
+    section_t *sec = &t->sections[t->num_sections];
+    if (t->status == 0 && io_write_full(t->fd, bytes, len, (off_t)(t->base + t->offset)) != 0) {
+        perror("Failed to write section");
+        t->status = -1;
+    }
+    sec->crc = dna_crc32c(sec->crc, bytes, len);
+    sec->length += len;
+    t->offset += len;
+}
+
+static void section_end(trailer_t *t, uint64_t count) {
+    t->sections[t->num_sections++].count = count;
+}
+
+static void append_block_index(trailer_t *t, const dna_block_t *blocks, size_t num_blocks) {
+    uint8_t raw[64 * BLOCK_ENTRY_SIZE];
+    section_begin(t, DNA_SECTION_BLOCK_INDEX);
+    for (size_t i = 0; i < num_blocks; i += 64) {
+        size_t n = num_blocks - i < 64 ? num_blocks - i : 64;
+        for (size_t j = 0; j < n; ++j) {
+            encode_block(raw + j * BLOCK_ENTRY_SIZE, &blocks[i + j]);
+        }
+        section_append(t, raw, n * BLOCK_ENTRY_SIZE);
+    }
+    section_end(t, num_blocks);
+}
+
+static void append_block_stats(trailer_t *t, const uint32_t (*stats)[4], size_t num_blocks) {
+    section_begin(t, DNA_SECTION_BLOCK_STATS);
+    for (size_t i = 0; i < num_blocks; ++i) {
+        uint8_t raw[BLOCK_STATS_ENTRY_SIZE];
+        for (int c = 0; c < 4; ++c) {
+            put_le32(raw + 4 * c, stats[i][c]);
+        }
+        section_append(t, raw, sizeof(raw));
+    }
+    section_end(t, num_blocks);
+}
+
+static void append_n_runs(trailer_t *t, const dna_n_run_t *runs, size_t num_runs) {
+    uint8_t raw[64 * N_RUN_ENTRY_SIZE];
+    size_t n = 0, count = 0;
+    section_begin(t, DNA_SECTION_N_RUNS);
+    for (size_t i = 0; i < num_runs; ++i) {
+        for (uint64_t start = runs[i].start, left = runs[i].length; left > 0;) {
+            uint32_t len = left > UINT32_MAX ? UINT32_MAX : (uint32_t)left;
+            put_le64(raw + n * N_RUN_ENTRY_SIZE, start);
+            put_le32(raw + n * N_RUN_ENTRY_SIZE + 8, len);
+            start += len;
+            left -= len;
+            count++;
+            if (++n == 64) {
+                section_append(t, raw, sizeof(raw));
+                n = 0;
+            }
+        }
+    }
+    section_append(t, raw, n * N_RUN_ENTRY_SIZE);
+    section_end(t, count);
+}
+
+// Section bytes produced while the payload is still being written are spooled
+// to an anonymous temporary file and copied behind the payload on close.
+typedef struct {
+    FILE *file;
+    uint64_t bytes;
+} spool_t;
+
+static int spool_write(spool_t *s, const void *bytes, size_t len) {
+    if (!s->file && !(s->file = tmpfile())) {
+        perror("Failed to create spool file");
+        return -1;
+    }
+    if (fwrite(bytes, 1, len, s->file) != len) {
+        perror("Failed to write spool file");
+        return -1;
+    }
+    s->bytes += len;
+    return 0;
+}
+
+static void spool_close(spool_t *s) {
+    if (s->file) {
+        fclose(s->file);
+        s->file = NULL;
+    }
+}
+
+static void append_spool(trailer_t *t, spool_t *s, uint32_t kind, uint64_t count) {
+    uint8_t raw[1 << 16];
+    section_begin(t, kind);
+    if (s->file && (fflush(s->file) != 0 || fseek(s->file, 0, SEEK_SET) != 0)) {
+        perror("Failed to read spool file");
+        t->status = -1;
+    }
+    for (uint64_t left = s->bytes; left > 0 && t->status == 0;) {
+        size_t n = left < sizeof(raw) ? (size_t)left : sizeof(raw);
+        if (fread(raw, 1, n, s->file) != n) {
+            perror("Failed to read spool file");
+            t->status = -1;
+            break;
+        }
+        section_append(t, raw, n);
+        left -= n;
+    }
+    section_end(t, count);
+}
+
+// Writes the section table and the final header. Returns 0, or -1 if any
+// trailer write failed.
+static int trailer_finish(trailer_t *t, file_header_t *hdr) {
+    if (t->num_sections) {
+        uint8_t raw[MAX_SECTIONS * SECTION_ENTRY_SIZE];
+        for (uint32_t i = 0; i < t->num_sections; ++i) {
+            encode_section(raw + i * SECTION_ENTRY_SIZE, &t->sections[i]);
+        }
+        hdr->num_sections = t->num_sections;
+        hdr->sections_offset = t->offset;
+        if (t->status == 0 &&
+            io_write_full(t->fd, raw, t->num_sections * SECTION_ENTRY_SIZE, (off_t)(t->base + t->offset)) != 0) {
+            perror("Failed to write section table");
+            t->status = -1;
+        }
+    }
+    uint8_t raw[DNA_HEADER_SIZE];
+    encode_header(raw, hdr);
+    if (t->status == 0 && io_write_full(t->fd, raw, sizeof(raw), (off_t)t->base) != 0) {
+        perror("Failed to write header");
+        t->status = -1;
+    }
+    return t->status;
+}
+
+// Index entries of raw blocks laid out back to back after the header.
+static dna_block_t *raw_block_index(const uint32_t *block_crcs, uint64_t num_bases, uint32_t block_size,
+                                    size_t *num_blocks) {
+    size_t n = (size_t)((num_bases + block_size - 1) / block_size);
+    dna_block_t *blocks = calloc(n ? n : 1, sizeof(*blocks));
+    if (!blocks) {
+        perror("Failed to allocate block index");
+        return NULL;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        blocks[i].offset = DNA_HEADER_SIZE + (uint64_t)i * (block_size / BASES_PER_BYTE);
+        blocks[i].num_bases = i + 1 < n ? block_size : (uint32_t)(num_bases - (uint64_t)i * block_size);
+        blocks[i].stored_bytes = (blocks[i].num_bases + 3) / 4;
+        blocks[i].crc = block_crcs[i];
+        blocks[i].codec = DNA_CODEC_RAW;
+    }
+    *num_blocks = n;
+    return blocks;
+}
+
+// Validates meta->block_size and sets up a header for `meta`.
+static int init_header(file_header_t *hdr, const dna_meta_t *meta) {
+    memset(hdr, 0, sizeof(*hdr));
+    if (meta) {
+        hdr->meta = *meta;
+    }
+    hdr->meta.num_bases = 0;
+    hdr->meta.checksum = 0;
+    hdr->meta.flags &= ~(DNA_FLAG_BLOCKED | DNA_FLAG_VARIABLE | DNA_FLAG_CODED);  // Set by whoever writes what they promise
+    if (hdr->meta.block_size % BASES_PER_BYTE != 0) {
+        fprintf(stderr, "Block size %u is not a multiple of %d\n", hdr->meta.block_size, BASES_PER_BYTE);
+        return -1;
+    }
+    if (hdr->meta.block_size) {
+        hdr->meta.flags |= DNA_FLAG_BLOCKED;
+    }
+    return 0;
+}
+
+static int save_headered(const char *filename, const uint8_t *arr, size_t size, const dna_meta_t *meta,
+                         uint8_t *seen) {
+    file_header_t hdr;
+    if (init_header(&hdr, meta) != 0) {
+        return -1;
+    }
+    hdr.meta.num_bases = size;
+
+    uint32_t block_size = hdr.meta.block_size;
+    size_t num_blocks = block_size ? (size + block_size - 1) / block_size : 0;
+    uint32_t *block_crcs = NULL;
+    uint32_t (*stats)[4] = NULL;
+    if (block_size) {
+        block_crcs = calloc(num_blocks ? num_blocks : 1, sizeof(*block_crcs));
+        stats = calloc(num_blocks ? num_blocks : 1, sizeof(*stats));
+        if (!block_crcs || !stats) {
+            perror("Failed to allocate block index");
+            free(block_crcs);
+            free(stats);
+            return -1;
+        }
+    }
+
+    int direct;
+    int fd = io_open(filename, O_WRONLY | O_CREAT | O_TRUNC, &direct);
+    if (fd < 0) {
+        perror("Failed to open file");
+        free(block_crcs);
+        free(stats);
+        return -1;
+    }
+
+    uint8_t raw[DNA_HEADER_SIZE];
+    encode_header(raw, &hdr);
+    int status = write_packed(fd, direct, raw, sizeof(raw), arr, size, &hdr.meta.checksum,
+                              block_crcs, stats, block_size / BASES_PER_BYTE, seen);
+
+    // The checksums are only known now; the trailer and the final header go
+    // out with plain buffered writes.
+#ifdef O_DIRECT
+    if (direct) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_DIRECT);
+    }
+#endif
+    if (status == 0) {
+        trailer_t t;
+        trailer_init(&t, fd, DNA_HEADER_SIZE + ((uint64_t)size + 3) / 4);
+        if (block_size) {
+            dna_block_t *blocks = raw_block_index(block_crcs, size, block_size, &num_blocks);
+            if (!blocks) {
+                t.status = -1;
+            } else {
+                append_block_index(&t, blocks, num_blocks);
+                append_block_stats(&t, (const uint32_t (*)[4])stats, num_blocks);
+            }
+            free(blocks);
+        }
+        status = trailer_finish(&t, &hdr);
+    }
+    free(block_crcs);
+    free(stats);
+    close(fd);
+    return status;
+}
+
+int dna_save_with_header(const char *filename, const uint8_t *arr, size_t size, const dna_meta_t *meta) {
+    uint8_t seen = 0;
+    return save_headered(filename, arr, size, meta, &seen);
+}
+
+int dna_save_checked(const char *filename, const uint8_t *arr, size_t size, const dna_meta_t *meta) {
+    uint8_t seen = 0;
+    int status = meta ? save_headered(filename, arr, size, meta, &seen) : save_headerless(filename, arr, size, &seen);
+    if (status == 0 && (seen & ~0x03)) {
+        unlink(filename);
+        return -2;
+    }
+    return status;
+}
+
+int dna_read_checked(const char *filename, uint8_t *arr, size_t size) {
+    int direct;
+    int fd = io_open(filename, O_RDONLY, &direct);
+    if (fd < 0) {
+        perror("Failed to open file");
+        return -1;
+    }
+
+    // Headerless files start with the payload; headered ones are verified
+    // whenever the whole payload is read.
+    file_header_t hdr;
+    int has_header = read_header_fd(fd, &hdr);
+    const dna_meta_t meta = hdr.meta;
+    if (has_header < 0) {
+        perror("Failed to read header");
+        close(fd);
+        return -1;
+    }
+    int short_file = has_header && size > meta.num_bases;  // The elements it has are still read
+    if (short_file) {
+        fprintf(stderr, "File %s holds only %llu elements\n", filename, (unsigned long long)meta.num_bases);
+        size = meta.num_bases;
+    }
+    if (has_header && (meta.flags & DNA_FLAG_CODED)) {
+        // Compressed blocks are decoded one by one through the block index.
+        close(fd);
+        dna_handle_t *h = dna_open_mmap(filename, size);
+        if (!h) {
+            return -1;
+        }
+        int status = dna_read_range(h, 0, size, arr) == 0 && !short_file ? 0 : -2;
+        dna_close_mmap(h);
+        return status;
+    }
+
+    struct stat st;
+    off_t data_offset = has_header ? DNA_HEADER_SIZE : 0;
+    if (fstat(fd, &st) == 0 && (uint64_t)(st.st_size - data_offset) < ((uint64_t)size + 3) / 4) {
+        fprintf(stderr, "Unexpected end of file: %s\n", filename);
+        close(fd);
+        return -2;
+    }
+    uint32_t crc = 0;
+    int status = read_packed(fd, direct, data_offset, filename, arr, size, &crc);
+    if (status == 0 && has_header && size == meta.num_bases && crc != meta.checksum) {
+        fprintf(stderr, "Checksum mismatch: %s\n", filename);
+        status = -2;
+    }
+    close(fd);
+    return status == 0 && short_file ? -2 : status;
+}
+
+void read_large_array_from_file(const char *filename, uint8_t *arr, size_t size) {
+    dna_read_checked(filename, arr, size);
+}
+
+// Binned qualities. 2 bits: Phred <10, <20, <30 and >=30; 4 bits: bins of
+// three scores, the last one open-ended. The section stores the score each
+// bin decodes to, so readers need not know the scheme.
+#define QUALS_PREFIX_BYTES 20  // u32 bits, 16 representative scores
+#define QUAL_STAGE 65536       // Bins packed per spool write
+
+static uint8_t qual_bin(int bits, uint8_t phred) {
+    if (bits == 2) {
+        return phred < 10 ? 0 : phred < 20 ? 1 : phred < 30 ? 2 : 3;
+    }
+    return phred / 3 < 15 ? phred / 3 : 15;
+}
+
+static void qual_table(int bits, uint8_t table[16]) {
+    static const uint8_t two_bit[4] = {6, 15, 25, 37};
+    memset(table, 0, 16);
+    for (int b = 0; b < (bits == 2 ? 4 : 16); ++b) {
+        table[b] = bits == 2 ? two_bit[b] : (uint8_t)(3 * b + 1);
+    }
+}
+
+// Packs `n` bins, first value in the high bits; a short tail is zero-padded.
+static size_t pack_quals(int bits, const uint8_t *bins, size_t n, uint8_t *out) {
+    if (bits == 2) {
+        dna_pack(bins, n, out);
+        return (n + 3) / 4;
+    }
+    for (size_t i = 0; i < n; i += 2) {
+        out[i / 2] = (uint8_t)(bins[i] << 4 | (i + 1 < n ? bins[i + 1] : 0));
+    }
+    return (n + 1) / 2;
+}
+
+// Read names are split into runs of digits and runs of anything else and
+// coded token by token against the previous name of the group: varint token
+// count, then per token either a run of matching tokens (op 0x00 | count,
+// count 1-63), a numeric delta (0x40, zigzag varint) or a literal (0x80,
+// varint length, bytes). Digit runs with a leading zero or more than 18
+// digits are not numeric, so decoding reproduces every name exactly.
+#define NAME_OP_MATCH 0x00
+#define NAME_OP_DELTA 0x40
+#define NAME_OP_LITERAL 0x80
+#define NAME_MAX_MATCH 63
+
+typedef struct {
+    uint32_t start;
+    uint32_t len;
+    int numeric;
+    uint64_t value;
+} name_token_t;
+
+typedef struct {
+    char *text;  // Previous name
+    size_t cap;
+    name_token_t *tokens;
+    size_t num_tokens;
+    size_t tokens_cap;
+} name_coder_t;
+
+static int name_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Splits `name` into `c->tokens`, remembering it as the previous name.
+static int name_tokenize(name_coder_t *c, const char *name, size_t len) {
+    if (len + 1 > c->cap) {
+        char *text = realloc(c->text, len + 1);
+        if (!text) {
+            return -1;
+        }
+        c->text = text;
+        c->cap = len + 1;
+    }
+    memcpy(c->text, name, len);
+    c->num_tokens = 0;
+    for (size_t i = 0; i < len;) {
+        size_t j = i + 1;
+        while (j < len && name_digit(name[j]) == name_digit(name[i])) {
+            j++;
+        }
+        if (c->num_tokens == c->tokens_cap) {
+            size_t cap = c->tokens_cap ? 2 * c->tokens_cap : 32;
+            name_token_t *tokens = realloc(c->tokens, cap * sizeof(*tokens));
+            if (!tokens) {
+                return -1;
+            }
+            c->tokens = tokens;
+            c->tokens_cap = cap;
+        }
+        name_token_t *t = &c->tokens[c->num_tokens++];
+        t->start = (uint32_t)i;
+        t->len = (uint32_t)(j - i);
+        t->numeric = name_digit(name[i]) && t->len <= 18 && (t->len == 1 || name[i] != '0');
+        t->value = 0;
+        for (size_t k = i; t->numeric && k < j; ++k) {
+            t->value = t->value * 10 + (uint64_t)(name[k] - '0');
+        }
+        i = j;
+    }
+    return 0;
+}
+
+static size_t put_varint(uint8_t *p, uint64_t v) {
+    size_t n = 0;
+    while (v >= 0x80) {
+        p[n++] = (uint8_t)(v | 0x80);
+        v >>= 7;
+    }
+    p[n++] = (uint8_t)v;
+    return n;
+}
+
+static int get_varint(const uint8_t **p, const uint8_t *end, uint64_t *v) {
+    *v = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (*p == end) {
+            return -1;
+        }
+        uint8_t byte = *(*p)++;
+        *v |= (uint64_t)(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void name_coder_free(name_coder_t *c) {
+    free(c->text);
+    free(c->tokens);
+}
+
+// Streaming writer. Bases are packed into a ring of WRITER_RING aligned
+// buffers; a flush thread writes full buffers while the caller fills the next
+// one, so memory stays at WRITER_RING * WRITER_BUFFER_BYTES no matter how
+// much is written. Everything goes to `<filename>.part`, which replaces
+// `filename` only in dna_writer_close().
+#define WRITER_RING 4
+#define WRITER_BUFFER_BYTES (DNA_WRITER_MEMORY / WRITER_RING)
+
+typedef struct {
+    uint8_t *data;
+    size_t len;  // Bytes filled, the header placeholder included
+} ring_buf_t;
+
+struct dna_writer {
+    char *path;
+    char *part_path;
+    int fd;
+    int direct;
+    int has_header;
+    file_header_t hdr;
+
+    ring_buf_t ring[WRITER_RING];
+    size_t head;  // Buffers handed to the flush thread so far; ring[head % WRITER_RING] is being filled
+    size_t tail;  // Buffers written so far
+    int closing;
+    int error;
+    pthread_t flusher;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+
+    uint8_t pending[BASES_PER_BYTE];  // Bases of a not yet complete byte
+    unsigned num_pending;
+    uint64_t num_bases;
+    uint64_t num_reads;
+    dna_writer_stats_t stats;
+    dna_writer_stats_t *stats_out;
+    dna_n_run_t *n_runs;
+    size_t num_n_runs;
+    size_t n_runs_cap;
+    int variable;  // Record read offsets
+    spool_t read_offsets;
+    uint64_t num_offsets;
+    uint64_t offsets_anchor;
+
+    int qual_bits;  // 0 when no qualities are stored
+    spool_t quals;
+    uint64_t num_quals;
+    uint8_t *qual_stage;
+    size_t qual_staged;
+
+    uint32_t codec;  // Tried on every block; DNA_CODEC_RAW writes the payload as it comes
+    int level;
+
+    spool_t names;
+    uint64_t num_names;
+    uint64_t *name_groups;  // Offset of each group in `names`
+    size_t name_groups_cap;
+    name_coder_t name_coder;
+    name_coder_t name_prev;
+
+    // Owned by the flush thread until it exits
+    uint64_t file_offset;
+    uint64_t payload_bytes;
+    uint32_t *block_crcs;
+    size_t block_crcs_cap;
+    uint8_t *block_buf;  // Payload of the block being gathered for coding
+    size_t block_fill;
+    uint8_t *coded;      // Coded block
+    dna_block_t *coded_blocks;
+    size_t num_coded_blocks;
+    size_t coded_blocks_cap;
+    cm_model_t *cm;
+    uint32_t (*block_stats)[4];  // Codes of each block, for DNA_SECTION_BLOCK_STATS
+    size_t block_stats_cap;
+
+    // Appending in place (dna_writer_open_append): the original header and
+    // file bytes from resume_offset on, put back if the append fails
+    int in_place;
+    uint8_t saved_header[DNA_HEADER_SIZE];
+    spool_t saved_tail;
+    uint64_t resume_offset;
+    uint64_t orig_bytes;
+    uint64_t resume_bases;
+
+    // Sample of an archive (dna_archive_add): `fd` belongs to the archive and
+    // the file starts at `base` in it
+    struct dna_archive_writer *archive;
+    uint64_t base;
+};
+
+static int writer_track_blocks(dna_writer_t *w, const uint8_t *p, size_t len) {
+    size_t block_bytes = w->hdr.meta.block_size / BASES_PER_BYTE;
+    for (uint64_t b = w->payload_bytes, end = w->payload_bytes + len; b < end;) {
+        size_t blk = (size_t)(b / block_bytes);
+        if (blk >= w->block_crcs_cap) {
+            size_t cap = w->block_crcs_cap ? 2 * w->block_crcs_cap : 64;
+            uint32_t *crcs = realloc(w->block_crcs, cap * sizeof(*crcs));
+            if (!crcs) {
+                return -1;
+            }
+            memset(crcs + w->block_crcs_cap, 0, (cap - w->block_crcs_cap) * sizeof(*crcs));
+            w->block_crcs = crcs;
+            w->block_crcs_cap = cap;
+        }
+        uint64_t stop = (uint64_t)(blk + 1) * block_bytes < end ? (uint64_t)(blk + 1) * block_bytes : end;
+        w->block_crcs[blk] = dna_crc32c(w->block_crcs[blk], p + (b - w->payload_bytes), (size_t)(stop - b));
+        b = stop;
+    }
+    return 0;
+}
+
+// Adds the codes of `len` payload bytes to the stats of their blocks.
+static int writer_count_blocks(dna_writer_t *w, const uint8_t *p, size_t len) {
+    size_t block_bytes = w->hdr.meta.block_size / BASES_PER_BYTE;
+    for (uint64_t b = w->payload_bytes, end = w->payload_bytes + len; b < end;) {
+        size_t blk = (size_t)(b / block_bytes);
+        if (blk >= w->block_stats_cap) {
+            size_t cap = w->block_stats_cap ? 2 * w->block_stats_cap : 64;
+            uint32_t (*stats)[4] = realloc(w->block_stats, cap * sizeof(*stats));
+            if (!stats) {
+                return -1;
+            }
+            memset(stats + w->block_stats_cap, 0, (cap - w->block_stats_cap) * sizeof(*stats));
+            w->block_stats = stats;
+            w->block_stats_cap = cap;
+        }
+        uint64_t stop = (uint64_t)(blk + 1) * block_bytes < end ? (uint64_t)(blk + 1) * block_bytes : end;
+        uint64_t counts[4] = {0, 0, 0, 0};
+        count_kernel(p + (b - w->payload_bytes), (size_t)(stop - b), counts);
+        for (int c = 0; c < 4; ++c) {
+            w->block_stats[blk][c] += (uint32_t)counts[c];
+        }
+        b = stop;
+    }
+    return 0;
+}
+
+// Codes the gathered block, or keeps it raw if that is not smaller, and
+// writes it at the current file offset.
+static int writer_store_block(dna_writer_t *w) {
+    size_t raw_bytes = w->block_fill;
+    size_t coded = 0;
+    if (w->codec == DNA_CODEC_CM) {
+        cm_model_t *fresh = cm_model_new();
+        if (fresh) {
+            free(w->cm);
+            w->cm = fresh;
+            coded = cm_compress(w->cm, w->block_buf, raw_bytes * BASES_PER_BYTE, w->coded, raw_bytes - 1);
+        }
+    }
+#ifdef DNA_USE_ZSTD
+    if (w->codec == DNA_CODEC_ZSTD) {
+        size_t n = ZSTD_compress(w->coded, raw_bytes - 1, w->block_buf, raw_bytes, w->level);
+        coded = ZSTD_isError(n) ? 0 : n;
+    }
+#endif
+    if (w->num_coded_blocks == w->coded_blocks_cap) {
+        size_t cap = w->coded_blocks_cap ? 2 * w->coded_blocks_cap : 64;
+        dna_block_t *blocks = realloc(w->coded_blocks, cap * sizeof(*blocks));
+        if (!blocks) {
+            perror("Failed to allocate block index");
+            return -1;
+        }
+        w->coded_blocks = blocks;
+        w->coded_blocks_cap = cap;
+    }
+    const uint8_t *stored = coded ? w->coded : w->block_buf;
+    dna_block_t *blk = &w->coded_blocks[w->num_coded_blocks++];
+    blk->offset = w->file_offset;
+    blk->num_bases = (uint32_t)(raw_bytes * BASES_PER_BYTE);  // The last block is trimmed on close
+    blk->stored_bytes = (uint32_t)(coded ? coded : raw_bytes);
+    blk->crc = dna_crc32c(0, stored, blk->stored_bytes);
+    blk->codec = coded ? w->codec : DNA_CODEC_RAW;
+    if (io_write_full(w->fd, stored, blk->stored_bytes, (off_t)(w->base + w->file_offset)) != 0) {
+        perror("Failed to write file");
+        return -1;
+    }
+    w->hdr.meta.checksum = dna_crc32c(w->hdr.meta.checksum, stored, blk->stored_bytes);
+    w->file_offset += blk->stored_bytes;
+    w->block_fill = 0;
+    return 0;
+}
+
+// Coded files: gathers the buffer's payload into blocks instead of writing it
+// as it is.
+static int writer_flush_coded(dna_writer_t *w, ring_buf_t *buf) {
+    size_t skip = 0;
+    if (w->file_offset == 0) {
+        skip = DNA_HEADER_SIZE;  // Placeholder, written for real on close
+        if (io_write_full(w->fd, buf->data, skip, (off_t)w->base) != 0) {
+            perror("Failed to write file");
+            return -1;
+        }
+        w->file_offset = skip;
+    }
+    size_t block_bytes = w->hdr.meta.block_size / BASES_PER_BYTE;
+    for (size_t pos = skip; pos < buf->len;) {
+        size_t m = buf->len - pos < block_bytes - w->block_fill ? buf->len - pos : block_bytes - w->block_fill;
+        memcpy(w->block_buf + w->block_fill, buf->data + pos, m);
+        w->block_fill += m;
+        pos += m;
+        if (w->block_fill == block_bytes && writer_store_block(w) != 0) {
+            return -1;
+        }
+    }
+    if (writer_count_blocks(w, buf->data + skip, buf->len - skip) != 0) {
+        perror("Failed to allocate block stats");
+        return -1;
+    }
+    w->payload_bytes += buf->len - skip;
+    return 0;
+}
+
+// Writes one buffer and folds its payload into the checksums.
+static int writer_flush_buffer(dna_writer_t *w, ring_buf_t *buf) {
+    if (w->codec != DNA_CODEC_RAW) {
+        return writer_flush_coded(w, buf);
+    }
+    size_t skip = w->file_offset == 0 && w->has_header ? DNA_HEADER_SIZE : 0;
+    const uint8_t *payload = buf->data + skip;
+    size_t payload_len = buf->len - skip;
+
+    size_t wlen = w->direct ? round_up(buf->len, IO_ALIGN) : buf->len;
+    memset(buf->data + buf->len, 0, wlen - buf->len);
+    if (io_write_full(w->fd, buf->data, wlen, (off_t)(w->base + w->file_offset)) != 0) {
+        perror("Failed to write file");
+        return -1;
+    }
+    w->hdr.meta.checksum = dna_crc32c(w->hdr.meta.checksum, payload, payload_len);
+    if (w->hdr.meta.block_size &&
+        (writer_track_blocks(w, payload, payload_len) != 0 || writer_count_blocks(w, payload, payload_len) != 0)) {
+        perror("Failed to allocate block index");
+        return -1;
+    }
+    w->file_offset += buf->len;
+    w->payload_bytes += payload_len;
+    return 0;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static void *writer_flush_main(void *arg) {
+    dna_writer_t *w = arg;
+    pthread_mutex_lock(&w->lock);
+    for (;;) {
+        uint64_t t0 = now_ns();
+        while (w->tail == w->head && !w->closing) {
+            pthread_cond_wait(&w->cond, &w->lock);
+        }
+        uint64_t t1 = now_ns();
+        w->stats.idle_ns += t1 - t0;
+        if (w->tail == w->head) {
+            break;
+        }
+        ring_buf_t *buf = &w->ring[w->tail % WRITER_RING];
+        pthread_mutex_unlock(&w->lock);
+        int status = w->error ? -1 : writer_flush_buffer(w, buf);
+        pthread_mutex_lock(&w->lock);
+        w->stats.write_ns += now_ns() - t1;
+        if (status != 0) {
+            w->error = 1;
+        }
+        buf->len = 0;
+        w->tail++;
+        pthread_cond_broadcast(&w->cond);
+    }
+    pthread_mutex_unlock(&w->lock);
+    return NULL;
+}
+
+// Hands the current buffer to the flush thread and waits for a free one.
+static int writer_submit(dna_writer_t *w) {
+    pthread_mutex_lock(&w->lock);
+    w->head++;
+    w->stats.buffers++;
+    w->stats.depth_sum += w->head - w->tail;
+    pthread_cond_broadcast(&w->cond);
+    if (w->head - w->tail == WRITER_RING) {
+        uint64_t t0 = now_ns();
+        while (w->head - w->tail == WRITER_RING) {
+            pthread_cond_wait(&w->cond, &w->lock);
+        }
+        w->stats.submit_wait_ns += now_ns() - t0;
+    }
+    int error = w->error;
+    pthread_mutex_unlock(&w->lock);
+    return error ? -1 : 0;
+}
+
+static void writer_free(dna_writer_t *w) {
+    for (int i = 0; i < WRITER_RING; ++i) {
+        free(w->ring[i].data);
+    }
+    free(w->block_crcs);
+    free(w->block_buf);
+    free(w->coded);
+    free(w->coded_blocks);
+    free(w->cm);
+    free(w->block_stats);
+    free(w->n_runs);
+    spool_close(&w->read_offsets);
+    spool_close(&w->quals);
+    free(w->qual_stage);
+    spool_close(&w->names);
+    spool_close(&w->saved_tail);
+    free(w->name_groups);
+    name_coder_free(&w->name_coder);
+    name_coder_free(&w->name_prev);
+    free(w->path);
+    free(w->part_path);
+    free(w);
+}
+
+static int writer_alloc_ring(dna_writer_t *w) {
+    for (int i = 0; i < WRITER_RING; ++i) {
+        if (posix_memalign((void **)&w->ring[i].data, IO_ALIGN, WRITER_BUFFER_BYTES) != 0) {
+            w->ring[i].data = NULL;
+        }
+        if (!w->ring[i].data) {
+            perror("Failed to allocate writer buffers");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int writer_start(dna_writer_t *w) {
+    pthread_mutex_init(&w->lock, NULL);
+    pthread_cond_init(&w->cond, NULL);
+    if (pthread_create(&w->flusher, NULL, writer_flush_main, w) != 0) {
+        perror("Failed to start writer thread");
+        pthread_mutex_destroy(&w->lock);
+        pthread_cond_destroy(&w->cond);
+        return -1;
+    }
+    return 0;
+}
+
+// A writer with its header set up and its ring allocated, not yet bound to a file.
+static dna_writer_t *writer_new(const char *filename, const dna_meta_t *meta) {
+    dna_writer_t *w = calloc(1, sizeof(*w));
+    if (!w) {
+        perror("Failed to allocate writer");
+        return NULL;
+    }
+    w->has_header = meta != NULL;
+    if (init_header(&w->hdr, meta) != 0) {
+        free(w);
+        return NULL;
+    }
+    if (meta && (meta->flags & DNA_FLAG_VARIABLE)) {
+        w->variable = 1;
+        w->hdr.meta.flags |= DNA_FLAG_VARIABLE;
+        w->hdr.meta.read_length = 0;
+    }
+    w->path = strdup(filename);
+    if (!w->path) {
+        perror("Failed to allocate writer");
+        writer_free(w);
+        return NULL;
+    }
+    if (writer_alloc_ring(w) != 0) {
+        writer_free(w);
+        return NULL;
+    }
+    return w;
+}
+
+dna_writer_t *dna_writer_open(const char *filename, const dna_meta_t *meta) {
+    dna_writer_t *w = writer_new(filename, meta);
+    if (!w) {
+        return NULL;
+    }
+    size_t len = strlen(filename);
+    w->part_path = malloc(len + sizeof(".part"));
+    if (!w->part_path) {
+        perror("Failed to allocate writer");
+        writer_free(w);
+        return NULL;
+    }
+    memcpy(w->part_path, filename, len);
+    memcpy(w->part_path + len, ".part", sizeof(".part"));
+
+    w->fd = io_open(w->part_path, O_WRONLY | O_CREAT | O_TRUNC, &w->direct);
+    if (w->fd < 0) {
+        perror("Failed to open file");
+        writer_free(w);
+        return NULL;
+    }
+    if (w->has_header) {
+        memset(w->ring[0].data, 0, DNA_HEADER_SIZE);  // Written for real on close
+        w->ring[0].len = DNA_HEADER_SIZE;
+    }
+    if (writer_start(w) != 0) {
+        close(w->fd);
+        unlink(w->part_path);
+        writer_free(w);
+        return NULL;
+    }
+    return w;
+}
+
+static int writer_put_byte(dna_writer_t *w, uint8_t byte) {
+    ring_buf_t *buf = &w->ring[w->head % WRITER_RING];
+    buf->data[buf->len++] = byte;
+    return buf->len == WRITER_BUFFER_BYTES ? writer_submit(w) : 0;
+}
+
+int dna_writer_append(dna_writer_t *w, const uint8_t *bases, size_t n) {
+    if (w->error) {
+        return -1;
+    }
+    w->num_bases += n;
+
+    // Complete the byte left open by the previous call.
+    if (w->num_pending) {
+        while (w->num_pending < BASES_PER_BYTE && n > 0) {
+            w->pending[w->num_pending++] = *bases++;
+            --n;
+        }
+        if (w->num_pending < BASES_PER_BYTE) {
+            return 0;
+        }
+        uint8_t byte;
+        pack_scalar(w->pending, BASES_PER_BYTE, &byte);
+        w->num_pending = 0;
+        if (writer_put_byte(w, byte) != 0) {
+            return -1;
+        }
+    }
+
+    // Whole bytes go straight into the ring, the remainder waits for the next call.
+    size_t whole = n / BASES_PER_BYTE * BASES_PER_BYTE;
+    while (whole > 0) {
+        ring_buf_t *buf = &w->ring[w->head % WRITER_RING];
+        size_t room = (WRITER_BUFFER_BYTES - buf->len) * BASES_PER_BYTE;
+        size_t m = whole < room ? whole : room;
+        dna_pack(bases, m, buf->data + buf->len);
+        buf->len += m / BASES_PER_BYTE;
+        bases += m;
+        whole -= m;
+        n -= m;
+        if (buf->len == WRITER_BUFFER_BYTES && writer_submit(w) != 0) {
+            return -1;
+        }
+    }
+    memcpy(w->pending, bases, n);
+    w->num_pending = (unsigned)n;
+    return 0;
+}
+
+// Adds entry `num_offsets` of the read offsets section.
+static int writer_add_offset(dna_writer_t *w, uint64_t offset) {
+    uint8_t raw[12];
+    size_t n = 0;
+    if (w->num_offsets % DNA_READ_OFFSETS_GROUP == 0) {
+        w->offsets_anchor = offset;
+        put_le64(raw, offset);
+        n = 8;
+    }
+    if (offset - w->offsets_anchor > UINT32_MAX) {
+        fprintf(stderr, "Reads too long for the read offsets index\n");
+        return -1;
+    }
+    put_le32(raw + n, (uint32_t)(offset - w->offsets_anchor));
+    w->num_offsets++;
+    return spool_write(&w->read_offsets, raw, n + 4);
+}
+
+static int writer_resume_coded(dna_writer_t *w);
+
+int dna_writer_set_codec(dna_writer_t *w, uint32_t codec, int level) {
+    pthread_mutex_lock(&w->lock);
+    int started = w->head != 0;
+    pthread_mutex_unlock(&w->lock);
+    // Appends choose before their first base too; coded files may switch codec.
+    int fresh = w->num_bases == (w->in_place ? w->resume_bases : 0);
+    if (!w->hdr.meta.block_size || !fresh || started || (w->codec != DNA_CODEC_RAW && !w->in_place)) {
+        fprintf(stderr, "Block codecs need a blocked file and must be set before writing\n");
+        return -1;
+    }
+    if (codec == DNA_CODEC_RAW) {
+        return 0;
+    }
+#ifdef DNA_USE_ZSTD
+    int available = codec == DNA_CODEC_CM || codec == DNA_CODEC_ZSTD;
+#else
+    int available = codec == DNA_CODEC_CM;
+#endif
+    if (!available) {
+        fprintf(stderr, "Block codec %u is not available in this build\n", codec);
+        return -1;
+    }
+    if (w->codec != DNA_CODEC_RAW) {
+        w->codec = codec;
+        w->level = level;
+        return 0;
+    }
+    size_t block_bytes = w->hdr.meta.block_size / BASES_PER_BYTE;
+    w->block_buf = malloc(block_bytes);
+    w->coded = malloc(block_bytes);
+    if (!w->block_buf || !w->coded) {
+        perror("Failed to allocate block buffers");
+        return -1;
+    }
+    if (w->in_place && writer_resume_coded(w) != 0) {
+        return -1;
+    }
+#ifdef O_DIRECT
+    // Coded blocks have arbitrary sizes and offsets.
+    if (w->direct) {
+        fcntl(w->fd, F_SETFL, fcntl(w->fd, F_GETFL) & ~O_DIRECT);
+        w->direct = 0;
+    }
+#endif
+    w->codec = codec;
+    w->level = level;
+    return 0;
+}
+
+int dna_writer_enable_quals(dna_writer_t *w, int bits) {
+    if (!w->has_header || w->num_bases || w->qual_bits || (bits != 2 && bits != 4)) {
+        return -1;
+    }
+    w->qual_stage = malloc(QUAL_STAGE);
+    if (!w->qual_stage) {
+        perror("Failed to allocate quality buffer");
+        return -1;
+    }
+    uint8_t prefix[QUALS_PREFIX_BYTES];
+    put_le32(prefix, (uint32_t)bits);
+    qual_table(bits, prefix + 4);
+    w->qual_bits = bits;
+    return spool_write(&w->quals, prefix, sizeof(prefix));
+}
+
+// Packs the staged bins into the quals spool; `all` also takes a partial tail.
+static int writer_flush_quals(dna_writer_t *w, int all) {
+    size_t per_byte = 8 / (size_t)w->qual_bits;
+    size_t n = all ? w->qual_staged : w->qual_staged / per_byte * per_byte;
+    uint8_t packed[QUAL_STAGE / 2];
+    size_t bytes = pack_quals(w->qual_bits, w->qual_stage, n, packed);
+    memmove(w->qual_stage, w->qual_stage + n, w->qual_staged - n);
+    w->qual_staged -= n;
+    return spool_write(&w->quals, packed, bytes);
+}
+
+int dna_writer_append_quals(dna_writer_t *w, const char *qual, size_t n) {
+    if (!w->qual_bits) {
+        return -1;
+    }
+    for (size_t i = 0; i < n; ++i) {
+        uint8_t phred = (uint8_t)qual[i] >= 33 ? (uint8_t)(qual[i] - 33) : 0;
+        w->qual_stage[w->qual_staged++] = qual_bin(w->qual_bits, phred);
+        if (w->qual_staged == QUAL_STAGE && writer_flush_quals(w, 0) != 0) {
+            return -1;
+        }
+    }
+    w->num_quals += n;
+    return 0;
+}
+
+int dna_writer_append_name(dna_writer_t *w, const char *name, size_t len) {
+    if (!w->has_header || len > UINT32_MAX) {
+        return -1;
+    }
+    if (w->num_names % DNA_NAME_GROUP == 0) {
+        size_t group = (size_t)(w->num_names / DNA_NAME_GROUP);
+        if (group == w->name_groups_cap) {
+            size_t cap = w->name_groups_cap ? 2 * w->name_groups_cap : 64;
+            uint64_t *groups = realloc(w->name_groups, cap * sizeof(*groups));
+            if (!groups) {
+                perror("Failed to allocate name index");
+                return -1;
+            }
+            w->name_groups = groups;
+            w->name_groups_cap = cap;
+        }
+        w->name_groups[group] = w->names.bytes;
+        w->name_prev.num_tokens = 0;  // Groups start from scratch
+    }
+
+    name_coder_t *cur = &w->name_coder, *prev = &w->name_prev;
+    if (name_tokenize(cur, name, len) != 0) {
+        perror("Failed to tokenize name");
+        return -1;
+    }
+    uint8_t raw[64];
+    size_t n = put_varint(raw, cur->num_tokens), run = 0;
+    int status = 0;
+    for (size_t i = 0; i <= cur->num_tokens && status == 0; ++i) {
+        const name_token_t *t = i < cur->num_tokens ? &cur->tokens[i] : NULL;
+        const name_token_t *p = t && i < prev->num_tokens ? &prev->tokens[i] : NULL;
+        if (p && t->len == p->len && memcmp(name + t->start, prev->text + p->start, t->len) == 0) {
+            if (++run == NAME_MAX_MATCH) {
+                raw[n++] = NAME_OP_MATCH | (uint8_t)run;
+                run = 0;
+            }
+            continue;
+        }
+        if (run) {
+            raw[n++] = NAME_OP_MATCH | (uint8_t)run;
+            run = 0;
+        }
+        if (!t) {
+            break;
+        }
+        if (p && t->numeric && p->numeric) {
+            int64_t delta = (int64_t)(t->value - p->value);
+            raw[n++] = NAME_OP_DELTA;
+            n += put_varint(raw + n, ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63));
+        } else {
+            raw[n++] = NAME_OP_LITERAL;
+            n += put_varint(raw + n, t->len);
+            status = spool_write(&w->names, raw, n);
+            n = 0;
+            if (status == 0) {
+                status = spool_write(&w->names, name + t->start, t->len);
+            }
+        }
+        if (n > sizeof(raw) - 24) {
+            status = spool_write(&w->names, raw, n);
+            n = 0;
+        }
+    }
+    if (status == 0) {
+        status = spool_write(&w->names, raw, n);
+    }
+    if (status != 0) {
+        return -1;
+    }
+    // The current name becomes the previous one.
+    name_coder_t swap = *prev;
+    *prev = *cur;
+    *cur = swap;
+    w->num_names++;
+    return 0;
+}
+
+int dna_writer_append_read(dna_writer_t *w, const uint8_t *bases, size_t n) {
+    if (w->variable && writer_add_offset(w, w->num_bases) != 0) {
+        w->error = 1;
+        return -1;
+    }
+    if (dna_writer_append(w, bases, n) != 0) {
+        return -1;
+    }
+    w->num_reads++;
+    return 0;
+}
+
+int dna_writer_append_keys(dna_writer_t *w, const uint64_t *keys, size_t n, unsigned read_length) {
+    if (read_length == 0 || read_length > 32) {
+        return -1;
+    }
+    // Reads are unpacked a batch at a time; without read offsets to record a
+    // batch goes in with a single append.
+    enum { BATCH = 4096 };
+    uint8_t codes[BATCH * 32];
+    for (size_t i = 0; i < n; i += BATCH) {
+        size_t m = n - i < BATCH ? n - i : BATCH;
+        uint8_t *c = codes;
+        for (size_t r = 0; r < m; ++r) {
+            for (unsigned b = read_length; b-- > 0;) {
+                *c++ = (keys[i + r] >> (2 * b)) & 0x03;
+            }
+        }
+        for (size_t r = 0; w->variable && r < m; ++r) {
+            if (dna_writer_append_read(w, codes + r * read_length, read_length) != 0) {
+                return -1;
+            }
+        }
+        if (!w->variable) {
+            if (dna_writer_append(w, codes, m * read_length) != 0) {
+                return -1;
+            }
+            w->num_reads += m;
+        }
+    }
+    return 0;
+}
+
+uint64_t dna_writer_num_bases(const dna_writer_t *w) {
+    return w->num_bases;
+}
+
+int dna_writer_mark_n(dna_writer_t *w, uint64_t start, uint64_t length) {
+    dna_n_run_t *last = w->num_n_runs ? &w->n_runs[w->num_n_runs - 1] : NULL;
+    if (!w->has_header || (last && start < last->start + last->length)) {
+        return -1;
+    }
+    if (length == 0) {
+        return 0;
+    }
+    if (last && start == last->start + last->length) {
+        last->length += length;
+        return 0;
+    }
+    if (w->num_n_runs == w->n_runs_cap) {
+        size_t cap = w->n_runs_cap ? 2 * w->n_runs_cap : 64;
+        dna_n_run_t *runs = realloc(w->n_runs, cap * sizeof(*runs));
+        if (!runs) {
+            perror("Failed to allocate N runs");
+            return -1;
+        }
+        w->n_runs = runs;
+        w->n_runs_cap = cap;
+    }
+    w->n_runs[w->num_n_runs++] = (dna_n_run_t){start, length};
+    return 0;
+}
+
+void dna_writer_set_stats(dna_writer_t *w, dna_writer_stats_t *stats) {
+    w->stats_out = stats;
+}
+
+// Flushes everything and stops the flush thread. Returns 0 if every write succeeded.
+static int writer_drain(dna_writer_t *w) {
+    int status = 0;
+    if (w->num_pending) {
+        uint8_t byte;
+        pack_scalar(w->pending, w->num_pending, &byte);
+        w->num_pending = 0;
+        status = writer_put_byte(w, byte);
+    }
+    pthread_mutex_lock(&w->lock);
+    if (w->ring[w->head % WRITER_RING].len > 0) {
+        w->head++;
+        w->stats.buffers++;
+        w->stats.depth_sum += w->head - w->tail;
+    }
+    w->closing = 1;
+    pthread_cond_broadcast(&w->cond);
+    pthread_mutex_unlock(&w->lock);
+    pthread_join(w->flusher, NULL);
+    pthread_mutex_destroy(&w->lock);
+    pthread_cond_destroy(&w->cond);
+    if (w->stats_out) {
+        *w->stats_out = w->stats;
+    }
+    return status != 0 || w->error ? -1 : 0;
+}
+
+static int archive_sample_done(dna_writer_t *w, int status, uint64_t end);
+
+// Puts back the header and the bytes an append has overwritten.
+static void writer_restore(dna_writer_t *w) {
+    uint8_t raw[1 << 16];
+    int status = 0;
+    spool_t *s = &w->saved_tail;
+    if (s->file && (fflush(s->file) != 0 || fseek(s->file, 0, SEEK_SET) != 0)) {
+        status = -1;
+    }
+    for (uint64_t off = 0; off < s->bytes && status == 0;) {
+        size_t n = s->bytes - off < sizeof(raw) ? (size_t)(s->bytes - off) : sizeof(raw);
+        if (fread(raw, 1, n, s->file) != n || io_write_full(w->fd, raw, n, (off_t)(w->resume_offset + off)) != 0) {
+            status = -1;
+        }
+        off += n;
+    }
+    if (status == 0 && w->has_header && io_write_full(w->fd, w->saved_header, DNA_HEADER_SIZE, 0) != 0) {
+        status = -1;
+    }
+    if (status == 0 && ftruncate(w->fd, (off_t)w->orig_bytes) != 0) {
+        status = -1;
+    }
+    fprintf(stderr, status == 0 ? "Append to %s failed, file restored\n" : "Append to %s failed, cannot restore the file\n",
+            w->path);
+}
+
+int dna_writer_close(dna_writer_t *w) {
+    int status = writer_drain(w);
+#ifdef O_DIRECT
+    if (w->direct) {
+        fcntl(w->fd, F_SETFL, fcntl(w->fd, F_GETFL) & ~O_DIRECT);
+    }
+#endif
+    if (status == 0 && w->direct && ftruncate(w->fd, (off_t)(w->base + w->file_offset)) != 0) {
+        perror("Failed to truncate file");
+        status = -1;
+    }
+
+    uint64_t end = w->file_offset;
+    if (status == 0 && w->has_header) {
+        file_header_t *hdr = &w->hdr;
+        hdr->meta.num_bases = w->num_bases;
+        if (w->num_reads) {
+            hdr->meta.num_reads = w->num_reads;
+        }
+        trailer_t t;
+        if (w->codec != DNA_CODEC_RAW) {
+            // The flush thread has exited, so the last block is ours to finish.
+            if (w->block_fill > 0 && writer_store_block(w) != 0) {
+                status = -1;
+            }
+            if (w->num_coded_blocks) {
+                dna_block_t *last = &w->coded_blocks[w->num_coded_blocks - 1];
+                last->num_bases = (uint32_t)(w->num_bases - (uint64_t)(w->num_coded_blocks - 1) * hdr->meta.block_size);
+            }
+            for (size_t i = 0; i < w->num_coded_blocks; ++i) {
+                if (w->coded_blocks[i].codec != DNA_CODEC_RAW) {
+                    hdr->meta.flags |= DNA_FLAG_CODED;
+                }
+            }
+        }
+        trailer_init(&t, w->fd, w->file_offset);
+        t.base = w->base;
+        t.status = status;
+        if (w->codec != DNA_CODEC_RAW) {
+            append_block_index(&t, w->coded_blocks, w->num_coded_blocks);
+        } else if (hdr->meta.block_size) {
+            size_t num_blocks;
+            if (!w->block_crcs) {
+                w->block_crcs = calloc(1, sizeof(*w->block_crcs));
+            }
+            dna_block_t *blocks = w->block_crcs
+                ? raw_block_index(w->block_crcs, w->num_bases, hdr->meta.block_size, &num_blocks) : NULL;
+            if (!blocks) {
+                t.status = -1;
+            } else {
+                append_block_index(&t, blocks, num_blocks);
+                free(blocks);
+            }
+        }
+        if (hdr->meta.block_size && w->num_bases) {
+            // The zero bits padding the last byte were counted as A.
+            size_t num_blocks = (size_t)((w->num_bases + hdr->meta.block_size - 1) / hdr->meta.block_size);
+            if (num_blocks > w->block_stats_cap) {
+                t.status = -1;
+            } else {
+                w->block_stats[num_blocks - 1][0] -= (uint32_t)(w->payload_bytes * BASES_PER_BYTE - w->num_bases);
+                append_block_stats(&t, (const uint32_t (*)[4])w->block_stats, num_blocks);
+            }
+        }
+        if (w->variable) {
+            if (writer_add_offset(w, w->num_bases) != 0) {
+                t.status = -1;
+            }
+            append_spool(&t, &w->read_offsets, DNA_SECTION_READ_OFFSETS, w->num_offsets);
+        }
+        if (w->qual_bits) {
+            if (w->num_quals != w->num_bases) {
+                fprintf(stderr, "%llu qualities for %llu bases\n",
+                        (unsigned long long)w->num_quals, (unsigned long long)w->num_bases);
+                t.status = -1;
+            }
+            if (writer_flush_quals(w, 1) != 0) {
+                t.status = -1;
+            }
+            append_spool(&t, &w->quals, DNA_SECTION_QUALS, w->num_quals);
+        }
+        if (w->num_names) {
+            if (w->num_names != w->num_reads) {
+                fprintf(stderr, "%llu names for %llu reads\n",
+                        (unsigned long long)w->num_names, (unsigned long long)w->num_reads);
+                t.status = -1;
+            }
+            append_spool(&t, &w->names, DNA_SECTION_NAMES, w->num_names);
+            size_t num_groups = (size_t)((w->num_names + DNA_NAME_GROUP - 1) / DNA_NAME_GROUP);
+            section_begin(&t, DNA_SECTION_NAME_INDEX);
+            for (size_t i = 0; i < num_groups; ++i) {
+                uint8_t raw[8];
+                put_le64(raw, w->name_groups[i]);
+                section_append(&t, raw, sizeof(raw));
+            }
+            section_end(&t, num_groups);
+        }
+        if (w->num_n_runs) {
+            const dna_n_run_t *last = &w->n_runs[w->num_n_runs - 1];
+            if (last->start + last->length > w->num_bases) {
+                fprintf(stderr, "N run past the end of the data\n");
+                t.status = -1;
+            }
+            append_n_runs(&t, w->n_runs, w->num_n_runs);
+        }
+        status = trailer_finish(&t, hdr);
+        end = t.offset + (uint64_t)t.num_sections * SECTION_ENTRY_SIZE;
+    }
+
+    if (w->archive) {
+        status = archive_sample_done(w, status, end);
+        writer_free(w);
+        return status;
+    }
+    if (w->in_place) {
+        // An append can end before the old trailer did.
+        if (status == 0 && ftruncate(w->fd, (off_t)end) != 0) {
+            perror("Failed to truncate file");
+            status = -1;
+        }
+        if (status != 0) {
+            writer_restore(w);
+        }
+    }
+    if (close(w->fd) != 0) {
+        perror("Failed to close file");
+        status = -1;
+    }
+    if (status == 0 && !w->in_place && rename(w->part_path, w->path) != 0) {
+        perror("Failed to rename file");
+        status = -1;
+    }
+    if (status != 0 && !w->in_place) {
+        unlink(w->part_path);
+    }
+    writer_free(w);
+    return status;
+}
+
+void dna_writer_abort(dna_writer_t *w) {
+    if (!w) {
+        return;
+    }
+    pthread_mutex_lock(&w->lock);
+    w->error = 1;
+    pthread_mutex_unlock(&w->lock);
+    writer_drain(w);
+    if (w->archive) {
+        archive_sample_done(w, -1, 0);
+        writer_free(w);
+        return;
+    }
+    if (w->in_place) {
+        writer_restore(w);
+    }
+    close(w->fd);
+    if (!w->in_place) {
+        unlink(w->part_path);
+    }
+    writer_free(w);
+}
+
+// Memory-mapped reader: decodes base ranges straight out of the page cache.
+struct dna_handle {
+    int fd;               // -1 for a sample of an archive, which owns the mapping
+    uint8_t *map;         // NULL for an empty file
+    size_t map_bytes;
+    const uint8_t *data;  // First packed byte
+    size_t num_bases;
+    int has_header;
+    dna_meta_t meta;      // Legacy files: num_bases only
+    dna_block_t *blocks;  // Block index of blocked files
+    size_t num_blocks;
+    const uint8_t *block_stats;  // Mapped per-block base counts, NULL if absent
+    uint64_t num_block_stats;
+    dna_n_run_t *n_runs;  // Sorted, non-overlapping
+    size_t num_n_runs;
+    const uint8_t *read_offsets;  // Mapped read offsets section of variable-length files
+    uint64_t num_offsets;
+    const uint8_t *quals;  // Mapped packed bins, NULL without qualities
+    int qual_bits;
+    uint8_t qual_table[16];
+    const uint8_t *names;  // Mapped names section
+    uint64_t names_bytes;
+    uint64_t num_names;
+    const uint8_t *name_index;
+    uint64_t num_name_groups;
+    struct block_cache *cache;  // Decoded coded blocks, NULL when disabled
+    struct prefetcher *prefetch;  // Read-ahead thread, NULL when stopped
+    atomic_int advice;            // DNA_ADVICE_*
+};
+
+// Returns a pointer to the `length` mapped bytes at file offset `offset`, or
+// NULL if they lie outside the file.
+static const uint8_t *map_at(const dna_handle_t *h, uint64_t offset, uint64_t length) {
+    if (offset > h->map_bytes || length > h->map_bytes - offset) {
+        return NULL;
+    }
+    return h->map + offset;
+}
+
+static int load_block_index(dna_handle_t *h, const section_t *sec, const uint8_t *p) {
+    if (sec->length != sec->count * BLOCK_ENTRY_SIZE || !h->meta.block_size) {
+        return -1;
+    }
+    h->blocks = calloc(sec->count ? sec->count : 1, sizeof(*h->blocks));
+    if (!h->blocks) {
+        return -1;
+    }
+    h->num_blocks = sec->count;
+    uint64_t bases = 0;
+    for (size_t i = 0; i < h->num_blocks; ++i) {
+        decode_block(p + i * BLOCK_ENTRY_SIZE, &h->blocks[i]);
+        const dna_block_t *blk = &h->blocks[i];
+        // Decoding writes up to a whole block into block-sized buffers and
+        // unpacks raw blocks straight from their stored bytes.
+        if (!map_at(h, blk->offset, blk->stored_bytes) || blk->num_bases > h->meta.block_size ||
+            (i + 1 < h->num_blocks && blk->num_bases != h->meta.block_size) ||
+            (blk->codec == DNA_CODEC_RAW && blk->stored_bytes < (blk->num_bases + 3) / 4)) {
+            return -1;
+        }
+        bases += blk->num_bases;
+    }
+    return bases == h->meta.num_bases ? 0 : -1;
+}
+
+static int load_block_stats(dna_handle_t *h, const section_t *sec, const uint8_t *p) {
+    if (sec->length != sec->count * BLOCK_STATS_ENTRY_SIZE || h->block_stats) {
+        return -1;
+    }
+    h->block_stats = p;
+    h->num_block_stats = sec->count;
+    return 0;
+}
+
+static int load_n_runs(dna_handle_t *h, const section_t *sec, const uint8_t *p) {
+    if (sec->length != sec->count * N_RUN_ENTRY_SIZE || h->n_runs) {
+        return -1;
+    }
+    h->n_runs = calloc(sec->count ? sec->count : 1, sizeof(*h->n_runs));
+    if (!h->n_runs) {
+        return -1;
+    }
+    h->num_n_runs = sec->count;
+    uint64_t end = 0;
+    for (size_t i = 0; i < h->num_n_runs; ++i) {
+        dna_n_run_t *run = &h->n_runs[i];
+        run->start = get_le64(p + i * N_RUN_ENTRY_SIZE);
+        run->length = get_le32(p + i * N_RUN_ENTRY_SIZE + 8);
+        if (run->start < end || run->length > h->meta.num_bases - run->start) {
+            return -1;
+        }
+        end = run->start + run->length;
+    }
+    return 0;
+}
+
+static uint64_t read_offset(const dna_handle_t *h, uint64_t i) {
+    const uint8_t *group = h->read_offsets + i / DNA_READ_OFFSETS_GROUP * READ_OFFSETS_GROUP_BYTES;
+    return get_le64(group) + get_le32(group + 8 + i % DNA_READ_OFFSETS_GROUP * 4);
+}
+
+static int load_read_offsets(dna_handle_t *h, const section_t *sec, const uint8_t *p) {
+    if (sec->count != h->meta.num_reads + 1 || sec->length != read_offsets_bytes(sec->count)) {
+        return -1;
+    }
+    h->read_offsets = p;
+    h->num_offsets = sec->count;
+    uint64_t prev = 0;
+    for (uint64_t i = 0; i < h->num_offsets; ++i) {
+        uint64_t offset = read_offset(h, i);
+        if (offset < prev || offset > h->meta.num_bases) {
+            return -1;
+        }
+        prev = offset;
+    }
+    return prev == h->meta.num_bases ? 0 : -1;
+}
+
+static int load_quals(dna_handle_t *h, const section_t *sec, const uint8_t *p) {
+    if (sec->length < QUALS_PREFIX_BYTES || sec->count != h->meta.num_bases) {
+        return -1;
+    }
+    int bits = (int)get_le32(p);
+    if ((bits != 2 && bits != 4) || sec->length != QUALS_PREFIX_BYTES + (sec->count * bits + 7) / 8) {
+        return -1;
+    }
+    h->qual_bits = bits;
+    memcpy(h->qual_table, p + 4, sizeof(h->qual_table));
+    h->quals = p + QUALS_PREFIX_BYTES;
+    return 0;
+}
+
+static int load_names(dna_handle_t *h, const section_t *sec, const uint8_t *p) {
+    if (sec->count != h->meta.num_reads) {
+        return -1;
+    }
+    h->names = p;
+    h->names_bytes = sec->length;
+    h->num_names = sec->count;
+    return 0;
+}
+
+static int load_name_index(dna_handle_t *h, const section_t *sec, const uint8_t *p) {
+    if (sec->length != sec->count * 8) {
+        return -1;
+    }
+    h->name_index = p;
+    h->num_name_groups = sec->count;
+    return 0;
+}
+
+static int load_sections(dna_handle_t *h, const file_header_t *hdr) {
+    const uint8_t *table = map_at(h, hdr->sections_offset, (uint64_t)hdr->num_sections * SECTION_ENTRY_SIZE);
+    if (!table) {
+        return hdr->num_sections ? -1 : 0;
+    }
+    for (uint32_t i = 0; i < hdr->num_sections; ++i) {
+        section_t sec;
+        decode_section(table + (size_t)i * SECTION_ENTRY_SIZE, &sec);
+        const uint8_t *p = map_at(h, sec.offset, sec.length);
+        if (!p || dna_crc32c(0, p, sec.length) != sec.crc) {
+            return -1;
+        }
+        if (sec.kind == DNA_SECTION_BLOCK_INDEX && load_block_index(h, &sec, p) != 0) {
+            return -1;
+        }
+        if (sec.kind == DNA_SECTION_BLOCK_STATS && load_block_stats(h, &sec, p) != 0) {
+            return -1;
+        }
+        if (sec.kind == DNA_SECTION_N_RUNS && load_n_runs(h, &sec, p) != 0) {
+            return -1;
+        }
+        if (sec.kind == DNA_SECTION_READ_OFFSETS && load_read_offsets(h, &sec, p) != 0) {
+            return -1;
+        }
+        if (sec.kind == DNA_SECTION_QUALS && load_quals(h, &sec, p) != 0) {
+            return -1;
+        }
+        if (sec.kind == DNA_SECTION_NAMES && load_names(h, &sec, p) != 0) {
+            return -1;
+        }
+        if (sec.kind == DNA_SECTION_NAME_INDEX && load_name_index(h, &sec, p) != 0) {
+            return -1;
+        }
+    }
+    if (h->names && (!h->name_index || h->num_name_groups != (h->num_names + DNA_NAME_GROUP - 1) / DNA_NAME_GROUP)) {
+        return -1;
+    }
+    for (uint64_t g = 0; g < h->num_name_groups; ++g) {
+        if (!h->names || get_le64(h->name_index + g * 8) > h->names_bytes) {
+            return -1;
+        }
+    }
+    if ((h->meta.flags & DNA_FLAG_VARIABLE) && !h->read_offsets) {
+        return -1;
+    }
+    if (h->block_stats && h->num_block_stats != h->num_blocks) {
+        return -1;
+    }
+    return (h->meta.flags & DNA_FLAG_BLOCKED) && !h->blocks && h->meta.num_bases ? -1 : 0;
+}
+
+dna_handle_t *dna_open_mmap(const char *filename, size_t size) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) {
+        perror("Failed to open file");
+        return NULL;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        perror("Failed to stat file");
+        close(fd);
+        return NULL;
+    }
+
+    file_header_t hdr;
+    int has_header = read_header_fd(fd, &hdr);
+    const dna_meta_t meta = hdr.meta;
+    if (has_header < 0) {
+        perror("Failed to read header");
+        close(fd);
+        return NULL;
+    }
+
+    size_t file_bytes = (size_t)st.st_size;
+    size_t data_offset = has_header ? DNA_HEADER_SIZE : 0;
+    if (size == 0) {
+        size = has_header ? meta.num_bases : file_bytes * BASES_PER_BYTE;
+    }
+    // The blocks of coded files are checked against the file size with the block index.
+    int coded = has_header && (meta.flags & DNA_FLAG_CODED);
+    if ((has_header && size > meta.num_bases) || (!coded && (size + 3) / 4 > file_bytes - data_offset)) {
+        fprintf(stderr, "File %s is too small for %zu elements\n", filename, size);
+        close(fd);
+        return NULL;
+    }
+
+    dna_handle_t *h = calloc(1, sizeof(*h));
+    if (!h) {
+        perror("Failed to allocate handle");
+        close(fd);
+        return NULL;
+    }
+    h->fd = fd;
+    h->num_bases = size;
+    h->has_header = has_header;
+    h->meta = meta;
+    if (file_bytes > 0) {
+        void *map = mmap(NULL, file_bytes, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            perror("Failed to mmap file");
+            close(fd);
+            free(h);
+            return NULL;
+        }
+        h->map = map;
+        h->map_bytes = file_bytes;
+    }
+    h->data = h->map + data_offset;
+    if (has_header && load_sections(h, &hdr) != 0) {
+        fprintf(stderr, "Corrupt section table: %s\n", filename);
+        dna_close_mmap(h);
+        return NULL;
+    }
+    if (coded) {
+        dna_set_cache(h, DNA_DEFAULT_CACHE_BYTES);  // Slots are allocated on first use
+    }
+    return h;
+}
+
+size_t dna_handle_size(const dna_handle_t *h) {
+    return h->num_bases;
+}
+
+const uint8_t *dna_handle_data(const dna_handle_t *h, size_t *nbytes) {
+    if (h->meta.flags & DNA_FLAG_CODED) {
+        return NULL;
+    }
+    *nbytes = (h->num_bases + BASES_PER_BYTE - 1) / BASES_PER_BYTE;
+    return h->data;
+}
+
+int dna_handle_meta(const dna_handle_t *h, dna_meta_t *meta) {
+    *meta = h->meta;
+    return h->has_header;
+}
+
+// Decodes the whole of coded block `i` into `packed`, (num_bases + 3) / 4
+// bytes, after checking it against its CRC.
+static int decode_block_packed(const dna_handle_t *h, size_t i, uint8_t *packed) {
+    const dna_block_t *blk = &h->blocks[i];
+    const uint8_t *stored = h->map + blk->offset;
+    if (dna_crc32c(0, stored, blk->stored_bytes) != blk->crc) {
+        fprintf(stderr, "Checksum mismatch in block %zu\n", i);
+        return -1;
+    }
+    int status = -1;
+    if (blk->codec == DNA_CODEC_CM) {
+        cm_model_t *m = cm_model_new();
+        uint8_t *codes = malloc(blk->num_bases);
+        if (m && codes) {
+            cm_decompress(m, stored, blk->stored_bytes, blk->num_bases, codes);
+            pack_codes(codes, blk->num_bases, packed);
+            status = 0;
+        }
+        free(codes);
+        free(m);
+    }
+#ifdef DNA_USE_ZSTD
+    if (blk->codec == DNA_CODEC_ZSTD) {
+        size_t raw_bytes = (blk->num_bases + 3) / 4;
+        status = ZSTD_decompress(packed, raw_bytes, stored, blk->stored_bytes) == raw_bytes ? 0 : -1;
+    }
+#endif
+    if (status != 0) {
+        fprintf(stderr, "Cannot decode block %zu (codec %u)\n", i, blk->codec);
+    }
+    return status;
+}
+
+// Cache of decoded coded blocks, kept packed (a quarter of the unpacked
+// size) so a hit is one unpack. Blocks map to shards by index; each shard
+// has its own lock and a CLOCK hand over its slots. A slot is pinned while
+// it is being loaded or copied from, and readers of a block still loading
+// wait for it instead of decoding it again.
+#define CACHE_SHARDS 16
+
+enum { SLOT_EMPTY, SLOT_LOADING, SLOT_READY };
+
+typedef struct {
+    size_t block;
+    uint8_t *data;  // Allocated on first use
+    int state;
+    int ref;  // CLOCK reference bit
+    unsigned pins;
+} cache_slot_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t loaded;
+    cache_slot_t *slots;
+    size_t num_slots, hand;
+    uint64_t hits, misses, evictions;
+} cache_shard_t;
+
+struct block_cache {
+    size_t slot_bytes;
+    size_t num_shards;
+    cache_shard_t *shards;
+    int32_t *slot_of;  // Slot of each block in its shard, -1 if not cached
+};
+
+static void cache_free(struct block_cache *c) {
+    if (!c) {
+        return;
+    }
+    for (size_t s = 0; s < c->num_shards; ++s) {
+        cache_shard_t *sh = &c->shards[s];
+        for (size_t j = 0; j < sh->num_slots; ++j) {
+            free(sh->slots[j].data);
+        }
+        free(sh->slots);
+        pthread_mutex_destroy(&sh->lock);
+        pthread_cond_destroy(&sh->loaded);
+    }
+    free(c->shards);
+    free(c->slot_of);
+    free(c);
+}
+
+static size_t prefetch_pause(dna_handle_t *h);
+
+static int set_cache(dna_handle_t *h, size_t budget_bytes) {
+    cache_free(h->cache);
+    h->cache = NULL;
+    size_t slot_bytes = h->meta.block_size / BASES_PER_BYTE;
+    size_t num_slots = slot_bytes ? budget_bytes / slot_bytes : 0;
+    if (!(h->meta.flags & DNA_FLAG_CODED) || num_slots == 0) {
+        return 0;
+    }
+
+    struct block_cache *c = calloc(1, sizeof(*c));
+    if (!c) {
+        return -1;
+    }
+    c->slot_bytes = slot_bytes;
+    c->num_shards = num_slots < CACHE_SHARDS ? num_slots : CACHE_SHARDS;
+    c->shards = calloc(c->num_shards, sizeof(*c->shards));
+    c->slot_of = malloc(h->num_blocks * sizeof(*c->slot_of));
+    if (!c->shards || !c->slot_of) {
+        free(c->shards);
+        free(c->slot_of);
+        free(c);
+        return -1;
+    }
+    memset(c->slot_of, 0xff, h->num_blocks * sizeof(*c->slot_of));
+    for (size_t s = 0; s < c->num_shards; ++s) {
+        cache_shard_t *sh = &c->shards[s];
+        pthread_mutex_init(&sh->lock, NULL);
+        pthread_cond_init(&sh->loaded, NULL);
+        sh->num_slots = num_slots / c->num_shards + (s < num_slots % c->num_shards);
+        sh->slots = calloc(sh->num_slots, sizeof(*sh->slots));
+        if (!sh->slots) {
+            sh->num_slots = 0;
+            c->num_shards = s + 1;
+            cache_free(c);
+            return -1;
+        }
+    }
+    h->cache = c;
+    return 0;
+}
+
+int dna_set_cache(dna_handle_t *h, size_t budget_bytes) {
+    // The prefetch thread fills the cache, so it is stopped while the cache is replaced.
+    size_t ahead = prefetch_pause(h);
+    int status = set_cache(h, budget_bytes);
+    if (ahead) {
+        dna_prefetch(h, ahead);
+    }
+    return status;
+}
+
+void dna_cache_stats(const dna_handle_t *h, dna_cache_stats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+    struct block_cache *c = h->cache;
+    for (size_t s = 0; c && s < c->num_shards; ++s) {
+        cache_shard_t *sh = &c->shards[s];
+        pthread_mutex_lock(&sh->lock);
+        stats->hits += sh->hits;
+        stats->misses += sh->misses;
+        stats->evictions += sh->evictions;
+        stats->capacity_bytes += sh->num_slots * c->slot_bytes;
+        pthread_mutex_unlock(&sh->lock);
+    }
+}
+
+// Returns the slot holding block `i`, pinned, loading it on a miss. Returns
+// NULL with *status 0 when every slot of the shard is pinned (the caller
+// decodes without the cache), or with *status -1 if the block cannot be
+// decoded.
+static cache_slot_t *cache_get(const dna_handle_t *h, size_t i, int *status) {
+    struct block_cache *c = h->cache;
+    cache_shard_t *sh = &c->shards[i % c->num_shards];
+    pthread_mutex_lock(&sh->lock);
+    while (c->slot_of[i] >= 0) {
+        cache_slot_t *slot = &sh->slots[c->slot_of[i]];
+        if (slot->state == SLOT_READY) {
+            slot->pins++;
+            slot->ref = 1;
+            sh->hits++;
+            pthread_mutex_unlock(&sh->lock);
+            return slot;
+        }
+        pthread_cond_wait(&sh->loaded, &sh->lock);
+    }
+
+    // Two sweeps clear every reference bit, so an unpinned slot is found if there is one.
+    cache_slot_t *victim = NULL;
+    for (size_t n = 0; n < 2 * sh->num_slots && !victim; ++n) {
+        cache_slot_t *slot = &sh->slots[sh->hand];
+        sh->hand = (sh->hand + 1) % sh->num_slots;
+        if (slot->pins) {
+            continue;
+        }
+        if (slot->ref) {
+            slot->ref = 0;
+            continue;
+        }
+        victim = slot;
+    }
+    *status = 0;
+    if (!victim) {
+        pthread_mutex_unlock(&sh->lock);
+        return NULL;
+    }
+    if (victim->state == SLOT_READY) {
+        c->slot_of[victim->block] = -1;
+        sh->evictions++;
+    }
+    sh->misses++;
+    victim->block = i;
+    victim->state = SLOT_LOADING;
+    victim->pins = 1;
+    victim->ref = 1;
+    c->slot_of[i] = (int32_t)(victim - sh->slots);
+    pthread_mutex_unlock(&sh->lock);
+
+    if (!victim->data) {
+        victim->data = malloc(c->slot_bytes);
+    }
+    int loaded = victim->data && decode_block_packed(h, i, victim->data) == 0;
+
+    pthread_mutex_lock(&sh->lock);
+    if (loaded) {
+        victim->state = SLOT_READY;
+    } else {
+        c->slot_of[i] = -1;
+        victim->state = SLOT_EMPTY;
+        victim->pins = 0;
+        *status = -1;
+    }
+    pthread_cond_broadcast(&sh->loaded);
+    pthread_mutex_unlock(&sh->lock);
+    return loaded ? victim : NULL;
+}
+
+static void cache_release(const dna_handle_t *h, cache_slot_t *slot) {
+    cache_shard_t *sh = &h->cache->shards[slot->block % h->cache->num_shards];
+    pthread_mutex_lock(&sh->lock);
+    slot->pins--;
+    pthread_mutex_unlock(&sh->lock);
+}
+
+// Decodes bases [from, to) of block `i` into `out`. Coded blocks are checked
+// against their CRC first, as a damaged block would decode to garbage, and
+// go through the block cache when the handle has one.
+static int decode_block_range(const dna_handle_t *h, size_t i, size_t from, size_t to, uint8_t *out) {
+    const dna_block_t *blk = &h->blocks[i];
+    const uint8_t *stored = h->map + blk->offset;
+    if (blk->codec == DNA_CODEC_RAW) {
+        dna_unpack(stored, from, to - from, out);
+        return 0;
+    }
+    if (h->cache) {
+        int status;
+        cache_slot_t *slot = cache_get(h, i, &status);
+        if (slot) {
+            dna_unpack(slot->data, from, to - from, out);
+            cache_release(h, slot);
+            return 0;
+        }
+        if (status != 0) {
+            return -1;
+        }
+    }
+    if (dna_crc32c(0, stored, blk->stored_bytes) != blk->crc) {
+        fprintf(stderr, "Checksum mismatch in block %zu\n", i);
+        return -1;
+    }
+    int status = -1;
+    if (blk->codec == DNA_CODEC_CM) {
+        cm_model_t *m = cm_model_new();
+        uint8_t *codes = from ? malloc(to) : out;
+        if (m && codes) {
+            cm_decompress(m, stored, blk->stored_bytes, to, codes);
+            if (from) {
+                memcpy(out, codes + from, to - from);
+            }
+            status = 0;
+        }
+        if (from) {
+            free(codes);
+        }
+        free(m);
+    }
+#ifdef DNA_USE_ZSTD
+    if (blk->codec == DNA_CODEC_ZSTD) {
+        size_t raw_bytes = (blk->num_bases + 3) / 4;
+        uint8_t *raw = malloc(raw_bytes);
+        if (raw && ZSTD_decompress(raw, raw_bytes, stored, blk->stored_bytes) == raw_bytes) {
+            dna_unpack(raw, from, to - from, out);
+            status = 0;
+        }
+        free(raw);
+    }
+#endif
+    if (status != 0) {
+        fprintf(stderr, "Cannot decode block %zu (codec %u)\n", i, blk->codec);
+    }
+    return status;
+}
+
+// Read-ahead. Readers note each range they read; a thread then brings the
+// bases the access pattern predicts next into memory: the next `ahead`
+// units past the end of the last read for sequential scans, or the next
+// `ahead` windows one stride apart for strided ones. Mapped pages are
+// touched, coded blocks are decoded into the block cache. A unit is a block
+// of blocked files and DNA_DEFAULT_BLOCK_SIZE bases otherwise.
+struct prefetcher {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    atomic_int stop;
+    const dna_handle_t *h;
+    size_t ahead;
+    uint64_t unit;
+    uint64_t start, len, stride;  // Last noted read, and its distance from the one before
+    uint64_t noted, handled;      // Count of notes, and the last one acted upon
+    uint64_t done_until;          // Sequential: bases up to here are already fetched
+};
+
+// Faults in the pages of `n` mapped bytes: MADV_WILLNEED starts the reads
+// asynchronously, and loading a byte per page waits for them.
+static void touch_bytes(const uint8_t *p, size_t n) {
+    if (n == 0) {
+        return;
+    }
+    size_t page_size = (size_t)sysconf(_SC_PAGESIZE);  // 16 or 64 KiB on some aarch64 and ppc64 kernels
+    uintptr_t page = (uintptr_t)p & ~(uintptr_t)(page_size - 1);
+    madvise((void *)page, (uintptr_t)(p + n) - page, MADV_WILLNEED);
+    volatile uint8_t sink;
+    for (size_t off = 0; off < n; off += page_size) {
+        sink = p[off];
+    }
+    sink = p[n - 1];
+    (void)sink;
+}
+
+static void prefetch_range(const dna_handle_t *h, uint64_t from, uint64_t to) {
+    if (!h->blocks) {
+        touch_bytes(h->data + from / BASES_PER_BYTE, (to + 3) / BASES_PER_BYTE - from / BASES_PER_BYTE);
+        return;
+    }
+    uint64_t block_size = h->meta.block_size;
+    for (size_t i = from / block_size; i * block_size < to && i < h->num_blocks; ++i) {
+        const dna_block_t *blk = &h->blocks[i];
+        if (blk->codec != DNA_CODEC_RAW && h->cache) {
+            int status;
+            cache_slot_t *slot = cache_get(h, i, &status);
+            if (slot) {
+                cache_release(h, slot);
+            }
+        } else if (blk->codec != DNA_CODEC_RAW) {
+            touch_bytes(h->map + blk->offset, blk->stored_bytes);
+        } else {
+            // Only the part of a raw block that was asked for
+            uint64_t a = from > i * block_size ? from - i * block_size : 0;
+            uint64_t b = to - i * block_size < blk->num_bases ? to - i * block_size : blk->num_bases;
+            touch_bytes(h->map + blk->offset + a / BASES_PER_BYTE, (b + 3) / BASES_PER_BYTE - a / BASES_PER_BYTE);
+        }
+    }
+}
+
+static void *prefetch_main(void *arg) {
+    struct prefetcher *pf = arg;
+    const dna_handle_t *h = pf->h;
+    pthread_mutex_lock(&pf->lock);
+    while (!atomic_load(&pf->stop)) {
+        if (pf->noted == pf->handled) {
+            pthread_cond_wait(&pf->wake, &pf->lock);
+            continue;
+        }
+        pf->handled = pf->noted;
+        uint64_t start = pf->start, len = pf->len, stride = pf->stride;
+        pthread_mutex_unlock(&pf->lock);
+
+        if (atomic_load(&h->advice) == DNA_ADVICE_SEQUENTIAL) {
+            uint64_t end = start + len, limit = end + pf->ahead * pf->unit;
+            if (pf->done_until < end || pf->done_until > limit) {
+                pf->done_until = end;  // First read, or a seek
+            }
+            limit = limit < h->num_bases ? limit : h->num_bases;
+            // One unit at a time, so a stop or a seek is noticed quickly
+            while (pf->done_until < limit && !atomic_load(&pf->stop)) {
+                uint64_t to = pf->done_until + pf->unit < limit ? pf->done_until + pf->unit : limit;
+                prefetch_range(h, pf->done_until, to);
+                pf->done_until = to;
+            }
+        } else if (stride > 0) {
+            for (size_t k = 1; k <= pf->ahead && !atomic_load(&pf->stop); ++k) {
+                uint64_t s = start + k * stride;
+                if (s >= h->num_bases) {
+                    break;
+                }
+                prefetch_range(h, s, s + len < h->num_bases ? s + len : h->num_bases);
+            }
+        }
+        pthread_mutex_lock(&pf->lock);
+    }
+    pthread_mutex_unlock(&pf->lock);
+    return NULL;
+}
+
+static void prefetch_note(const dna_handle_t *h, uint64_t start, uint64_t len) {
+    struct prefetcher *pf = h->prefetch;
+    int advice = atomic_load(&h->advice);
+    if (!pf || (advice != DNA_ADVICE_SEQUENTIAL && advice != DNA_ADVICE_STRIDED)) {
+        return;
+    }
+    pthread_mutex_lock(&pf->lock);
+    pf->stride = start > pf->start ? start - pf->start : 0;
+    pf->start = start;
+    pf->len = len;
+    pf->noted++;
+    pthread_cond_signal(&pf->wake);
+    pthread_mutex_unlock(&pf->lock);
+}
+
+static void prefetch_stop(dna_handle_t *h) {
+    struct prefetcher *pf = h->prefetch;
+    if (!pf) {
+        return;
+    }
+    pthread_mutex_lock(&pf->lock);
+    atomic_store(&pf->stop, 1);
+    pthread_cond_signal(&pf->wake);
+    pthread_mutex_unlock(&pf->lock);
+    pthread_join(pf->thread, NULL);
+    pthread_mutex_destroy(&pf->lock);
+    pthread_cond_destroy(&pf->wake);
+    free(pf);
+    h->prefetch = NULL;
+}
+
+// Stops the prefetch thread, returning its `ahead` (0 if none ran).
+static size_t prefetch_pause(dna_handle_t *h) {
+    size_t ahead = h->prefetch ? h->prefetch->ahead : 0;
+    prefetch_stop(h);
+    return ahead;
+}
+
+int dna_prefetch(dna_handle_t *h, size_t ahead) {
+    prefetch_stop(h);
+    if (ahead == 0) {
+        return 0;
+    }
+    struct prefetcher *pf = calloc(1, sizeof(*pf));
+    if (!pf) {
+        return -1;
+    }
+    pf->h = h;
+    pf->ahead = ahead;
+    pf->unit = h->blocks ? h->meta.block_size : DNA_DEFAULT_BLOCK_SIZE;
+    pthread_mutex_init(&pf->lock, NULL);
+    pthread_cond_init(&pf->wake, NULL);
+    if (pthread_create(&pf->thread, NULL, prefetch_main, pf) != 0) {
+        perror("Failed to start prefetch thread");
+        pthread_mutex_destroy(&pf->lock);
+        pthread_cond_destroy(&pf->wake);
+        free(pf);
+        return -1;
+    }
+    h->prefetch = pf;
+    return 0;
+}
+
+int dna_advise(dna_handle_t *h, int advice) {
+    int madv, fadv;
+    switch (advice) {
+    case DNA_ADVICE_NORMAL:
+        madv = MADV_NORMAL, fadv = POSIX_FADV_NORMAL;
+        break;
+    case DNA_ADVICE_SEQUENTIAL:
+        madv = MADV_SEQUENTIAL, fadv = POSIX_FADV_SEQUENTIAL;
+        break;
+    case DNA_ADVICE_RANDOM:
+    case DNA_ADVICE_STRIDED:
+        // Kernel read-ahead would fetch the gaps; the prefetch thread fetches the windows.
+        madv = MADV_RANDOM, fadv = POSIX_FADV_RANDOM;
+        break;
+    default:
+        return -1;
+    }
+    // Archive samples start on an IO_ALIGN boundary, which need not be a page.
+    size_t lead = (uintptr_t)h->map % (uintptr_t)sysconf(_SC_PAGESIZE);
+    if (h->map && madvise(h->map - lead, h->map_bytes + lead, madv) != 0) {
+        perror("madvise");
+        return -1;
+    }
+    if (h->fd >= 0) {
+        posix_fadvise(h->fd, 0, 0, fadv);  // Advisory only; some filesystems ignore it
+    }
+    atomic_store(&h->advice, advice);
+    return 0;
+}
+
+int dna_read_range(const dna_handle_t *h, size_t start, size_t len, uint8_t *out) {
+    if (start > h->num_bases || len > h->num_bases - start) {
+        return -1;
+    }
+    prefetch_note(h, start, len);
+    if (!(h->meta.flags & DNA_FLAG_CODED)) {
+        dna_unpack(h->data, start, len, out);
+        return 0;
+    }
+    size_t block_size = h->meta.block_size;
+    for (size_t pos = start; pos < start + len;) {
+        size_t i = pos / block_size;
+        size_t from = pos - i * block_size;
+        size_t to = start + len - i * block_size < h->blocks[i].num_bases ? start + len - i * block_size
+                                                                          : h->blocks[i].num_bases;
+        if (decode_block_range(h, i, from, to, out + (pos - start)) != 0) {
+            return -1;
+        }
+        pos = i * block_size + to;
+    }
+    return 0;
+}
+
+// First N run ending after `start`; runs are sorted and disjoint, so their
+// ends are sorted too.
+static size_t first_n_run(const dna_handle_t *h, size_t start) {
+    size_t lo = 0, hi = h->num_n_runs;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (h->n_runs[mid].start + h->n_runs[mid].length <= start) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+int dna_read_range_n(const dna_handle_t *h, size_t start, size_t len, uint8_t *out, uint8_t n_code) {
+    if (dna_read_range(h, start, len, out) != 0) {
+        return -1;
+    }
+    for (size_t i = first_n_run(h, start); i < h->num_n_runs && h->n_runs[i].start < start + len; ++i) {
+        uint64_t a = h->n_runs[i].start > start ? h->n_runs[i].start : start;
+        uint64_t b = h->n_runs[i].start + h->n_runs[i].length;
+        if (b > start + len) {
+            b = start + len;
+        }
+        memset(out + (a - start), n_code, (size_t)(b - a));
+    }
+    return 0;
+}
+
+// Window gather, windows split into tasks of about GATHER_TASK_BASES bases.
+// One-hot rows are expanded from a small buffer of codes per window chunk.
+#define GATHER_TASK_BASES (256u << 10)
+#define GATHER_STAGE 4096
+
+static const int8_t onehot_i8[4][4] = {{1, 0, 0, 0}, {0, 1, 0, 0}, {0, 0, 1, 0}, {0, 0, 0, 1}};
+static const uint16_t onehot_f16[4][4] = {  // IEEE binary16 1.0 is 0x3C00
+    {0x3C00, 0, 0, 0}, {0, 0x3C00, 0, 0}, {0, 0, 0x3C00, 0}, {0, 0, 0, 0x3C00}};
+
+typedef struct {
+    const dna_handle_t *h;
+    const uint64_t *starts;
+    size_t count, len, per_task;
+    int format;
+    void *out;
+    atomic_int failed;
+} gather_job_t;
+
+static int gather_window(const gather_job_t *job, uint64_t start, void *dst) {
+    const dna_handle_t *h = job->h;
+    size_t len = job->len;
+    if (job->format == DNA_GATHER_CODES) {
+        return dna_read_range(h, start, len, dst);
+    }
+
+    int f16 = job->format == DNA_GATHER_ONEHOT_F16;
+    size_t row = f16 ? sizeof(onehot_f16[0]) : sizeof(onehot_i8[0]);
+    uint8_t codes[GATHER_STAGE];
+    uint8_t *rows = dst;
+    for (size_t pos = 0; pos < len; pos += GATHER_STAGE) {
+        size_t n = len - pos < GATHER_STAGE ? len - pos : GATHER_STAGE;
+        if (dna_read_range(h, start + pos, n, codes) != 0) {
+            return -1;
+        }
+        // Separate loops so each row copy is a single fixed-size store
+        uint8_t *p = rows + pos * row;
+        if (f16) {
+            for (size_t j = 0; j < n; ++j) {
+                memcpy(p + j * sizeof(onehot_f16[0]), onehot_f16[codes[j]], sizeof(onehot_f16[0]));
+            }
+        } else {
+            for (size_t j = 0; j < n; ++j) {
+                memcpy(p + j * sizeof(onehot_i8[0]), onehot_i8[codes[j]], sizeof(onehot_i8[0]));
+            }
+        }
+    }
+
+    // N positions get an all-zero row
+    for (size_t i = first_n_run(h, start); i < h->num_n_runs && h->n_runs[i].start < start + len; ++i) {
+        uint64_t a = h->n_runs[i].start > start ? h->n_runs[i].start : start;
+        uint64_t b = h->n_runs[i].start + h->n_runs[i].length;
+        if (b > start + len) {
+            b = start + len;
+        }
+        memset(rows + (a - start) * row, 0, (size_t)(b - a) * row);
+    }
+    return 0;
+}
+
+static void gather_task(void *arg, size_t task) {
+    gather_job_t *job = arg;
+    size_t first = task * job->per_task;
+    size_t last = first + job->per_task < job->count ? first + job->per_task : job->count;
+    size_t stride = job->len * (job->format == DNA_GATHER_CODES       ? 1
+                                : job->format == DNA_GATHER_ONEHOT_I8 ? sizeof(onehot_i8[0])
+                                                                      : sizeof(onehot_f16[0]));
+    for (size_t w = first; w < last && !atomic_load(&job->failed); ++w) {
+        if (gather_window(job, job->starts[w], (uint8_t *)job->out + w * stride) != 0) {
+            atomic_store(&job->failed, 1);
+        }
+    }
+}
+
+int dna_gather_windows(const dna_handle_t *h, const uint64_t *starts, size_t count, size_t len, int format,
+                       void *out) {
+    if (format != DNA_GATHER_CODES && format != DNA_GATHER_ONEHOT_I8 && format != DNA_GATHER_ONEHOT_F16) {
+        return -1;
+    }
+    for (size_t w = 0; w < count; ++w) {
+        if (starts[w] > h->num_bases || len > h->num_bases - starts[w]) {
+            return -1;
+        }
+    }
+    if (count == 0 || len == 0) {
+        return 0;
+    }
+
+    gather_job_t job = {h, starts, count, len, 0, format, out, 0};
+    job.per_task = len < GATHER_TASK_BASES ? GATHER_TASK_BASES / len : 1;
+    size_t num_tasks = (count + job.per_task - 1) / job.per_task;
+    if (count * len < PARALLEL_MIN_BASES / 4) {
+        // Too little work to pay for starting threads
+        job.per_task = count;
+        num_tasks = 1;
+    }
+    parallel_for(num_tasks, gather_task, &job);
+    return atomic_load(&job.failed) ? -1 : 0;
+}
+
+int dna_read_extent(const dna_handle_t *h, size_t i, uint64_t *start, uint64_t *length) {
+    if (h->read_offsets) {
+        if (i + 1 >= h->num_offsets) {
+            return -1;
+        }
+        *start = read_offset(h, i);
+        *length = read_offset(h, i + 1) - *start;
+        return 0;
+    }
+    uint64_t read_length = h->meta.read_length;
+    if (!h->has_header || read_length == 0 || i >= h->meta.num_bases / read_length) {
+        return -1;
+    }
+    *start = i * read_length;
+    *length = read_length;
+    return 0;
+}
+
+long dna_read_canonical_kmers(const dna_handle_t *h, size_t i, unsigned k, uint64_t *out, size_t cap) {
+    uint64_t start, len;
+    if (k == 0 || k > 32 || dna_read_extent(h, i, &start, &len) != 0) {
+        return -1;
+    }
+    size_t count = len >= k ? len - k + 1 : 0;
+    if (count == 0 || count > cap) {
+        return (long)count;
+    }
+    if (!(h->meta.flags & DNA_FLAG_CODED)) {
+        dna_canonical_kmers(h->data, start, len, k, out);
+        return (long)count;
+    }
+    // Coded blocks are decoded and repacked first.
+    uint8_t *codes = malloc(len + (len + 3) / BASES_PER_BYTE);
+    if (!codes) {
+        return -1;
+    }
+    uint8_t *packed = codes + len;
+    long status = -1;
+    if (dna_read_range(h, start, len, codes) == 0) {
+        pack_kernel(codes, len, packed);
+        dna_canonical_kmers(packed, 0, len, k, out);
+        status = (long)count;
+    }
+    free(codes);
+    return status;
+}
+
+// Counts stored codes, 'N' included as A. Coded blocks are decoded in
+// pieces of at most a block.
+static int count_stored(const dna_handle_t *h, size_t start, size_t len, uint64_t counts[4]) {
+    if (!(h->meta.flags & DNA_FLAG_CODED)) {
+        count_packed(h->data, start, len, counts);
+        return 0;
+    }
+    size_t piece = len < h->meta.block_size ? len : h->meta.block_size;
+    uint8_t *codes = malloc(piece ? piece : 1);
+    if (!codes) {
+        return -1;
+    }
+    int status = 0;
+    for (size_t pos = start; pos < start + len && status == 0; pos += piece) {
+        size_t n = start + len - pos < piece ? start + len - pos : piece;
+        status = dna_read_range(h, pos, n, codes);
+        for (size_t i = 0; i < n && status == 0; ++i) {
+            counts[codes[i]]++;
+        }
+    }
+    free(codes);
+    return status;
+}
+
+int dna_count_bases(const dna_handle_t *h, size_t start, size_t len, uint64_t counts[4]) {
+    if (start > h->num_bases || len > h->num_bases - start) {
+        return -1;
+    }
+    memset(counts, 0, 4 * sizeof(*counts));
+    size_t pos = start, end = start + len;
+    if (h->block_stats) {
+        // Blocks lying wholly inside the range come from the stats section.
+        size_t block_size = h->meta.block_size;
+        size_t first = (start + block_size - 1) / block_size, last = end / block_size;
+        if (first < last) {
+            if (count_stored(h, start, first * block_size - start, counts) != 0) {
+                return -1;
+            }
+            for (size_t i = first; i < last; ++i) {
+                for (int c = 0; c < 4; ++c) {
+                    counts[c] += get_le32(h->block_stats + i * BLOCK_STATS_ENTRY_SIZE + 4 * c);
+                }
+            }
+            pos = last * block_size;
+        }
+    }
+    if (count_stored(h, pos, end - pos, counts) != 0) {
+        return -1;
+    }
+    for (size_t i = first_n_run(h, start); i < h->num_n_runs && h->n_runs[i].start < end; ++i) {
+        uint64_t a = h->n_runs[i].start > start ? h->n_runs[i].start : start;
+        uint64_t b = h->n_runs[i].start + h->n_runs[i].length;
+        counts[0] -= (b < end ? b : end) - a;
+    }
+    return 0;
+}
+
+static float gc_fraction(const uint64_t counts[4]) {
+    uint64_t called = counts[0] + counts[1] + counts[2] + counts[3];
+    return called ? (float)(counts[1] + counts[2]) / (float)called : 0.0f;
+}
+
+long dna_gc_windows(const dna_handle_t *h, size_t start, size_t len, size_t window, float *out) {
+    if (window == 0 || start > h->num_bases || len > h->num_bases - start) {
+        return -1;
+    }
+    long n = 0;
+    for (size_t pos = start; pos < start + len; pos += window, ++n) {
+        uint64_t counts[4];
+        size_t w = start + len - pos < window ? start + len - pos : window;
+        if (dna_count_bases(h, pos, w, counts) != 0) {
+            return -1;
+        }
+        out[n] = gc_fraction(counts);
+    }
+    return n;
+}
+
+int dna_read_gc(const dna_handle_t *h, size_t first, size_t count, float *out) {
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t start, len, counts[4];
+        if (dna_read_extent(h, first + i, &start, &len) != 0 || dna_count_bases(h, start, len, counts) != 0) {
+            return -1;
+        }
+        out[i] = gc_fraction(counts);
+    }
+    return 0;
+}
+
+// Pattern search, one task per SEARCH_CHUNK candidate starts. Each task
+// keeps its own hit list; the lists are concatenated in task order.
+#define SEARCH_CHUNK DNA_DEFAULT_BLOCK_SIZE
+
+typedef struct {
+    const dna_handle_t *h;
+    search_pattern_t pat;
+    uint64_t first, last;  // Candidate starts
+    hit_list_t *lists;
+} search_job_t;
+
+static void search_task(void *arg, size_t task) {
+    search_job_t *job = arg;
+    const dna_handle_t *h = job->h;
+    hit_list_t *hits = &job->lists[task];
+    uint64_t c0 = job->first + (uint64_t)task * SEARCH_CHUNK;
+    uint64_t c1 = job->last - c0 < SEARCH_CHUNK ? job->last : c0 + SEARCH_CHUNK;
+    if (!(h->meta.flags & DNA_FLAG_CODED)) {
+        search_kernel(h->data, (h->num_bases + 3) / BASES_PER_BYTE, c0, c1, &job->pat, 0, hits);
+    } else {
+        // Decode the chunk and the bases its last candidates reach into, then repack.
+        size_t n = (size_t)(c1 - c0) + job->pat.m - 1;
+        uint8_t *codes = malloc(n + (n + 3) / BASES_PER_BYTE);
+        if (!codes || dna_read_range(h, c0, n, codes) != 0) {
+            free(codes);
+            hits->failed = 1;
+            return;
+        }
+        uint8_t *packed = codes + n;
+        pack_kernel(codes, n, packed);
+        search_kernel(packed, (n + 3) / BASES_PER_BYTE, 0, c1 - c0, &job->pat, c0, hits);
+        free(codes);
+    }
+    // Drop matches that overlap an N run.
+    size_t kept = 0;
+    for (size_t i = 0; i < hits->count; ++i) {
+        uint64_t p = hits->pos[i];
+        size_t r = first_n_run(h, p);
+        if (r == h->num_n_runs || h->n_runs[r].start >= p + job->pat.m) {
+            hits->pos[kept++] = p;
+        }
+    }
+    hits->count = kept;
+}
+
+long dna_search(const dna_handle_t *h, size_t start, size_t len, const uint8_t *pattern, unsigned m,
+                unsigned max_mismatches, uint64_t *hits, size_t max_hits) {
+    if (m == 0 || m > 32 || start > h->num_bases || len > h->num_bases - start) {
+        return -1;
+    }
+    if (len < m) {
+        return 0;
+    }
+    search_job_t job = {.h = h, .first = start, .last = start + len - m + 1};
+    job.pat.m = m;
+    job.pat.max_mismatches = max_mismatches;
+    for (unsigned i = 0; i < m; ++i) {
+        job.pat.word |= (uint64_t)(pattern[i] & 0x03) << (62 - 2 * i);
+        job.pat.mask |= 1ULL << (63 - 2 * i);
+    }
+    size_t num_tasks = (size_t)((job.last - job.first + SEARCH_CHUNK - 1) / SEARCH_CHUNK);
+    job.lists = calloc(num_tasks, sizeof(*job.lists));
+    if (!job.lists) {
+        return -1;
+    }
+    parallel_for(num_tasks, search_task, &job);
+    long total = 0;
+    for (size_t t = 0; t < num_tasks; ++t) {
+        if (job.lists[t].failed) {
+            total = -1;
+        }
+        if (total >= 0) {
+            for (size_t i = 0; i < job.lists[t].count; ++i, ++total) {
+                if ((size_t)total < max_hits) {
+                    hits[total] = job.lists[t].pos[i];
+                }
+            }
+        }
+        free(job.lists[t].pos);
+    }
+    free(job.lists);
+    return total;
+}
+
+int dna_read_quals(const dna_handle_t *h, size_t start, size_t len, char *out) {
+    if (!h->quals || start > h->num_bases || len > h->num_bases - start) {
+        return -1;
+    }
+    if (h->qual_bits == 2) {
+        // Same layout as the bases: decode the bins in place, then map them.
+        dna_unpack(h->quals, start, len, (uint8_t *)out);
+        for (size_t i = 0; i < len; ++i) {
+            out[i] = (char)(h->qual_table[(uint8_t)out[i]] + 33);
+        }
+        return 0;
+    }
+    for (size_t i = 0; i < len; ++i) {
+        uint8_t byte = h->quals[(start + i) / 2];
+        out[i] = (char)(h->qual_table[(start + i) % 2 ? byte & 0x0f : byte >> 4] + 33);
+    }
+    return 0;
+}
+
+long dna_read_name(const dna_handle_t *h, size_t i, char *buf, size_t cap) {
+    if (!h->names || i >= h->num_names) {
+        return -1;
+    }
+    size_t group = i / DNA_NAME_GROUP;
+    const uint8_t *p = h->names + get_le64(h->name_index + group * 8);
+    const uint8_t *end = h->names + h->names_bytes;
+    name_coder_t prev, cur;
+    memset(&prev, 0, sizeof(prev));
+    memset(&cur, 0, sizeof(cur));
+    char *text = NULL;
+    size_t text_cap = 0;
+    long result = -1;
+
+    for (size_t r = group * DNA_NAME_GROUP; r <= i; ++r) {
+        uint64_t num_tokens;
+        size_t len = 0;
+        if (get_varint(&p, end, &num_tokens) != 0) {
+            goto done;
+        }
+        for (uint64_t t = 0; t < num_tokens;) {
+            if (p == end) {
+                goto done;
+            }
+            uint8_t op = *p++;
+            const char *src = NULL;
+            size_t src_len = 0, count = 1;
+            char digits[24];
+            if ((op & 0xc0) == NAME_OP_MATCH) {
+                count = op & NAME_MAX_MATCH;
+                if (count == 0 || t + count > num_tokens || t + count > prev.num_tokens) {
+                    goto done;
+                }
+                src = prev.text + prev.tokens[t].start;
+                const name_token_t *last = &prev.tokens[t + count - 1];
+                src_len = last->start + last->len - prev.tokens[t].start;
+            } else if (op == NAME_OP_DELTA) {
+                uint64_t zz;
+                if (get_varint(&p, end, &zz) != 0 || t >= prev.num_tokens || !prev.tokens[t].numeric) {
+                    goto done;
+                }
+                uint64_t value = prev.tokens[t].value + ((zz >> 1) ^ (0 - (zz & 1)));
+                src_len = (size_t)snprintf(digits, sizeof(digits), "%llu", (unsigned long long)value);
+                src = digits;
+            } else if (op == NAME_OP_LITERAL) {
+                uint64_t n;
+                if (get_varint(&p, end, &n) != 0 || n > (uint64_t)(end - p)) {
+                    goto done;
+                }
+                src = (const char *)p;
+                src_len = (size_t)n;
+                p += n;
+            } else {
+                goto done;
+            }
+            if (len + src_len + 1 > text_cap) {
+                size_t new_cap = 2 * (len + src_len + 1);
+                char *grown = realloc(text, new_cap);
+                if (!grown) {
+                    goto done;
+                }
+                text = grown;
+                text_cap = new_cap;
+            }
+            memcpy(text + len, src, src_len);
+            len += src_len;
+            t += count;
+        }
+        if (name_tokenize(&cur, text ? text : "", len) != 0 || cur.num_tokens != num_tokens) {
+            goto done;
+        }
+        name_coder_t swap = prev;
+        prev = cur;
+        cur = swap;
+        if (r == i) {
+            if (cap > 0) {
+                size_t n = len < cap - 1 ? len : cap - 1;
+                memcpy(buf, prev.text, n);
+                buf[n] = '\0';
+            }
+            result = (long)len;
+        }
+    }
+done:
+    free(text);
+    name_coder_free(&prev);
+    name_coder_free(&cur);
+    return result;
+}
+
+const dna_n_run_t *dna_n_runs(const dna_handle_t *h, size_t *count) {
+    *count = h->num_n_runs;
+    return h->n_runs;
+}
+
+size_t dna_num_blocks(const dna_handle_t *h) {
+    return h->num_blocks;
+}
+
+int dna_block_info(const dna_handle_t *h, size_t i, dna_block_t *blk) {
+    if (i >= h->num_blocks) {
+        return -1;
+    }
+    *blk = h->blocks[i];
+    return 0;
+}
+
+int dna_verify_block(const dna_handle_t *h, size_t i) {
+    if (i >= h->num_blocks) {
+        return -1;
+    }
+    const dna_block_t *blk = &h->blocks[i];
+    return dna_crc32c(0, h->map + blk->offset, blk->stored_bytes) == blk->crc ? 0 : -1;
+}
+
+long dna_verify_range(const dna_handle_t *h, size_t start, size_t len) {
+    if (start > h->num_bases || len > h->num_bases - start) {
+        return -1;
+    }
+    if (!h->has_header) {
+        return 0;
+    }
+    if (!h->num_blocks) {
+        size_t nbytes = (h->num_bases + 3) / 4;
+        return dna_crc32c(0, h->data, nbytes) == h->meta.checksum ? 0 : 1;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    long bad = 0;
+    for (size_t i = start / h->meta.block_size; i <= (start + len - 1) / h->meta.block_size; ++i) {
+        bad += dna_verify_block(h, i) != 0;
+    }
+    return bad;
+}
+
+// K-mer iterator. Bases are rolled in from the packed bytes of one segment
+// at a time: the rest of the current read up to the next N run and, for
+// coded files, the end of the block held repacked in `window`.
+struct dna_kmer_iter {
+    const dna_handle_t *h;
+    unsigned k;
+    uint64_t step;
+    int canonical;
+    uint64_t mask;
+    int by_read;            // Reads are recorded, k-mers stay inside them
+    size_t read;            // Current read
+    uint64_t read_end;
+    uint64_t pos;           // Next base to roll in
+    uint64_t valid;         // Bases rolled in since the last restart
+    uint64_t next_start;    // Start of the next k-mer to emit
+    uint64_t fwd, rev;
+    size_t n_run;           // First N run that may still lie ahead
+    uint8_t *codes;         // Coded files: one decoded block,
+    uint8_t *window;        // and the same block packed
+    uint64_t window_start, window_end;
+    uint64_t range_first, range_end;  // Reads, or k-mer starts for files without reads
+};
+
+// Moves to the start of read `i`, or of the whole array for files without
+// reads. Returns 0 past the last read.
+static int kmer_iter_seek_read(dna_kmer_iter_t *it, size_t i) {
+    uint64_t start, len;
+    if (it->by_read) {
+        if (i >= it->range_end || dna_read_extent(it->h, i, &start, &len) != 0) {
+            return 0;
+        }
+    } else {
+        if (i > 0) {
+            return 0;
+        }
+        // The last k-mer starts before range_end; `step` counts from base 0.
+        uint64_t end = it->range_end + it->k - 1;
+        start = it->range_first;
+        len = (end < it->h->num_bases ? end : it->h->num_bases) - start;
+        it->next_start = start + (it->step - start % it->step) % it->step;
+    }
+    it->read = i;
+    it->pos = start;
+    it->read_end = start + len;
+    if (it->by_read) {
+        it->next_start = start;
+    }
+    it->valid = 0;
+    return 1;
+}
+
+static uint64_t kmer_iter_units(const dna_kmer_iter_t *it) {
+    const dna_handle_t *h = it->h;
+    if (!it->by_read) {
+        return h->num_bases;
+    }
+    return h->read_offsets ? h->num_offsets - 1 : h->meta.num_bases / h->meta.read_length;
+}
+
+dna_kmer_iter_t *dna_kmer_iter_open(const dna_handle_t *h, unsigned k, size_t step) {
+    if (k == 0 || k > 32 || step == 0) {
+        return NULL;
+    }
+    dna_kmer_iter_t *it = calloc(1, sizeof(*it));
+    if (!it) {
+        return NULL;
+    }
+    it->h = h;
+    it->k = k;
+    it->step = step;
+    it->mask = k == 32 ? ~0ULL : (1ULL << (2 * k)) - 1;
+    uint64_t start, len;
+    it->by_read = h->num_bases > 0 && dna_read_extent(h, 0, &start, &len) == 0;
+    it->range_end = kmer_iter_units(it);
+    if (h->meta.flags & DNA_FLAG_CODED) {
+        size_t block_size = h->meta.block_size;
+        it->codes = malloc(block_size);
+        it->window = malloc(block_size / BASES_PER_BYTE);
+        if (!it->codes || !it->window) {
+            dna_kmer_iter_close(it);
+            return NULL;
+        }
+    }
+    if (!kmer_iter_seek_read(it, 0)) {
+        it->pos = it->read_end = 0;  // empty file
+    }
+    return it;
+}
+
+void dna_kmer_iter_canonical(dna_kmer_iter_t *it, int enable) {
+    it->canonical = enable != 0;
+}
+
+int dna_kmer_iter_part(dna_kmer_iter_t *it, size_t part, size_t parts) {
+    if (part >= parts) {
+        return -1;
+    }
+    uint64_t units = kmer_iter_units(it);
+    it->range_first = units / parts * part + units % parts * part / parts;
+    it->range_end = units / parts * (part + 1) + units % parts * (part + 1) / parts;
+    it->n_run = 0;
+    if (!kmer_iter_seek_read(it, it->by_read ? (size_t)it->range_first : 0)) {
+        it->read = (size_t)it->range_end;  // Nothing in this part
+        it->pos = it->read_end = 0;
+    }
+    return 0;
+}
+
+// Decodes and repacks the block holding base `pos`.
+static int kmer_iter_load_block(dna_kmer_iter_t *it, uint64_t pos) {
+    size_t i = pos / it->h->meta.block_size;
+    uint64_t start = (uint64_t)i * it->h->meta.block_size;
+    size_t n = it->h->blocks[i].num_bases;
+    if (dna_read_range(it->h, start, n, it->codes) != 0) {
+        return -1;
+    }
+    pack_kernel(it->codes, n, it->window);
+    it->window_start = start;
+    it->window_end = start + n;
+    return 0;
+}
+
+size_t dna_kmer_iter_next(dna_kmer_iter_t *it, uint64_t *out, uint64_t *starts, size_t max) {
+    const dna_handle_t *h = it->h;
+    const unsigned k = it->k, top = 2 * (k - 1);
+    size_t got = 0;
+    prefetch_note(h, it->pos, 0);
+    while (got < max) {
+        if (it->pos >= it->read_end) {
+            if (!kmer_iter_seek_read(it, it->read + 1)) {
+                break;
+            }
+            continue;
+        }
+        // Skip past N runs: k-mers never span one.
+        uint64_t seg_end = it->read_end;
+        while (it->n_run < h->num_n_runs && h->n_runs[it->n_run].start + h->n_runs[it->n_run].length <= it->pos) {
+            ++it->n_run;
+        }
+        if (it->n_run < h->num_n_runs) {
+            const dna_n_run_t *run = &h->n_runs[it->n_run];
+            if (run->start <= it->pos) {
+                it->pos = run->start + run->length;
+                it->valid = 0;
+                if (it->next_start < it->pos) {
+                    it->next_start += (it->pos - it->next_start + it->step - 1) / it->step * it->step;
+                }
+                continue;
+            }
+            if (run->start < seg_end) {
+                seg_end = run->start;
+            }
+        }
+        const uint8_t *src = h->data;
+        uint64_t base = 0;
+        if (it->window) {
+            if (it->pos < it->window_start || it->pos >= it->window_end) {
+                if (kmer_iter_load_block(it, it->pos) != 0) {
+                    break;
+                }
+            }
+            if (seg_end > it->window_end) {
+                seg_end = it->window_end;
+            }
+            src = it->window;
+            base = it->window_start;
+        }
+        uint64_t pos = it->pos, valid = it->valid, next_start = it->next_start;
+        uint64_t fwd = it->fwd, rev = it->rev;
+        for (; pos < seg_end && got < max; ++pos) {
+            uint64_t b = pos - base;
+            uint64_t code = (src[b / BASES_PER_BYTE] >> (6 - 2 * (b % BASES_PER_BYTE))) & 0x03;
+            fwd = ((fwd << 2) | code) & it->mask;
+            rev = (rev >> 2) | ((code ^ 3) << top);
+            if (++valid >= k && pos + 1 - k == next_start) {
+                out[got] = it->canonical && rev < fwd ? rev : fwd;
+                if (starts) {
+                    starts[got] = next_start;
+                }
+                ++got;
+                next_start += it->step;
+            }
+        }
+        it->pos = pos;
+        it->valid = valid;
+        it->next_start = next_start;
+        it->fwd = fwd;
+        it->rev = rev;
+    }
+    return got;
+}
+
+void dna_kmer_iter_close(dna_kmer_iter_t *it) {
+    if (!it) {
+        return;
+    }
+    free(it->codes);
+    free(it->window);
+    free(it);
+}
+
+// Integer keys of fixed-length reads. Raw payloads are read straight from
+// the mapping, coded ones through dna_read_range() a slice at a time; the
+// reads are split over the configured threads.
+#define KEYS_PER_TASK (1u << 16)
+
+typedef struct {
+    const dna_handle_t *h;
+    unsigned read_length;
+    size_t first;
+    size_t count;
+    uint64_t *out;
+    atomic_int failed;
+} keys_job_t;
+
+// The `bits` bits at bit `bit` of the packed bytes `src`, as the low bits of
+// the result. `bit` is even and bits at most 64, so they span at most nine
+// bytes; bytes past `nbytes` read as zero.
+static uint64_t packed_bits(const uint8_t *src, size_t nbytes, uint64_t bit, unsigned bits) {
+    size_t j = (size_t)(bit / 8);
+    unsigned skip = (unsigned)(bit % 8);
+    uint64_t word = 0;
+    uint8_t next = 0;
+    if (j + 9 <= nbytes) {
+        memcpy(&word, src + j, 8);
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        word = __builtin_bswap64(word);
+#endif
+        next = src[j + 8];
+    } else {
+        for (size_t b = 0; b < 8; ++b) {
+            word = (word << 8) | (j + b < nbytes ? src[j + b] : 0);
+        }
+        next = j + 8 < nbytes ? src[j + 8] : 0;
+    }
+    if (skip) {
+        word = (word << skip) | (next >> (8 - skip));
+    }
+    return word >> (64 - bits);
+}
+
+static void keys_task(void *arg, size_t task) {
+    keys_job_t *job = arg;
+    const dna_handle_t *h = job->h;
+    const unsigned len = job->read_length;
+    size_t i = task * KEYS_PER_TASK;
+    size_t n = job->count - i < KEYS_PER_TASK ? job->count - i : KEYS_PER_TASK;
+    uint64_t *out = job->out + i;
+    uint64_t start = (uint64_t)(job->first + i) * len;
+    if (!(h->meta.flags & DNA_FLAG_CODED)) {
+        size_t nbytes = (h->num_bases + 3) / BASES_PER_BYTE;
+        for (size_t r = 0; r < n; ++r) {
+            out[r] = packed_bits(h->data, nbytes, 2 * (start + (uint64_t)r * len), 2 * len);
+        }
+        return;
+    }
+    size_t per_slice = PARALLEL_CHUNK / len;
+    uint8_t *codes = malloc(per_slice * len);
+    if (!codes) {
+        atomic_store(&job->failed, 1);
+        return;
+    }
+    for (size_t r = 0; r < n; r += per_slice) {
+        size_t m = n - r < per_slice ? n - r : per_slice;
+        if (dna_read_range(h, start + (uint64_t)r * len, m * len, codes) != 0) {
+            atomic_store(&job->failed, 1);
+            break;
+        }
+        const uint8_t *c = codes;
+        for (size_t q = 0; q < m; ++q) {
+            uint64_t key = 0;
+            for (unsigned b = 0; b < len; ++b) {
+                key = (key << 2) | *c++;
+            }
+            out[r + q] = key;
+        }
+    }
+    free(codes);
+}
+
+int dna_read_keys(const dna_handle_t *h, unsigned read_length, size_t first, size_t count, uint64_t *out) {
+    if (read_length == 0) {
+        read_length = h->has_header && !h->read_offsets ? (unsigned)h->meta.read_length : 0;
+    }
+    if (read_length == 0 || read_length > 32 || first > h->num_bases / read_length ||
+        count > h->num_bases / read_length - first) {
+        return -1;
+    }
+    keys_job_t job = {h, read_length, first, count, out, 0};
+    parallel_for((count + KEYS_PER_TASK - 1) / KEYS_PER_TASK, keys_task, &job);
+    return atomic_load(&job.failed) ? -1 : 0;
+}
+
+// Parallel LSD radix sort, SORT_DIGIT_BITS per pass. Each task histograms
+// and then scatters its own contiguous slice, so every pass is stable.
+#define SORT_DIGIT_BITS 11
+#define SORT_DIGITS (1u << SORT_DIGIT_BITS)
+#define SORT_MIN_PER_TASK (1u << 16)  // Keys per task below which extra tasks do not pay
+
+typedef struct {
+    const uint64_t *src;
+    uint64_t *dst;
+    size_t n;
+    size_t num_tasks;
+    unsigned shift;
+    size_t (*counts)[SORT_DIGITS];  // Per task: digit counts, then output positions
+} sort_job_t;
+
+static void sort_slice(const sort_job_t *job, size_t task, size_t *lo, size_t *hi) {
+    *lo = job->n / job->num_tasks * task + job->n % job->num_tasks * task / job->num_tasks;
+    *hi = job->n / job->num_tasks * (task + 1) + job->n % job->num_tasks * (task + 1) / job->num_tasks;
+}
+
+static void sort_count_task(void *arg, size_t task) {
+    const sort_job_t *job = arg;
+    size_t lo, hi, *count = job->counts[task];
+    sort_slice(job, task, &lo, &hi);
+    memset(count, 0, SORT_DIGITS * sizeof(*count));
+    for (size_t i = lo; i < hi; ++i) {
+        count[(job->src[i] >> job->shift) & (SORT_DIGITS - 1)]++;
+    }
+}
+
+static void sort_scatter_task(void *arg, size_t task) {
+    const sort_job_t *job = arg;
+    size_t lo, hi, *pos = job->counts[task];
+    sort_slice(job, task, &lo, &hi);
+    for (size_t i = lo; i < hi; ++i) {
+        uint64_t key = job->src[i];
+        job->dst[pos[(key >> job->shift) & (SORT_DIGITS - 1)]++] = key;
+    }
+}
+
+int dna_sort_keys(uint64_t *keys, size_t n, unsigned bits) {
+    if (n < 2 || bits == 0) {
+        return 0;
+    }
+    size_t num_tasks = n / SORT_MIN_PER_TASK;
+    num_tasks = num_tasks < 1 ? 1 : num_tasks > (size_t)num_threads ? (size_t)num_threads : num_tasks;
+    uint64_t *tmp = malloc(n * sizeof(*tmp));
+    size_t (*counts)[SORT_DIGITS] = malloc(num_tasks * sizeof(*counts));
+    if (!tmp || !counts) {
+        free(tmp);
+        free(counts);
+        return -1;
+    }
+    sort_job_t job = {keys, tmp, n, num_tasks, 0, counts};
+    for (unsigned shift = 0; shift < bits && shift < 64; shift += SORT_DIGIT_BITS) {
+        job.shift = shift;
+        parallel_for(num_tasks, sort_count_task, &job);
+        // Output positions run digit by digit, then task by task within a digit.
+        size_t sum = 0;
+        int constant = 0;
+        for (size_t d = 0; d < SORT_DIGITS && !constant; ++d) {
+            size_t total = 0;
+            for (size_t t = 0; t < num_tasks; ++t) {
+                size_t c = counts[t][d];
+                counts[t][d] = sum + total;
+                total += c;
+            }
+            constant = total == n;  // Every key has this digit: nothing moves
+            sum += total;
+        }
+        if (constant) {
+            continue;
+        }
+        parallel_for(num_tasks, sort_scatter_task, &job);
+        const uint64_t *src = job.src;
+        job.src = job.dst;
+        job.dst = (uint64_t *)src;
+    }
+    if (job.src != keys) {
+        memcpy(keys, job.src, n * sizeof(*keys));
+    }
+    free(counts);
+    free(tmp);
+    return 0;
+}
+
+size_t dna_collapse_keys(uint64_t *keys, size_t n, uint32_t *counts) {
+    size_t out = 0;
+    for (size_t i = 0; i < n;) {
+        size_t j = i + 1;
+        while (j < n && keys[j] == keys[i]) {
+            ++j;
+        }
+        keys[out] = keys[i];
+        if (counts) {
+            counts[out] = j - i < UINT32_MAX ? (uint32_t)(j - i) : UINT32_MAX;
+        }
+        ++out;
+        i = j;
+    }
+    return out;
+}
+
+void dna_close_mmap(dna_handle_t *h) {
+    if (!h) {
+        return;
+    }
+    prefetch_stop(h);
+    cache_free(h->cache);
+    free(h->blocks);
+    free(h->n_runs);
+    if (h->fd >= 0) {
+        if (h->map) {
+            munmap(h->map, h->map_bytes);
+        }
+        close(h->fd);
+    }
+    free(h);
+}
+
+// Appending. The bases already in the file stay where they are: the writer
+// resumes at the last whole byte, or for coded files at the start of a
+// partial last block, which is decoded back into the block buffer. The
+// checksums are rewound over whatever will be rewritten, the trailing
+// sections are reloaded to be written again behind the new data, and the
+// bytes from the resume point on are saved so a failed append can put them back.
+static int writer_resume(dna_writer_t *w, const dna_handle_t *h) {
+    const dna_meta_t *meta = &h->meta;
+    uint64_t whole = h->num_bases / BASES_PER_BYTE;
+    unsigned rem = (unsigned)(h->num_bases % BASES_PER_BYTE);
+    uint32_t block_size = meta->block_size;
+    w->has_header = h->has_header;
+    if (h->has_header) {
+        w->hdr.meta = *meta;
+        memcpy(w->saved_header, h->map, DNA_HEADER_SIZE);
+    }
+    w->num_bases = h->num_bases;
+    w->num_reads = meta->num_reads;
+    w->variable = (meta->flags & DNA_FLAG_VARIABLE) != 0;
+    w->payload_bytes = whole;
+    w->file_offset = (h->has_header ? DNA_HEADER_SIZE : 0) + whole;
+    const uint8_t *last_byte = rem ? h->data + whole : NULL;
+
+    if (meta->flags & DNA_FLAG_CODED) {
+        size_t nb = h->num_blocks;
+        const dna_block_t *last = &h->blocks[nb - 1];
+        int partial = h->num_bases % block_size != 0;
+        w->coded_blocks_cap = nb + 64;
+        w->coded_blocks = malloc(w->coded_blocks_cap * sizeof(*w->coded_blocks));
+        w->block_buf = malloc(block_size / BASES_PER_BYTE);
+        w->coded = malloc(block_size / BASES_PER_BYTE);
+        if (!w->coded_blocks || !w->block_buf || !w->coded) {
+            perror("Failed to allocate block buffers");
+            return -1;
+        }
+        memcpy(w->coded_blocks, h->blocks, nb * sizeof(*h->blocks));
+        w->num_coded_blocks = partial ? nb - 1 : nb;
+        for (size_t i = 0; i < nb && w->codec == DNA_CODEC_RAW; ++i) {
+            w->codec = h->blocks[i].codec;
+        }
+#ifndef DNA_USE_ZSTD
+        if (w->codec == DNA_CODEC_ZSTD) {
+            fprintf(stderr, "Block codec %u is not available in this build\n", w->codec);
+            return -1;
+        }
+#endif
+        w->level = 3;
+        w->file_offset = partial ? last->offset : last->offset + last->stored_bytes;
+        w->hdr.meta.checksum = meta->checksum;
+        if (partial) {
+            w->hdr.meta.checksum = crc32c_rewind(meta->checksum, h->map + last->offset, last->stored_bytes);
+            if (last->codec == DNA_CODEC_RAW) {
+                memcpy(w->block_buf, h->map + last->offset, last->stored_bytes);
+            } else if (decode_block_packed(h, nb - 1, w->block_buf) != 0) {
+                return -1;
+            }
+            w->block_fill = last->num_bases / BASES_PER_BYTE;
+            last_byte = rem ? w->block_buf + w->block_fill : NULL;
+        }
+    } else if (h->has_header && rem) {
+        w->hdr.meta.checksum = crc32c_rewind(meta->checksum, last_byte, 1);
+    }
+    if (block_size && !(meta->flags & DNA_FLAG_CODED) && h->num_blocks) {
+        w->block_crcs_cap = h->num_blocks + 64;
+        w->block_crcs = calloc(w->block_crcs_cap, sizeof(*w->block_crcs));
+        if (!w->block_crcs) {
+            perror("Failed to allocate block index");
+            return -1;
+        }
+        for (size_t i = 0; i < h->num_blocks; ++i) {
+            w->block_crcs[i] = h->blocks[i].crc;
+        }
+        if (rem) {
+            w->block_crcs[h->num_blocks - 1] = crc32c_rewind(w->block_crcs[h->num_blocks - 1], last_byte, 1);
+        }
+    }
+    for (unsigned j = 0; j < rem; ++j) {
+        w->pending[j] = (*last_byte >> (6 - 2 * j)) & 0x03;
+    }
+    w->num_pending = rem;
+
+    if (block_size && h->num_blocks) {
+        // The pending bases are counted again when their byte is rewritten.
+        w->block_stats_cap = h->num_blocks + 64;
+        w->block_stats = calloc(w->block_stats_cap, sizeof(*w->block_stats));
+        if (!w->block_stats) {
+            perror("Failed to allocate block stats");
+            return -1;
+        }
+        for (size_t i = 0; i < h->num_blocks; ++i) {
+            uint64_t counts[4];
+            if (h->block_stats) {
+                for (int c = 0; c < 4; ++c) {
+                    counts[c] = get_le32(h->block_stats + i * BLOCK_STATS_ENTRY_SIZE + 4 * c);
+                }
+            } else if (count_stored(h, i * block_size, h->blocks[i].num_bases, counts) != 0) {
+                return -1;
+            }
+            for (int c = 0; c < 4; ++c) {
+                w->block_stats[i][c] = (uint32_t)counts[c];
+            }
+        }
+        for (unsigned j = 0; j < rem; ++j) {
+            w->block_stats[h->num_blocks - 1][w->pending[j]]--;
+        }
+    }
+
+    if (w->variable) {
+        for (uint64_t i = 0; i + 1 < h->num_offsets; ++i) {
+            if (writer_add_offset(w, read_offset(h, i)) != 0) {
+                return -1;
+            }
+        }
+    }
+    if (h->num_n_runs) {
+        w->n_runs_cap = h->num_n_runs + 64;
+        w->n_runs = malloc(w->n_runs_cap * sizeof(*w->n_runs));
+        if (!w->n_runs) {
+            perror("Failed to allocate N runs");
+            return -1;
+        }
+        memcpy(w->n_runs, h->n_runs, h->num_n_runs * sizeof(*h->n_runs));
+        w->num_n_runs = h->num_n_runs;
+    }
+    if (h->quals) {
+        // Whole bytes go back to the spool, the bins of a partial last byte to the stage.
+        size_t per_byte = 8 / (size_t)h->qual_bits;
+        uint64_t full = h->num_bases / per_byte;
+        size_t tail = (size_t)(h->num_bases % per_byte);
+        w->qual_bits = h->qual_bits;
+        w->qual_stage = malloc(QUAL_STAGE);
+        if (!w->qual_stage || spool_write(&w->quals, h->quals - QUALS_PREFIX_BYTES, QUALS_PREFIX_BYTES + full) != 0) {
+            perror("Failed to reload qualities");
+            return -1;
+        }
+        for (size_t j = 0; j < tail; ++j) {
+            uint8_t b = h->quals[full];
+            w->qual_stage[j] = h->qual_bits == 2 ? (b >> (6 - 2 * j)) & 0x03 : b >> 4;
+        }
+        w->qual_staged = tail;
+        w->num_quals = h->num_bases;
+    }
+    if (h->names) {
+        w->name_groups_cap = h->num_name_groups + 64;
+        w->name_groups = malloc(w->name_groups_cap * sizeof(*w->name_groups));
+        if (!w->name_groups || spool_write(&w->names, h->names, h->names_bytes) != 0) {
+            perror("Failed to reload names");
+            return -1;
+        }
+        for (uint64_t g = 0; g < h->num_name_groups; ++g) {
+            w->name_groups[g] = get_le64(h->name_index + g * 8);
+        }
+        w->num_names = h->num_names;
+        if (w->num_names % DNA_NAME_GROUP) {
+            // The next name is coded against the last one.
+            char buf[256];
+            long len = dna_read_name(h, w->num_names - 1, buf, sizeof(buf));
+            char *name = len >= (long)sizeof(buf) ? malloc((size_t)len + 1) : buf;
+            int ok = len >= 0 && name && (name == buf || dna_read_name(h, w->num_names - 1, name, (size_t)len + 1) == len) &&
+                     name_tokenize(&w->name_prev, name, (size_t)len) == 0;
+            if (name != buf) {
+                free(name);
+            }
+            if (!ok) {
+                fprintf(stderr, "Cannot decode the last read name\n");
+                return -1;
+            }
+        }
+    }
+
+    w->resume_offset = w->file_offset;
+    w->resume_bases = w->num_bases;
+    w->orig_bytes = h->map_bytes;
+    if (w->orig_bytes > w->resume_offset &&
+        spool_write(&w->saved_tail, h->map + w->resume_offset, w->orig_bytes - w->resume_offset) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+// Moves an append to a raw blocked file onto the coded path: the stored
+// blocks become raw entries of the block index, and the whole bytes of a
+// partial last block are read back into the block buffer to be coded again.
+static int writer_resume_coded(dna_writer_t *w) {
+    uint32_t block_size = w->hdr.meta.block_size;
+    size_t block_bytes = block_size / BASES_PER_BYTE;
+    size_t full = (size_t)(w->num_bases / block_size);
+    w->coded_blocks_cap = full + 64;
+    w->coded_blocks = malloc(w->coded_blocks_cap * sizeof(*w->coded_blocks));
+    if (!w->coded_blocks) {
+        perror("Failed to allocate block index");
+        return -1;
+    }
+    for (size_t i = 0; i < full; ++i) {
+        dna_block_t *blk = &w->coded_blocks[i];
+        blk->offset = DNA_HEADER_SIZE + (uint64_t)i * block_bytes;
+        blk->num_bases = block_size;
+        blk->stored_bytes = (uint32_t)block_bytes;
+        blk->crc = w->block_crcs[i];
+        blk->codec = DNA_CODEC_RAW;
+    }
+    w->num_coded_blocks = full;
+
+    size_t fill = (size_t)(w->payload_bytes - (uint64_t)full * block_bytes);
+    if (fill == 0) {
+        return 0;
+    }
+    uint64_t offset = DNA_HEADER_SIZE + (uint64_t)full * block_bytes;
+    if (io_read_full(w->fd, w->block_buf, fill, (off_t)offset) != (ssize_t)fill) {
+        perror("Failed to read file");
+        return -1;
+    }
+    w->hdr.meta.checksum = crc32c_rewind(w->hdr.meta.checksum, w->block_buf, fill);
+    w->block_fill = fill;
+    w->file_offset = offset;
+
+    // The saved tail now has to start at the block.
+    spool_t tail = {NULL, 0};
+    uint8_t raw[1 << 16];
+    int status = spool_write(&tail, w->block_buf, fill);
+    spool_t *old = &w->saved_tail;
+    if (status == 0 && old->file && (fflush(old->file) != 0 || fseek(old->file, 0, SEEK_SET) != 0)) {
+        status = -1;
+    }
+    for (uint64_t left = old->bytes; left > 0 && status == 0;) {
+        size_t n = left < sizeof(raw) ? (size_t)left : sizeof(raw);
+        status = fread(raw, 1, n, old->file) == n ? spool_write(&tail, raw, n) : -1;
+        left -= n;
+    }
+    spool_close(old);
+    *old = tail;
+    w->resume_offset = offset;
+    return status;
+}
+
+dna_writer_t *dna_writer_open_append(const char *filename, size_t size) {
+    dna_handle_t *h = dna_open_mmap(filename, size);
+    if (!h) {
+        return NULL;
+    }
+    dna_writer_t *w = calloc(1, sizeof(*w));
+    if (!w) {
+        perror("Failed to allocate writer");
+        dna_close_mmap(h);
+        return NULL;
+    }
+    w->in_place = 1;
+    w->path = strdup(filename);
+    int status = !w->path || writer_alloc_ring(w) != 0 || writer_resume(w, h) != 0 ? -1 : 0;
+    dna_close_mmap(h);
+    if (status != 0) {
+        writer_free(w);
+        return NULL;
+    }
+
+    // Appends land at unaligned offsets, so no O_DIRECT here.
+    w->fd = open(filename, O_RDWR);
+    if (w->fd < 0) {
+        perror("Failed to open file");
+        writer_free(w);
+        return NULL;
+    }
+    if (writer_start(w) != 0) {
+        close(w->fd);
+        writer_free(w);
+        return NULL;
+    }
+    return w;
+}
+
+int dna_writer_layout(const dna_writer_t *w, dna_meta_t *meta, int *qual_bits, int *has_names) {
+    *meta = w->hdr.meta;
+    meta->num_bases = w->num_bases;
+    meta->num_reads = w->num_reads;
+    *qual_bits = w->qual_bits;
+    *has_names = w->num_names != 0;
+    return w->has_header;
+}
+
+// Archives. Each sample is written by an ordinary writer whose offsets are
+// shifted by the sample's start, so a sample is byte for byte the file the
+// writer would have produced on its own, and a reader can map it in place.
+#define ARCHIVE_MAGIC "DNAR"
+#define ARCHIVE_VERSION 1
+#define ARCHIVE_ENTRY_SIZE 34
+
+struct dna_archive_writer {
+    char *path;
+    char *part_path;
+    int fd;
+    int direct;
+    uint64_t end;         // Start of the next sample, a multiple of IO_ALIGN
+    dna_writer_t *open;   // Sample being written, at most one at a time
+    spool_t directory;
+    uint64_t num_samples;
+    uint32_t crc;         // Of the directory so far
+    int error;
+};
+
+dna_archive_writer_t *dna_archive_create(const char *filename) {
+    dna_archive_writer_t *ar = calloc(1, sizeof(*ar));
+    size_t len = strlen(filename);
+    if (ar) {
+        ar->path = strdup(filename);
+        ar->part_path = malloc(len + sizeof(".part"));
+    }
+    if (!ar || !ar->path || !ar->part_path) {
+        perror("Failed to allocate archive");
+        if (ar) {
+            free(ar->path);
+            free(ar->part_path);
+        }
+        free(ar);
+        return NULL;
+    }
+    memcpy(ar->part_path, filename, len);
+    memcpy(ar->part_path + len, ".part", sizeof(".part"));
+    ar->fd = io_open(ar->part_path, O_WRONLY | O_CREAT | O_TRUNC, &ar->direct);
+    if (ar->fd < 0) {
+        perror("Failed to open file");
+        free(ar->path);
+        free(ar->part_path);
+        free(ar);
+        return NULL;
+    }
+    ar->end = IO_ALIGN;  // The archive header is written on finish
+    return ar;
+}
+
+dna_writer_t *dna_archive_add(dna_archive_writer_t *ar, const char *name, const dna_meta_t *meta) {
+    size_t len = strlen(name);
+    if (ar->open || ar->error || !meta || len == 0 || len > UINT16_MAX) {
+        fprintf(stderr, "Cannot add sample %s: samples need a header, a name and the previous sample closed\n", name);
+        return NULL;
+    }
+    dna_writer_t *w = writer_new(name, meta);
+    if (!w) {
+        return NULL;
+    }
+#ifdef O_DIRECT
+    if (ar->direct) {
+        fcntl(ar->fd, F_SETFL, fcntl(ar->fd, F_GETFL) | O_DIRECT);  // The previous close cleared it
+    }
+#endif
+    w->fd = ar->fd;
+    w->direct = ar->direct;
+    w->archive = ar;
+    w->base = ar->end;
+    memset(w->ring[0].data, 0, DNA_HEADER_SIZE);  // Written for real on close
+    w->ring[0].len = DNA_HEADER_SIZE;
+    if (writer_start(w) != 0) {
+        writer_free(w);
+        return NULL;
+    }
+    ar->open = w;
+    return w;
+}
+
+// Called by dna_writer_close() and dna_writer_abort() on a sample of `end`
+// bytes: lists it in the directory, or cuts a failed one off the file.
+static int archive_sample_done(dna_writer_t *w, int status, uint64_t end) {
+    dna_archive_writer_t *ar = w->archive;
+    ar->open = NULL;
+    if (status == 0) {
+        size_t len = strlen(w->path);
+        uint8_t entry[ARCHIVE_ENTRY_SIZE];
+        put_le64(entry, w->base);
+        put_le64(entry + 8, end);
+        put_le64(entry + 16, w->num_bases);
+        put_le64(entry + 24, w->num_reads);
+        put_le16(entry + 32, (uint16_t)len);
+        if (spool_write(&ar->directory, entry, sizeof(entry)) != 0 || spool_write(&ar->directory, w->path, len) != 0) {
+            perror("Failed to write archive directory");
+            ar->error = 1;
+            return -1;
+        }
+        ar->crc = dna_crc32c(ar->crc, entry, sizeof(entry));
+        ar->crc = dna_crc32c(ar->crc, w->path, len);
+        ar->num_samples++;
+        ar->end = round_up(w->base + end, IO_ALIGN);
+        return 0;
+    }
+    if (ftruncate(ar->fd, (off_t)ar->end) != 0) {
+        perror("Failed to truncate archive");
+        ar->error = 1;
+    }
+    return -1;
+}
+
+int dna_archive_finish(dna_archive_writer_t *ar) {
+    int status = ar->open || ar->error || ar->num_samples > UINT32_MAX ? -1 : 0;
+#ifdef O_DIRECT
+    if (ar->direct) {
+        fcntl(ar->fd, F_SETFL, fcntl(ar->fd, F_GETFL) & ~O_DIRECT);
+    }
+#endif
+    trailer_t t;
+    trailer_init(&t, ar->fd, ar->end);
+    t.status = status;
+    append_spool(&t, &ar->directory, 0, ar->num_samples);
+    uint8_t raw[DNA_HEADER_SIZE];
+    memset(raw, 0, sizeof(raw));
+    memcpy(raw, ARCHIVE_MAGIC, 4);
+    put_le16(raw + 4, ARCHIVE_VERSION);
+    put_le16(raw + 6, DNA_HEADER_SIZE);
+    put_le32(raw + 8, (uint32_t)ar->num_samples);
+    put_le32(raw + 12, ar->crc);
+    put_le64(raw + 16, ar->end);
+    put_le64(raw + 24, ar->directory.bytes);
+    status = t.status;
+    if (status == 0 && (io_write_full(ar->fd, raw, sizeof(raw), 0) != 0 || ftruncate(ar->fd, (off_t)t.offset) != 0)) {
+        perror("Failed to write archive");
+        status = -1;
+    }
+    if (close(ar->fd) != 0) {
+        perror("Failed to close file");
+        status = -1;
+    }
+    if (status == 0 && rename(ar->part_path, ar->path) != 0) {
+        perror("Failed to rename file");
+        status = -1;
+    }
+    if (status != 0) {
+        unlink(ar->part_path);
+    }
+    spool_close(&ar->directory);
+    free(ar->path);
+    free(ar->part_path);
+    free(ar);
+    return status;
+}
+
+void dna_archive_discard(dna_archive_writer_t *ar) {
+    if (!ar) {
+        return;
+    }
+    if (ar->open) {
+        dna_writer_abort(ar->open);
+    }
+    close(ar->fd);
+    unlink(ar->part_path);
+    spool_close(&ar->directory);
+    free(ar->path);
+    free(ar->part_path);
+    free(ar);
+}
+
+struct dna_archive {
+    int fd;
+    uint8_t *map;
+    size_t map_bytes;
+    dna_sample_t *samples;
+    size_t num_samples;
+    char *names;       // NUL-terminated copies of the sample names
+    const dna_sample_t **by_name;  // Sorted by name
+};
+
+static int compare_sample_names(const void *a, const void *b) {
+    return strcmp((*(const dna_sample_t *const *)a)->name, (*(const dna_sample_t *const *)b)->name);
+}
+
+// Checks the directory at `dir` and lists it in `ar`. Returns 0, or -1 if it
+// is corrupt.
+static int archive_load(dna_archive_t *ar, const uint8_t *dir, uint64_t dir_bytes, uint64_t dir_offset) {
+    ar->samples = calloc(ar->num_samples ? ar->num_samples : 1, sizeof(*ar->samples));
+    ar->names = malloc(dir_bytes + 1);
+    ar->by_name = malloc((ar->num_samples ? ar->num_samples : 1) * sizeof(*ar->by_name));
+    if (!ar->samples || !ar->names || !ar->by_name) {
+        return -1;
+    }
+    uint64_t pos = 0;
+    char *names = ar->names;
+    for (size_t i = 0; i < ar->num_samples; ++i) {
+        if (dir_bytes - pos < ARCHIVE_ENTRY_SIZE) {
+            return -1;
+        }
+        const uint8_t *entry = dir + pos;
+        dna_sample_t *s = &ar->samples[i];
+        s->offset = get_le64(entry);
+        s->bytes = get_le64(entry + 8);
+        s->num_bases = get_le64(entry + 16);
+        s->num_reads = get_le64(entry + 24);
+        size_t len = get_le16(entry + 32);
+        pos += ARCHIVE_ENTRY_SIZE;
+        if (dir_bytes - pos < len || s->offset > dir_offset || s->bytes > dir_offset - s->offset ||
+            s->offset % IO_ALIGN != 0) {
+            return -1;
+        }
+        memcpy(names, dir + pos, len);
+        names[len] = '\0';
+        s->name = names;
+        names += len + 1;
+        pos += len;
+        ar->by_name[i] = s;
+    }
+    if (pos != dir_bytes) {
+        return -1;
+    }
+    qsort(ar->by_name, ar->num_samples, sizeof(*ar->by_name), compare_sample_names);
+    return 0;
+}
+
+dna_archive_t *dna_archive_open(const char *filename) {
+    dna_archive_t *ar = calloc(1, sizeof(*ar));
+    if (!ar) {
+        perror("Failed to allocate archive");
+        return NULL;
+    }
+    ar->fd = open(filename, O_RDONLY);
+    if (ar->fd < 0) {
+        perror("Failed to open file");
+        free(ar);
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(ar->fd, &st) != 0) {
+        perror("Failed to stat file");
+        dna_archive_close(ar);
+        return NULL;
+    }
+    if (st.st_size > 0) {
+        void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, ar->fd, 0);
+        if (map == MAP_FAILED) {
+            perror("Failed to mmap file");
+            dna_archive_close(ar);
+            return NULL;
+        }
+        ar->map = map;
+        ar->map_bytes = (size_t)st.st_size;
+    }
+    const uint8_t *p = ar->map;
+    if (ar->map_bytes < DNA_HEADER_SIZE || memcmp(p, ARCHIVE_MAGIC, 4) != 0 ||
+        get_le16(p + 4) != ARCHIVE_VERSION || get_le16(p + 6) != DNA_HEADER_SIZE) {
+        fprintf(stderr, "Not an archive: %s\n", filename);
+        dna_archive_close(ar);
+        return NULL;
+    }
+    ar->num_samples = get_le32(p + 8);
+    uint32_t crc = get_le32(p + 12);
+    uint64_t dir_offset = get_le64(p + 16), dir_bytes = get_le64(p + 24);
+    if (dir_offset > ar->map_bytes || dir_bytes > ar->map_bytes - dir_offset ||
+        dna_crc32c(0, ar->map + dir_offset, dir_bytes) != crc ||
+        archive_load(ar, ar->map + dir_offset, dir_bytes, dir_offset) != 0) {
+        fprintf(stderr, "Corrupt archive directory: %s\n", filename);
+        dna_archive_close(ar);
+        return NULL;
+    }
+    return ar;
+}
+
+size_t dna_archive_num_samples(const dna_archive_t *ar) {
+    return ar->num_samples;
+}
+
+int dna_archive_sample(const dna_archive_t *ar, size_t i, dna_sample_t *sample) {
+    if (i >= ar->num_samples) {
+        return -1;
+    }
+    *sample = ar->samples[i];
+    return 0;
+}
+
+long dna_archive_find(const dna_archive_t *ar, const char *name) {
+    size_t lo = 0, hi = ar->num_samples;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = strcmp(ar->by_name[mid]->name, name);
+        if (c == 0) {
+            return (long)(ar->by_name[mid] - ar->samples);
+        }
+        if (c < 0) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return -1;
+}
+
+dna_handle_t *dna_archive_open_sample(const dna_archive_t *ar, size_t i) {
+    if (i >= ar->num_samples) {
+        return NULL;
+    }
+    const dna_sample_t *s = &ar->samples[i];
+    uint8_t *map = ar->map + s->offset;
+    file_header_t hdr;
+    if (!decode_header(map, s->bytes, &hdr)) {
+        fprintf(stderr, "Corrupt sample header: %s\n", s->name);
+        return NULL;
+    }
+    int coded = (hdr.meta.flags & DNA_FLAG_CODED) != 0;
+    if (!coded && (hdr.meta.num_bases + 3) / 4 > s->bytes - DNA_HEADER_SIZE) {
+        fprintf(stderr, "Sample %s is too small for %llu elements\n", s->name, (unsigned long long)hdr.meta.num_bases);
+        return NULL;
+    }
+    dna_handle_t *h = calloc(1, sizeof(*h));
+    if (!h) {
+        perror("Failed to allocate handle");
+        return NULL;
+    }
+    h->fd = -1;
+    h->map = map;
+    h->map_bytes = (size_t)s->bytes;
+    h->data = map + DNA_HEADER_SIZE;
+    h->num_bases = (size_t)hdr.meta.num_bases;
+    h->has_header = 1;
+    h->meta = hdr.meta;
+    if (load_sections(h, &hdr) != 0) {
+        fprintf(stderr, "Corrupt section table: %s\n", s->name);
+        dna_close_mmap(h);
+        return NULL;
+    }
+    if (coded) {
+        dna_set_cache(h, DNA_DEFAULT_CACHE_BYTES);
+    }
+    return h;
+}
+
+void dna_archive_close(dna_archive_t *ar) {
+    if (!ar) {
+        return;
+    }
+    if (ar->map) {
+        munmap(ar->map, ar->map_bytes);
+    }
+    close(ar->fd);
+    free(ar->samples);
+    free(ar->names);
+    free(ar->by_name);
+    free(ar);
 }
@@ -0,0 +1,519 @@
+#ifndef DNA_ARRAY_H
+#define DNA_ARRAY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Bases are stored as A=0, C=1, G=2, T=3, four per byte, first base in the
+// two most significant bits.
+
+// Optional file header, DNA_HEADER_SIZE bytes in front of the payload:
+//   0  char[4] magic "DNA2"      4  u16 version (1)     6  u16 header size (64)
+//   8  u32 flags                12  u32 block size (bases, 0 = unblocked)
+//  16  u64 number of bases      24  u64 number of reads (0 = unknown)
+//  32  u64 read length (0 = variable or unknown)
+//  40  u32 CRC-32C of the packed payload
+//  44  u32 number of trailing sections   48  u64 offset of the section table
+//  56  reserved (zero)
+// All fields are little-endian. Files without the magic are legacy headerless
+// files: the payload starts at byte 0 and the caller must know the length.
+#define DNA_HEADER_SIZE 64
+
+// Header flags
+#define DNA_FLAG_BLOCKED 0x1   // Payload is split into blocks listed in a block index
+#define DNA_FLAG_VARIABLE 0x2  // Reads of varying length, bounded by a read offsets section
+#define DNA_FLAG_CODED 0x4     // Some blocks are compressed: read the payload through the block index
+
+// Trailing section kinds
+#define DNA_SECTION_BLOCK_INDEX 1
+#define DNA_SECTION_N_RUNS 2  // Runs of 'N' stored as code 0: u64 start, u32 length each
+#define DNA_SECTION_READ_OFFSETS 3  // num_reads + 1 read start offsets, see below
+#define DNA_SECTION_QUALS 4        // One binned quality per base, see below
+#define DNA_SECTION_NAMES 5        // Tokenized read names, in groups of DNA_NAME_GROUP
+#define DNA_SECTION_NAME_INDEX 6   // u64 offset into DNA_SECTION_NAMES of each group
+#define DNA_SECTION_BLOCK_STATS 7  // u32 count of A, C, G and T codes in each block
+
+// The read offsets section holds groups of DNA_READ_OFFSETS_GROUP entries,
+// each a u64 anchor followed by one u32 per entry, relative to the anchor
+// (the first entry of a group is its anchor): entry i is found in O(1) at
+// group i / 64 without decoding anything else. The last entry is num_bases.
+#define DNA_READ_OFFSETS_GROUP 64
+
+// The quals section starts with u32 bits per value (2 or 4) and the 16 Phred
+// scores the bins stand for, then holds one bin per base packed like the
+// bases, first value in the high bits: base i's quality is at bit i * bits.
+// Read names are coded against the previous name of their group, so any
+// group can be decoded on its own.
+#define DNA_NAME_GROUP 4096
+
+// Block codecs
+#define DNA_CODEC_RAW 0   // Plain 2-bit packed bases
+#define DNA_CODEC_CM 1    // Built-in order-10/order-3 context-mixing arithmetic coder over bases
+#define DNA_CODEC_ZSTD 2  // zstd over the packed bytes; needs a build with -DDNA_USE_ZSTD
+
+// Value dna_read_range_n() can write for positions that were 'N'
+#define DNA_CODE_N 4
+
+// Default number of bases per block for blocked files
+#define DNA_DEFAULT_BLOCK_SIZE (1u << 20)
+
+// Block cache budget dna_open_mmap() gives files with coded blocks
+#define DNA_DEFAULT_CACHE_BYTES (64u << 20)
+
+typedef struct {
+    uint64_t num_bases;
+    uint64_t num_reads;
+    uint64_t read_length;
+    uint32_t block_size;
+    uint32_t flags;
+    uint32_t checksum;
+} dna_meta_t;
+
+// Block index entry of a blocked file. Block i holds bases
+// [i * block_size, i * block_size + num_bases).
+typedef struct {
+    uint64_t offset;        // File offset of the stored block
+    uint32_t num_bases;
+    uint32_t stored_bytes;
+    uint32_t crc;           // CRC-32C of the stored bytes
+    uint32_t codec;
+} dna_block_t;
+
+// Run of `length` 'N' bases starting at base `start`. The payload holds code 0
+// (A) there; readers that care restore the Ns from the run list.
+typedef struct {
+    uint64_t start;
+    uint64_t length;
+} dna_n_run_t;
+
+// Threads used by dna_pack/dna_unpack and everything built on them (file
+// reads and writes, range decodes). 1 (the default) keeps all work on the
+// calling thread; 0 or less means one per online CPU. Calls shorter than a
+// few million bases always run on one thread.
+void dna_set_num_threads(int n);
+int dna_get_num_threads(void);
+
+// Caller-supplied thread pool. `run` must call fn(arg, t) for every t in
+// [0, num_tasks), in any order and on any threads, and return once all calls
+// have finished. Pass NULL to go back to the built-in threads.
+typedef void (*dna_task_fn)(void *arg, size_t task);
+typedef void (*dna_executor_fn)(void *pool, size_t num_tasks, dna_task_fn fn, void *arg);
+void dna_set_executor(dna_executor_fn run, void *pool);
+
+// Runs fn(arg, t) for every t in [0, num_tasks) on the configured threads and
+// returns when all have finished.
+void dna_parallel_for(size_t num_tasks, dna_task_fn fn, void *arg);
+
+// Kernel sets for dna_use_kernels()
+#define DNA_KERNELS_SCALAR 0  // Portable reference kernels, a byte or base at a time
+#define DNA_KERNELS_BEST 1    // Widest kernels the CPU supports (the default)
+
+// Switches the pack, unpack, CRC, base count, search and reverse complement
+// kernels to `set`, for measuring one against the other; results do not
+// change. Must not run concurrently with other calls. Returns 0, or -1 for
+// an unknown set.
+int dna_use_kernels(int set);
+
+// Name of the pack and unpack kernels in use: "scalar", "word", "sse2" or "avx2".
+const char *dna_kernel_name(void);
+
+// Packs `n` codes from `src` into the (n + 3) / 4 bytes at `dst`. Only the two
+// low bits of each code are used; unused bits of the last byte are zero.
+void dna_pack(const uint8_t *src, size_t n, uint8_t *dst);
+
+// Like dna_pack(), checking the codes in the same pass. Returns 0, or -1 if
+// any code is above 3 (`dst` is filled regardless).
+int dna_pack_checked(const uint8_t *src, size_t n, uint8_t *dst);
+
+// Unpacks `n` codes starting at base `offset` of the packed buffer `src` into
+// `dst`. `offset` need not be a multiple of four.
+void dna_unpack(const uint8_t *src, size_t offset, size_t n, uint8_t *dst);
+
+// Writes the reverse complement of the `n` bases starting at base `offset` of
+// the packed buffer `src` to the (n + 3) / 4 bytes at `dst`, packed from base
+// 0. Complements are XOR 3 (A<->T, C<->G). `dst` must not overlap `src`.
+void dna_revcomp(const uint8_t *src, size_t offset, size_t n, uint8_t *dst);
+
+// Reverse-complements the `n` packed bases at `buf` in place.
+void dna_revcomp_inplace(uint8_t *buf, size_t n);
+
+// Writes the n - k + 1 canonical k-mers of the `n` bases starting at base
+// `offset` of the packed buffer `src` to `out`: each the smaller of the k-mer
+// and its reverse complement as a 2k-bit integer, first base in the most
+// significant bits. `k` is 1 to 32. Returns the number written, 0 if n < k.
+size_t dna_canonical_kmers(const uint8_t *src, size_t offset, size_t n, unsigned k, uint64_t *out);
+
+// Packs `size` codes from `arr` into `filename`, truncating any existing file.
+void save_large_array_to_file(const char *filename, const uint8_t *arr, size_t size);
+
+// Unpacks the first `size` codes of `filename` into `arr`, skipping the header
+// if there is one.
+void read_large_array_from_file(const char *filename, uint8_t *arr, size_t size);
+
+// Like read_large_array_from_file, but reports what went wrong. Returns 0,
+// -1 if the file cannot be opened or read, or -2 if it holds fewer than
+// `size` codes or fails its checksum. `arr` is only fully written on 0.
+int dna_read_checked(const char *filename, uint8_t *arr, size_t size);
+
+// Like save_large_array_to_file, but writes a header in front of the payload.
+// `meta` supplies num_reads, read_length, block_size and flags (NULL for
+// none); num_bases and checksum are filled in. A non-zero block_size (a
+// multiple of 4) writes a blocked file: blocks of block_size bases followed
+// by a block index with per-block checksums. Returns 0, or -1 on error.
+int dna_save_with_header(const char *filename, const uint8_t *arr, size_t size, const dna_meta_t *meta);
+
+// Writes `arr` as dna_save_with_header() does, or as a headerless file when
+// `meta` is NULL, checking the codes while packing. Returns 0, -1 on error,
+// or -2 (and removes the file) if any code is above 3.
+int dna_save_checked(const char *filename, const uint8_t *arr, size_t size, const dna_meta_t *meta);
+
+// Fills `meta` from the header of `filename` and returns 1. For a legacy
+// headerless file returns 0 with num_bases set to four per file byte (an upper
+// bound). Returns -1 on error.
+int dna_read_header(const char *filename, dna_meta_t *meta);
+
+// Continues the CRC-32C `crc` (0 to start) over `n` bytes of `buf`.
+uint32_t dna_crc32c(uint32_t crc, const void *buf, size_t n);
+
+// Opens files with O_DIRECT when `enable` is non-zero and the filesystem allows it.
+void dna_set_direct_io(int enable);
+
+// Streaming writer: packs bases as they arrive with constant memory use.
+// Output goes to `<filename>.part` and is renamed to `filename` by
+// dna_writer_close(), so a crashed or aborted run never leaves a file that
+// looks complete. Each open writer buffers about DNA_WRITER_MEMORY bytes.
+typedef struct dna_writer dna_writer_t;
+
+#define DNA_WRITER_MEMORY (16u << 20)
+
+// Starts a file. `meta` NULL writes a legacy headerless file; otherwise a
+// header is written with num_reads, read_length, block_size and flags taken
+// from `meta` (num_bases and checksum are filled in on close). Returns NULL
+// on error.
+dna_writer_t *dna_writer_open(const char *filename, const dna_meta_t *meta);
+
+// Reopens an existing file to add data at its end, in place: the bases
+// already stored are not rewritten, only a partial last byte (or for coded
+// files a partial last block) and the trailing sections, so an append costs
+// about the size of the new data. The file keeps its layout: codec, read
+// offsets, qualities (required for every new base if the file has them) and
+// names (one per new read) continue where they stopped; see
+// dna_writer_layout(). `size` is as for dna_open_mmap(); headerless files
+// are taken to hold four bases per byte unless it is given. If the append
+// fails or is aborted the original file is put back; a crash while appending
+// can leave it unreadable. Returns NULL on error.
+dna_writer_t *dna_writer_open_append(const char *filename, size_t size);
+
+// Fills `meta` with the header a writer works towards (num_bases and
+// num_reads so far), `qual_bits` with its quality bits (0 for none) and
+// `has_names` with whether it has stored names. Returns 1, or 0 for a
+// headerless file.
+int dna_writer_layout(const dna_writer_t *w, dna_meta_t *meta, int *qual_bits, int *has_names);
+
+// Appends `n` codes. Calls may split the stream anywhere; the output is the
+// same as one save of the concatenation. Returns 0, or -1 on error.
+int dna_writer_append(dna_writer_t *w, const uint8_t *bases, size_t n);
+
+// Appends one read of `n` codes and counts it towards the header's num_reads.
+// With DNA_FLAG_VARIABLE in the meta passed to dna_writer_open(), the read's
+// start offset also goes into the read offsets section.
+int dna_writer_append_read(dna_writer_t *w, const uint8_t *bases, size_t n);
+
+// Appends `n` reads of `read_length` bases (1 to 32), each given as a key as
+// dna_read_keys() returns it. Returns 0, or -1 on error.
+int dna_writer_append_keys(dna_writer_t *w, const uint64_t *keys, size_t n, unsigned read_length);
+
+// Number of codes appended so far.
+uint64_t dna_writer_num_bases(const dna_writer_t *w);
+
+// Compresses each block of a blocked file with `codec` (`level` is the zstd
+// level). Blocks that do not shrink are stored raw, and raw blocks are still
+// decoded straight from the mapped file. Must be called before anything is
+// appended; on a writer from dna_writer_open_append it sets the codec of the
+// new blocks. Returns 0, or -1 if the codec is unavailable.
+int dna_writer_set_codec(dna_writer_t *w, uint32_t codec, int level);
+
+// Stores binned qualities from now on, `bits` (2 or 4) per base. Must be
+// called before anything is appended; needs a header. Returns 0, or -1.
+int dna_writer_enable_quals(dna_writer_t *w, int bits);
+
+// Appends the Phred+33 qualities of `n` bases. The quality count must match
+// the base count when the writer is closed.
+int dna_writer_append_quals(dna_writer_t *w, const char *qual, size_t n);
+
+// Appends the name of the next read. Either every read gets a name or none
+// does. Needs a header.
+int dna_writer_append_name(dna_writer_t *w, const char *name, size_t len);
+
+// Records that bases [start, start + length) are 'N'. Runs must arrive in
+// order and may lie ahead of the appended bases; they are written as a
+// DNA_SECTION_N_RUNS section on close. Needs a header. Returns 0, or -1.
+int dna_writer_mark_n(dna_writer_t *w, uint64_t start, uint64_t length);
+
+// Time spent by each side of the writer ring, for finding the slow stage of
+// a pipeline. Elapsed times are in nanoseconds.
+typedef struct {
+    uint64_t write_ns;        // Flush thread writing buffers
+    uint64_t idle_ns;         // Flush thread waiting for a full buffer
+    uint64_t submit_wait_ns;  // Appending thread waiting for a free buffer
+    uint64_t buffers;         // Buffers handed to the flush thread
+    uint64_t depth_sum;       // Sum of the ring depth right after each hand-off
+} dna_writer_stats_t;
+
+// Asks for the writer's stats to be stored in `*stats` when it is closed or
+// aborted.
+void dna_writer_set_stats(dna_writer_t *w, dna_writer_stats_t *stats);
+
+// Finishes the file and frees `w`. Returns 0, or -1 on error (the partial
+// output is then removed).
+int dna_writer_close(dna_writer_t *w);
+
+// Discards the output and frees `w`.
+void dna_writer_abort(dna_writer_t *w);
+
+// Read-only memory-mapped view of a packed file.
+typedef struct dna_handle dna_handle_t;
+
+// Maps `filename` holding `size` elements. `size` 0 takes the count from the
+// header, or four per file byte for legacy files. Returns NULL on error.
+dna_handle_t *dna_open_mmap(const char *filename, size_t size);
+
+// Number of elements addressable through `h`.
+size_t dna_handle_size(const dna_handle_t *h);
+
+// Mapped packed payload of `h` (first base in the high bits of byte 0), valid
+// until dna_close_mmap(). Returns NULL for files with coded blocks.
+const uint8_t *dna_handle_data(const dna_handle_t *h, size_t *nbytes);
+
+// Copies the header fields into `meta`. Returns 1, or 0 for a legacy file.
+int dna_handle_meta(const dna_handle_t *h, dna_meta_t *meta);
+
+// Decodes elements [start, start + len) into `out`. Returns 0, or -1 if the
+// range runs past the end of the file.
+int dna_read_range(const dna_handle_t *h, size_t start, size_t len, uint8_t *out);
+
+// Like dna_read_range(), then writes `n_code` (for example DNA_CODE_N or 'N')
+// at every position inside an N run. Ranges without Ns decode as fast as
+// dna_read_range().
+int dna_read_range_n(const dna_handle_t *h, size_t start, size_t len, uint8_t *out, uint8_t n_code);
+
+// Access pattern hints for dna_advise()
+#define DNA_ADVICE_NORMAL 0      // Kernel default read-ahead
+#define DNA_ADVICE_SEQUENTIAL 1  // Front-to-back scan: aggressive read-ahead
+#define DNA_ADVICE_RANDOM 2      // Scattered windows: no read-ahead
+#define DNA_ADVICE_STRIDED 3     // Windows at a fixed stride: no kernel read-ahead, see dna_prefetch()
+
+// Passes an access pattern hint to the kernel (madvise() on the mapping and
+// posix_fadvise() on the file), and to the prefetch thread. Returns 0, or -1
+// for an unknown hint or if madvise() fails.
+int dna_advise(dna_handle_t *h, int advice);
+
+// Starts a thread that reads ahead of dna_read_range() and the k-mer
+// iterator under DNA_ADVICE_SEQUENTIAL or DNA_ADVICE_STRIDED: it faults in
+// the next `ahead` blocks (DNA_DEFAULT_BLOCK_SIZE bases for unblocked files)
+// after the last range read, or the next `ahead` windows one stride apart,
+// decoding coded blocks into the block cache. 0 stops the thread. Must not
+// run concurrently with reads of `h`. Returns 0, or -1 if the thread cannot
+// be started.
+int dna_prefetch(dna_handle_t *h, size_t ahead);
+
+// Block cache counters, summed over the shards of the cache.
+typedef struct {
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t evictions;
+    uint64_t capacity_bytes;  // Budget rounded down to whole blocks
+} dna_cache_stats_t;
+
+// Caches up to `budget_bytes` of decoded coded blocks of `h` (kept packed, a
+// quarter of a byte per base), evicting with CLOCK; 0 disables the cache and
+// clears the counters. Raw blocks are always read straight from the mapping.
+// Must not run concurrently with reads of `h`. Returns 0, or -1 if out of
+// memory (the cache is then disabled).
+int dna_set_cache(dna_handle_t *h, size_t budget_bytes);
+
+// Copies the cache counters of `h` into `stats` (all zero without a cache).
+void dna_cache_stats(const dna_handle_t *h, dna_cache_stats_t *stats);
+
+// Output formats of dna_gather_windows()
+#define DNA_GATHER_CODES 0        // uint8 codes, `len` per window
+#define DNA_GATHER_ONEHOT_I8 1    // int8 [len][4] one-hot rows; N positions are all zero
+#define DNA_GATHER_ONEHOT_F16 2   // IEEE half-precision [len][4] one-hot rows, as uint16
+
+// Decodes the `count` windows [starts[w], starts[w] + len) into `out`, window
+// after window, in the given DNA_GATHER_* format, spreading the windows over
+// the configured threads. Returns 0, or -1 if a window runs past the end of
+// the file (checked before anything is written), the format is unknown, or a
+// block cannot be decoded.
+int dna_gather_windows(const dna_handle_t *h, const uint64_t *starts, size_t count, size_t len, int format,
+                       void *out);
+
+// Bounds of read `i`: from the read offsets of variable-length files, from
+// read_length otherwise. Returns 0, or -1 if `i` is out of range or the file
+// does not record reads.
+int dna_read_extent(const dna_handle_t *h, size_t i, uint64_t *start, uint64_t *length);
+
+// Writes the canonical k-mers of read `i` (see dna_canonical_kmers) to `out`
+// if they fit in `cap`. Returns their number, or -1 for a bad read or `k`.
+// Bases stored for 'N' count as A.
+long dna_read_canonical_kmers(const dna_handle_t *h, size_t i, unsigned k, uint64_t *out, size_t cap);
+
+// Counts the A, C, G and T in elements [start, start + len) into `counts`,
+// straight from the packed bytes. Ns are left out. Blocks wholly inside the
+// range are taken from the block stats section when the file has one, so a
+// whole-file count costs O(number of blocks). Returns 0, or -1 for a bad range.
+int dna_count_bases(const dna_handle_t *h, size_t start, size_t len, uint64_t counts[4]);
+
+// Writes the GC fraction of every `window` elements of [start, start + len),
+// the last window possibly shorter, to `out`. Ns are left out of the
+// fraction. Returns the number of windows, or -1 on error.
+long dna_gc_windows(const dna_handle_t *h, size_t start, size_t len, size_t window, float *out);
+
+// Writes the GC fraction of reads [first, first + count) to `out`. Returns 0,
+// or -1 if a read is out of range.
+int dna_read_gc(const dna_handle_t *h, size_t first, size_t count, float *out);
+
+// Finds every start p in [start, start + len - m] where the m-base `pattern`
+// (codes 0-3, m from 1 to 32) matches elements [p, p + m) with at most
+// `max_mismatches` differing bases (Hamming distance), straight from the
+// packed bytes and split across the configured threads. Matches overlapping
+// an N run are skipped. Writes the first `max_hits` starts, ascending, to
+// `hits` and returns the number of matches, or -1 on error.
+long dna_search(const dna_handle_t *h, size_t start, size_t len, const uint8_t *pattern, unsigned m,
+                unsigned max_mismatches, uint64_t *hits, size_t max_hits);
+
+// Writes the Phred+33 qualities of bases [start, start + len) to `out`, each
+// the representative score of its bin. Returns 0, or -1 if the file has no
+// qualities or the range is out of bounds.
+int dna_read_quals(const dna_handle_t *h, size_t start, size_t len, char *out);
+
+// Decodes the name of read `i` into `buf` (NUL-terminated, truncated to fit
+// `cap`). Returns the full name length, or -1 if the file has no names or the
+// name cannot be decoded.
+long dna_read_name(const dna_handle_t *h, size_t i, char *buf, size_t cap);
+
+// The N runs of `h`, sorted by start, with their number in `*count`.
+const dna_n_run_t *dna_n_runs(const dna_handle_t *h, size_t *count);
+
+// Number of blocks of a blocked file, 0 otherwise.
+size_t dna_num_blocks(const dna_handle_t *h);
+
+// Copies entry `i` of the block index into `blk`. Returns 0, or -1 if out of range.
+int dna_block_info(const dna_handle_t *h, size_t i, dna_block_t *blk);
+
+// Checks block `i` against its stored checksum. Returns 0 if it matches.
+int dna_verify_block(const dna_handle_t *h, size_t i);
+
+// Checks the blocks overlapping elements [start, start + len) and returns how
+// many are corrupt, or -1 for a bad range. Unblocked headered files are checked
+// as a whole; legacy files have nothing to check.
+long dna_verify_range(const dna_handle_t *h, size_t start, size_t len);
+
+void dna_close_mmap(dna_handle_t *h);
+
+// Multi-sample archive: complete headered files ("samples") one after the
+// other in a single file, each starting at a multiple of 4096 bytes, then a
+// directory. Offsets inside a sample are relative to its start. Header:
+//   0  char[4] magic "DNAR"      4  u16 version (1)     6  u16 header size (64)
+//   8  u32 number of samples    12  u32 CRC-32C of the directory
+//  16  u64 offset of the directory                     24  u64 directory length
+//  32  reserved (zero)
+// Each directory entry is a u64 sample offset, u64 sample length in bytes,
+// u64 number of bases, u64 number of reads, u16 name length and the name.
+typedef struct dna_archive_writer dna_archive_writer_t;
+
+// Starts an archive, written to `<filename>.part` until dna_archive_finish().
+// Returns NULL on error.
+dna_archive_writer_t *dna_archive_create(const char *filename);
+
+// Starts sample `name` as dna_writer_open() would with `meta` (which must not
+// be NULL). dna_writer_close() adds it to the directory, dna_writer_abort()
+// drops it; only one sample can be open at a time. Returns NULL on error.
+dna_writer_t *dna_archive_add(dna_archive_writer_t *ar, const char *name, const dna_meta_t *meta);
+
+// Writes the directory, renames the archive into place and frees `ar`.
+// Returns 0, or -1 on error (the partial archive is then removed).
+int dna_archive_finish(dna_archive_writer_t *ar);
+
+// Discards the archive, aborting an open sample, and frees `ar`.
+void dna_archive_discard(dna_archive_writer_t *ar);
+
+typedef struct {
+    const char *name;  // NUL-terminated, valid until dna_archive_close()
+    uint64_t offset;   // Of the sample in the archive
+    uint64_t bytes;
+    uint64_t num_bases;
+    uint64_t num_reads;
+} dna_sample_t;
+
+// Read-only view of an archive: one mapping shared by all its samples.
+typedef struct dna_archive dna_archive_t;
+
+// Maps `filename` and checks its directory. Returns NULL on error.
+dna_archive_t *dna_archive_open(const char *filename);
+
+size_t dna_archive_num_samples(const dna_archive_t *ar);
+
+// Copies directory entry `i` into `sample`. Returns 0, or -1 if out of range.
+int dna_archive_sample(const dna_archive_t *ar, size_t i, dna_sample_t *sample);
+
+// Index of the sample called `name`, or -1 if there is none.
+long dna_archive_find(const dna_archive_t *ar, const char *name);
+
+// A handle on sample `i`, reading from the archive's mapping, for use with
+// every dna_handle_t function. Close it with dna_close_mmap() before the
+// archive. Returns NULL on error.
+dna_handle_t *dna_archive_open_sample(const dna_archive_t *ar, size_t i);
+
+void dna_archive_close(dna_archive_t *ar);
+
+// Streams the k-mers of a mapped file as 2k-bit integers, first base in the
+// most significant bits. In files that record reads (fixed read_length or
+// variable-length) k-mers never cross a read boundary, and the first k-mer of
+// each read is followed by every `step`-th one. K-mers overlapping an N run
+// are skipped. The iterator must be closed before `h`.
+typedef struct dna_kmer_iter dna_kmer_iter_t;
+
+// `k` is 1 to 32 and `step` at least 1. Returns NULL on error.
+dna_kmer_iter_t *dna_kmer_iter_open(const dna_handle_t *h, unsigned k, size_t step);
+
+// Emits canonical k-mers (the smaller of each k-mer and its reverse
+// complement) instead of forward ones when `enable` is non-zero.
+void dna_kmer_iter_canonical(dna_kmer_iter_t *it, int enable);
+
+// Restricts `it` to part `part` (0-based) of `parts` about equal slices of
+// the file: a run of whole reads in files that record reads, otherwise the
+// k-mers starting in a slice of the elements. The parts together yield
+// exactly the k-mers of the whole file, so each can be scanned on its own
+// thread with its own iterator. Call before dna_kmer_iter_next(). Returns 0,
+// or -1 if `part` is out of range.
+int dna_kmer_iter_part(dna_kmer_iter_t *it, size_t part, size_t parts);
+
+// Writes up to `max` k-mers to `out` and, unless `starts` is NULL, the
+// position of each k-mer's first base to `starts`. Returns the number
+// written; 0 once the file is exhausted.
+size_t dna_kmer_iter_next(dna_kmer_iter_t *it, uint64_t *out, uint64_t *starts, size_t max);
+
+void dna_kmer_iter_close(dna_kmer_iter_t *it);
+
+// Reads of at most 32 bases as integer keys, for sorting and deduplicating
+// them without unpacking: key i holds the bases of elements
+// [(first + i) * L, (first + i + 1) * L) as a 2L-bit integer, first base in
+// the most significant bits, so keys order like the reads. `read_length` L
+// is 1 to 32, or 0 to take it from the header of a fixed-length file. Bases
+// stored for 'N' count as A. Returns 0, or -1 if L is unknown or too long or
+// the reads run past the end of the file.
+int dna_read_keys(const dna_handle_t *h, unsigned read_length, size_t first, size_t count, uint64_t *out);
+
+// Sorts `n` keys ascending with a radix sort over their low `bits` bits (the
+// bits above must be equal, 2L for dna_read_keys() output), split across the
+// configured threads. Needs n more keys of scratch memory. Returns 0, or -1
+// if that cannot be allocated (the keys are then unchanged).
+int dna_sort_keys(uint64_t *keys, size_t n, unsigned bits);
+
+// Collapses each run of equal keys of the sorted `keys` into its first entry,
+// in place, and writes the run lengths (saturating) to `counts` unless it is
+// NULL. Returns the number of distinct keys.
+size_t dna_collapse_keys(uint64_t *keys, size_t n, uint32_t *counts);
+
+#endif
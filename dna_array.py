@@ -1,6 +1,7 @@
 import ctypes
 import numpy as np
 import mmap
+import contextlib
 
 # Load the shared library
 dna_array_lib = ctypes.CDLL('./dna_array.so')  # Use .dll on Windows
@@ -15,52 +16,986 @@ dna_array_lib.read_large_array_from_file.argtypes = [
 dna_array_lib.read_large_array_from_file.restype = None
 dna_array_lib.save_large_array_to_file.restype = None
 
-def save_large_array(filename, arr):
+class DnaMeta(ctypes.Structure):
+    """Mirror of `dna_meta_t` in dna_array.h."""
+    _fields_ = [
+        ("num_bases", ctypes.c_uint64),
+        ("num_reads", ctypes.c_uint64),
+        ("read_length", ctypes.c_uint64),
+        ("block_size", ctypes.c_uint32),
+        ("flags", ctypes.c_uint32),
+        ("checksum", ctypes.c_uint32),
+    ]
+
+dna_array_lib.dna_save_with_header.argtypes = [
+    ctypes.c_char_p,                 # const char *filename
+    ctypes.POINTER(ctypes.c_uint8),  # const uint8_t *arr
+    ctypes.c_size_t,                 # size_t size
+    ctypes.POINTER(DnaMeta)          # const dna_meta_t *meta
+]
+dna_array_lib.dna_save_with_header.restype = ctypes.c_int
+dna_array_lib.dna_save_checked.argtypes = [
+    ctypes.c_char_p,                 # const char *filename
+    ctypes.POINTER(ctypes.c_uint8),  # const uint8_t *arr
+    ctypes.c_size_t,                 # size_t size
+    ctypes.POINTER(DnaMeta)          # const dna_meta_t *meta, NULL for a headerless file
+]
+dna_array_lib.dna_save_checked.restype = ctypes.c_int
+dna_array_lib.dna_read_checked.argtypes = [
+    ctypes.c_char_p,                 # const char *filename
+    ctypes.POINTER(ctypes.c_uint8),  # uint8_t *arr
+    ctypes.c_size_t                  # size_t size
+]
+dna_array_lib.dna_read_checked.restype = ctypes.c_int
+dna_array_lib.dna_read_header.argtypes = [ctypes.c_char_p, ctypes.POINTER(DnaMeta)]
+dna_array_lib.dna_read_header.restype = ctypes.c_int
+
+dna_array_lib.dna_pack.argtypes = [
+    ctypes.POINTER(ctypes.c_uint8),  # const uint8_t *src
+    ctypes.c_size_t,                 # size_t n
+    ctypes.POINTER(ctypes.c_uint8)   # uint8_t *dst
+]
+dna_array_lib.dna_pack.restype = None
+dna_array_lib.dna_pack_checked.argtypes = [
+    ctypes.POINTER(ctypes.c_uint8),  # const uint8_t *src
+    ctypes.c_size_t,                 # size_t n
+    ctypes.POINTER(ctypes.c_uint8)   # uint8_t *dst
+]
+dna_array_lib.dna_pack_checked.restype = ctypes.c_int
+
+dna_array_lib.dna_unpack.argtypes = [
+    ctypes.POINTER(ctypes.c_uint8),  # const uint8_t *src
+    ctypes.c_size_t,                 # size_t offset
+    ctypes.c_size_t,                 # size_t n
+    ctypes.POINTER(ctypes.c_uint8)   # uint8_t *dst
+]
+dna_array_lib.dna_unpack.restype = None
+
+dna_array_lib.dna_revcomp.argtypes = [
+    ctypes.POINTER(ctypes.c_uint8),  # const uint8_t *src
+    ctypes.c_size_t,                 # size_t offset
+    ctypes.c_size_t,                 # size_t n
+    ctypes.POINTER(ctypes.c_uint8)   # uint8_t *dst
+]
+dna_array_lib.dna_revcomp.restype = None
+dna_array_lib.dna_canonical_kmers.argtypes = [
+    ctypes.POINTER(ctypes.c_uint8),   # const uint8_t *src
+    ctypes.c_size_t,                  # size_t offset
+    ctypes.c_size_t,                  # size_t n
+    ctypes.c_uint,                    # unsigned k
+    ctypes.POINTER(ctypes.c_uint64)   # uint64_t *out
+]
+dna_array_lib.dna_canonical_kmers.restype = ctypes.c_size_t
+
+class DnaCacheStats(ctypes.Structure):
+    """Mirror of `dna_cache_stats_t` in dna_array.h."""
+    _fields_ = [
+        ("hits", ctypes.c_uint64),
+        ("misses", ctypes.c_uint64),
+        ("evictions", ctypes.c_uint64),
+        ("capacity_bytes", ctypes.c_uint64),
+    ]
+
+class DnaSample(ctypes.Structure):
+    """Mirror of `dna_sample_t` in dna_array.h."""
+    _fields_ = [
+        ("name", ctypes.c_char_p),
+        ("offset", ctypes.c_uint64),
+        ("bytes", ctypes.c_uint64),
+        ("num_bases", ctypes.c_uint64),
+        ("num_reads", ctypes.c_uint64),
+    ]
+
+dna_array_lib.dna_open_mmap.argtypes = [ctypes.c_char_p, ctypes.c_size_t]
+dna_array_lib.dna_open_mmap.restype = ctypes.c_void_p
+dna_array_lib.dna_handle_size.argtypes = [ctypes.c_void_p]
+dna_array_lib.dna_handle_size.restype = ctypes.c_size_t
+dna_array_lib.dna_handle_meta.argtypes = [ctypes.c_void_p, ctypes.POINTER(DnaMeta)]
+dna_array_lib.dna_handle_meta.restype = ctypes.c_int
+dna_array_lib.dna_handle_data.argtypes = [ctypes.c_void_p, ctypes.POINTER(ctypes.c_size_t)]
+dna_array_lib.dna_handle_data.restype = ctypes.c_void_p
+dna_array_lib.dna_read_range.argtypes = [
+    ctypes.c_void_p,                 # const dna_handle_t *h
+    ctypes.c_size_t,                 # size_t start
+    ctypes.c_size_t,                 # size_t len
+    ctypes.POINTER(ctypes.c_uint8)   # uint8_t *out
+]
+dna_array_lib.dna_read_range.restype = ctypes.c_int
+dna_array_lib.dna_read_range_n.argtypes = [
+    ctypes.c_void_p,                 # const dna_handle_t *h
+    ctypes.c_size_t,                 # size_t start
+    ctypes.c_size_t,                 # size_t len
+    ctypes.POINTER(ctypes.c_uint8),  # uint8_t *out
+    ctypes.c_uint8                   # uint8_t n_code
+]
+dna_array_lib.dna_read_range_n.restype = ctypes.c_int
+dna_array_lib.dna_gather_windows.argtypes = [
+    ctypes.c_void_p,                  # const dna_handle_t *h
+    ctypes.POINTER(ctypes.c_uint64),  # const uint64_t *starts
+    ctypes.c_size_t,                  # size_t count
+    ctypes.c_size_t,                  # size_t len
+    ctypes.c_int,                     # int format
+    ctypes.c_void_p                   # void *out
+]
+dna_array_lib.dna_gather_windows.restype = ctypes.c_int
+dna_array_lib.dna_read_extent.argtypes = [
+    ctypes.c_void_p,                  # const dna_handle_t *h
+    ctypes.c_size_t,                  # size_t i
+    ctypes.POINTER(ctypes.c_uint64),  # uint64_t *start
+    ctypes.POINTER(ctypes.c_uint64)   # uint64_t *length
+]
+dna_array_lib.dna_read_extent.restype = ctypes.c_int
+dna_array_lib.dna_read_canonical_kmers.argtypes = [
+    ctypes.c_void_p,                  # const dna_handle_t *h
+    ctypes.c_size_t,                  # size_t i
+    ctypes.c_uint,                    # unsigned k
+    ctypes.POINTER(ctypes.c_uint64),  # uint64_t *out
+    ctypes.c_size_t                   # size_t cap
+]
+dna_array_lib.dna_read_canonical_kmers.restype = ctypes.c_long
+dna_array_lib.dna_kmer_iter_open.argtypes = [ctypes.c_void_p, ctypes.c_uint, ctypes.c_size_t]
+dna_array_lib.dna_kmer_iter_open.restype = ctypes.c_void_p
+dna_array_lib.dna_kmer_iter_canonical.argtypes = [ctypes.c_void_p, ctypes.c_int]
+dna_array_lib.dna_kmer_iter_canonical.restype = None
+dna_array_lib.dna_kmer_iter_next.argtypes = [
+    ctypes.c_void_p,                  # dna_kmer_iter_t *it
+    ctypes.POINTER(ctypes.c_uint64),  # uint64_t *out
+    ctypes.POINTER(ctypes.c_uint64),  # uint64_t *starts
+    ctypes.c_size_t                   # size_t max
+]
+dna_array_lib.dna_kmer_iter_next.restype = ctypes.c_size_t
+dna_array_lib.dna_kmer_iter_close.argtypes = [ctypes.c_void_p]
+dna_array_lib.dna_kmer_iter_close.restype = None
+dna_array_lib.dna_read_keys.argtypes = [
+    ctypes.c_void_p,                  # const dna_handle_t *h
+    ctypes.c_uint,                    # unsigned read_length
+    ctypes.c_size_t,                  # size_t first
+    ctypes.c_size_t,                  # size_t count
+    ctypes.POINTER(ctypes.c_uint64)   # uint64_t *out
+]
+dna_array_lib.dna_read_keys.restype = ctypes.c_int
+dna_array_lib.dna_sort_keys.argtypes = [
+    ctypes.POINTER(ctypes.c_uint64),  # uint64_t *keys
+    ctypes.c_size_t,                  # size_t n
+    ctypes.c_uint                     # unsigned bits
+]
+dna_array_lib.dna_sort_keys.restype = ctypes.c_int
+dna_array_lib.dna_collapse_keys.argtypes = [
+    ctypes.POINTER(ctypes.c_uint64),  # uint64_t *keys
+    ctypes.c_size_t,                  # size_t n
+    ctypes.POINTER(ctypes.c_uint32)   # uint32_t *counts
+]
+dna_array_lib.dna_collapse_keys.restype = ctypes.c_size_t
+dna_array_lib.dna_count_bases.argtypes = [
+    ctypes.c_void_p,                 # const dna_handle_t *h
+    ctypes.c_size_t,                 # size_t start
+    ctypes.c_size_t,                 # size_t len
+    ctypes.POINTER(ctypes.c_uint64)  # uint64_t counts[4]
+]
+dna_array_lib.dna_count_bases.restype = ctypes.c_int
+dna_array_lib.dna_gc_windows.argtypes = [
+    ctypes.c_void_p,                # const dna_handle_t *h
+    ctypes.c_size_t,                # size_t start
+    ctypes.c_size_t,                # size_t len
+    ctypes.c_size_t,                # size_t window
+    ctypes.POINTER(ctypes.c_float)  # float *out
+]
+dna_array_lib.dna_gc_windows.restype = ctypes.c_long
+dna_array_lib.dna_read_gc.argtypes = [
+    ctypes.c_void_p,                # const dna_handle_t *h
+    ctypes.c_size_t,                # size_t first
+    ctypes.c_size_t,                # size_t count
+    ctypes.POINTER(ctypes.c_float)  # float *out
+]
+dna_array_lib.dna_read_gc.restype = ctypes.c_int
+dna_array_lib.dna_search.argtypes = [
+    ctypes.c_void_p,                  # const dna_handle_t *h
+    ctypes.c_size_t,                  # size_t start
+    ctypes.c_size_t,                  # size_t len
+    ctypes.POINTER(ctypes.c_uint8),   # const uint8_t *pattern
+    ctypes.c_uint,                    # unsigned m
+    ctypes.c_uint,                    # unsigned max_mismatches
+    ctypes.POINTER(ctypes.c_uint64),  # uint64_t *hits
+    ctypes.c_size_t                   # size_t max_hits
+]
+dna_array_lib.dna_search.restype = ctypes.c_long
+dna_array_lib.dna_read_quals.argtypes = [
+    ctypes.c_void_p,  # const dna_handle_t *h
+    ctypes.c_size_t,  # size_t start
+    ctypes.c_size_t,  # size_t len
+    ctypes.c_char_p   # char *out
+]
+dna_array_lib.dna_read_quals.restype = ctypes.c_int
+dna_array_lib.dna_read_name.argtypes = [
+    ctypes.c_void_p,  # const dna_handle_t *h
+    ctypes.c_size_t,  # size_t i
+    ctypes.c_char_p,  # char *buf
+    ctypes.c_size_t   # size_t cap
+]
+dna_array_lib.dna_read_name.restype = ctypes.c_long
+dna_array_lib.dna_num_blocks.argtypes = [ctypes.c_void_p]
+dna_array_lib.dna_num_blocks.restype = ctypes.c_size_t
+dna_array_lib.dna_verify_range.argtypes = [ctypes.c_void_p, ctypes.c_size_t, ctypes.c_size_t]
+dna_array_lib.dna_verify_range.restype = ctypes.c_long
+dna_array_lib.dna_set_cache.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+dna_array_lib.dna_set_cache.restype = ctypes.c_int
+dna_array_lib.dna_cache_stats.argtypes = [ctypes.c_void_p, ctypes.POINTER(DnaCacheStats)]
+dna_array_lib.dna_cache_stats.restype = None
+dna_array_lib.dna_advise.argtypes = [ctypes.c_void_p, ctypes.c_int]
+dna_array_lib.dna_advise.restype = ctypes.c_int
+dna_array_lib.dna_prefetch.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+dna_array_lib.dna_prefetch.restype = ctypes.c_int
+dna_array_lib.dna_close_mmap.argtypes = [ctypes.c_void_p]
+dna_array_lib.dna_close_mmap.restype = None
+dna_array_lib.dna_archive_open.argtypes = [ctypes.c_char_p]
+dna_array_lib.dna_archive_open.restype = ctypes.c_void_p
+dna_array_lib.dna_archive_num_samples.argtypes = [ctypes.c_void_p]
+dna_array_lib.dna_archive_num_samples.restype = ctypes.c_size_t
+dna_array_lib.dna_archive_sample.argtypes = [
+    ctypes.c_void_p,              # const dna_archive_t *ar
+    ctypes.c_size_t,              # size_t i
+    ctypes.POINTER(DnaSample)     # dna_sample_t *sample
+]
+dna_array_lib.dna_archive_sample.restype = ctypes.c_int
+dna_array_lib.dna_archive_find.argtypes = [ctypes.c_void_p, ctypes.c_char_p]
+dna_array_lib.dna_archive_find.restype = ctypes.c_long
+dna_array_lib.dna_archive_open_sample.argtypes = [ctypes.c_void_p, ctypes.c_size_t]
+dna_array_lib.dna_archive_open_sample.restype = ctypes.c_void_p
+dna_array_lib.dna_archive_close.argtypes = [ctypes.c_void_p]
+dna_array_lib.dna_archive_close.restype = None
+
+dna_array_lib.dna_set_num_threads.argtypes = [ctypes.c_int]
+dna_array_lib.dna_set_num_threads.restype = None
+
+def set_num_threads(n):
+    """
+    Set the number of threads the C library uses for large pack/unpack calls.
+
+    Args:
+        n (int): Thread count; 0 uses every online CPU, 1 disables threading.
+    """
+    dna_array_lib.dna_set_num_threads(n)
+
+def _ptr(arr):
+    return arr.ctypes.data_as(ctypes.POINTER(ctypes.c_uint8))
+
+def _out(out, size):
+    """Return `out` if it can take `size` uint8 elements in place, or a new array."""
+    if out is None:
+        return np.empty(size, dtype=np.uint8)
+    if out.dtype != np.uint8 or out.size != size or not out.flags.c_contiguous or not out.flags.writeable:
+        raise ValueError(f"out must be a writeable contiguous uint8 array of {size} elements.")
+    return out
+
+def pack(arr, out=None):
+    """
+    Pack an array of 2-bit codes in memory, without touching the filesystem.
+
+    Args:
+        arr (numpy.ndarray): A contiguous NumPy array of uint8 elements (values 0-3).
+        out (numpy.ndarray): Optional uint8 array of (arr.size + 3) // 4
+            elements to pack into, instead of a new one.
+
+    Returns:
+        numpy.ndarray: The packed bytes, (arr.size + 3) // 4 of them.
+
+    Raises:
+        ValueError: If array contains values outside the range [0, 3]; the
+            check is made by the pack kernel in the same pass.
+    """
+    if arr.dtype != np.uint8:
+        raise ValueError("Array must be of type uint8.")
+    arr = np.ascontiguousarray(arr)
+    packed = _out(out, (arr.size + 3) // 4)
+    if dna_array_lib.dna_pack_checked(_ptr(arr), arr.size, _ptr(packed)) != 0:
+        raise ValueError("Array values must be in the range [0, 3].")
+    return packed
+
+def unpack(packed, size, offset=0, out=None):
+    """
+    Unpack `size` 2-bit elements starting at element `offset` of a packed buffer.
+
+    Args:
+        packed (numpy.ndarray): Packed bytes as produced by `pack`.
+        size (int): The number of 2-bit elements to unpack.
+        offset (int): Index of the first element; need not be a multiple of 4.
+        out (numpy.ndarray): Optional uint8 array of `size` elements to unpack
+            into, instead of a new one.
+
+    Returns:
+        numpy.ndarray: A NumPy array containing the unpacked data.
+    """
+    if packed.dtype != np.uint8:
+        raise ValueError("Packed buffer must be of type uint8.")
+    if (offset + size + 3) // 4 > packed.size:
+        raise ValueError("Range exceeds the packed buffer.")
+    packed = np.ascontiguousarray(packed)
+    arr = _out(out, size)
+    dna_array_lib.dna_unpack(_ptr(packed), offset, size, _ptr(arr))
+    return arr
+
+def reverse_complement(packed, size, offset=0):
+    """
+    Reverse complement of `size` packed elements starting at element `offset`,
+    computed on the packed bytes.
+
+    Args:
+        packed (numpy.ndarray): Packed bytes as produced by `pack`.
+        size (int): The number of 2-bit elements.
+        offset (int): Index of the first element; need not be a multiple of 4.
+
+    Returns:
+        numpy.ndarray: The packed reverse complement, (size + 3) // 4 bytes.
+    """
+    if packed.dtype != np.uint8:
+        raise ValueError("Packed buffer must be of type uint8.")
+    if (offset + size + 3) // 4 > packed.size:
+        raise ValueError("Range exceeds the packed buffer.")
+    packed = np.ascontiguousarray(packed)
+    out = np.empty((size + 3) // 4, dtype=np.uint8)
+    dna_array_lib.dna_revcomp(_ptr(packed), offset, size, _ptr(out))
+    return out
+
+def canonical_kmers(packed, size, k, offset=0):
+    """
+    Canonical k-mers of `size` packed elements starting at element `offset`.
+
+    Args:
+        packed (numpy.ndarray): Packed bytes as produced by `pack`.
+        size (int): The number of 2-bit elements.
+        k (int): k-mer length, 1 to 32.
+        offset (int): Index of the first element; need not be a multiple of 4.
+
+    Returns:
+        numpy.ndarray: size - k + 1 uint64 values, each the smaller of a k-mer
+        and its reverse complement, first base in the most significant bits.
+    """
+    if packed.dtype != np.uint8:
+        raise ValueError("Packed buffer must be of type uint8.")
+    if not 1 <= k <= 32:
+        raise ValueError("k must be between 1 and 32.")
+    if (offset + size + 3) // 4 > packed.size:
+        raise ValueError("Range exceeds the packed buffer.")
+    packed = np.ascontiguousarray(packed)
+    out = np.empty(max(size - k + 1, 0), dtype=np.uint64)
+    dna_array_lib.dna_canonical_kmers(_ptr(packed), offset, size, k,
+                                      out.ctypes.data_as(ctypes.POINTER(ctypes.c_uint64)))
+    return out
+
+def sort_keys(keys, bits=64):
+    """
+    Sort uint64 keys in place with the library's parallel radix sort.
+
+    Args:
+        keys (numpy.ndarray): Contiguous uint64 keys, e.g. from
+            `PackedArrayMmap.read_keys`.
+        bits (int): Sort on the low `bits` bits only (2 * read length for
+            read keys); the bits above must be equal across keys.
+
+    Returns:
+        numpy.ndarray: `keys`, sorted.
+    """
+    if keys.dtype != np.uint64 or not keys.flags.c_contiguous or not keys.flags.writeable:
+        raise ValueError("keys must be a writeable contiguous uint64 array.")
+    if dna_array_lib.dna_sort_keys(keys.ctypes.data_as(ctypes.POINTER(ctypes.c_uint64)), keys.size, bits) != 0:
+        raise MemoryError("Failed to allocate the sort buffer")
+    return keys
+
+def collapse_keys(keys):
+    """
+    Collapse runs of equal keys of a sorted array.
+
+    Args:
+        keys (numpy.ndarray): Sorted uint64 keys; left unchanged.
+
+    Returns:
+        tuple: (keys, counts): the distinct keys in order and the uint32
+            number of times each occurs.
+    """
+    out = np.array(keys, dtype=np.uint64, copy=True, order='C')
+    counts = np.empty(out.size, dtype=np.uint32)
+    n = dna_array_lib.dna_collapse_keys(out.ctypes.data_as(ctypes.POINTER(ctypes.c_uint64)), out.size,
+                                        counts.ctypes.data_as(ctypes.POINTER(ctypes.c_uint32)))
+    return out[:n], counts[:n]
+
+def read_header(filename):
+    """
+    Read the header of a packed file.
+
+    Args:
+        filename (str): The path to the binary file.
+
+    Returns:
+        dict: The header fields, or None for a legacy headerless file.
+    """
+    meta = DnaMeta()
+    status = dna_array_lib.dna_read_header(filename.encode('utf-8'), ctypes.byref(meta))
+    if status < 0:
+        raise OSError(f"Failed to read {filename}")
+    if status == 0:
+        return None
+    return {name: getattr(meta, name) for name, _ in DnaMeta._fields_}
+
+def save_large_array(filename, arr, header=False, num_reads=0, read_length=0, block_size=0):
     """
     Python interface for the C function `save_large_array_to_file`.
 
     Args:
         filename (str): The path to save the binary file.
         arr (numpy.ndarray): A NumPy array of uint8 elements (values 0-3).
+        header (bool): Write a self-describing header (`dna_save_with_header`).
+        num_reads (int): Number of reads recorded in the header.
+        read_length (int): Fixed read length recorded in the header.
+        block_size (int): Write a blocked file with this many bases per block
+            (a multiple of 4); implies `header`.
 
     Raises:
-        ValueError: If array contains values outside the range [0, 3].
+        ValueError: If array contains values outside the range [0, 3]. The
+            pack kernel checks the values while packing, and the partly
+            written file is removed.
     """
     if arr.dtype != np.uint8:
         raise ValueError("Array must be of type uint8.")
-    if not np.all((arr >= 0) & (arr <= 3)):
-        raise ValueError("Array values must be in the range [0, 3].")
+    arr = np.ascontiguousarray(arr)
 
-    # Call the C function to save the array
-    dna_array_lib.save_large_array_to_file(
-        filename.encode('utf-8'),  # Convert filename to bytes
-        arr.ctypes.data_as(ctypes.POINTER(ctypes.c_uint8)),  # Pass array pointer
-        arr.size
-    )
+    meta = None
+    if header or block_size:
+        meta = ctypes.byref(DnaMeta(num_reads=num_reads, read_length=read_length, block_size=block_size))
+    status = dna_array_lib.dna_save_checked(filename.encode('utf-8'), _ptr(arr), arr.size, meta)
+    if status == -2:
+        raise ValueError("Array values must be in the range [0, 3].")
+    if status != 0:
+        raise OSError(f"Failed to write {filename}")
 
-def read_large_array(filename, size):
+def read_large_array(filename, size=None, out=None):
     """
-    Python interface for the C function `read_large_array_from_file`.
+    Python interface for the C function `dna_read_checked`.
 
     Args:
         filename (str): The path to the binary file containing packed data.
-        size (int): The number of 2-bit elements to unpack.
+        size (int): The number of 2-bit elements to unpack. Optional for files
+            with a header, which record their own length, or when `out` is given.
+        out (numpy.ndarray): Optional uint8 array to decode into, for example
+            a reused loader buffer; its size is the number of elements read.
 
     Returns:
         numpy.ndarray: A NumPy array containing the unpacked data.
+
+    Raises:
+        OSError: If the file cannot be opened or read.
+        ValueError: If the file holds fewer than `size` elements or fails its
+            checksum.
     """
-    # Allocate space for the array
-    arr = np.zeros(size, dtype=np.uint8)
+    if size is None and out is not None:
+        size = out.size
+    if size is None:
+        meta = read_header(filename)
+        if meta is None:
+            raise ValueError("Headerless file: `size` is required.")
+        size = meta["num_bases"]
+
+    # Every element is written unless the read fails, which raises, so the
+    # array needs no zeroing
+    arr = _out(out, size)
 
     # Call the C function
-    dna_array_lib.read_large_array_from_file(
+    status = dna_array_lib.dna_read_checked(
         filename.encode('utf-8'),  # Convert filename to bytes
         arr.ctypes.data_as(ctypes.POINTER(ctypes.c_uint8)),  # Pass the array as pointer
         size
     )
+    if status == -2:
+        raise ValueError(f"{filename} holds fewer than {size} elements or fails its checksum.")
+    if status != 0:
+        raise OSError(f"Failed to read {filename}")
 
     return arr
 
+def read_kmer_counts(filename):
+    """
+    Load a k-mer count table written by `dna_array_kmer`.
+
+    Args:
+        filename (str): The path to the table.
+
+    Returns:
+        tuple: (kmers, counts, k): the k-mers in ascending order as a uint64
+            array (2k-bit codes, first base in the high bits), their uint32
+            counts, and k.
+    """
+    raw = np.fromfile(filename, dtype=np.uint8)
+    if raw.size < 32 or raw[:4].tobytes() != b"DNAK":
+        raise ValueError(f"{filename} is not a k-mer count table")
+    k = int(raw[8:12].view('<u4')[0])
+    num_entries = int(raw[16:24].view('<u8')[0])
+    key_bytes = int(raw[28:32].view('<u4')[0])
+    entries = raw[32:32 + num_entries * (key_bytes + 4)].reshape(num_entries, key_bytes + 4)
+    keys = np.zeros((num_entries, 8), dtype=np.uint8)
+    keys[:, :key_bytes] = entries[:, :key_bytes]
+    counts = np.ascontiguousarray(entries[:, key_bytes:]).view('<u4').ravel()
+    return keys.view('<u8').ravel(), counts, k
+
+class PackedArrayMmap:
+    """
+    Random access to a packed file through the C memory-mapped reader.
+
+    Slices are decoded by `dna_read_range` directly into a fresh array, so
+    nothing is cached and any start position costs the same. With `sample`,
+    `filename` is an archive (`dna_array_fastq -A`) and the named sample is
+    read from the archive's mapping.
+    """
+    def __init__(self, filename, num_elements=0, sample=None):
+        self.filename = filename
+        self.sample = sample
+        self._archive = None
+        if sample is None:
+            self.handle = dna_array_lib.dna_open_mmap(filename.encode('utf-8'), num_elements)
+        else:
+            self._archive = dna_array_lib.dna_archive_open(filename.encode('utf-8'))
+            i = dna_array_lib.dna_archive_find(self._archive, sample.encode('utf-8')) if self._archive else -1
+            self.handle = dna_array_lib.dna_archive_open_sample(self._archive, i) if i >= 0 else None
+        if not self.handle:
+            if self._archive:
+                dna_array_lib.dna_archive_close(self._archive)
+                self._archive = None
+            raise OSError(f"Failed to map {filename}" + (f" sample {sample}" if sample is not None else ""))
+        self.num_elements = dna_array_lib.dna_handle_size(self.handle)
+        self._views = 0
+
+    def __len__(self):
+        return self.num_elements
+
+    def __getitem__(self, key):
+        if isinstance(key, int):
+            if key < 0:
+                key += self.num_elements
+            if key < 0 or key >= self.num_elements:
+                raise IndexError("Index out of range")
+            return self[key:key + 1][0]
+
+        elif isinstance(key, slice):
+            start, stop, step = key.indices(self.num_elements)
+            if step != 1:
+                return self[start:stop][::step] if stop > start else np.empty(0, dtype=np.uint8)
+            return self.read(start, stop)
+
+        else:
+            raise TypeError("Invalid index type")
+
+    def read(self, start=0, stop=None, n_value=None, out=None):
+        """
+        Decode elements [start, stop), optionally restoring 'N' positions.
+
+        Args:
+            start (int): First element.
+            stop (int): End of the range, the end of the file by default.
+            n_value (int): Value written where the file recorded an 'N', for
+                example 4 or ord('N'). None leaves the stored code 0.
+            out (numpy.ndarray): Optional uint8 array of stop - start elements
+                to decode into, instead of a new one.
+
+        Returns:
+            numpy.ndarray: The decoded elements.
+        """
+        stop = self.num_elements if stop is None else stop
+        out = _out(out, max(stop - start, 0))
+        if n_value is None:
+            status = dna_array_lib.dna_read_range(self.handle, start, out.size, _ptr(out))
+        else:
+            status = dna_array_lib.dna_read_range_n(self.handle, start, out.size, _ptr(out), n_value)
+        if status != 0:
+            raise IndexError("Range out of bounds")
+        return out
+
+    @contextlib.contextmanager
+    def packed_view(self, start=0, stop=None):
+        """
+        Read-only view of the packed bytes holding elements [start, stop),
+        straight from the mapping, without copying. The view is only valid
+        inside the `with` block; `close` refuses to unmap while one is open.
+
+        Args:
+            start (int): First element.
+            stop (int): End of the range, the end of the file by default.
+
+        Yields:
+            tuple: (bytes, offset) -- a uint8 array of the packed bytes and the
+            index of element `start` within them (0 to 3), ready for `unpack`.
+        """
+        stop = self.num_elements if stop is None else stop
+        if not 0 <= start <= stop <= self.num_elements:
+            raise IndexError("Range out of bounds")
+        nbytes = ctypes.c_size_t()
+        addr = dna_array_lib.dna_handle_data(self.handle, ctypes.byref(nbytes))
+        if not addr:
+            raise ValueError("Files with coded blocks have no packed view.")
+        first, last = start // 4, (stop + 3) // 4
+        view = np.ctypeslib.as_array((ctypes.c_uint8 * (last - first)).from_address(addr + first))
+        view.flags.writeable = False
+        self._views += 1
+        try:
+            yield view, start % 4
+        finally:
+            self._views -= 1
+
+    def gather(self, starts, length, onehot=None, out=None):
+        """
+        Decode many windows of `length` elements in one call, for example the
+        random training windows of a batch. The windows are decoded on the
+        threads set by `set_num_threads`, and ctypes releases the GIL for the
+        call, so DataLoader worker threads do not serialize on it.
+
+        Args:
+            starts (array-like): Start element of every window.
+            length (int): Elements per window.
+            onehot (type): None for uint8 codes, or np.int8 / np.float16 for
+                one-hot rows in A, C, G, T order (all zero at N positions).
+            out (numpy.ndarray): Optional array to decode into, of shape
+                (len(starts), length), or (len(starts), length, 4) with `onehot`.
+
+        Returns:
+            numpy.ndarray: The windows, one per row; transpose the last two
+            axes of one-hot output for channels-first models.
+        """
+        starts = np.ascontiguousarray(starts, dtype=np.uint64)
+        formats = {None: (0, np.uint8), np.int8: (1, np.int8), np.float16: (2, np.float16)}
+        key = None if onehot is None else np.dtype(onehot).type
+        if key not in formats:
+            raise ValueError("onehot must be None, np.int8 or np.float16.")
+        fmt, dtype = formats[key]
+        shape = (starts.size, length) if fmt == 0 else (starts.size, length, 4)
+        if out is None:
+            out = np.empty(shape, dtype=dtype)
+        elif out.dtype != dtype or out.shape != shape or not out.flags.c_contiguous or not out.flags.writeable:
+            raise ValueError(f"out must be a writeable contiguous {np.dtype(dtype).name} array of shape {shape}.")
+        if dna_array_lib.dna_gather_windows(self.handle, starts.ctypes.data_as(ctypes.POINTER(ctypes.c_uint64)),
+                                            starts.size, length, fmt, out.ctypes.data) != 0:
+            raise IndexError("Window out of bounds or undecodable block")
+        return out
+
+    def read_extent(self, i):
+        """
+        Locate read `i` of a file that records reads.
+
+        Returns:
+            tuple: (start, length) of the read in elements.
+        """
+        start, length = ctypes.c_uint64(), ctypes.c_uint64()
+        if dna_array_lib.dna_read_extent(self.handle, i, ctypes.byref(start), ctypes.byref(length)) != 0:
+            raise IndexError("Read index out of range")
+        return start.value, length.value
+
+    def get_read(self, i, n_value=None):
+        """
+        Decode read `i`, located in O(1) through the read offsets of a
+        variable-length file or the fixed read length of any other file.
+        """
+        start, length = self.read_extent(i)
+        return self.read(start, start + length, n_value)
+
+    def canonical_kmers(self, i, k):
+        """
+        Canonical k-mers of read `i`, computed on the packed bases.
+
+        Returns:
+            numpy.ndarray: uint64 k-mers, see `canonical_kmers`.
+        """
+        start, length = self.read_extent(i)
+        out = np.empty(max(length - k + 1, 0), dtype=np.uint64)
+        n = dna_array_lib.dna_read_canonical_kmers(self.handle, i, k,
+                                                   out.ctypes.data_as(ctypes.POINTER(ctypes.c_uint64)), out.size)
+        if n < 0:
+            raise ValueError("k must be between 1 and 32")
+        return out
+
+    def kmers(self, k, step=1, canonical=False, positions=False, batch=1 << 16):
+        """
+        Stream the k-mers of the file in batches, without unpacking it. K-mers
+        stay inside reads and skip N runs; see `dna_kmer_iter_open`.
+
+        Args:
+            k (int): k-mer length, 1 to 32.
+            step (int): Emit every `step`-th k-mer of each read.
+            canonical (bool): Emit canonical instead of forward k-mers.
+            positions (bool): Also yield the start of each k-mer.
+            batch (int): Largest number of k-mers per yielded array.
+
+        Yields:
+            numpy.ndarray: uint64 k-mers, or (k-mers, starts) with `positions`.
+        """
+        it = dna_array_lib.dna_kmer_iter_open(self.handle, k, step)
+        if not it:
+            raise ValueError("k must be between 1 and 32 and step at least 1")
+        try:
+            dna_array_lib.dna_kmer_iter_canonical(it, int(canonical))
+            u64 = ctypes.POINTER(ctypes.c_uint64)
+            while True:
+                out = np.empty(batch, dtype=np.uint64)
+                starts = np.empty(batch, dtype=np.uint64) if positions else None
+                n = dna_array_lib.dna_kmer_iter_next(it, out.ctypes.data_as(u64),
+                                                     starts.ctypes.data_as(u64) if positions else None, batch)
+                if n == 0:
+                    break
+                yield (out[:n], starts[:n]) if positions else out[:n]
+        finally:
+            dna_array_lib.dna_kmer_iter_close(it)
+
+    def read_keys(self, first=0, count=None, read_length=0):
+        """
+        Reads [first, first + count) of at most 32 bases as uint64 keys,
+        straight from the packed bytes; see `dna_read_keys`. Keys order like
+        the reads, so `sort_keys` and `collapse_keys` deduplicate them.
+
+        Args:
+            first (int): Index of the first read.
+            count (int): Number of reads; None reads to the end.
+            read_length (int): Bases per read; 0 takes it from the header.
+
+        Returns:
+            numpy.ndarray: One uint64 per read, first base in the high bits
+            of its 2 * read_length bits.
+        """
+        if read_length == 0:
+            meta = DnaMeta()
+            variable = 0x2  # DNA_FLAG_VARIABLE
+            if dna_array_lib.dna_handle_meta(self.handle, ctypes.byref(meta)) != 1 or meta.flags & variable:
+                raise ValueError("The file has no fixed read length; pass read_length")
+            read_length = meta.read_length
+        if not 1 <= read_length <= 32:
+            raise ValueError("Reads must be 1 to 32 bases long")
+        if count is None:
+            count = max(self.num_elements // read_length - first, 0)
+        out = np.empty(count, dtype=np.uint64)
+        if dna_array_lib.dna_read_keys(self.handle, read_length, first, count,
+                                       out.ctypes.data_as(ctypes.POINTER(ctypes.c_uint64))) != 0:
+            raise IndexError("Reads out of range or not decodable")
+        return out
+
+    def count_bases(self, start=0, stop=None):
+        """
+        Count A, C, G and T in elements [start, stop), Ns left out, without
+        unpacking. Whole blocks come from the block stats of blocked files.
+
+        Returns:
+            numpy.ndarray: Four uint64 counts, indexed by code.
+        """
+        stop = self.num_elements if stop is None else stop
+        counts = np.zeros(4, dtype=np.uint64)
+        if dna_array_lib.dna_count_bases(self.handle, start, max(stop - start, 0),
+                                         counts.ctypes.data_as(ctypes.POINTER(ctypes.c_uint64))) != 0:
+            raise IndexError("Range out of bounds")
+        return counts
+
+    def gc_windows(self, window, start=0, stop=None):
+        """
+        GC fraction of every `window` elements of [start, stop), the last
+        window possibly shorter.
+
+        Returns:
+            numpy.ndarray: One float32 per window.
+        """
+        stop = self.num_elements if stop is None else stop
+        length = max(stop - start, 0)
+        out = np.empty((length + window - 1) // window, dtype=np.float32)
+        if dna_array_lib.dna_gc_windows(self.handle, start, length, window,
+                                        out.ctypes.data_as(ctypes.POINTER(ctypes.c_float))) < 0:
+            raise IndexError("Range out of bounds")
+        return out
+
+    def read_gc(self, first=0, count=1):
+        """
+        GC fraction of reads [first, first + count).
+
+        Returns:
+            numpy.ndarray: One float32 per read.
+        """
+        out = np.empty(count, dtype=np.float32)
+        if dna_array_lib.dna_read_gc(self.handle, first, count,
+                                     out.ctypes.data_as(ctypes.POINTER(ctypes.c_float))) != 0:
+            raise IndexError("Read index out of range")
+        return out
+
+    def search(self, pattern, max_mismatches=0, start=0, stop=None):
+        """
+        Find a short pattern in elements [start, stop) without unpacking,
+        allowing up to `max_mismatches` substituted bases.
+
+        Args:
+            pattern (str or numpy.ndarray): Up to 32 bases, as "ACGT" letters or codes 0-3.
+            max_mismatches (int): Largest Hamming distance of a match.
+
+        Returns:
+            numpy.ndarray: uint64 start of every match, ascending.
+        """
+        if isinstance(pattern, str):
+            codes = np.frombuffer(pattern.upper().encode(), dtype=np.uint8)
+            lut = np.full(256, 255, dtype=np.uint8)
+            lut[np.frombuffer(b"ACGT", dtype=np.uint8)] = np.arange(4, dtype=np.uint8)
+            pattern = lut[codes]
+        pattern = np.ascontiguousarray(pattern, dtype=np.uint8)
+        if not 1 <= pattern.size <= 32 or np.any(pattern > 3):
+            raise ValueError("Pattern must be 1 to 32 bases of A, C, G or T.")
+        stop = self.num_elements if stop is None else stop
+        length = max(stop - start, 0)
+        hits = np.empty(1 << 12, dtype=np.uint64)
+        while True:
+            n = dna_array_lib.dna_search(self.handle, start, length, _ptr(pattern), pattern.size, max_mismatches,
+                                         hits.ctypes.data_as(ctypes.POINTER(ctypes.c_uint64)), hits.size)
+            if n < 0:
+                raise IndexError("Range out of bounds")
+            if n <= hits.size:
+                return hits[:n]
+            hits = np.empty(n, dtype=np.uint64)
+
+    def read_quals(self, start=0, stop=None):
+        """
+        Phred+33 qualities of elements [start, stop), as stored (binned).
+
+        Returns:
+            bytes: One quality character per element.
+        """
+        stop = self.num_elements if stop is None else stop
+        out = ctypes.create_string_buffer(max(stop - start, 0))
+        if dna_array_lib.dna_read_quals(self.handle, start, len(out), out) != 0:
+            raise IndexError("No qualities stored or range out of bounds")
+        return out.raw
+
+    def read_name(self, i):
+        """
+        Name of read `i`, decoded from its group of read names.
+
+        Returns:
+            str: The read name without the leading '@'.
+        """
+        buf = ctypes.create_string_buffer(256)
+        n = dna_array_lib.dna_read_name(self.handle, i, buf, len(buf))
+        if n < 0:
+            raise IndexError("No names stored or read index out of range")
+        if n >= len(buf):
+            buf = ctypes.create_string_buffer(n + 1)
+            dna_array_lib.dna_read_name(self.handle, i, buf, len(buf))
+        return buf.value.decode('utf-8', errors='replace')
+
+    @property
+    def num_blocks(self):
+        return dna_array_lib.dna_num_blocks(self.handle)
+
+    def verify(self, start=0, stop=None):
+        """
+        Check the stored checksums of the blocks covering [start, stop).
+
+        Returns:
+            int: The number of corrupt blocks (0 if all match).
+        """
+        stop = self.num_elements if stop is None else stop
+        bad = dna_array_lib.dna_verify_range(self.handle, start, max(stop - start, 0))
+        if bad < 0:
+            raise IndexError("Range out of bounds")
+        return bad
+
+    _ADVICE = {"normal": 0, "sequential": 1, "random": 2, "strided": 3}
+
+    def advise(self, pattern, prefetch=0):
+        """
+        Tell the kernel and the prefetch thread how the file will be read.
+
+        Args:
+            pattern (str): "normal", "sequential", "random" or "strided".
+            prefetch (int): Blocks (or windows, when strided) to read ahead of
+                `read` and `kmers` on a background thread; 0 for none.
+        """
+        if pattern not in self._ADVICE:
+            raise ValueError(f"pattern must be one of {', '.join(self._ADVICE)}")
+        if dna_array_lib.dna_advise(self.handle, self._ADVICE[pattern]) != 0:
+            raise OSError(f"madvise failed on {self.filename}")
+        if dna_array_lib.dna_prefetch(self.handle, prefetch) != 0:
+            raise OSError("Cannot start the prefetch thread")
+
+    def set_cache(self, budget_bytes):
+        """
+        Set the memory budget of the decoded block cache, shared by every read
+        of this file; 0 disables it. Only files with coded blocks use it.
+        Do not call while other threads read from this object.
+        """
+        if dna_array_lib.dna_set_cache(self.handle, budget_bytes) != 0:
+            raise MemoryError("Cannot allocate the block cache")
+
+    def cache_stats(self):
+        """
+        Returns:
+            dict: hits, misses, evictions and capacity_bytes of the block cache.
+        """
+        stats = DnaCacheStats()
+        dna_array_lib.dna_cache_stats(self.handle, ctypes.byref(stats))
+        return {name: getattr(stats, name) for name, _ in DnaCacheStats._fields_}
+
+    def close(self):
+        if getattr(self, "_views", 0):
+            raise RuntimeError("close() with packed views still open")
+        if self.handle:
+            dna_array_lib.dna_close_mmap(self.handle)
+            self.handle = None
+        if getattr(self, "_archive", None):
+            dna_array_lib.dna_archive_close(self._archive)
+            self._archive = None
+
+    def __getstate__(self):
+        # A spawned DataLoader worker gets the filename and maps the file
+        # itself; forked workers simply inherit the parent's mapping.
+        return {"filename": self.filename, "num_elements": self.num_elements, "sample": self.sample}
+
+    def __setstate__(self, state):
+        if state.get("sample") is None:
+            self.__init__(state["filename"], state["num_elements"])
+        else:
+            self.__init__(state["filename"], sample=state["sample"])
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+    def __del__(self):
+        self.close()
+
+class PackedArchive:
+    """
+    Directory of a multi-sample archive written by `dna_array_fastq -A`.
+
+    `archive[name]` opens a sample as a `PackedArrayMmap`.
+    """
+    def __init__(self, filename):
+        self.filename = filename
+        ar = dna_array_lib.dna_archive_open(filename.encode('utf-8'))
+        if not ar:
+            raise OSError(f"Failed to open archive {filename}")
+        self.samples = {}
+        try:
+            entry = DnaSample()
+            for i in range(dna_array_lib.dna_archive_num_samples(ar)):
+                dna_array_lib.dna_archive_sample(ar, i, ctypes.byref(entry))
+                self.samples[entry.name.decode('utf-8')] = {
+                    "offset": entry.offset, "bytes": entry.bytes,
+                    "num_bases": entry.num_bases, "num_reads": entry.num_reads,
+                }
+        finally:
+            dna_array_lib.dna_archive_close(ar)
+
+    def __len__(self):
+        return len(self.samples)
+
+    def __iter__(self):
+        return iter(self.samples)
+
+    def __contains__(self, name):
+        return name in self.samples
+
+    def __getitem__(self, name):
+        if name not in self.samples:
+            raise KeyError(name)
+        return PackedArrayMmap(self.filename, sample=name)
+
 # Example usage
 if __name__ == "__main__":
 
@@ -85,3 +1020,7 @@ if __name__ == "__main__":
     print("First 10 elements:", unpacked_array[:10])
 
     print(f"All identical: {(array == unpacked_array).all()}")
+
+    # Pack and unpack in memory
+    packed = pack(array)
+    print(f"In-memory round trip identical: {(unpack(packed, array_size - 3, offset=3) == array[3:]).all()}")
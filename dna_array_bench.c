@@ -0,0 +1,620 @@
+#define _GNU_SOURCE  // environ
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <spawn.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "dna_array.h"
+
+// Measures the throughput of the library's hot paths over a sweep of sizes,
+// thread counts and alignments, and reports every configuration as one JSON
+// object or CSV row: the mean, standard deviation and minimum of `-r` timed
+// repetitions (after one untimed warm-up), as bases/s and GB/s. Bases/s
+// counts bases handed to or returned by the call; GB/s counts the data the
+// case is usually sized by, stated per case below. Inputs are random codes,
+// and files are reread from the page cache, so the numbers are for warm
+// memory rather than disk.
+//
+// Cases:
+//   pack         dna_pack() of the codes, sources offset by `-a` bytes; GB/s of codes
+//   unpack       dna_unpack() starting at base offset `-a`; GB/s of codes
+//   range        dna_gather_windows() of random `-w`-base windows of a raw
+//                blocked file; GB/s of packed bytes
+//   kmer         every `-k`-mer of the raw file, one dna_kmer_iter_part() per
+//                thread; GB/s of packed bytes
+//   write        streaming writer, 150-base reads into a blocked file; GB/s of codes
+//   cache_miss   windows of a DNA_CODEC_CM file of skewed (compressible)
+//                codes, each in a block not yet in the block cache; counts
+//                the bases of the blocks decoded
+//   cache_hit    windows of the same file inside blocks held by the cache
+//   fastq        the `-X` dna_array_fastq binary on a FASTQ file of the size;
+//                GB/s of FASTQ text
+// pack, unpack, range and write also run on the scalar reference kernels
+// (dna_use_kernels), and the row of the default kernels then carries its
+// speedup over them. Coded files are capped at CODED_MAX_BASES since their
+// cost does not grow with the file, and the coded cases run once per size
+// up to that cap; fastq runs once per size.
+
+#define MIB (1ull << 20)
+#define RANGE_WORK_BASES (16u << 20)  // Bases returned per repetition of the window cases
+#define CODED_MAX_BASES (64u << 20)
+#define HOT_BLOCKS 16                 // Blocks the cache_hit windows fall into
+#define FASTQ_READ_LENGTH 150
+#define MAX_LIST 16
+
+enum { CASE_PACK, CASE_UNPACK, CASE_RANGE, CASE_KMER, CASE_WRITE, CASE_CACHE_MISS, CASE_CACHE_HIT, CASE_FASTQ,
+       NUM_CASES };
+static const char *case_names[NUM_CASES] = {"pack", "unpack", "range", "kmer", "write", "cache_miss", "cache_hit",
+                                            "fastq"};
+static const int case_has_scalar[NUM_CASES] = {1, 1, 1, 0, 1, 0, 0, 0};
+
+typedef struct {
+    // Options
+    long min_mib, max_mib;
+    long threads[MAX_LIST];
+    size_t num_threads;
+    long aligns[MAX_LIST];
+    size_t num_aligns;
+    int reps;
+    size_t window;
+    unsigned k;
+    const char *dir;
+    const char *fastq_tool;
+    int csv;
+    int scalar;
+    int enabled[NUM_CASES];
+    FILE *out;
+    size_t rows;
+
+    // Current configuration
+    size_t n;        // Bases
+    size_t align;
+    uint8_t *codes;  // Largest size plus room for alignment
+    uint8_t *packed;
+    uint8_t *window_out;
+    uint64_t *starts;
+    size_t num_windows;
+    char raw_path[4096], coded_path[4096], write_path[4096], fastq_path[4096], fastq_out[4096];
+    dna_handle_t *raw, *coded;
+    size_t coded_n;
+    int coded_fresh;  // The coded file changed with this size
+    uint64_t fastq_bytes;
+    uint64_t sink;  // Keeps results alive
+    int failed;
+} bench_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t next_random(uint64_t *state) {
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static void fill_random(uint8_t *codes, size_t n, uint64_t seed) {
+    uint64_t state = seed | 1;
+    for (size_t i = 0; i < n; i += 32) {
+        uint64_t r = next_random(&state);
+        for (size_t j = i; j < i + 32 && j < n; ++j, r >>= 2) {
+            codes[j] = r & 0x03;
+        }
+    }
+}
+
+// Codes with about 1.4 bits of entropy (A three times in four), which the
+// context model compresses, so the blocks of the coded file are stored coded.
+static void fill_skewed(uint8_t *codes, size_t n, uint64_t *state) {
+    for (size_t i = 0; i < n; i += 16) {
+        uint64_t r = next_random(state);
+        for (size_t j = i; j < i + 16 && j < n; ++j, r >>= 4) {
+            codes[j] = (r & 0x0C) ? 0 : r & 0x03;
+        }
+    }
+}
+
+// Parses a comma-separated list of integers. Returns the count, or 0 on error.
+static size_t parse_list(const char *s, long *out, size_t cap) {
+    size_t count = 0;
+    while (*s && count < cap) {
+        char *end;
+        out[count++] = strtol(s, &end, 10);
+        if (end == s || (*end && *end != ',')) {
+            return 0;
+        }
+        s = *end ? end + 1 : end;
+    }
+    return *s ? 0 : count;
+}
+
+// Windows starting at random positions of [0, span - window), or of the
+// first `hot` blocks when `hot` is non-zero.
+static void pick_windows(bench_t *b, size_t span, size_t hot, uint64_t seed) {
+    uint64_t state = seed | 1;
+    size_t limit = hot ? hot * DNA_DEFAULT_BLOCK_SIZE : span;
+    limit = limit < span ? limit : span;
+    for (size_t i = 0; i < b->num_windows; ++i) {
+        b->starts[i] = limit > b->window ? next_random(&state) % (limit - b->window) : 0;
+    }
+}
+
+static void kmer_task(void *arg, size_t task) {
+    bench_t *b = arg;
+    uint64_t buf[4096], sum = 0;
+    dna_kmer_iter_t *it = dna_kmer_iter_open(b->raw, b->k, 1);
+    if (!it) {
+        __atomic_store_n(&b->failed, 1, __ATOMIC_RELAXED);
+        return;
+    }
+    dna_kmer_iter_part(it, task, (size_t)dna_get_num_threads());
+    size_t got;
+    while ((got = dna_kmer_iter_next(it, buf, NULL, 4096)) > 0) {
+        sum += buf[got - 1];
+    }
+    dna_kmer_iter_close(it);
+    __atomic_fetch_add(&b->sink, sum, __ATOMIC_RELAXED);
+}
+
+static int run_fastq_tool(bench_t *b) {
+    remove(b->fastq_out);
+    char *argv[] = {(char *)b->fastq_tool, "-q", b->fastq_path, "-o", b->fastq_out, "-k", "0", "-f", "2",
+                    "-n", "2000000000", NULL};
+    pid_t pid;
+    int status;
+    if (posix_spawn(&pid, b->fastq_tool, NULL, NULL, argv, environ) != 0 || waitpid(pid, &status, 0) != pid) {
+        perror("Failed to run the fastq tool");
+        return -1;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+// Runs one repetition of `c`. Returns 0, or -1 on error.
+static int run_once(bench_t *b, int c) {
+    switch (c) {
+    case CASE_PACK:
+        dna_pack(b->codes + b->align, b->n, b->packed);
+        return 0;
+    case CASE_UNPACK:
+        dna_unpack(b->packed, b->align, b->n, b->codes);
+        return 0;
+    case CASE_RANGE:
+        return dna_gather_windows(b->raw, b->starts, b->num_windows, b->window, DNA_GATHER_CODES, b->window_out);
+    case CASE_KMER:
+        b->failed = 0;
+        dna_parallel_for((size_t)dna_get_num_threads(), kmer_task, b);
+        return b->failed ? -1 : 0;
+    case CASE_WRITE: {
+        dna_meta_t meta = {.read_length = FASTQ_READ_LENGTH, .block_size = DNA_DEFAULT_BLOCK_SIZE};
+        dna_writer_t *w = dna_writer_open(b->write_path, &meta);
+        if (!w) {
+            return -1;
+        }
+        for (size_t i = 0; i < b->n; i += FASTQ_READ_LENGTH) {
+            size_t len = b->n - i < FASTQ_READ_LENGTH ? b->n - i : FASTQ_READ_LENGTH;
+            if (dna_writer_append_read(w, b->codes + i, len) != 0) {
+                dna_writer_abort(w);
+                return -1;
+            }
+        }
+        return dna_writer_close(w);
+    }
+    case CASE_CACHE_MISS:
+        // A fresh cache each time; every window lies in its own block
+        if (dna_set_cache(b->coded, 0) != 0 || dna_set_cache(b->coded, DNA_DEFAULT_CACHE_BYTES) != 0) {
+            return -1;
+        }
+        return dna_gather_windows(b->coded, b->starts, b->num_windows, b->window, DNA_GATHER_CODES,
+                                  b->window_out);
+    case CASE_CACHE_HIT:
+        return dna_gather_windows(b->coded, b->starts, b->num_windows, b->window, DNA_GATHER_CODES,
+                                  b->window_out);
+    case CASE_FASTQ:
+        return run_fastq_tool(b);
+    }
+    return -1;
+}
+
+typedef struct {
+    double mean_s, sd_s, min_s;
+    double bases_per_s, bases_per_s_sd;
+    double gb_per_s, gb_per_s_sd;
+} result_t;
+
+// Times `-r` repetitions of `c` after a warm-up. `bases` and `bytes` are
+// the work of one repetition.
+static int measure(bench_t *b, int c, double bases, double bytes, result_t *r) {
+    if (run_once(b, c) != 0) {
+        return -1;
+    }
+    double sum = 0, sum_sq = 0, rate_sum = 0, rate_sq = 0;
+    r->min_s = INFINITY;
+    for (int i = 0; i < b->reps; ++i) {
+        uint64_t t0 = now_ns();
+        if (run_once(b, c) != 0) {
+            return -1;
+        }
+        double s = (now_ns() - t0) / 1e9;
+        s = s > 1e-9 ? s : 1e-9;
+        sum += s;
+        sum_sq += s * s;
+        rate_sum += bases / s;
+        rate_sq += (bases / s) * (bases / s);
+        r->min_s = s < r->min_s ? s : r->min_s;
+    }
+    double reps = b->reps;
+    r->mean_s = sum / reps;
+    r->sd_s = reps > 1 ? sqrt(fmax(sum_sq - sum * sum / reps, 0) / (reps - 1)) : 0;
+    r->bases_per_s = rate_sum / reps;
+    r->bases_per_s_sd = reps > 1 ? sqrt(fmax(rate_sq - rate_sum * rate_sum / reps, 0) / (reps - 1)) : 0;
+    r->gb_per_s = r->bases_per_s * (bytes / bases) / 1e9;
+    r->gb_per_s_sd = r->bases_per_s_sd * (bytes / bases) / 1e9;
+    return 0;
+}
+
+static void report(bench_t *b, int c, const char *kernels, size_t bases, const result_t *r, double hit_rate,
+                   double vs_scalar) {
+    if (b->csv) {
+        if (b->rows == 0) {
+            fprintf(b->out, "case,kernels,threads,bases,align,reps,mean_s,sd_s,min_s,bases_per_s,bases_per_s_sd,"
+                    "gb_per_s,gb_per_s_sd,hit_rate,vs_scalar\n");
+        }
+        fprintf(b->out, "%s,%s,%d,%zu,%zu,%d,%.6g,%.3g,%.6g,%.6g,%.3g,%.6g,%.3g,", case_names[c], kernels,
+                dna_get_num_threads(), bases, b->align, b->reps, r->mean_s, r->sd_s, r->min_s, r->bases_per_s,
+                r->bases_per_s_sd, r->gb_per_s, r->gb_per_s_sd);
+        if (hit_rate >= 0) {
+            fprintf(b->out, "%.4f", hit_rate);
+        }
+        fprintf(b->out, ",");
+        if (vs_scalar > 0) {
+            fprintf(b->out, "%.3f", vs_scalar);
+        }
+        fprintf(b->out, "\n");
+    } else {
+        fprintf(b->out, "%s\n    {\"case\": \"%s\", \"kernels\": \"%s\", \"threads\": %d, \"bases\": %zu, "
+                "\"align\": %zu, \"reps\": %d, \"mean_s\": %.6g, \"sd_s\": %.3g, \"min_s\": %.6g, "
+                "\"bases_per_s\": %.6g, \"bases_per_s_sd\": %.3g, \"gb_per_s\": %.6g, \"gb_per_s_sd\": %.3g",
+                b->rows ? "," : "", case_names[c], kernels, dna_get_num_threads(), bases, b->align, b->reps,
+                r->mean_s, r->sd_s, r->min_s, r->bases_per_s, r->bases_per_s_sd, r->gb_per_s, r->gb_per_s_sd);
+        if (hit_rate >= 0) {
+            fprintf(b->out, ", \"hit_rate\": %.4f", hit_rate);
+        }
+        if (vs_scalar > 0) {
+            fprintf(b->out, ", \"vs_scalar\": %.3f", vs_scalar);
+        }
+        fprintf(b->out, "}");
+    }
+    fflush(b->out);
+    b->rows++;
+}
+
+// Measures case `c` in the current configuration, on the scalar kernels
+// first when it has them, and reports it.
+static int bench_case(bench_t *b, int c) {
+    double bases = (double)b->n, bytes = (double)b->n;
+    size_t size = b->n;
+    dna_handle_t *window_src = c == CASE_RANGE ? b->raw : b->coded;
+    if (c == CASE_RANGE || c == CASE_CACHE_MISS || c == CASE_CACHE_HIT) {
+        size_t span = dna_handle_size(window_src);
+        size_t blocks = (span + DNA_DEFAULT_BLOCK_SIZE - 1) / DNA_DEFAULT_BLOCK_SIZE;
+        b->num_windows = RANGE_WORK_BASES / b->window;
+        if (c == CASE_CACHE_MISS) {
+            // As many windows as fit in distinct cached blocks
+            size_t cap_blocks = DNA_DEFAULT_CACHE_BYTES / (DNA_DEFAULT_BLOCK_SIZE / 4);
+            b->num_windows = blocks < cap_blocks ? blocks : cap_blocks;
+            b->num_windows = b->num_windows < RANGE_WORK_BASES / b->window ? b->num_windows
+                                                                           : RANGE_WORK_BASES / b->window;
+            for (size_t i = 0; i < b->num_windows; ++i) {
+                size_t block_bases = span - i * DNA_DEFAULT_BLOCK_SIZE;
+                block_bases = block_bases < DNA_DEFAULT_BLOCK_SIZE ? block_bases : DNA_DEFAULT_BLOCK_SIZE;
+                b->starts[i] = (uint64_t)i * DNA_DEFAULT_BLOCK_SIZE +
+                               (block_bases > b->window ? (block_bases - b->window) / 2 : 0);
+            }
+        } else {
+            pick_windows(b, span, c == CASE_CACHE_HIT ? HOT_BLOCKS : 0, 42 + b->n);
+        }
+        if (span < b->window) {
+            return 0;
+        }
+        bases = (double)b->num_windows * b->window;
+        if (c == CASE_CACHE_MISS) {
+            size_t decoded = b->num_windows * DNA_DEFAULT_BLOCK_SIZE;
+            bases = (double)(decoded < span ? decoded : span);
+        }
+        bytes = bases / 4;
+        size = span;
+    } else if (c == CASE_KMER) {
+        bytes = bases / 4;
+    } else if (c == CASE_FASTQ) {
+        bytes = (double)b->fastq_bytes;
+    }
+
+    double scalar_rate = 0;
+    result_t r;
+    if (b->scalar && case_has_scalar[c]) {
+        dna_use_kernels(DNA_KERNELS_SCALAR);
+        int status = measure(b, c, bases, bytes, &r);
+        dna_use_kernels(DNA_KERNELS_BEST);
+        if (status != 0) {
+            return -1;
+        }
+        report(b, c, "scalar", size, &r, -1, 0);
+        scalar_rate = r.bases_per_s;
+    }
+    // cache_hit counts from a warm cache; cache_miss starts each repetition
+    // with a fresh cache, so its counters cover the last one
+    dna_cache_stats_t before = {0}, after;
+    if (c == CASE_CACHE_HIT) {
+        if (run_once(b, c) != 0) {
+            return -1;
+        }
+        dna_cache_stats(b->coded, &before);
+    }
+    if (measure(b, c, bases, bytes, &r) != 0) {
+        return -1;
+    }
+    double hit_rate = -1;
+    if (c == CASE_CACHE_MISS || c == CASE_CACHE_HIT) {
+        dna_cache_stats(b->coded, &after);
+        uint64_t hits = after.hits - before.hits, misses = after.misses - before.misses;
+        hit_rate = hits + misses ? (double)hits / (hits + misses) : 0;
+    }
+    report(b, c, dna_kernel_name(), size, &r, hit_rate, scalar_rate > 0 ? r.bases_per_s / scalar_rate : 0);
+    return 0;
+}
+
+static int write_fastq(bench_t *b) {
+    FILE *f = fopen(b->fastq_path, "w");
+    if (!f) {
+        perror("Failed to open FASTQ file");
+        return -1;
+    }
+    char seq[FASTQ_READ_LENGTH + 1], qual[FASTQ_READ_LENGTH + 1];
+    memset(qual, 'I', FASTQ_READ_LENGTH);
+    for (size_t i = 0, r = 0; i < b->n; i += FASTQ_READ_LENGTH, ++r) {
+        size_t len = b->n - i < FASTQ_READ_LENGTH ? b->n - i : FASTQ_READ_LENGTH;
+        for (size_t j = 0; j < len; ++j) {
+            seq[j] = "ACGT"[b->codes[i + j]];
+        }
+        seq[len] = qual[len] = 0;
+        fprintf(f, "@r%zu\n%s\n+\n%s\n", r, seq, qual);
+        qual[len] = 'I';
+    }
+    if (fclose(f) != 0) {
+        perror("Failed to write FASTQ file");
+        return -1;
+    }
+    struct stat st;
+    b->fastq_bytes = stat(b->fastq_path, &st) == 0 ? (uint64_t)st.st_size : 0;
+    return 0;
+}
+
+// Writes and maps the files for size `b->n`. Returns 0, or -1 on error.
+static int prepare_size(bench_t *b) {
+    dna_meta_t meta = {.block_size = DNA_DEFAULT_BLOCK_SIZE};
+    if (b->enabled[CASE_RANGE] || b->enabled[CASE_KMER]) {
+        dna_close_mmap(b->raw);
+        b->raw = NULL;
+        if (dna_save_with_header(b->raw_path, b->codes, b->n, &meta) != 0 ||
+            !(b->raw = dna_open_mmap(b->raw_path, 0))) {
+            return -1;
+        }
+    }
+    size_t coded_n = b->n < CODED_MAX_BASES ? b->n : CODED_MAX_BASES;
+    b->coded_fresh = (b->enabled[CASE_CACHE_MISS] || b->enabled[CASE_CACHE_HIT]) && coded_n != b->coded_n;
+    if (b->coded_fresh) {
+        dna_close_mmap(b->coded);
+        b->coded = NULL;
+        dna_writer_t *w = dna_writer_open(b->coded_path, &meta);
+        int status = w && dna_writer_set_codec(w, DNA_CODEC_CM, 0) == 0 ? 0 : -1;
+        uint64_t state = 0x2545F4914F6CDD1Dull;
+        for (size_t i = 0; i < coded_n && status == 0; i += RANGE_WORK_BASES) {
+            size_t len = coded_n - i < RANGE_WORK_BASES ? coded_n - i : RANGE_WORK_BASES;
+            fill_skewed(b->window_out, len, &state);  // Free until the window cases run
+            status = dna_writer_append(w, b->window_out, len);
+        }
+        if (status != 0) {
+            dna_writer_abort(w);
+            return -1;
+        }
+        if (dna_writer_close(w) != 0 || !(b->coded = dna_open_mmap(b->coded_path, 0))) {
+            return -1;
+        }
+        b->coded_n = coded_n;
+    }
+    if (b->enabled[CASE_FASTQ] && write_fastq(b) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+void error_usage() {
+    fprintf(stderr, "Usage:   dna_array_bench [options]\n");
+    fprintf(stderr, "Example: dna_array_bench -S 1 -L 10240 -t 1,4,0 -r 7 -f 1 -o bench.csv\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -S <int>    smallest size in MiB of bases (default: 1)\n");
+    fprintf(stderr, "  -L <int>    largest size in MiB of bases; sizes grow tenfold from `-S` (default: 1024)\n");
+    fprintf(stderr, "  -t <list>   comma-separated thread counts, 0 uses every CPU (default: 1,0)\n");
+    fprintf(stderr, "  -a <list>   comma-separated alignments in bases for pack and unpack, 0 to 3 (default: 0,1)\n");
+    fprintf(stderr, "  -r <int>    timed repetitions per configuration (default: 5)\n");
+    fprintf(stderr, "  -w <int>    window length in bases of the window cases (default: 4096)\n");
+    fprintf(stderr, "  -k <int>    k-mer length of the kmer case (default: 31)\n");
+    fprintf(stderr, "  -c <list>   comma-separated cases: pack,unpack,range,kmer,write,cache_miss,cache_hit,fastq\n");
+    fprintf(stderr, "              (default: all; fastq needs `-X`)\n");
+    fprintf(stderr, "  -X <FILE>   dna_array_fastq binary for the fastq case\n");
+    fprintf(stderr, "  -K <int>    1 also measures the scalar reference kernels (default: 1)\n");
+    fprintf(stderr, "  -d <DIR>    directory for temporary files (default: .)\n");
+    fprintf(stderr, "  -f <int>    report format: 0 JSON, 1 CSV (default: 0)\n");
+    fprintf(stderr, "  -o <FILE>   report file (default: stdout)\n");
+    exit(EXIT_FAILURE);
+}
+
+static int parse_cases(const char *s, int *enabled) {
+    memset(enabled, 0, NUM_CASES * sizeof(*enabled));
+    while (*s) {
+        size_t len = strcspn(s, ",");
+        int found = 0;
+        for (int c = 0; c < NUM_CASES; ++c) {
+            if (strlen(case_names[c]) == len && strncmp(s, case_names[c], len) == 0) {
+                enabled[c] = found = 1;
+            }
+        }
+        if (!found) {
+            return -1;
+        }
+        s += len + (s[len] == ',');
+    }
+    return 0;
+}
+
+int main(int argc, char *argv[]) {
+    bench_t b;
+    memset(&b, 0, sizeof(b));
+    b.min_mib = 1;
+    b.max_mib = 1024;
+    b.threads[0] = 1;
+    b.threads[1] = 0;
+    b.num_threads = 2;
+    b.aligns[0] = 0;
+    b.aligns[1] = 1;
+    b.num_aligns = 2;
+    b.reps = 5;
+    b.window = 4096;
+    b.k = 31;
+    b.dir = ".";
+    b.scalar = 1;
+    const char *output_file = NULL;
+    const char *cases = NULL;
+    long window = 4096, k = 31;
+
+    for (int i = 1; i < argc; i+=2) {
+        if (i + 1 >= argc) { error_usage(); } // must have arg after flag
+        if (argv[i][0] != '-') { error_usage(); } // must start with dash
+        if (strlen(argv[i]) != 2) { error_usage(); } // must be -x (one dash, one letter)
+        if (argv[i][1] == 'S') { b.min_mib = atol(argv[i + 1]); }
+        else if (argv[i][1] == 'L') { b.max_mib = atol(argv[i + 1]); }
+        else if (argv[i][1] == 't') { b.num_threads = parse_list(argv[i + 1], b.threads, MAX_LIST); }
+        else if (argv[i][1] == 'a') { b.num_aligns = parse_list(argv[i + 1], b.aligns, MAX_LIST); }
+        else if (argv[i][1] == 'r') { b.reps = atoi(argv[i + 1]); }
+        else if (argv[i][1] == 'w') { window = atol(argv[i + 1]); }
+        else if (argv[i][1] == 'k') { k = atol(argv[i + 1]); }
+        else if (argv[i][1] == 'c') { cases = argv[i + 1]; }
+        else if (argv[i][1] == 'X') { b.fastq_tool = argv[i + 1]; }
+        else if (argv[i][1] == 'K') { b.scalar = atoi(argv[i + 1]) != 0; }
+        else if (argv[i][1] == 'd') { b.dir = argv[i + 1]; }
+        else if (argv[i][1] == 'f') { b.csv = atoi(argv[i + 1]) == 1; }
+        else if (argv[i][1] == 'o') { output_file = argv[i + 1]; }
+        else { error_usage(); }
+    }
+    for (int c = 0; c < NUM_CASES; ++c) {
+        b.enabled[c] = c != CASE_FASTQ || b.fastq_tool;
+    }
+    if ((cases && parse_cases(cases, b.enabled) != 0) || (b.enabled[CASE_FASTQ] && !b.fastq_tool)) {
+        error_usage();
+    }
+    if (b.min_mib < 1 || b.max_mib < b.min_mib || !b.num_threads || !b.num_aligns || b.reps < 1 || window < 1 ||
+        window > (long)RANGE_WORK_BASES || k < 1 || k > 32) {
+        error_usage();
+    }
+    for (size_t i = 0; i < b.num_aligns; ++i) {
+        if (b.aligns[i] < 0 || b.aligns[i] > 3) {
+            error_usage();
+        }
+    }
+    b.window = (size_t)window;
+    b.k = (unsigned)k;
+
+    b.out = output_file ? fopen(output_file, "w") : stdout;
+    if (!b.out) {
+        perror("Failed to open report file");
+        exit(EXIT_FAILURE);
+    }
+    size_t max_n = 0;
+    for (long mib = b.min_mib; mib <= b.max_mib; mib *= 10) {
+        max_n = (size_t)mib * MIB;
+    }
+    b.codes = malloc(max_n + 64);
+    b.packed = malloc(max_n / 4 + 64);
+    b.starts = malloc((RANGE_WORK_BASES / b.window + 1) * sizeof(*b.starts));
+    b.window_out = malloc(RANGE_WORK_BASES + b.window);
+    if (!b.codes || !b.packed || !b.starts || !b.window_out) {
+        perror("Failed to allocate buffers");
+        exit(EXIT_FAILURE);
+    }
+    fill_random(b.codes, max_n + 64, 0x5DEECE66Dull);
+    dna_pack(b.codes, max_n + 32, b.packed);
+    int pid = (int)getpid();
+    snprintf(b.raw_path, sizeof(b.raw_path), "%s/dna_array_bench.%d.raw.bin", b.dir, pid);
+    snprintf(b.coded_path, sizeof(b.coded_path), "%s/dna_array_bench.%d.coded.bin", b.dir, pid);
+    snprintf(b.write_path, sizeof(b.write_path), "%s/dna_array_bench.%d.write.bin", b.dir, pid);
+    snprintf(b.fastq_path, sizeof(b.fastq_path), "%s/dna_array_bench.%d.fq", b.dir, pid);
+    snprintf(b.fastq_out, sizeof(b.fastq_out), "%s/dna_array_bench.%d.fq.bin", b.dir, pid);
+
+    if (!b.csv) {
+        fprintf(b.out, "{\"kernels\": \"%s\", \"cpus\": %ld, \"results\": [", dna_kernel_name(),
+                sysconf(_SC_NPROCESSORS_ONLN));
+    }
+    int status = 0;
+    for (long mib = b.min_mib; mib <= b.max_mib && status == 0; mib *= 10) {
+        b.n = (size_t)mib * MIB;
+        if (prepare_size(&b) != 0) {
+            fprintf(stderr, "Failed to prepare the files for %ld MiB\n", mib);
+            status = -1;
+            break;
+        }
+        for (size_t t = 0; t < b.num_threads && status == 0; ++t) {
+            dna_set_num_threads((int)b.threads[t]);
+            for (int c = 0; c < NUM_CASES && status == 0; ++c) {
+                if (!b.enabled[c] || (c == CASE_FASTQ && t > 0) ||
+                    ((c == CASE_CACHE_MISS || c == CASE_CACHE_HIT) && !b.coded_fresh)) {
+                    continue;
+                }
+                size_t num_aligns = c == CASE_PACK || c == CASE_UNPACK ? b.num_aligns : 1;
+                for (size_t a = 0; a < num_aligns && status == 0; ++a) {
+                    b.align = num_aligns > 1 ? (size_t)b.aligns[a] : 0;
+                    if (c == CASE_FASTQ) {
+                        dna_set_num_threads(1);  // The tool runs as its own process
+                    }
+                    if (c == CASE_CACHE_HIT && dna_set_cache(b.coded, DNA_DEFAULT_CACHE_BYTES) != 0) {
+                        status = -1;
+                    }
+                    if (status == 0 && bench_case(&b, c) != 0) {
+                        fprintf(stderr, "Case %s failed at %ld MiB\n", case_names[c], mib);
+                        status = -1;
+                    }
+                    dna_set_num_threads((int)b.threads[t]);
+                }
+            }
+        }
+    }
+    if (!b.csv) {
+        fprintf(b.out, "\n]}\n");
+    }
+
+    dna_close_mmap(b.raw);
+    dna_close_mmap(b.coded);
+    remove(b.raw_path);
+    remove(b.coded_path);
+    remove(b.write_path);
+    remove(b.fastq_path);
+    remove(b.fastq_out);
+    if (output_file && fclose(b.out) != 0) {
+        perror("Failed to write report file");
+        status = -1;
+    }
+    free(b.codes);
+    free(b.packed);
+    free(b.starts);
+    free(b.window_out);
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,414 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "dna_array.h"
+
+// Round-trip checks for the packed formats: kernel equivalence, coded blocks
+// and their checksums, appends, and multi-sample archives. Each check prints
+// one line; the exit status is the number of failed checks (0 when all pass).
+// Scratch files are written to the current directory and removed.
+
+#define CHECK_BLOCK_SIZE 4096  // Small blocks, so every file has many
+
+static int failures = 0;
+
+static void check(int ok, const char *what) {
+    printf("%s: %s\n", ok ? "ok  " : "FAIL", what);
+    failures += !ok;
+}
+
+static uint64_t rng_state = 0x9e3779b97f4a7c15ull;
+
+static uint64_t rng(void) {
+    rng_state ^= rng_state << 13;
+    rng_state ^= rng_state >> 7;
+    rng_state ^= rng_state << 17;
+    return rng_state;
+}
+
+// Random codes; with `skewed`, three quarters are A so the block codecs have
+// something to compress.
+static void fill_codes(uint8_t *codes, size_t n, int skewed) {
+    for (size_t i = 0; i < n; ++i) {
+        uint64_t r = rng();
+        codes[i] = skewed && (r & 0x300) ? 0 : (uint8_t)(r & 0x03);
+    }
+}
+
+// Whole contents of `path`, or NULL. The caller frees the buffer.
+static uint8_t *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    rewind(f);
+    uint8_t *buf = malloc(size > 0 ? (size_t)size : 1);
+    if (buf && fread(buf, 1, (size_t)size, f) != (size_t)size) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    *len = (size_t)size;
+    return buf;
+}
+
+static int same_file(const char *a, const char *b) {
+    size_t len_a, len_b;
+    uint8_t *x = read_file(a, &len_a), *y = read_file(b, &len_b);
+    int same = x && y && len_a == len_b && memcmp(x, y, len_a) == 0;
+    free(x);
+    free(y);
+    return same;
+}
+
+// Pack, unpack and reverse complement give the same bytes with the scalar
+// and the best kernels, and match the codes they started from.
+static void check_kernels(void) {
+    enum { MAX_BASES = 70000 };
+    uint8_t *codes = malloc(MAX_BASES + 64);
+    uint8_t *packed[2], *unpacked[2], *revcomp[2];
+    for (int k = 0; k < 2; ++k) {
+        packed[k] = malloc(MAX_BASES / 4 + 32);
+        unpacked[k] = malloc(MAX_BASES + 64);
+        revcomp[k] = malloc(MAX_BASES / 4 + 32);
+    }
+    uint8_t *expect = malloc(MAX_BASES + 64);
+    int pack_ok = 1, unpack_ok = 1, revcomp_ok = 1;
+    for (int trial = 0; trial < 2000; ++trial) {
+        // Every length up to 64, then random ones with odd tails
+        size_t total = trial <= 64 ? (size_t)trial : (size_t)(rng() % MAX_BASES);
+        size_t offset = total ? (size_t)(rng() % (total + 1)) : 0;
+        size_t n = total - offset;
+        fill_codes(codes, total, 0);
+        for (int k = 0; k < 2; ++k) {
+            dna_use_kernels(k ? DNA_KERNELS_BEST : DNA_KERNELS_SCALAR);
+            memset(packed[k], 0xa5, MAX_BASES / 4 + 32);
+            dna_pack(codes, total, packed[k]);
+            dna_unpack(packed[k], offset, n, unpacked[k]);
+            dna_revcomp(packed[k], offset, n, revcomp[k]);
+        }
+        size_t bytes = (total + 3) / 4;
+        pack_ok &= memcmp(packed[0], packed[1], bytes) == 0 && packed[1][bytes] == 0xa5;
+        unpack_ok &= memcmp(unpacked[0], unpacked[1], n) == 0 && memcmp(unpacked[1], codes + offset, n) == 0;
+        for (size_t i = 0; i < n; ++i) {
+            expect[i] = codes[offset + n - 1 - i] ^ 3;
+        }
+        uint8_t *repacked = packed[0];  // Both packs are done with
+        dna_pack(expect, n, repacked);
+        revcomp_ok &= memcmp(revcomp[0], revcomp[1], (n + 3) / 4) == 0 && memcmp(revcomp[1], repacked, (n + 3) / 4) == 0;
+    }
+    dna_use_kernels(DNA_KERNELS_BEST);
+    char what[128];
+    snprintf(what, sizeof(what), "pack matches between scalar and %s kernels", dna_kernel_name());
+    check(pack_ok, what);
+    check(unpack_ok, "unpack matches the input at any offset");
+    check(revcomp_ok, "revcomp matches the reversed complement");
+    free(codes);
+    free(expect);
+    for (int k = 0; k < 2; ++k) {
+        free(packed[k]);
+        free(unpacked[k]);
+        free(revcomp[k]);
+    }
+}
+
+// A blocked file mixing context-model and raw blocks decodes back to its
+// input, whole and in random ranges, and a flipped stored byte is reported
+// against the right block.
+static void check_coded_blocks(void) {
+    const char *path = "check_coded.bin";
+    size_t n = 40 * CHECK_BLOCK_SIZE + 1234;
+    uint8_t *codes = malloc(n), *out = malloc(n);
+    for (size_t b = 0; b < n; b += CHECK_BLOCK_SIZE) {
+        size_t len = n - b < CHECK_BLOCK_SIZE ? n - b : CHECK_BLOCK_SIZE;
+        fill_codes(codes + b, len, (b / CHECK_BLOCK_SIZE) % 3 != 2);  // Every third block is incompressible
+    }
+    dna_meta_t meta = {.read_length = 100, .block_size = CHECK_BLOCK_SIZE};
+    dna_writer_t *w = dna_writer_open(path, &meta);
+    int written = w && dna_writer_set_codec(w, DNA_CODEC_CM, 0) == 0;
+    for (size_t i = 0; written && i < n;) {  // Uneven appends
+        size_t len = (size_t)(rng() % 10000) + 1;
+        len = len < n - i ? len : n - i;
+        written = dna_writer_append(w, codes + i, len) == 0;
+        i += len;
+    }
+    written = w && dna_writer_close(w) == 0 && written;
+    check(written, "write a context-model coded blocked file");
+    dna_handle_t *h = written ? dna_open_mmap(path, 0) : NULL;
+    if (!h) {
+        check(0, "open the coded file");
+        free(codes);
+        free(out);
+        return;
+    }
+
+    size_t coded = 0, raw = 0, coded_block = 0;
+    for (size_t i = 0; i < dna_num_blocks(h); ++i) {
+        dna_block_t blk;
+        dna_block_info(h, i, &blk);
+        if (blk.codec == DNA_CODEC_CM) {
+            coded_block = coded++ ? coded_block : i;
+        } else {
+            raw++;
+        }
+    }
+    check(coded > 0 && raw > 0, "the file mixes coded and raw blocks");
+    check(dna_read_range(h, 0, n, out) == 0 && memcmp(out, codes, n) == 0, "full decode matches the input");
+    int ranges_ok = 1;
+    for (int trial = 0; trial < 500; ++trial) {
+        size_t start = (size_t)(rng() % n);
+        size_t len = (size_t)(rng() % (3 * CHECK_BLOCK_SIZE));
+        len = len < n - start ? len : n - start;
+        ranges_ok &= dna_read_range(h, start, len, out) == 0 && memcmp(out, codes + start, len) == 0;
+    }
+    check(ranges_ok, "random range decodes match the input");
+    check(dna_verify_range(h, 0, n) == 0, "an intact file verifies");
+    dna_block_t blk;
+    dna_block_info(h, coded_block, &blk);
+    dna_close_mmap(h);
+    memset(out, 0xaa, n);
+    check(dna_read_checked(path, out, n) == 0 && memcmp(out, codes, n) == 0, "dna_read_checked decodes coded blocks");
+
+    FILE *f = fopen(path, "r+b");
+    fseek(f, (long)(blk.offset + blk.stored_bytes / 2), SEEK_SET);
+    int c = fgetc(f);
+    fseek(f, (long)(blk.offset + blk.stored_bytes / 2), SEEK_SET);
+    fputc(c ^ 0x10, f);
+    fclose(f);
+    h = dna_open_mmap(path, 0);
+    size_t first = coded_block * CHECK_BLOCK_SIZE;
+    size_t rest = first + CHECK_BLOCK_SIZE;
+    check(h && dna_verify_range(h, 0, n) == 1 && dna_verify_range(h, first, 1) == 1 &&
+          dna_verify_block(h, coded_block) != 0 && dna_verify_range(h, rest, n - rest) == 0,
+          "a flipped byte is reported against its block only");
+    if (h) {
+        dna_close_mmap(h);
+    }
+    remove(path);
+    free(codes);
+    free(out);
+}
+
+// Variable-length reads with N runs, binned qualities and names, as
+// dna_array_fastq writes them.
+typedef struct {
+    size_t num_reads;
+    size_t *starts;  // num_reads + 1 base offsets
+    uint8_t *codes;
+    char *quals;
+    uint8_t *has_n;  // Per read: bases [10, 20) are an N run
+} reads_t;
+
+static void make_reads(reads_t *r, size_t num_reads) {
+    r->num_reads = num_reads;
+    r->starts = malloc((num_reads + 1) * sizeof(*r->starts));
+    r->has_n = malloc(num_reads);
+    r->starts[0] = 0;
+    for (size_t i = 0; i < num_reads; ++i) {
+        r->starts[i + 1] = r->starts[i] + 30 + (size_t)(rng() % 270);
+        r->has_n[i] = rng() % 7 == 0;
+    }
+    size_t n = r->starts[num_reads];
+    r->codes = malloc(n);
+    r->quals = malloc(n);
+    fill_codes(r->codes, n, 1);
+    for (size_t i = 0; i < n; ++i) {
+        r->quals[i] = (char)('!' + rng() % 42);
+    }
+    for (size_t i = 0; i < num_reads; ++i) {
+        if (r->has_n[i]) {
+            memset(r->codes + r->starts[i] + 10, 0, 10);  // Ns are stored as A
+        }
+    }
+}
+
+static void free_reads(reads_t *r) {
+    free(r->starts);
+    free(r->codes);
+    free(r->quals);
+    free(r->has_n);
+}
+
+static int write_reads(dna_writer_t *w, const reads_t *r, size_t from, size_t to) {
+    for (size_t i = from; i < to; ++i) {
+        size_t start = r->starts[i], len = r->starts[i + 1] - start;
+        char name[32];
+        int name_len = snprintf(name, sizeof(name), "read%zu", i);
+        if ((r->has_n[i] && dna_writer_mark_n(w, dna_writer_num_bases(w) + 10, 10) != 0) ||
+            dna_writer_append_read(w, r->codes + start, len) != 0 ||
+            dna_writer_append_quals(w, r->quals + start, len) != 0 ||
+            dna_writer_append_name(w, name, (size_t)name_len) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Writes reads [from, to) to a new file at `path`. Returns 0, or -1.
+static int write_new(const char *path, const reads_t *r, size_t from, size_t to, uint32_t codec) {
+    dna_meta_t meta = {.block_size = CHECK_BLOCK_SIZE, .flags = DNA_FLAG_VARIABLE};
+    dna_writer_t *w = dna_writer_open(path, &meta);
+    if (!w) {
+        return -1;
+    }
+    if ((codec && dna_writer_set_codec(w, codec, 0) != 0) || dna_writer_enable_quals(w, 4) != 0 ||
+        write_reads(w, r, from, to) != 0) {
+        dna_writer_abort(w);
+        return -1;
+    }
+    return dna_writer_close(w);
+}
+
+static int append_reads(const char *path, const reads_t *r, size_t from, size_t to, uint32_t codec) {
+    dna_writer_t *w = dna_writer_open_append(path, 0);
+    if (!w) {
+        return -1;
+    }
+    if ((codec && dna_writer_set_codec(w, codec, 0) != 0) || write_reads(w, r, from, to) != 0) {
+        dna_writer_abort(w);
+        return -1;
+    }
+    return dna_writer_close(w);
+}
+
+// Appending in pieces gives the same bytes as one write, and an aborted or
+// failed append puts the original file back.
+static void check_append(void) {
+    const char *whole = "check_whole.bin", *pieces = "check_pieces.bin";
+    reads_t r;
+    make_reads(&r, 3000);
+    const uint32_t codecs[] = {DNA_CODEC_RAW, DNA_CODEC_CM};
+    for (int c = 0; c < 2; ++c) {
+        size_t a = 1 + (size_t)(rng() % 1000), b = a + 1 + (size_t)(rng() % 1000);
+        int ok = write_new(whole, &r, 0, r.num_reads, codecs[c]) == 0 && write_new(pieces, &r, 0, a, codecs[c]) == 0 &&
+                 append_reads(pieces, &r, a, b, codecs[c]) == 0 && append_reads(pieces, &r, b, r.num_reads, codecs[c]) == 0;
+        char what[96];
+        snprintf(what, sizeof(what), "two appends match one write (%s blocks, N runs, quals, names)",
+                 codecs[c] ? "coded" : "raw");
+        check(ok && same_file(whole, pieces), what);
+    }
+
+    // `pieces` now holds every read, coded; abort an append, then fail one
+    size_t len;
+    uint8_t *before = read_file(pieces, &len);
+    dna_writer_t *w = dna_writer_open_append(pieces, 0);
+    int wrote = w && write_reads(w, &r, 0, 100) == 0;
+    if (w) {
+        dna_writer_abort(w);
+    }
+    size_t after_len;
+    uint8_t *after = read_file(pieces, &after_len);
+    check(wrote && after && after_len == len && memcmp(before, after, len) == 0 && access("check_pieces.bin.part", F_OK) != 0,
+          "an aborted append leaves the original file");
+    free(after);
+
+    w = dna_writer_open_append(pieces, 0);
+    int refused = w && dna_writer_append_read(w, r.codes, 50) == 0 && dna_writer_close(w) != 0;  // No qualities
+    after = read_file(pieces, &after_len);
+    check(refused && after && after_len == len && memcmp(before, after, len) == 0,
+          "a failed append puts the original file back");
+    free(after);
+    free(before);
+    remove(whole);
+    remove(pieces);
+    free_reads(&r);
+}
+
+// Compares everything a reader can see of two handles.
+static int same_contents(const dna_handle_t *x, const dna_handle_t *y) {
+    size_t n = dna_handle_size(x);
+    if (dna_handle_size(y) != n) {
+        return 0;
+    }
+    uint8_t *a = malloc(n ? n : 1), *b = malloc(n ? n : 1);
+    char *qa = malloc(n ? n : 1), *qb = malloc(n ? n : 1);
+    int same = dna_read_range(x, 0, n, a) == 0 && dna_read_range(y, 0, n, b) == 0 && memcmp(a, b, n) == 0 &&
+               dna_read_quals(x, 0, n, qa) == 0 && dna_read_quals(y, 0, n, qb) == 0 && memcmp(qa, qb, n) == 0;
+    dna_meta_t ma, mb;
+    dna_handle_meta(x, &ma);
+    dna_handle_meta(y, &mb);
+    same = same && ma.num_reads == mb.num_reads;
+    for (uint64_t i = 0; same && i < ma.num_reads; ++i) {
+        char na[64], nb[64];
+        long la = dna_read_name(x, i, na, sizeof(na)), lb = dna_read_name(y, i, nb, sizeof(nb));
+        same = la >= 0 && la == lb && strcmp(na, nb) == 0;
+    }
+    size_t runs_a, runs_b;
+    const dna_n_run_t *ra = dna_n_runs(x, &runs_a), *rb = dna_n_runs(y, &runs_b);
+    same = same && runs_a == runs_b && (runs_a == 0 || memcmp(ra, rb, runs_a * sizeof(*ra)) == 0);
+    free(a);
+    free(b);
+    free(qa);
+    free(qb);
+    return same;
+}
+
+// Samples read back from an archive match the same reads written as
+// standalone files.
+static void check_archive(void) {
+    const char *archive = "check_archive.bin", *files[2] = {"check_s1.bin", "check_s2.bin"};
+    const char *names[2] = {"S1", "S2"};
+    const uint32_t codecs[2] = {DNA_CODEC_CM, DNA_CODEC_RAW};
+    reads_t r;
+    make_reads(&r, 2000);
+    size_t split = 1200;
+
+    dna_archive_writer_t *ar = dna_archive_create(archive);
+    int ok = ar != NULL;
+    for (int s = 0; ok && s < 2; ++s) {
+        dna_meta_t meta = {.block_size = CHECK_BLOCK_SIZE, .flags = DNA_FLAG_VARIABLE};
+        dna_writer_t *w = dna_archive_add(ar, names[s], &meta);
+        ok = w && (!codecs[s] || dna_writer_set_codec(w, codecs[s], 0) == 0) && dna_writer_enable_quals(w, 4) == 0 &&
+             write_reads(w, &r, s ? split : 0, s ? r.num_reads : split) == 0;
+        if (w) {
+            ok = ok ? dna_writer_close(w) == 0 : (dna_writer_abort(w), 0);
+        }
+        ok = ok && write_new(files[s], &r, s ? split : 0, s ? r.num_reads : split, codecs[s]) == 0;
+    }
+    if (ar) {
+        ok = ok ? dna_archive_finish(ar) == 0 : (dna_archive_discard(ar), 0);
+    }
+    check(ok, "write a two-sample archive");
+
+    dna_archive_t *in = ok ? dna_archive_open(archive) : NULL;
+    check(in && dna_archive_num_samples(in) == 2, "the archive lists both samples");
+    for (int s = 0; in && s < 2; ++s) {
+        long i = dna_archive_find(in, names[s]);
+        dna_handle_t *x = i >= 0 ? dna_archive_open_sample(in, (size_t)i) : NULL;
+        dna_handle_t *y = dna_open_mmap(files[s], 0);
+        char what[80];
+        snprintf(what, sizeof(what), "sample %s matches its standalone file and verifies", names[s]);
+        check(x && y && same_contents(x, y) && dna_verify_range(x, 0, dna_handle_size(x)) == 0, what);
+        if (x) {
+            dna_close_mmap(x);
+        }
+        if (y) {
+            dna_close_mmap(y);
+        }
+    }
+    if (in) {
+        dna_archive_close(in);
+    }
+    remove(archive);
+    remove(files[0]);
+    remove(files[1]);
+    free_reads(&r);
+}
+
+int main() {
+    check_kernels();
+    check_coded_blocks();
+    check_append();
+    check_archive();
+    if (failures) {
+        printf("%d checks failed\n", failures);
+    } else {
+        printf("All checks passed\n");
+    }
+    return failures;
+}
@@ -0,0 +1,205 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "dna_array.h"
+
+// Sorts the fixed-length reads of a packed file and optionally collapses
+// duplicates, without unpacking: reads of L <= 32 bases are loaded as 2L-bit
+// integer keys (dna_read_keys), radix-sorted on every thread
+// (dna_sort_keys) and written back packed, one read per distinct key. The
+// count of each written read can go to a side file of little-endian u32, one
+// per read in output order, so (read, count) pairs cost 4 bytes per read on
+// top of the packed bases. Memory use is 16 bytes per input read (the keys
+// and the sort's scratch), plus 4 with `-C`.
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static void put_le32(uint8_t *p, uint32_t v) {
+    for (unsigned b = 0; b < 4; ++b) {
+        p[b] = (uint8_t)(v >> (8 * b));
+    }
+}
+
+// Writes `counts` to `<path>.part` and renames it into place. Returns 0, or -1.
+static int write_counts(const char *path, const uint32_t *counts, size_t n) {
+    size_t len = strlen(path);
+    char *part_path = malloc(len + sizeof(".part"));
+    if (!part_path) {
+        perror("Failed to allocate");
+        return -1;
+    }
+    memcpy(part_path, path, len);
+    memcpy(part_path + len, ".part", sizeof(".part"));
+    FILE *f = fopen(part_path, "wb");
+    if (!f) {
+        perror("Failed to open counts file");
+        free(part_path);
+        return -1;
+    }
+    uint8_t buf[4 * 4096];
+    int status = 0;
+    for (size_t i = 0; i < n && status == 0; i += sizeof(buf) / 4) {
+        size_t m = n - i < sizeof(buf) / 4 ? n - i : sizeof(buf) / 4;
+        for (size_t j = 0; j < m; ++j) {
+            put_le32(buf + 4 * j, counts[i + j]);
+        }
+        status = fwrite(buf, 4, m, f) == m ? 0 : -1;
+    }
+    if (fclose(f) != 0 || status != 0) {
+        perror("Failed to write counts file");
+        status = -1;
+    }
+    if (status == 0 && rename(part_path, path) != 0) {
+        perror("Failed to rename counts file");
+        status = -1;
+    }
+    if (status != 0) {
+        remove(part_path);
+    }
+    free(part_path);
+    return status;
+}
+
+void error_usage() {
+    fprintf(stderr, "Usage:   dna_array_dedup [options]\n");
+    fprintf(stderr, "Example: dna_array_dedup -i out.bin -o dedup.bin -C dedup.counts\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -i <FILE>   packed input file of reads of at most 32 bases\n");
+    fprintf(stderr, "  -o <FILE>   output file of the sorted reads\n");
+    fprintf(stderr, "  -C <FILE>   u32 count of each output read, needs `-d` 1 (default: none)\n");
+    fprintf(stderr, "  -k <int>    read length, 0 takes it from the header; needed for headerless input (default: 0)\n");
+    fprintf(stderr, "  -d <int>    1 writes each distinct read once, 0 keeps duplicates (default: 1)\n");
+    fprintf(stderr, "  -f <int>    output format: 0 headerless, 1 with header, 2 blocked, -1 as the input (default: -1)\n");
+    fprintf(stderr, "  -c <int>    block codec: 0 raw, 1 context model, 2 zstd; needs blocked output (default: 0)\n");
+    fprintf(stderr, "  -z <int>    zstd level for `-c 2` (default: 3)\n");
+    fprintf(stderr, "  -t <int>    threads, 0 uses every CPU (default: 0)\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    const char *input_file = NULL;
+    const char *output_file = NULL;
+    const char *counts_file = NULL;
+    long read_length = 0;
+    int collapse = 1;
+    int format = -1;
+    int codec = DNA_CODEC_RAW;
+    int level = 3;
+    int threads = 0;
+
+    for (int i = 1; i < argc; i+=2) {
+        if (i + 1 >= argc) { error_usage(); } // must have arg after flag
+        if (argv[i][0] != '-') { error_usage(); } // must start with dash
+        if (strlen(argv[i]) != 2) { error_usage(); } // must be -x (one dash, one letter)
+        if (argv[i][1] == 'i') { input_file = argv[i + 1]; }
+        else if (argv[i][1] == 'o') { output_file = argv[i + 1]; }
+        else if (argv[i][1] == 'C') { counts_file = argv[i + 1]; }
+        else if (argv[i][1] == 'k') { read_length = atol(argv[i + 1]); }
+        else if (argv[i][1] == 'd') { collapse = atoi(argv[i + 1]) != 0; }
+        else if (argv[i][1] == 'f') { format = atoi(argv[i + 1]); }
+        else if (argv[i][1] == 'c') { codec = atoi(argv[i + 1]); }
+        else if (argv[i][1] == 'z') { level = atoi(argv[i + 1]); }
+        else if (argv[i][1] == 't') { threads = atoi(argv[i + 1]); }
+        else { error_usage(); }
+    }
+    if (!input_file || !output_file || read_length < 0 || read_length > 32 || format < -1 || format > 2 ||
+        codec < 0 || codec > DNA_CODEC_ZSTD || threads < 0 || (counts_file && !collapse)) {
+        error_usage();
+    }
+
+    dna_set_num_threads(threads);
+    dna_handle_t *h = dna_open_mmap(input_file, 0);
+    if (!h) {
+        exit(EXIT_FAILURE);
+    }
+    dna_meta_t in_meta;
+    int has_header = dna_handle_meta(h, &in_meta);
+    if (read_length == 0) {
+        read_length = has_header && !(in_meta.flags & DNA_FLAG_VARIABLE) ? (long)in_meta.read_length : 0;
+    }
+    if (read_length == 0 || read_length > 32) {
+        fprintf(stderr, "%s does not hold reads of 1 to 32 bases; give their length with `-k`\n", input_file);
+        dna_close_mmap(h);
+        exit(EXIT_FAILURE);
+    }
+    size_t num_runs;
+    dna_n_runs(h, &num_runs);
+    if (num_runs) {
+        // Stored as A, the Ns would merge reads that differ
+        fprintf(stderr, "%s has N runs, which dna_array_dedup cannot keep\n", input_file);
+        dna_close_mmap(h);
+        exit(EXIT_FAILURE);
+    }
+    if (format < 0) {
+        format = !has_header ? 0 : in_meta.block_size ? 2 : 1;
+    }
+    if (codec != DNA_CODEC_RAW && format != 2) {
+        error_usage();
+    }
+    dna_advise(h, DNA_ADVICE_SEQUENTIAL);
+
+    unsigned len = (unsigned)read_length;
+    size_t num_reads = dna_handle_size(h) / len;
+    uint64_t *keys = malloc((num_reads ? num_reads : 1) * sizeof(*keys));
+    uint32_t *counts = counts_file ? malloc((num_reads ? num_reads : 1) * sizeof(*counts)) : NULL;
+    if (!keys || (counts_file && !counts)) {
+        perror("Failed to allocate keys");
+        exit(EXIT_FAILURE);
+    }
+    int status = 0;
+    uint64_t t0 = now_ns();
+    if (dna_read_keys(h, len, 0, num_reads, keys) != 0) {
+        fprintf(stderr, "Failed to read %s\n", input_file);
+        status = -1;
+    }
+    dna_close_mmap(h);
+    uint64_t t1 = now_ns();
+    if (status == 0 && dna_sort_keys(keys, num_reads, 2 * len) != 0) {
+        perror("Failed to allocate sort buffer");
+        status = -1;
+    }
+    size_t distinct = 0;
+    for (size_t i = 0; status == 0 && !collapse && i < num_reads; ++i) {
+        distinct += i == 0 || keys[i] != keys[i - 1];
+    }
+    if (status == 0 && collapse) {
+        distinct = dna_collapse_keys(keys, num_reads, counts);
+    }
+    size_t written = collapse ? distinct : num_reads;
+    uint64_t t2 = now_ns();
+
+    if (status == 0) {
+        dna_meta_t meta = {.read_length = len};
+        if (format == 2) {
+            meta.block_size = has_header && in_meta.block_size ? in_meta.block_size : DNA_DEFAULT_BLOCK_SIZE;
+        }
+        dna_writer_t *writer = dna_writer_open(output_file, format == 0 ? NULL : &meta);
+        if (!writer || (codec != DNA_CODEC_RAW && dna_writer_set_codec(writer, (uint32_t)codec, level) != 0) ||
+            dna_writer_append_keys(writer, keys, written, len) != 0) {
+            fprintf(stderr, "Failed to write %s\n", output_file);
+            dna_writer_abort(writer);
+            status = -1;
+        } else if (dna_writer_close(writer) != 0) {
+            status = -1;
+        }
+    }
+    if (status == 0 && counts_file && write_counts(counts_file, counts, written) != 0) {
+        status = -1;
+    }
+    if (status == 0) {
+        fprintf(stderr, "%zu reads, %zu distinct (%.4f), %zu written; loaded in %.2f s, sorted in %.2f s, "
+                "written in %.2f s\n", num_reads, distinct,
+                num_reads ? (double)distinct / num_reads : 0.0, written, (t1 - t0) / 1e9, (t2 - t1) / 1e9,
+                (now_ns() - t2) / 1e9);
+    }
+    free(counts);
+    free(keys);
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
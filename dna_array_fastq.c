@@ -2,145 +2,1160 @@
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <unistd.h> // Required for access()
 #include <zlib.h>  // For handling compressed files
+#ifdef DNA_USE_LIBDEFLATE
+#include <libdeflate.h>  // Faster inflate for BGZF blocks
+#endif
+
+#include "dna_array.h"
 
-#define MAX_LINE_LENGTH 1024
 #define BASES_PER_BYTE 4
+#define READ_CHUNK (1u << 20)  // Bytes inflated per gzread() call
+#define SOURCE_DEPTH 4         // Inflated chunks in flight between the inflate thread and the parser
+#define SOURCE_CHUNK (4u << 20)  // Minimum bytes per inflated chunk
+#define BGZF_MAX_BLOCK 65536   // Upper bound on a BGZF block, compressed or not
+#define PIPE_DEPTH 4           // Read batches shared by the parse and encode stages
+#define PIPE_BATCH_BYTES (1u << 20)  // Sequence bytes per batch
+#define PIPE_BATCH_READS 16384       // Reads per batch
+
+// Encoding table: maps ASCII base to 2-bit integer, with flag bits for 'N'
+// and for anything else that is not a base.
+#define CODE_N 0x40
+#define CODE_INVALID 0x80
+static uint8_t code_table[256];
+
+static void init_code_table(void) {
+    memset(code_table, CODE_INVALID, sizeof(code_table));
+    code_table['A'] = 0;
+    code_table['C'] = 1;
+    code_table['G'] = 2;
+    code_table['T'] = 3;
+    code_table['N'] = CODE_N;
+}
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+// Decompression source feeding the tokenizer. With `-@ 0` the parser calls
+// gzread() itself. Otherwise a source thread inflates ahead into a ring of
+// recycled chunks: BGZF input (bgzip, and most multi-member gzip written by
+// sequencing pipelines) is split at block boundaries and each batch of blocks
+// is inflated in parallel with dna_parallel_for(); any other input (plain
+// gzip, concatenated members without BGZF framing, uncompressed text) is
+// inflated by that one thread with gzread(), overlapping with parsing.
+typedef struct {
+    char *data;
+    size_t len;
+    size_t cap;
+} chunk_t;
+
+typedef struct {
+    int threaded;
+    int bgzf;
+    gzFile file;  // Unless bgzf
+    int fd;       // Raw input when bgzf
+
+    chunk_t ring[SOURCE_DEPTH];
+    size_t head;  // Chunks produced
+    size_t tail;  // Chunks consumed
+    size_t pos;   // Read position in ring[tail % SOURCE_DEPTH]
+    int done;
+    int error;
+    int stop;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    uint64_t inflate_ns;  // Reading and inflating, on whichever thread does it
+    uint64_t wait_ns;     // Parser waiting for the source thread
+
+    uint8_t *raw;  // Compressed BGZF bytes not yet inflated
+    size_t raw_len;
+    size_t raw_cap;
+} fastq_source_t;
+
+static uint16_t le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | p[1] << 8);
+}
+
+static uint32_t le32(const uint8_t *p) {
+    return le16(p) | (uint32_t)le16(p + 2) << 16;
+}
+
+// Returns the total size of the BGZF block at `p` (`avail` bytes available),
+// 0 if more bytes are needed to tell, or -1 if `p` is not a BGZF block.
+static long bgzf_block_size(const uint8_t *p, size_t avail) {
+    if (avail < 18) {
+        return 0;
+    }
+    if (p[0] != 0x1f || p[1] != 0x8b || p[2] != 8 || !(p[3] & 0x04)) {
+        return -1;
+    }
+    size_t xlen = le16(p + 10);
+    if (avail < 12 + xlen) {
+        return 0;
+    }
+    for (size_t i = 12; i + 4 <= 12 + xlen; i += 4 + le16(p + i + 2)) {
+        if (p[i] == 'B' && p[i + 1] == 'C' && le16(p + i + 2) == 2 && i + 6 <= 12 + xlen) {
+            return (long)le16(p + i + 4) + 1;
+        }
+    }
+    return -1;
+}
+
+typedef struct {
+    const uint8_t *in;
+    size_t in_len;
+    char *out;
+    size_t out_len;
+    uint32_t crc;
+} bgzf_block_t;
 
-// Encoding table: maps ASCII base to 2-bit integer
-uint8_t base_to_code(char base) {
-    switch (base) {
-        case 'A': return 0;
-        case 'C': return 1;
-        case 'G': return 2;
-        case 'T': return 3;
-        default: return 255;  // Invalid base (e.g., 'N')
+typedef struct {
+    bgzf_block_t *blocks;
+    int failed;
+} bgzf_batch_t;
+
+static void bgzf_inflate_task(void *arg, size_t task) {
+    bgzf_batch_t *batch = arg;
+    bgzf_block_t *blk = &batch->blocks[task];
+    int ok;
+#ifdef DNA_USE_LIBDEFLATE
+    struct libdeflate_decompressor *d = libdeflate_alloc_decompressor();
+    size_t out_len = 0;
+    ok = d && libdeflate_deflate_decompress(d, blk->in, blk->in_len, blk->out, blk->out_len, &out_len) ==
+              LIBDEFLATE_SUCCESS && out_len == blk->out_len &&
+         libdeflate_crc32(0, blk->out, blk->out_len) == blk->crc;
+    libdeflate_free_decompressor(d);
+#else
+    z_stream zs;
+    memset(&zs, 0, sizeof(zs));
+    ok = inflateInit2(&zs, -15) == Z_OK;
+    if (ok) {
+        zs.next_in = (Bytef *)blk->in;
+        zs.avail_in = (uInt)blk->in_len;
+        zs.next_out = (Bytef *)blk->out;
+        zs.avail_out = (uInt)blk->out_len;
+        ok = inflate(&zs, Z_FINISH) == Z_STREAM_END && zs.total_out == blk->out_len &&
+             crc32(0, (const Bytef *)blk->out, (uInt)blk->out_len) == blk->crc;
+        inflateEnd(&zs);
+    }
+#endif
+    if (!ok) {
+        __atomic_store_n(&batch->failed, 1, __ATOMIC_RELAXED);
     }
 }
 
-void save_large_array_to_file(const char *filename, const uint8_t *arr, size_t size) {
-    FILE *file = fopen(filename, "wb");
-    if (!file) {
-        perror("Failed to open file");
-        return;
+// gzread() that reports a truncated or corrupt stream as an error: at the
+// cut, zlib returns 0 like a clean end of file and only gzerror() tells.
+static int gz_read(gzFile file, void *buf, unsigned len) {
+    int got = gzread(file, buf, len);
+    if (got == 0) {
+        int err;
+        gzerror(file, &err);
+        if (err != Z_OK && err != Z_STREAM_END) {
+            return -1;
+        }
     }
+    return got;
+}
 
-    uint8_t buffer = 0;  // Buffer for packed bits
-    int bit_position = 0; // Tracks current bit position in the buffer
+// Inflates as many whole BGZF blocks as fit into `chunk`, at most
+// `max_blocks` of them (blocks may inflate to much less than BGZF_MAX_BLOCK).
+// Returns 1 if anything was produced, 0 at end of input, or -1 on error.
+static int bgzf_fill(fastq_source_t *src, chunk_t *chunk, bgzf_block_t *blocks, size_t max_blocks) {
+    for (;;) {
+        ssize_t got;
+        while (src->raw_len < src->raw_cap &&
+               (got = read(src->fd, src->raw + src->raw_len, src->raw_cap - src->raw_len)) != 0) {
+            if (got < 0) {
+                return -1;
+            }
+            src->raw_len += (size_t)got;
+        }
+
+        size_t n = 0, pos = 0;
+        chunk->len = 0;
+        while (n < max_blocks && chunk->len + BGZF_MAX_BLOCK <= chunk->cap) {
+            long size = bgzf_block_size(src->raw + pos, src->raw_len - pos);
+            if (size < 0 || (size == 0 && src->raw_len - pos >= 18 + BGZF_MAX_BLOCK)) {
+                return -1;
+            }
+            if (size == 0 || (size_t)size > src->raw_len - pos) {
+                break;
+            }
+            const uint8_t *p = src->raw + pos;
+            size_t header = 12 + le16(p + 10);
+            if ((size_t)size < header + 8 || le32(p + size - 4) > BGZF_MAX_BLOCK) {
+                return -1;
+            }
+            blocks[n].in = p + header;
+            blocks[n].in_len = (size_t)size - header - 8;
+            blocks[n].crc = le32(p + size - 8);
+            blocks[n].out_len = le32(p + size - 4);
+            blocks[n].out = chunk->data + chunk->len;
+            chunk->len += blocks[n].out_len;
+            n++;
+            pos += (size_t)size;
+        }
+        if (n == 0) {
+            return src->raw_len == 0 ? 0 : -1;  // Trailing garbage or a truncated block
+        }
 
-    for (size_t i = 0; i < size; ++i) {
-        // Pack 2 bits of the current element into the buffer
-        buffer |= (arr[i] & 0x03) << (6 - bit_position);
-        bit_position += 2;
+        bgzf_batch_t batch = {blocks, 0};
+        dna_parallel_for(n, bgzf_inflate_task, &batch);
+        if (batch.failed) {
+            return -1;
+        }
+        memmove(src->raw, src->raw + pos, src->raw_len - pos);
+        src->raw_len -= pos;
+        if (chunk->len > 0) {
+            return 1;
+        }
+        // Only empty blocks (such as the BGZF end-of-file marker); keep going.
+    }
+}
 
-        // Write buffer when full
-        if (bit_position == 8) {
-            fwrite(&buffer, 1, 1, file);
-            buffer = 0;
-            bit_position = 0;
+static void *source_main(void *arg) {
+    fastq_source_t *src = arg;
+    bgzf_block_t *blocks = NULL;
+    size_t max_blocks = src->ring[0].cap / BGZF_MAX_BLOCK;
+    int status = 0;
+    if (src->bgzf) {
+        blocks = malloc(max_blocks * sizeof(*blocks));
+        if (!blocks) {
+            status = -1;
         }
     }
 
-    // Write remaining bits
-    if (bit_position > 0) {
-        fwrite(&buffer, 1, 1, file);
+    while (status == 0) {
+        pthread_mutex_lock(&src->lock);
+        while (src->head - src->tail == SOURCE_DEPTH && !src->stop) {
+            pthread_cond_wait(&src->cond, &src->lock);
+        }
+        int stop = src->stop;
+        pthread_mutex_unlock(&src->lock);
+        if (stop) {
+            break;
+        }
+
+        chunk_t *chunk = &src->ring[src->head % SOURCE_DEPTH];
+        uint64_t t0 = now_ns();
+        if (src->bgzf) {
+            status = bgzf_fill(src, chunk, blocks, max_blocks);
+        } else {
+            int got = gz_read(src->file, chunk->data, (unsigned)chunk->cap);
+            chunk->len = got > 0 ? (size_t)got : 0;
+            status = got < 0 ? -1 : got > 0;
+        }
+        src->inflate_ns += now_ns() - t0;
+        if (status <= 0) {
+            break;
+        }
+        status = 0;
+
+        pthread_mutex_lock(&src->lock);
+        src->head++;
+        pthread_cond_broadcast(&src->cond);
+        pthread_mutex_unlock(&src->lock);
     }
 
-    fclose(file);
+    pthread_mutex_lock(&src->lock);
+    src->done = 1;
+    src->error = status < 0;
+    pthread_cond_broadcast(&src->cond);
+    pthread_mutex_unlock(&src->lock);
+    free(blocks);
+    return NULL;
 }
 
-void read_large_array_from_file(const char *filename, uint8_t *arr, size_t size) {
-    FILE *file = fopen(filename, "rb");
-    if (!file) {
-        perror("Failed to open file");
-        return;
-    }
+static int source_open(fastq_source_t *src, const char *input_file, int threads) {
+    memset(src, 0, sizeof(*src));
+    src->fd = -1;
+    src->threaded = threads > 0;
 
-    uint8_t buffer = 0;  // Buffer for packed bits
-    int bit_position = 0; // Tracks current bit position in the buffer
+    if (src->threaded) {
+        int fd = open(input_file, O_RDONLY);
+        if (fd < 0) {
+            return -1;
+        }
+        uint8_t magic[18 + 6];
+        ssize_t got = pread(fd, magic, sizeof(magic), 0);
+        if (got > 0 && bgzf_block_size(magic, (size_t)got) > 0) {
+            src->bgzf = 1;
+            src->fd = fd;
+        } else {
+            close(fd);
+        }
+    }
+    if (!src->bgzf) {
+        src->file = gzopen(input_file, "r");
+        if (!src->file) {
+            return -1;
+        }
+        gzbuffer(src->file, READ_CHUNK);
+    }
+    if (!src->threaded) {
+        return 0;
+    }
 
-    for (size_t i = 0; i < size; ++i) {
-        // Read a new byte when needed
-        if (bit_position == 0) {
-            fread(&buffer, 1, 1, file);
+    // Each chunk takes a whole batch of blocks: at least two per thread.
+    size_t cap = SOURCE_CHUNK;
+    if (src->bgzf && cap < (size_t)threads * 2 * BGZF_MAX_BLOCK) {
+        cap = (size_t)threads * 2 * BGZF_MAX_BLOCK;
+    }
+    for (int i = 0; i < SOURCE_DEPTH; ++i) {
+        src->ring[i].data = malloc(cap);
+        src->ring[i].cap = cap;
+    }
+    src->raw_cap = cap;
+    src->raw = src->bgzf ? malloc(src->raw_cap) : NULL;
+    for (int i = 0; i < SOURCE_DEPTH; ++i) {
+        if (!src->ring[i].data || (src->bgzf && !src->raw)) {
+            goto fail;
         }
+    }
+    pthread_mutex_init(&src->lock, NULL);
+    pthread_cond_init(&src->cond, NULL);
+    if (pthread_create(&src->thread, NULL, source_main, src) != 0) {
+        pthread_mutex_destroy(&src->lock);
+        pthread_cond_destroy(&src->cond);
+        goto fail;
+    }
+    return 0;
 
-        // Extract the next 2 bits
-        arr[i] = (buffer >> (6 - bit_position)) & 0x03;
-        bit_position += 2;
+fail:
+    for (int i = 0; i < SOURCE_DEPTH; ++i) {
+        free(src->ring[i].data);
+    }
+    free(src->raw);
+    if (src->file) {
+        gzclose(src->file);
+    }
+    if (src->fd >= 0) {
+        close(src->fd);
+    }
+    return -1;
+}
 
-        // Reset bit position when byte is consumed
-        if (bit_position == 8) {
-            bit_position = 0;
+// Copies up to `n` inflated bytes into `buf`. Returns the number copied, 0 at
+// end of input, or -1 on error.
+static long source_read(fastq_source_t *src, char *buf, size_t n) {
+    if (!src->threaded) {
+        uint64_t t0 = now_ns();
+        long got = gz_read(src->file, buf, (unsigned)(n < (1u << 30) ? n : (1u << 30)));
+        src->inflate_ns += now_ns() - t0;
+        return got;
+    }
+
+    pthread_mutex_lock(&src->lock);
+    if (src->tail == src->head && !src->done) {
+        uint64_t t0 = now_ns();
+        while (src->tail == src->head && !src->done) {
+            pthread_cond_wait(&src->cond, &src->lock);
         }
+        src->wait_ns += now_ns() - t0;
+    }
+    if (src->tail == src->head) {
+        long status = src->error ? -1 : 0;
+        pthread_mutex_unlock(&src->lock);
+        return status;
     }
+    pthread_mutex_unlock(&src->lock);
 
-    fclose(file);
+    chunk_t *chunk = &src->ring[src->tail % SOURCE_DEPTH];
+    size_t m = chunk->len - src->pos < n ? chunk->len - src->pos : n;
+    memcpy(buf, chunk->data + src->pos, m);
+    src->pos += m;
+    if (src->pos == chunk->len) {
+        src->pos = 0;
+        pthread_mutex_lock(&src->lock);
+        src->tail++;
+        pthread_cond_broadcast(&src->cond);
+        pthread_mutex_unlock(&src->lock);
+    }
+    return (long)m;
 }
 
-// Process a FASTQ file
-size_t process_fastq(const char *input_file, const char *output_file, size_t num_reads, size_t kmer_length) {
-    if (access(output_file, F_OK) == 0) {
-        printf("Output file `%s` exists, skip it.\n", output_file);
-	return 0;
+static void source_close(fastq_source_t *src) {
+    if (src->threaded) {
+        pthread_mutex_lock(&src->lock);
+        src->stop = 1;
+        pthread_cond_broadcast(&src->cond);
+        pthread_mutex_unlock(&src->lock);
+        pthread_join(src->thread, NULL);
+        pthread_mutex_destroy(&src->lock);
+        pthread_cond_destroy(&src->cond);
+        for (int i = 0; i < SOURCE_DEPTH; ++i) {
+            free(src->ring[i].data);
+        }
+        free(src->raw);
     }
-    gzFile file = gzopen(input_file, "r");
-    if (!file) {
-        perror("Failed to open FASTQ file");
-        exit(EXIT_FAILURE);
+    if (src->file) {
+        gzclose(src->file);
+    }
+    if (src->fd >= 0) {
+        close(src->fd);
     }
+}
 
-    char id[MAX_LINE_LENGTH], seq[MAX_LINE_LENGTH], plus[MAX_LINE_LENGTH], qual[MAX_LINE_LENGTH];
-    uint8_t *encoded_reads = malloc(kmer_length * num_reads);  // preallocated space for encoded reads
-    size_t total_reads = 0;
-    size_t total_bases = 0;
+// Chunked FASTQ tokenizer: takes large blocks of inflated text from the
+// source and finds record boundaries with memchr(). Lines may be of any
+// length; the buffer grows to hold the longest record.
+typedef struct {
+    fastq_source_t source;
+    char *buf;
+    size_t cap;
+    size_t pos;  // Start of the unparsed text
+    size_t len;  // End of the inflated text
+    int eof;
+    uint64_t inflated;  // Bytes inflated so far; read by the progress line while parsing
+} fastq_reader_t;
 
-    while (gzgets(file, id, sizeof(id))) {
-        gzgets(file, seq, sizeof(seq));  // Sequence line
-        gzgets(file, plus, sizeof(plus));  // '+' line
-        gzgets(file, qual, sizeof(qual));  // Quality line
+typedef struct {
+    const char *id, *seq, *qual;  // Not NUL-terminated
+    size_t id_len, seq_len, qual_len;
+} fastq_record_t;
 
-        // Remove newline characters
-        seq[strcspn(seq, "\r\n")] = '\0';
+static int fastq_reader_open(fastq_reader_t *r, const char *input_file, int threads) {
+    memset(r, 0, sizeof(*r));
+    if (source_open(&r->source, input_file, threads) != 0) {
+        return -1;
+    }
+    r->cap = 4 * READ_CHUNK;
+    r->buf = malloc(r->cap);
+    if (!r->buf) {
+        source_close(&r->source);
+        return -1;
+    }
+    return 0;
+}
 
-        // Filter out reads with 'N' or length < 32
-        size_t len = strlen(seq);
-        if (len < 32 || strchr(seq, 'N')) {
+static void fastq_reader_close(fastq_reader_t *r) {
+    free(r->buf);
+    source_close(&r->source);
+}
+
+// Moves the unparsed tail to the front and inflates more text behind it.
+// Returns 1 if new bytes arrived, 0 at end of input, or -1 on error.
+static int fastq_refill(fastq_reader_t *r) {
+    if (r->eof) {
+        return 0;
+    }
+    size_t rest = r->len - r->pos;
+    memmove(r->buf, r->buf + r->pos, rest);
+    r->pos = 0;
+    r->len = rest;
+    if (r->cap - r->len < READ_CHUNK) {
+        char *buf = realloc(r->buf, 2 * r->cap);
+        if (!buf) {
+            return -1;
+        }
+        r->buf = buf;
+        r->cap *= 2;
+    }
+    long got = source_read(&r->source, r->buf + r->len, r->cap - r->len);
+    if (got < 0) {
+        return -1;
+    }
+    if (got == 0) {
+        r->eof = 1;
+    }
+    __atomic_fetch_add(&r->inflated, (uint64_t)got, __ATOMIC_RELAXED);
+    r->len += (size_t)got;
+    return (int)(got > 0);
+}
+
+// Parses the next record. Returns 1, 0 at end of input, or -1 on a read
+// error or a truncated or malformed record.
+static int fastq_next(fastq_reader_t *r, fastq_record_t *rec) {
+    size_t ends[4];
+    size_t scan = r->pos;
+    int lines = 0;
+    int unterminated = 0;
+    while (lines < 4) {
+        char *nl = memchr(r->buf + scan, '\n', r->len - scan);
+        if (nl) {
+            ends[lines++] = (size_t)(nl - r->buf);
+            scan = ends[lines - 1] + 1;
             continue;
         }
+        if (r->eof) {
+            if (lines == 3 && scan < r->len) {
+                ends[lines++] = r->len;  // Last line without a trailing newline
+                unterminated = 1;
+                break;
+            }
+            return r->pos == r->len ? 0 : -1;
+        }
+        // Refilling moves the text, so the record is scanned again from its start.
+        if (fastq_refill(r) < 0) {
+            return -1;
+        }
+        scan = r->pos;
+        lines = 0;
+    }
 
-        // Encode the first 32 bases
-        for (size_t i = 0; i < kmer_length; ++i) {
-            uint8_t code = base_to_code(seq[i]);
-            if (code == 255) {
-                fprintf(stderr, "Invalid base in sequence: %s\n", seq);
-                exit(EXIT_FAILURE);
+    const char *base = r->buf + r->pos;
+    size_t starts[4] = {0, ends[0] + 1 - r->pos, ends[1] + 1 - r->pos, ends[2] + 1 - r->pos};
+    size_t lens[4];
+    for (int i = 0; i < 4; ++i) {
+        lens[i] = ends[i] - r->pos - starts[i];
+        if (lens[i] > 0 && base[starts[i] + lens[i] - 1] == '\r') {
+            lens[i]--;
+        }
+    }
+    if (lens[0] == 0 || base[0] != '@' || lens[2] == 0 || base[starts[2]] != '+') {
+        return -1;
+    }
+    if (unterminated && lens[3] != lens[1]) {
+        return -1;  // A cut-off file rather than a missing final newline
+    }
+    rec->id = base;
+    rec->id_len = lens[0];
+    rec->seq = base + starts[1];
+    rec->seq_len = lens[1];
+    rec->qual = base + starts[3];
+    rec->qual_len = lens[3];
+    r->pos = ends[3] < r->len ? ends[3] + 1 : r->len;
+    return 1;
+}
+
+// Outcome of encoding a read
+#define READ_OK 0
+#define READ_HAS_N 1
+#define READ_INVALID 2
+
+// Encodes the first `kmer_length` bases of `seq` into `out` and checks the
+// whole sequence for 'N', touching every byte once. With `keep_n`, 'N' is
+// encoded as 0 and only the clipped bases matter: READ_HAS_N then means an
+// 'N' inside them, in a read that is otherwise valid.
+static int encode_read(const char *seq, size_t len, size_t kmer_length, int keep_n, uint8_t *out) {
+    uint8_t flags = 0;
+    for (size_t i = 0; i < kmer_length; ++i) {
+        uint8_t code = code_table[(uint8_t)seq[i]];
+        out[i] = code & 0x03;
+        flags |= code;
+    }
+    if (keep_n) {
+        return flags & CODE_INVALID ? READ_INVALID : flags & CODE_N ? READ_HAS_N : READ_OK;
+    }
+    if (flags & CODE_N) {
+        return READ_HAS_N;
+    }
+    if (memchr(seq + kmer_length, 'N', len - kmer_length)) {
+        return READ_HAS_N;
+    }
+    return flags & CODE_INVALID ? READ_INVALID : READ_OK;
+}
+
+// Output formats selected with `-f`
+#define FORMAT_LEGACY 0  // headerless packed bases, length kept in the log
+#define FORMAT_HEADER 1  // dna_array.h header in front of the packed bases
+#define FORMAT_BLOCKED 2 // header, blocks of DNA_DEFAULT_BLOCK_SIZE bases and a block index
+
+// Settings shared by every file of a run
+typedef struct {
+    size_t num_reads;
+    size_t kmer_length;  // 0 keeps whole reads (variable-length mode)
+    size_t min_length;   // Shorter reads are dropped (`-L`)
+    int format;
+    int threads;   // Decompression threads per file (`-@`)
+    int pipeline;  // Parse on a separate thread from encoding (`-p`)
+    int keep_n;    // Keep reads with 'N' and record where the Ns are (`-N`)
+    int qual_bits; // Store binned qualities, 0 for none (`-Q`)
+    int names;     // Store read names (`-I`)
+    int codec;     // Block codec, DNA_CODEC_RAW for none (`-c`)
+    int level;     // zstd level (`-z`)
+    int stats;     // Report per-stage times (`-s`)
+    int progress;  // Seconds between progress lines, 0 for none (`-P`)
+    int append;    // Append to existing outputs instead of skipping them (`-a`)
+    dna_archive_writer_t *archive;  // Samples go into one archive (`-A`), NULL for a file each
+} fastq_options_t;
+
+// What happened to one file, for the stats log (`-S`). The counters are
+// gathered on every run; they cost a few additions per batch. Reads parsed
+// ahead of the `-n` limit are not counted, except for the short reads of the
+// last batch.
+typedef struct {
+    const char *status;  // "ok", "skipped" or "failed"
+    uint64_t input_bytes;
+    uint64_t inflated_bytes;
+    size_t reads_kept;
+    size_t reads_short;    // Shorter than `-L` or `-k`
+    size_t reads_n;        // Dropped for an 'N'
+    size_t reads_invalid;  // Stopped the file; at most 1
+    size_t kept_with_n;    // Kept with `-N`
+    size_t bases;
+    uint64_t inflate_ns;   // Reading and inflating the input
+    uint64_t parse_ns;     // Tokenizing, without inflating or waiting for the input
+    uint64_t encode_ns;    // Validating, encoding and packing, without waiting on the writer
+    uint64_t write_ns;     // Compressing and writing blocks on the writer's flush thread
+    uint64_t wall_ns;
+} fastq_stats_t;
+
+// Three-stage pipeline: a parse thread inflates and tokenizes (stage 1) and
+// hands batches of sequences to the calling thread, which validates, encodes
+// and packs them (stage 2) into the dna_writer ring, whose flush thread
+// writes them out (stage 3). Batches are recycled through a pair of
+// single-producer single-consumer queues; with PIPE_DEPTH batches in total
+// a push never finds a queue full, so only the popping side ever waits.
+typedef struct {
+    char *text;      // Per read: the sequence, then its qualities and name if wanted
+    size_t text_len;
+    size_t text_cap;
+    size_t *lens;       // Sequence lengths
+    size_t *name_lens;  // Only with names
+    size_t count;
+    size_t short_reads;  // Records dropped for being shorter than min_len
+    int status;      // 1 if more batches follow, 0 at end of input, -1 on a read or parse error
+} read_batch_t;
+
+typedef struct {
+    read_batch_t *slots[PIPE_DEPTH];
+    _Alignas(64) size_t head;  // Pushed so far; written by the producer only
+    _Alignas(64) size_t tail;  // Popped so far; written by the consumer only
+} batch_queue_t;
+
+typedef struct {
+    uint64_t parse_busy_ns;
+    uint64_t parse_stall_ns;   // Parse thread waiting for a free batch
+    uint64_t encode_busy_ns;   // Includes waiting on the writer ring
+    uint64_t encode_stall_ns;  // Encoder waiting for parsed reads
+    uint64_t batches;
+    uint64_t depth_sum;        // Parsed batches ready at each pop
+} pipeline_stats_t;
+
+typedef struct {
+    fastq_reader_t *reader;
+    size_t min_len;  // Shorter reads are dropped while parsing
+    int quals;       // Copy qualities
+    int names;       // Copy read names
+    int threaded;
+    read_batch_t batches[PIPE_DEPTH];
+    batch_queue_t parsed;  // Stage 1 to stage 2
+    batch_queue_t free;    // Stage 2 back to stage 1
+    int stop;              // Set once stage 2 needs no more reads
+    pthread_t thread;
+    pipeline_stats_t stats;
+} pipeline_t;
+
+static void queue_push(batch_queue_t *q, read_batch_t *b) {
+    size_t head = __atomic_load_n(&q->head, __ATOMIC_RELAXED);
+    q->slots[head % PIPE_DEPTH] = b;
+    __atomic_store_n(&q->head, head + 1, __ATOMIC_RELEASE);
+}
+
+// Waits for a batch. Returns NULL if `*stop` becomes set first.
+static read_batch_t *queue_pop(batch_queue_t *q, const int *stop, uint64_t *stall_ns) {
+    size_t tail = __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+    if (__atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == tail) {
+        uint64_t t0 = now_ns();
+        for (unsigned spins = 0; __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) == tail; ++spins) {
+            if (stop && __atomic_load_n(stop, __ATOMIC_ACQUIRE)) {
+                *stall_ns += now_ns() - t0;
+                return NULL;
             }
-            encoded_reads[total_bases++] = code;
+            if (spins < 64) {
+                sched_yield();
+            } else {
+                nanosleep(&(struct timespec){0, 50000}, NULL);
+            }
+        }
+        *stall_ns += now_ns() - t0;
+    }
+    read_batch_t *b = q->slots[tail % PIPE_DEPTH];
+    __atomic_store_n(&q->tail, tail + 1, __ATOMIC_RELEASE);
+    return b;
+}
+
+static size_t queue_depth(batch_queue_t *q) {
+    return __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) - __atomic_load_n(&q->tail, __ATOMIC_RELAXED);
+}
+
+// Fills `b` with the next reads of at least `p->min_len` bases. Returns b->status.
+static int parse_batch(const pipeline_t *p, read_batch_t *b) {
+    fastq_record_t rec;
+    b->text_len = 0;
+    b->count = 0;
+    b->short_reads = 0;
+    b->status = 1;
+    while (b->count < PIPE_BATCH_READS && b->text_len < PIPE_BATCH_BYTES) {
+        int status = fastq_next(p->reader, &rec);
+        if (status != 1) {
+            b->status = status;
+            break;
+        }
+        if (rec.seq_len < p->min_len) {
+            b->short_reads++;
+            continue;
+        }
+        if (p->quals && rec.qual_len != rec.seq_len) {
+            b->status = -1;  // Malformed record
+            break;
+        }
+        size_t name_len = p->names ? rec.id_len - 1 : 0;  // Without the '@'
+        size_t need = rec.seq_len * (p->quals ? 2 : 1) + name_len;
+        if (b->text_len + need > b->text_cap) {  // Reads longer than a batch
+            size_t cap = b->text_len + need;
+            char *text = realloc(b->text, cap);
+            if (!text) {
+                b->status = -1;
+                break;
+            }
+            b->text = text;
+            b->text_cap = cap;
+        }
+        memcpy(b->text + b->text_len, rec.seq, rec.seq_len);
+        b->text_len += rec.seq_len;
+        if (p->quals) {
+            memcpy(b->text + b->text_len, rec.qual, rec.seq_len);
+            b->text_len += rec.seq_len;
+        }
+        if (p->names) {
+            memcpy(b->text + b->text_len, rec.id + 1, name_len);
+            b->text_len += name_len;
+            b->name_lens[b->count] = name_len;
+        }
+        b->lens[b->count++] = rec.seq_len;
+    }
+    return b->status;
+}
+
+static void *parse_main(void *arg) {
+    pipeline_t *p = arg;
+    while (!__atomic_load_n(&p->stop, __ATOMIC_ACQUIRE)) {
+        read_batch_t *b = queue_pop(&p->free, &p->stop, &p->stats.parse_stall_ns);
+        if (!b) {
+            break;
+        }
+        uint64_t t0 = now_ns();
+        int status = parse_batch(p, b);
+        p->stats.parse_busy_ns += now_ns() - t0;
+        queue_push(&p->parsed, b);
+        if (status != 1) {
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void pipeline_free(pipeline_t *p) {
+    for (int i = 0; i < PIPE_DEPTH; ++i) {
+        free(p->batches[i].text);
+        free(p->batches[i].lens);
+        free(p->batches[i].name_lens);
+    }
+}
+
+static int pipeline_start(pipeline_t *p, fastq_reader_t *reader, size_t min_len, int quals, int names, int threaded) {
+    memset(p, 0, sizeof(*p));
+    p->reader = reader;
+    p->min_len = min_len;
+    p->quals = quals;
+    p->names = names;
+    p->threaded = threaded;
+    for (int i = 0; i < (threaded ? PIPE_DEPTH : 1); ++i) {
+        read_batch_t *b = &p->batches[i];
+        b->text_cap = PIPE_BATCH_BYTES;
+        b->text = malloc(b->text_cap);
+        b->lens = malloc(PIPE_BATCH_READS * sizeof(*b->lens));
+        b->name_lens = names ? malloc(PIPE_BATCH_READS * sizeof(*b->name_lens)) : NULL;
+        if (!b->text || !b->lens || (names && !b->name_lens)) {
+            pipeline_free(p);
+            return -1;
+        }
+        queue_push(&p->free, b);
+    }
+    if (threaded && pthread_create(&p->thread, NULL, parse_main, p) != 0) {
+        pipeline_free(p);
+        return -1;
+    }
+    return 0;
+}
+
+// Returns the next batch of reads for stage 2.
+static read_batch_t *pipeline_next(pipeline_t *p) {
+    if (!p->threaded) {
+        uint64_t t0 = now_ns();
+        parse_batch(p, &p->batches[0]);
+        p->stats.parse_busy_ns += now_ns() - t0;
+        return &p->batches[0];
+    }
+    p->stats.batches++;
+    p->stats.depth_sum += queue_depth(&p->parsed);
+    return queue_pop(&p->parsed, NULL, &p->stats.encode_stall_ns);
+}
+
+static void pipeline_release(pipeline_t *p, read_batch_t *b) {
+    if (p->threaded) {
+        queue_push(&p->free, b);
+    }
+}
+
+// Stops stage 1, which may still be parsing ahead, and frees the batches.
+static void pipeline_stop(pipeline_t *p) {
+    if (p->threaded) {
+        __atomic_store_n(&p->stop, 1, __ATOMIC_RELEASE);
+        pthread_join(p->thread, NULL);
+    }
+    pipeline_free(p);
+}
+
+static void report_pipeline(const char *input_file, const pipeline_stats_t *ps, const dna_writer_stats_t *ws) {
+    double s = 1e-9;
+    fprintf(stderr,
+            "Pipeline `%s`: parse busy %.3fs stall %.3fs; encode busy %.3fs stall %.3fs on input %.3fs on writer; "
+            "write busy %.3fs idle %.3fs; parsed queue depth %.2f/%d, writer ring depth %.2f\n",
+            input_file, ps->parse_busy_ns * s, ps->parse_stall_ns * s,
+            (ps->encode_busy_ns - ws->submit_wait_ns) * s, ps->encode_stall_ns * s, ws->submit_wait_ns * s,
+            ws->write_ns * s, ws->idle_ns * s,
+            ps->batches ? (double)ps->depth_sum / ps->batches : 0.0, PIPE_DEPTH,
+            ws->buffers ? (double)ws->depth_sum / ws->buffers : 0.0);
+}
+
+// Records the runs of 'N' among the first `kmer_length` bases of the read
+// about to be appended.
+static int mark_n_runs(dna_writer_t *writer, const char *seq, size_t kmer_length) {
+    uint64_t base = dna_writer_num_bases(writer);
+    for (size_t i = 0; i < kmer_length;) {
+        const char *n = memchr(seq + i, 'N', kmer_length - i);
+        if (!n) {
+            break;
+        }
+        size_t start = (size_t)(n - seq), end = start;
+        while (end < kmer_length && seq[end] == 'N') {
+            end++;
+        }
+        if (dna_writer_mark_n(writer, base + start, end - start) != 0) {
+            return -1;
+        }
+        i = end;
+    }
+    return 0;
+}
+
+// Appends must keep the layout of the existing file. Returns 0 if `opt`
+// matches it, or -1.
+static int check_append_layout(const dna_writer_t *writer, const fastq_options_t *opt, const char *output_file) {
+    dna_meta_t meta;
+    int qual_bits, has_names;
+    int has_header = dna_writer_layout(writer, &meta, &qual_bits, &has_names);
+    int format = !has_header ? FORMAT_LEGACY : meta.block_size ? FORMAT_BLOCKED : FORMAT_HEADER;
+    int variable = (meta.flags & DNA_FLAG_VARIABLE) != 0;
+    int same = format == opt->format && variable == (opt->kmer_length == 0) &&
+               (variable || !has_header || meta.read_length == opt->kmer_length) && qual_bits == opt->qual_bits;
+    if (meta.num_reads) {
+        same = same && has_names == opt->names;  // Files without reads cannot tell
+    }
+    if (!same) {
+        fprintf(stderr, "Output file `%s` was written with different -f, -k, -Q or -I options\n", output_file);
+        return -1;
+    }
+    return 0;
+}
+
+static void report_progress(const char *input_file, const fastq_stats_t *st, uint64_t inflated, uint64_t elapsed_ns) {
+    double s = elapsed_ns * 1e-9;
+    fprintf(stderr, "Progress `%s`: %zu reads kept, %.0f reads/s, %.1f MiB inflated, %.0fs\n", input_file,
+            st->reads_kept, s > 0 ? st->reads_kept / s : 0.0, inflated / 1048576.0, s);
+}
+
+// Process a FASTQ file. Returns 0 on success or -1 on error, filling `*st`
+// either way; st->bases is the number of bases written (0 if the output
+// already existed). With an archive, `output_file` is the sample name.
+int process_fastq(const char *input_file, const char *output_file, const fastq_options_t *opt, fastq_stats_t *st) {
+    uint64_t start_ns = now_ns();
+    memset(st, 0, sizeof(*st));
+    st->status = "failed";
+    struct stat input_stat;
+    if (stat(input_file, &input_stat) == 0) {
+        st->input_bytes = (uint64_t)input_stat.st_size;
+    }
+    int append = !opt->archive && opt->append && access(output_file, F_OK) == 0;
+    if (!opt->archive && !append && access(output_file, F_OK) == 0) {
+        printf("Output file `%s` exists, skip it.\n", output_file);
+        st->status = "skipped";
+	return 0;
+    }
+    fastq_reader_t reader;
+    if (fastq_reader_open(&reader, input_file, opt->threads) != 0) {
+        fprintf(stderr, "Failed to open FASTQ file `%s`: %s\n", input_file, strerror(errno));
+        return -1;
+    }
+
+    // Reads are packed and flushed as they are encoded, so memory use does not
+    // depend on `num_reads`.
+    size_t kmer_length = opt->kmer_length;
+    dna_meta_t meta = {.read_length = kmer_length};
+    if (kmer_length == 0) {
+        meta.flags = DNA_FLAG_VARIABLE;
+    }
+    if (opt->format == FORMAT_BLOCKED) {
+        meta.block_size = DNA_DEFAULT_BLOCK_SIZE;
+    }
+    dna_writer_t *writer = opt->archive ? dna_archive_add(opt->archive, output_file, &meta)
+                         : append       ? dna_writer_open_append(output_file, 0)
+                                        : dna_writer_open(output_file, opt->format == FORMAT_LEGACY ? NULL : &meta);
+    size_t encoded_cap = kmer_length ? kmer_length : READ_CHUNK;
+    uint8_t *encoded_read = malloc(encoded_cap);  // codes of the current read
+    if (!writer || !encoded_read || (append && check_append_layout(writer, opt, output_file) != 0) ||
+        (opt->codec && dna_writer_set_codec(writer, opt->codec, opt->level) != 0)) {
+        if (writer) {
+            dna_writer_abort(writer);
+        }
+        free(encoded_read);
+        fastq_reader_close(&reader);
+        return -1;
+    }
+
+    dna_writer_stats_t writer_stats;
+    memset(&writer_stats, 0, sizeof(writer_stats));
+    dna_writer_set_stats(writer, &writer_stats);
 
-            // Resize the array if needed
-            /*if (total_reads % (1 * 1024 * 1024) == 0) {
-                encoded_reads = realloc(encoded_reads, total_reads + (1 * 1024 * 1024));
-                if (!encoded_reads) {
-                    perror("Failed to allocate memory for encoded reads");
-                    exit(EXIT_FAILURE);
+    // Filter out reads shorter than `min_length` and reads too short to clip
+    // to `kmer_length` while parsing, and reads with 'N' while encoding
+    // unless they are kept with `-N`
+    pipeline_t pipe;
+    size_t min_length = kmer_length > opt->min_length ? kmer_length : opt->min_length;
+    if ((opt->qual_bits && !append && dna_writer_enable_quals(writer, opt->qual_bits) != 0) ||
+        pipeline_start(&pipe, &reader, min_length, opt->qual_bits != 0, opt->names, opt->pipeline) != 0) {
+        perror("Failed to start pipeline");
+        dna_writer_abort(writer);
+        free(encoded_read);
+        fastq_reader_close(&reader);
+        return -1;
+    }
+
+    size_t total_reads = 0;
+    size_t total_bases_written = 0;
+    uint64_t progress_ns = (uint64_t)opt->progress * 1000000000u;
+    uint64_t next_progress = start_ns + progress_ns;
+    int status = 1;
+    while (status == 1) {
+        read_batch_t *batch = pipeline_next(&pipe);
+        uint64_t t0 = now_ns();
+        const char *next = batch->text;
+        for (size_t i = 0; i < batch->count; ++i) {
+            size_t seq_len = batch->lens[i];
+            const char *seq = next;
+            const char *qual = seq + seq_len;
+            const char *name = qual + (opt->qual_bits ? seq_len : 0);
+            size_t name_len = opt->names ? batch->name_lens[i] : 0;
+            next = name + name_len;
+            size_t read_length = kmer_length ? kmer_length : seq_len;
+            if (read_length > encoded_cap) {
+                uint8_t *buf = realloc(encoded_read, read_length);
+                if (!buf) {
+                    perror("Failed to allocate read buffer");
+                    status = -2;
+                    break;
                 }
+                encoded_read = buf;
+                encoded_cap = read_length;
+            }
+            int outcome = encode_read(seq, seq_len, read_length, opt->keep_n, encoded_read);
+            if (outcome == READ_HAS_N && !opt->keep_n) {
+                st->reads_n++;
+                continue;
+            }
+            if (outcome == READ_HAS_N) {
+                st->kept_with_n++;
+                if (mark_n_runs(writer, seq, read_length) != 0) {
+                    status = -2;
+                    break;
+                }
+            }
+            if (outcome == READ_INVALID) {
+                fprintf(stderr, "Invalid base in sequence: %.*s\n", (int)seq_len, seq);
+                st->reads_invalid++;
+                status = -2;
+                break;
+            }
+            if (dna_writer_append_read(writer, encoded_read, read_length) != 0 ||
+                (opt->qual_bits && dna_writer_append_quals(writer, qual, read_length) != 0) ||
+                (opt->names && dna_writer_append_name(writer, name, name_len) != 0)) {
+                status = -2;
+                break;
+            }
+            total_bases_written += read_length;
+            total_reads += 1;
+            if (total_reads == opt->num_reads) {
+                status = 0;
+                break;
             }
-	    */
         }
-	total_reads += 1;
-	if (total_reads == num_reads) {
-	    break;
-	}
+        if (status == 1) {
+            status = batch->status;
+        }
+        st->reads_short += batch->short_reads;
+        pipeline_release(&pipe, batch);
+        uint64_t t1 = now_ns();
+        pipe.stats.encode_busy_ns += t1 - t0;
+        st->reads_kept = total_reads;
+        if (progress_ns && t1 >= next_progress) {
+            report_progress(input_file, st, __atomic_load_n(&reader.inflated, __ATOMIC_RELAXED), t1 - start_ns);
+            next_progress = t1 + progress_ns;
+        }
+    }
+    pipeline_stop(&pipe);
+    if (status == -1) {
+        fprintf(stderr, "Failed to parse FASTQ file `%s` after %zu reads\n", input_file, total_reads);
     }
 
-    // Save the packed array
-    save_large_array_to_file(output_file, encoded_reads, total_bases);
+    free(encoded_read);
+    fastq_reader_close(&reader);
+    if (status < 0) {
+        dna_writer_abort(writer);
+    } else if (dna_writer_close(writer) != 0) {
+        status = -2;
+    }
 
-    free(encoded_reads);
-    gzclose(file);
-    return total_bases;
+    // The parse stage's busy time includes inflating with `-@ 0`, and waiting
+    // for the source thread otherwise.
+    st->reads_kept = total_reads;
+    st->bases = total_bases_written;
+    st->inflated_bytes = reader.inflated;
+    st->inflate_ns = reader.source.inflate_ns;
+    st->parse_ns = pipe.stats.parse_busy_ns - (reader.source.threaded ? reader.source.wait_ns : reader.source.inflate_ns);
+    st->encode_ns = pipe.stats.encode_busy_ns - writer_stats.submit_wait_ns;
+    st->write_ns = writer_stats.write_ns;
+    st->wall_ns = now_ns() - start_ns;
+    if (status < 0) {
+        return -1;
+    }
+    if (opt->stats) {
+        report_pipeline(input_file, &pipe.stats, &writer_stats);
+    }
+    st->status = "ok";
+    return 0;
+}
+
+// Writes `s` as a JSON string.
+static void json_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s; ++s) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fprintf(f, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(f, "\\u%04x", c);
+        } else {
+            fputc(c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+// Appends one JSON object for a file to the stats log. Peak RSS is that of
+// the whole process so far, which covers the files run alongside it.
+static void write_stats(FILE *f, const char *input_file, const char *output_file, const fastq_stats_t *st) {
+    double s = 1e-9;
+    struct rusage ru;
+    long peak_rss_kib = getrusage(RUSAGE_SELF, &ru) == 0 ? ru.ru_maxrss : 0;
+    size_t seen = st->reads_kept + st->reads_short + st->reads_n + st->reads_invalid;
+    fputs("{\"input\":", f);
+    json_string(f, input_file);
+    fputs(",\"output\":", f);
+    json_string(f, output_file);
+    fprintf(f, ",\"status\":\"%s\",\"input_bytes\":%llu,\"inflated_bytes\":%llu,\"reads_seen\":%zu,"
+            "\"reads_kept\":%zu,\"dropped_short\":%zu,\"dropped_n\":%zu,\"dropped_invalid\":%zu,"
+            "\"kept_with_n\":%zu,\"bases\":%zu,\"inflate_s\":%.3f,\"parse_s\":%.3f,\"encode_s\":%.3f,"
+            "\"write_s\":%.3f,\"wall_s\":%.3f,\"reads_per_s\":%.0f,\"peak_rss_kib\":%ld}\n",
+            st->status, (unsigned long long)st->input_bytes, (unsigned long long)st->inflated_bytes, seen,
+            st->reads_kept, st->reads_short, st->reads_n, st->reads_invalid, st->kept_with_n, st->bases,
+            st->inflate_ns * s, st->parse_ns * s, st->encode_ns * s, st->write_ns * s, st->wall_ns * s,
+            st->wall_ns ? st->reads_kept / (st->wall_ns * s) : 0.0, peak_rss_kib);
+    fflush(f);
+}
+
+// Batch mode (`-i`): the listed files form a work queue, largest first, that
+// `-t` workers drain concurrently. Each output is written to `<out>.part` and
+// renamed when complete, so an existing output is always whole and a rerun
+// skips it. Log rows and stats lines are written under a lock, one complete
+// row per file, in the order the files finish.
+#define BATCH_FILES_PER_JOB 2   // FASTQ input and packed output
+#define BATCH_RESERVED_FILES 16 // stdio, the file list, the log and some slack
+
+typedef struct {
+    char *input;
+    char *output;
+    off_t size;
+} batch_job_t;
+
+typedef struct {
+    batch_job_t *jobs;
+    size_t num_jobs;
+    size_t next;  // Next job to hand out
+    int failed;   // Set once a file fails; no further jobs start
+    const fastq_options_t *opt;
+    FILE *log;
+    FILE *stats_log;  // `-S`, or NULL
+    pthread_mutex_t log_lock;
+} batch_t;
+
+static int compare_jobs(const void *a, const void *b) {
+    off_t x = ((const batch_job_t *)a)->size, y = ((const batch_job_t *)b)->size;
+    return (x < y) - (x > y);
+}
+
+// Peak memory of one file in flight: the writer ring, the tokenizer buffer,
+// the read batches, the block codec's buffers and model and, with `-@`, the
+// source ring and its compressed staging buffer.
+static size_t job_memory(const fastq_options_t *opt) {
+    size_t bytes = DNA_WRITER_MEMORY + 4 * READ_CHUNK;
+    if (opt->codec) {
+        bytes += 2 * DNA_DEFAULT_BLOCK_SIZE / 4 + (8u << 20);  // the order-10 model is 6 MiB
+    }
+    bytes += (opt->pipeline ? PIPE_DEPTH : 1) * (2 * PIPE_BATCH_BYTES + 2 * PIPE_BATCH_READS * sizeof(size_t));
+    if (opt->threads > 0) {
+        size_t chunk = SOURCE_CHUNK;
+        if (chunk < (size_t)opt->threads * 2 * BGZF_MAX_BLOCK) {
+            chunk = (size_t)opt->threads * 2 * BGZF_MAX_BLOCK;
+        }
+        bytes += (SOURCE_DEPTH + 1) * chunk;
+    }
+    return bytes;
+}
+
+static void *batch_worker(void *arg) {
+    batch_t *batch = arg;
+    for (;;) {
+        size_t i = __atomic_fetch_add(&batch->next, 1, __ATOMIC_RELAXED);
+        if (i >= batch->num_jobs || __atomic_load_n(&batch->failed, __ATOMIC_RELAXED)) {
+            break;
+        }
+        batch_job_t *job = &batch->jobs[i];
+        fastq_stats_t stats;
+        int failed = process_fastq(job->input, job->output, batch->opt, &stats) != 0;
+        if (batch->log || batch->stats_log) {
+            pthread_mutex_lock(&batch->log_lock);
+            if (batch->log && !failed) {
+                fprintf(batch->log, "\"%s\",%zu\n", job->output, stats.bases);
+                fflush(batch->log);
+            }
+            if (batch->stats_log) {
+                write_stats(batch->stats_log, job->input, job->output, &stats);
+            }
+            pthread_mutex_unlock(&batch->log_lock);
+        }
+        if (failed) {
+            fprintf(stderr, "Failed to process `%s`\n", job->input);
+            __atomic_store_n(&batch->failed, 1, __ATOMIC_RELAXED);
+            break;
+        }
+    }
+    return NULL;
 }
 
 void error_usage() {
@@ -152,7 +1167,23 @@ void error_usage() {
     fprintf(stderr, "  -i <FILE>   text file storing fastq files - one per line\n");
     fprintf(stderr, "  -q <FILE>   fastq file, if set overwrite `-i`\n");
     fprintf(stderr, "  -n <int>    number of reads (default: int(1e6))\n");
-    fprintf(stderr, "  -k <int>    kmer length to clip (default: 32)\n");
+    fprintf(stderr, "  -k <int>    kmer length to clip, 0 keeps whole reads and needs `-f` 1 or 2 (default: 32)\n");
+    fprintf(stderr, "  -L <int>    minimum read length (default: 32)\n");
+    fprintf(stderr, "  -f <int>    output format: 0 headerless, 1 with header, 2 blocked (default: 0)\n");
+    fprintf(stderr, "  -@ <int>    decompression threads, 0 inflates on the main thread (default: 0)\n");
+    fprintf(stderr, "  -N <int>    1 keeps reads with 'N' and records N runs, needs `-f` 1 or 2 (default: 0)\n");
+    fprintf(stderr, "  -Q <int>    bits per stored quality score, 2 or 4; 0 drops them (default: 0)\n");
+    fprintf(stderr, "  -I <int>    1 stores read names (default: 0)\n");
+    fprintf(stderr, "  -c <int>    block codec: 0 raw, 1 context model, 2 zstd; needs `-f` 2 (default: 0)\n");
+    fprintf(stderr, "  -z <int>    zstd level for `-c 2` (default: 3)\n");
+    fprintf(stderr, "  -p <int>    1 parses on its own thread, 0 parses and encodes on one thread (default: 1)\n");
+    fprintf(stderr, "  -s <int>    1 prints per-stage busy and stall times to stderr (default: 0)\n");
+    fprintf(stderr, "  -S <FILE>   appends a line of JSON stats per file: reads kept and dropped, stage times, peak RSS\n");
+    fprintf(stderr, "  -P <int>    seconds between progress lines on stderr, 0 for none (default: 0)\n");
+    fprintf(stderr, "  -t <int>    files processed concurrently with `-i` (default: 1)\n");
+    fprintf(stderr, "  -M <int>    memory cap in MiB shared by concurrent files, 0 for none (default: 0)\n");
+    fprintf(stderr, "  -a <int>    1 appends to existing outputs instead of skipping them (default: 0)\n");
+    fprintf(stderr, "  -A <FILE>   with `-i`, writes every file as a sample of one archive; needs `-f` 1 or 2\n");
     exit(EXIT_FAILURE);
 }
 
@@ -164,17 +1195,141 @@ const char *get_basename(const char *file_path) {
     return base ? base + 1 : file_path; // Return the portion after the last '/'
 }
 
+// Runs the files listed in `input_file` on up to `num_workers` threads,
+// fewer if the memory cap (`memory_mib`, 0 for none) or the open-file limit
+// would be exceeded. Returns 0 if every file succeeded.
+static int process_batch(const char *input_file, FILE *fout, FILE *stats_log, const fastq_options_t *opt, int num_workers,
+                         size_t memory_mib) {
+    FILE *fp = fopen(input_file, "r");
+    if (!fp) {
+        perror("Failed to open file list");
+        return -1;
+    }
+
+    batch_t batch;
+    memset(&batch, 0, sizeof(batch));
+    batch.opt = opt;
+    batch.log = fout;
+    batch.stats_log = stats_log;
+    size_t cap = 0;
+    char *line = NULL;
+    size_t line_cap = 0;
+    int status = 0;
+    while (getline(&line, &line_cap, fp) >= 0) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0') {
+            continue;
+        }
+        if (batch.num_jobs == cap) {
+            cap = cap ? 2 * cap : 64;
+            batch_job_t *jobs = realloc(batch.jobs, cap * sizeof(*jobs));
+            if (!jobs) {
+                status = -1;
+                break;
+            }
+            batch.jobs = jobs;
+        }
+        batch_job_t *job = &batch.jobs[batch.num_jobs];
+        const char *base = get_basename(line);
+        const char *suffix = opt->archive ? "" : ".bin";  // Archive samples are named after their file
+        job->input = strdup(line);
+        job->output = malloc(strlen(base) + strlen(suffix) + 1);
+        if (!job->input || !job->output) {
+            free(job->input);
+            free(job->output);
+            status = -1;
+            break;
+        }
+        sprintf(job->output, "%s%s", base, suffix);
+        struct stat st;
+        job->size = stat(line, &st) == 0 ? st.st_size : 0;
+        batch.num_jobs++;
+    }
+    free(line);
+    fclose(fp);
+    if (status != 0) {
+        perror("Failed to read file list");
+    }
+
+    // Largest first, so one big sample does not start last and run alone.
+    qsort(batch.jobs, batch.num_jobs, sizeof(*batch.jobs), compare_jobs);
+
+    if (memory_mib > 0) {
+        size_t by_memory = (memory_mib << 20) / job_memory(opt);
+        if ((size_t)num_workers > by_memory) {
+            num_workers = by_memory > 0 ? (int)by_memory : 1;
+        }
+    }
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur != RLIM_INFINITY) {
+        rlim_t by_files = rl.rlim_cur > BATCH_RESERVED_FILES ? (rl.rlim_cur - BATCH_RESERVED_FILES) / BATCH_FILES_PER_JOB : 1;
+        if ((rlim_t)num_workers > by_files) {
+            num_workers = by_files > 0 ? (int)by_files : 1;
+        }
+    }
+    if ((size_t)num_workers > batch.num_jobs) {
+        num_workers = batch.num_jobs > 0 ? (int)batch.num_jobs : 1;
+    }
+
+    if (status == 0) {
+        pthread_mutex_init(&batch.log_lock, NULL);
+        pthread_t *workers = malloc((size_t)num_workers * sizeof(*workers));
+        int started = 0;
+        if (workers) {
+            while (started < num_workers - 1 && pthread_create(&workers[started], NULL, batch_worker, &batch) == 0) {
+                started++;
+            }
+        }
+        batch_worker(&batch);  // The main thread works too
+        for (int i = 0; i < started; ++i) {
+            pthread_join(workers[i], NULL);
+        }
+        free(workers);
+        pthread_mutex_destroy(&batch.log_lock);
+        if (batch.failed) {
+            status = -1;
+        }
+    }
+
+    for (size_t i = 0; i < batch.num_jobs; ++i) {
+        free(batch.jobs[i].input);
+        free(batch.jobs[i].output);
+    }
+    free(batch.jobs);
+    return status;
+}
+
 int main(int argc, char *argv[]) {
     if (argc < 3) {
         error_usage();
     }
 
+    init_code_table();
+
     const char *input_file = NULL;
     const char *fastq_file = NULL;
     const char *log_file = NULL;
     const char *output_file = NULL;
-    size_t num_reads = 1000000;  // 1Mb reads
-    size_t kmer_length = 32;
+    const char *stats_file = NULL;
+    fastq_options_t opt = {
+        .num_reads = 1000000,  // 1Mb reads
+        .kmer_length = 32,
+        .min_length = 32,
+        .format = FORMAT_LEGACY,
+        .threads = 0,
+        .pipeline = 1,
+        .keep_n = 0,
+        .qual_bits = 0,
+        .names = 0,
+        .codec = DNA_CODEC_RAW,
+        .level = 3,
+        .stats = 0,
+        .progress = 0,
+        .append = 0,
+    };
+    const char *archive_file = NULL;
+    int num_workers = 1;
+    long memory_mib = 0;
 
     for (int i = 1; i < argc; i+=2) {
         // do some basic validation
@@ -185,42 +1340,118 @@ int main(int argc, char *argv[]) {
         if (argv[i][1] == 'o') { output_file = argv[i + 1]; }
         else if (argv[i][1] == 'q') { fastq_file = argv[i + 1]; }
         else if (argv[i][1] == 'i') { input_file = argv[i + 1]; }
-        else if (argv[i][1] == 'n') { num_reads = atoi(argv[i + 1]); }
-        else if (argv[i][1] == 'k') { kmer_length = atoi(argv[i + 1]); }
+        else if (argv[i][1] == 'n') { opt.num_reads = atoi(argv[i + 1]); }
+        else if (argv[i][1] == 'k') { opt.kmer_length = atoi(argv[i + 1]); }
+        else if (argv[i][1] == 'L') { opt.min_length = atoi(argv[i + 1]); }
         else if (argv[i][1] == 'l') { log_file = argv[i + 1]; }
+        else if (argv[i][1] == 'f') { opt.format = atoi(argv[i + 1]); }
+        else if (argv[i][1] == '@') { opt.threads = atoi(argv[i + 1]); }
+        else if (argv[i][1] == 'N') { opt.keep_n = atoi(argv[i + 1]) != 0; }
+        else if (argv[i][1] == 'Q') { opt.qual_bits = atoi(argv[i + 1]); }
+        else if (argv[i][1] == 'I') { opt.names = atoi(argv[i + 1]) != 0; }
+        else if (argv[i][1] == 'c') { opt.codec = atoi(argv[i + 1]); }
+        else if (argv[i][1] == 'z') { opt.level = atoi(argv[i + 1]); }
+        else if (argv[i][1] == 'p') { opt.pipeline = atoi(argv[i + 1]) != 0; }
+        else if (argv[i][1] == 's') { opt.stats = atoi(argv[i + 1]) != 0; }
+        else if (argv[i][1] == 'S') { stats_file = argv[i + 1]; }
+        else if (argv[i][1] == 'P') { opt.progress = atoi(argv[i + 1]); }
+        else if (argv[i][1] == 'a') { opt.append = atoi(argv[i + 1]) != 0; }
+        else if (argv[i][1] == 'A') { archive_file = argv[i + 1]; }
+        else if (argv[i][1] == 't') { num_workers = atoi(argv[i + 1]); }
+        else if (argv[i][1] == 'M') { memory_mib = atol(argv[i + 1]); }
         else { error_usage(); }
     }
 
+    if (opt.format < FORMAT_LEGACY || opt.format > FORMAT_BLOCKED) {
+        error_usage();
+    }
+    if (opt.qual_bits != 0 && opt.qual_bits != 2 && opt.qual_bits != 4) {
+        error_usage();
+    }
+    if (opt.codec < DNA_CODEC_RAW || opt.codec > DNA_CODEC_ZSTD || (opt.codec && opt.format != FORMAT_BLOCKED)) {
+        error_usage();  // codecs apply per block
+    }
+    if ((opt.keep_n || opt.kmer_length == 0 || opt.qual_bits || opt.names) && opt.format == FORMAT_LEGACY) {
+        error_usage();  // N runs, read offsets, qualities and names live in trailing sections
+    }
+
+    if (opt.threads < 0 || num_workers < 1 || memory_mib < 0 || opt.progress < 0) {
+        error_usage();
+    }
+    if (archive_file && (!input_file || fastq_file || opt.format == FORMAT_LEGACY || opt.append)) {
+        error_usage();  // Samples are headered files, written once
+    }
+    if (opt.threads > 0) {
+        dna_set_num_threads(opt.threads);  // BGZF blocks are inflated on the library's threads
+    }
+
+    // Stats lines accumulate across runs, like the outputs they describe.
+    FILE *stats_log = stats_file ? fopen(stats_file, "a") : NULL;
+    if (stats_file && !stats_log) {
+        perror("Failed to open stats file");
+        exit(EXIT_FAILURE);
+    }
+
     if (fastq_file != NULL) {
-        size_t total_bases = process_fastq(fastq_file, output_file, num_reads, kmer_length);
+        fastq_stats_t stats;
+        int status = process_fastq(fastq_file, output_file, &opt, &stats);
+        if (stats_log) {
+            write_stats(stats_log, fastq_file, output_file, &stats);
+        }
+        if (status != 0) {
+            exit(EXIT_FAILURE);
+        }
     } else {
-	if (log_file == NULL) {
+	if (log_file == NULL && archive_file == NULL) {
 	    perror("You must provide a log_file via `-l`.");
 	    exit(EXIT_FAILURE);
 	}
 
-	if (access(log_file, F_OK) == 0) {
+	if (log_file && access(log_file, F_OK) == 0) {
             printf("Log file `%s` exists, exit.\n", log_file);
             return 0;
         }
+        if (archive_file) {
+            // The archive's directory replaces the log, and its samples are
+            // written one at a time.
+            if (access(archive_file, F_OK) == 0) {
+                printf("Archive `%s` exists, exit.\n", archive_file);
+                return 0;
+            }
+            opt.archive = dna_archive_create(archive_file);
+            if (!opt.archive) {
+                exit(EXIT_FAILURE);
+            }
+            num_workers = 1;
+        }
 
-	char buffer[1024];
-	char out[2048];
-        FILE *fp = fopen(input_file, "r");
-	FILE *fout = fopen(log_file, "w");
-	fprintf(fout, "file_path,total_base\n");
-	while (fgets(buffer, sizeof(buffer), fp)) {
-	    buffer[strcspn(buffer, "\r\n")] = '\0';
-	    //output_file = get_basename(buffer);
-	    sprintf(out, "%s%s", get_basename(buffer), ".bin");
-	    size_t total_bases = process_fastq(buffer, out, num_reads, kmer_length);
-	    fprintf(fout, "\"%s\",%ld\n", out, total_bases);
-	    fflush(fout);
+	FILE *fout = log_file ? fopen(log_file, "w") : NULL;
+	if (log_file && !fout) {
+	    perror("Failed to open log file");
+	    dna_archive_discard(opt.archive);
+	    exit(EXIT_FAILURE);
+	}
+	if (fout) {
+	    fprintf(fout, "file_path,total_base\n");
+	}
+	int status = process_batch(input_file, fout, stats_log, &opt, num_workers, (size_t)memory_mib);
+	if (fout) {
+	    fclose(fout);
+	}
+	if (opt.archive) {
+	    if (status == 0) {
+	        status = dna_archive_finish(opt.archive);
+	    } else {
+	        dna_archive_discard(opt.archive);
+	    }
+	}
+	if (status != 0) {
+	    exit(EXIT_FAILURE);
 	}
-	fclose(fp);
-	fclose(fout);
     }
 
+    if (stats_log) {
+        fclose(stats_log);
+    }
     return EXIT_SUCCESS;
 }
-
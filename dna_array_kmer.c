@@ -0,0 +1,462 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "dna_array.h"
+
+// Counts the k-mers of a packed file into a sorted table.
+//
+// K-mers are spread over 2^COUNT_PARTS_LOG2 partitions by their leading
+// bases (fewer for k < 4), so the partitions, each sorted on its own,
+// concatenate into a sorted table. Each partition is an open-addressing
+// hash table with linear probing under its own lock. Scanning threads read
+// disjoint parts of the file through their own k-mer iterator and hand
+// k-mers to a partition in batches, which keeps lock traffic to one
+// acquisition per LOCAL_BATCH k-mers.
+//
+// Output, all fields little-endian:
+//   0  char[4] magic "DNAK"      4  u16 version (1)     6  u16 header size (32)
+//   8  u32 k                    12  u32 flags (1 = canonical k-mers)
+//  16  u64 number of entries    24  u32 minimum count  28  u32 bytes per k-mer
+// then one entry per distinct k-mer with at least the minimum count, in
+// ascending k-mer order: the 2k-bit k-mer in (2k + 7) / 8 bytes followed by
+// a u32 count (saturating). Fixed-size entries keep the table searchable
+// by bisection.
+
+#define TABLE_MAGIC "DNAK"
+#define TABLE_VERSION 1
+#define TABLE_HEADER_SIZE 32
+#define TABLE_FLAG_CANONICAL 0x1
+
+#define COUNT_PARTS_LOG2 8    // 256 partitions, the first four bases
+#define LOCAL_BATCH 1024      // K-mers gathered per partition before taking its lock
+#define SCAN_BATCH (1u << 16) // K-mers fetched per dna_kmer_iter_next() call
+#define TASKS_PER_THREAD 4    // Parts of the file per scanning thread, for balance
+#define BYTES_PER_KMER 64     // Table and sort memory per distinct k-mer, growth included, for `-M`
+
+typedef struct {
+    uint64_t kmer;
+    uint32_t count;  // 0 marks an empty slot
+} slot_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    slot_t *slots;
+    size_t mask;  // Slots - 1, a power of two
+    size_t used;
+    size_t kept;  // Entries left at the front after filtering and sorting
+} partition_t;
+
+typedef struct {
+    const dna_handle_t *h;
+    unsigned k;
+    int canonical;
+    size_t num_tasks;
+    unsigned part_shift;  // K-mer bits below the partition index
+    size_t num_parts;
+    partition_t *parts;
+    size_t lo, hi;  // Partitions counted in this pass
+    uint32_t min_count;
+    uint64_t total;  // K-mers seen over all passes, summed under `lock`
+    int failed;
+    pthread_mutex_t lock;
+} counter_t;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
+
+static size_t slot_of(uint64_t kmer, size_t mask) {
+    return (size_t)((kmer * 0x9E3779B97F4A7C15ull) >> 32) & mask;
+}
+
+static int partition_grow(partition_t *p) {
+    size_t cap = p->slots ? 2 * (p->mask + 1) : 1u << 12;
+    slot_t *slots = calloc(cap, sizeof(*slots));
+    if (!slots) {
+        return -1;
+    }
+    for (size_t i = 0; p->slots && i <= p->mask; ++i) {
+        if (p->slots[i].count) {
+            size_t j = slot_of(p->slots[i].kmer, cap - 1);
+            while (slots[j].count) {
+                j = (j + 1) & (cap - 1);
+            }
+            slots[j] = p->slots[i];
+        }
+    }
+    free(p->slots);
+    p->slots = slots;
+    p->mask = cap - 1;
+    return 0;
+}
+
+// Adds `n` k-mers to `p`, whose lock the caller holds. Returns 0, or -1 if
+// the table cannot grow.
+static int partition_add(partition_t *p, const uint64_t *kmers, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        if ((p->used + 1) * 10 > (p->mask + 1) * 7 && partition_grow(p) != 0) {
+            return -1;
+        }
+        size_t j = slot_of(kmers[i], p->mask);
+        while (p->slots[j].count && p->slots[j].kmer != kmers[i]) {
+            j = (j + 1) & p->mask;
+        }
+        slot_t *s = &p->slots[j];
+        if (s->count == 0) {
+            s->kmer = kmers[i];
+            p->used++;
+        }
+        if (s->count != UINT32_MAX) {
+            s->count++;
+        }
+    }
+    return 0;
+}
+
+static int flush_local(counter_t *c, size_t part, const uint64_t *kmers, size_t n) {
+    partition_t *p = &c->parts[part];
+    pthread_mutex_lock(&p->lock);
+    int status = partition_add(p, kmers, n);
+    pthread_mutex_unlock(&p->lock);
+    return status;
+}
+
+// Scans part `task` of the file.
+static void count_task(void *arg, size_t task) {
+    counter_t *c = arg;
+    uint64_t *scan = malloc(SCAN_BATCH * sizeof(*scan));
+    size_t n = c->hi - c->lo;
+    uint64_t *local = malloc(n * LOCAL_BATCH * sizeof(*local));
+    size_t *fill = calloc(n, sizeof(*fill));
+    dna_kmer_iter_t *it = dna_kmer_iter_open(c->h, c->k, 1);
+    int status = scan && local && fill && it ? 0 : -1;
+    uint64_t seen = 0;
+    if (status == 0) {
+        dna_kmer_iter_canonical(it, c->canonical);
+        dna_kmer_iter_part(it, task, c->num_tasks);
+    }
+    size_t got;
+    while (status == 0 && (got = dna_kmer_iter_next(it, scan, NULL, SCAN_BATCH)) > 0) {
+        seen += got;
+        for (size_t i = 0; i < got && status == 0; ++i) {
+            size_t part = (size_t)(scan[i] >> c->part_shift) - c->lo;
+            if (part >= n) {
+                continue;  // Counted in another pass
+            }
+            uint64_t *batch = local + part * LOCAL_BATCH;
+            batch[fill[part]++] = scan[i];
+            if (fill[part] == LOCAL_BATCH) {
+                status = flush_local(c, c->lo + part, batch, LOCAL_BATCH);
+                fill[part] = 0;
+            }
+        }
+        if (__atomic_load_n(&c->failed, __ATOMIC_RELAXED)) {
+            break;
+        }
+    }
+    for (size_t part = 0; status == 0 && part < n; ++part) {
+        if (fill[part]) {
+            status = flush_local(c, c->lo + part, local + part * LOCAL_BATCH, fill[part]);
+        }
+    }
+    pthread_mutex_lock(&c->lock);
+    c->total += seen;
+    if (status != 0) {
+        c->failed = 1;
+    }
+    pthread_mutex_unlock(&c->lock);
+    dna_kmer_iter_close(it);
+    free(fill);
+    free(local);
+    free(scan);
+}
+
+static int compare_slots(const void *a, const void *b) {
+    uint64_t x = ((const slot_t *)a)->kmer, y = ((const slot_t *)b)->kmer;
+    return (x > y) - (x < y);
+}
+
+// LSD radix sort of `n` slots by the low `bits` bits of their k-mers, a byte
+// per pass; passes where every k-mer has the same digit are skipped. Falls
+// back to qsort() if the scratch buffer cannot be allocated.
+static void radix_sort(slot_t *a, size_t n, unsigned bits) {
+    slot_t *tmp = n > 1 ? malloc(n * sizeof(*tmp)) : NULL;
+    if (!tmp) {
+        qsort(a, n, sizeof(*a), compare_slots);
+        return;
+    }
+    slot_t *src = a, *dst = tmp;
+    for (unsigned shift = 0; shift < bits; shift += 8) {
+        size_t count[256] = {0};
+        for (size_t i = 0; i < n; ++i) {
+            count[(src[i].kmer >> shift) & 0xFF]++;
+        }
+        if (count[(src[0].kmer >> shift) & 0xFF] == n) {
+            continue;
+        }
+        size_t sum = 0;
+        for (int d = 0; d < 256; ++d) {
+            size_t c = count[d];
+            count[d] = sum;
+            sum += c;
+        }
+        for (size_t i = 0; i < n; ++i) {
+            dst[count[(src[i].kmer >> shift) & 0xFF]++] = src[i];
+        }
+        slot_t *t = src;
+        src = dst;
+        dst = t;
+    }
+    if (src != a) {
+        memcpy(a, src, n * sizeof(*a));
+    }
+    free(tmp);
+}
+
+// Moves the entries of partition lo + `task` that pass the cutoff to the
+// front of its slots and sorts them. The table is shrunk to its entries
+// first so the sort's scratch buffer fits in what the table gave up.
+static void finish_task(void *arg, size_t task) {
+    counter_t *c = arg;
+    partition_t *p = &c->parts[c->lo + task];
+    size_t kept = 0;
+    for (size_t i = 0; p->slots && i <= p->mask; ++i) {
+        if (p->slots[i].count >= c->min_count) {
+            p->slots[kept++] = p->slots[i];
+        }
+    }
+    slot_t *shrunk = kept ? realloc(p->slots, kept * sizeof(*p->slots)) : NULL;
+    if (shrunk) {
+        p->slots = shrunk;
+    }
+    radix_sort(p->slots, kept, c->part_shift);  // The bits above are the partition's
+    p->kept = kept;
+}
+
+// Output table being written to `<file>.part`.
+typedef struct {
+    FILE *f;
+    char *path;
+    char *part_path;
+    uint64_t entries;
+    int status;
+} table_t;
+
+static void put_le(uint8_t *p, uint64_t v, unsigned bytes) {
+    for (unsigned b = 0; b < bytes; ++b) {
+        p[b] = (uint8_t)(v >> (8 * b));
+    }
+}
+
+static int table_header(table_t *t, const counter_t *c) {
+    uint8_t raw[TABLE_HEADER_SIZE] = {0};
+    memcpy(raw, TABLE_MAGIC, 4);
+    put_le(raw + 4, TABLE_VERSION, 2);
+    put_le(raw + 6, TABLE_HEADER_SIZE, 2);
+    put_le(raw + 8, c->k, 4);
+    put_le(raw + 12, c->canonical ? TABLE_FLAG_CANONICAL : 0, 4);
+    put_le(raw + 16, t->entries, 8);
+    put_le(raw + 24, c->min_count, 4);
+    put_le(raw + 28, (2 * c->k + 7) / 8, 4);
+    return fseek(t->f, 0, SEEK_SET) == 0 && fwrite(raw, 1, sizeof(raw), t->f) == sizeof(raw) ? 0 : -1;
+}
+
+static int table_open(table_t *t, const char *path, const counter_t *c) {
+    memset(t, 0, sizeof(*t));
+    size_t len = strlen(path);
+    t->path = strdup(path);
+    t->part_path = malloc(len + sizeof(".part"));
+    if (!t->path || !t->part_path) {
+        perror("Failed to allocate");
+        return -1;
+    }
+    memcpy(t->part_path, path, len);
+    memcpy(t->part_path + len, ".part", sizeof(".part"));
+    t->f = fopen(t->part_path, "wb");
+    if (!t->f) {
+        perror("Failed to open output file");
+        return -1;
+    }
+    t->status = table_header(t, c);  // Rewritten with the entry count on close
+    return t->status;
+}
+
+// Appends the sorted entries of partitions [lo, hi) to the table.
+static void table_append(table_t *t, const counter_t *c, size_t lo, size_t hi) {
+    unsigned key_bytes = (2 * c->k + 7) / 8;
+    uint8_t buf[12 * 4096];
+    size_t used = 0;
+    for (size_t i = lo; i < hi && t->status == 0; ++i) {
+        const partition_t *p = &c->parts[i];
+        for (size_t j = 0; j < p->kept && t->status == 0; ++j) {
+            put_le(buf + used, p->slots[j].kmer, key_bytes);
+            put_le(buf + used + key_bytes, p->slots[j].count, 4);
+            used += key_bytes + 4;
+            if (used + 12 > sizeof(buf)) {
+                t->status = fwrite(buf, 1, used, t->f) == used ? 0 : -1;
+                used = 0;
+            }
+        }
+        t->entries += p->kept;
+    }
+    if (t->status == 0 && used && fwrite(buf, 1, used, t->f) != used) {
+        t->status = -1;
+    }
+}
+
+// Finishes the table, or removes it if anything failed. Returns 0 on success.
+static int table_close(table_t *t, const counter_t *c) {
+    int status = t->status;
+    if (t->f) {
+        if (status == 0) {
+            status = table_header(t, c);
+        }
+        if (fclose(t->f) != 0 || status != 0) {
+            perror("Failed to write output file");
+            status = -1;
+        }
+        if (status == 0 && rename(t->part_path, t->path) != 0) {
+            perror("Failed to rename output file");
+            status = -1;
+        }
+        if (status != 0) {
+            remove(t->part_path);
+        }
+    }
+    free(t->path);
+    free(t->part_path);
+    return t->f ? status : -1;
+}
+
+void error_usage() {
+    fprintf(stderr, "Usage:   dna_array_kmer [options]\n");
+    fprintf(stderr, "Example: dna_array_kmer -i out.bin -o out.kmers -k 31 -m 2\n");
+    fprintf(stderr, "Options:\n");
+    fprintf(stderr, "  -i <FILE>   packed input file\n");
+    fprintf(stderr, "  -o <FILE>   output k-mer count table\n");
+    fprintf(stderr, "  -k <int>    k-mer length, 1 to 32 (default: 31)\n");
+    fprintf(stderr, "  -m <int>    minimum count of a k-mer to be written (default: 1)\n");
+    fprintf(stderr, "  -c <int>    1 counts canonical k-mers, 0 forward k-mers (default: 1)\n");
+    fprintf(stderr, "  -t <int>    threads, 0 uses every CPU (default: 0)\n");
+    fprintf(stderr, "  -M <int>    memory cap in MiB for the count tables, 0 for none (default: 0)\n");
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    const char *input_file = NULL;
+    const char *output_file = NULL;
+    long k = 31;
+    long min_count = 1;
+    int canonical = 1;
+    int threads = 0;
+    long memory_mib = 0;
+
+    for (int i = 1; i < argc; i+=2) {
+        if (i + 1 >= argc) { error_usage(); } // must have arg after flag
+        if (argv[i][0] != '-') { error_usage(); } // must start with dash
+        if (strlen(argv[i]) != 2) { error_usage(); } // must be -x (one dash, one letter)
+        if (argv[i][1] == 'i') { input_file = argv[i + 1]; }
+        else if (argv[i][1] == 'o') { output_file = argv[i + 1]; }
+        else if (argv[i][1] == 'k') { k = atol(argv[i + 1]); }
+        else if (argv[i][1] == 'm') { min_count = atol(argv[i + 1]); }
+        else if (argv[i][1] == 'c') { canonical = atoi(argv[i + 1]) != 0; }
+        else if (argv[i][1] == 't') { threads = atoi(argv[i + 1]); }
+        else if (argv[i][1] == 'M') { memory_mib = atol(argv[i + 1]); }
+        else { error_usage(); }
+    }
+    if (!input_file || !output_file || k < 1 || k > 32 || min_count < 1 || min_count > UINT32_MAX || threads < 0 ||
+        memory_mib < 0) {
+        error_usage();
+    }
+
+    dna_set_num_threads(threads);
+    dna_handle_t *h = dna_open_mmap(input_file, 0);
+    if (!h) {
+        exit(EXIT_FAILURE);
+    }
+    dna_advise(h, DNA_ADVICE_SEQUENTIAL);
+
+    counter_t c;
+    memset(&c, 0, sizeof(c));
+    c.h = h;
+    c.k = (unsigned)k;
+    c.canonical = canonical;
+    c.min_count = (uint32_t)min_count;
+    unsigned part_bits = 2 * c.k < COUNT_PARTS_LOG2 ? 2 * c.k : COUNT_PARTS_LOG2;
+    c.part_shift = 2 * c.k - part_bits;
+    c.num_parts = (size_t)1 << part_bits;
+    c.num_tasks = (size_t)dna_get_num_threads() * TASKS_PER_THREAD;
+    c.parts = calloc(c.num_parts, sizeof(*c.parts));
+    if (!c.parts) {
+        perror("Failed to allocate partitions");
+        exit(EXIT_FAILURE);
+    }
+    for (size_t i = 0; i < c.num_parts; ++i) {
+        pthread_mutex_init(&c.parts[i].lock, NULL);
+    }
+    pthread_mutex_init(&c.lock, NULL);
+
+    // Under a memory cap the partitions are counted a contiguous range at a
+    // time, one pass over the file each, sized as if every k-mer were distinct.
+    size_t passes = 1;
+    if (memory_mib > 0) {
+        uint64_t distinct_max = dna_handle_size(h);
+        if (c.k < 32 && distinct_max > 1ull << (2 * c.k)) {
+            distinct_max = 1ull << (2 * c.k);
+        }
+        uint64_t bound = distinct_max * BYTES_PER_KMER;
+        uint64_t cap = (uint64_t)memory_mib << 20;
+        passes = (size_t)((bound + cap - 1) / cap);
+        passes = passes < 1 ? 1 : passes > c.num_parts ? c.num_parts : passes;
+    }
+    table_t table;
+    int status = table_open(&table, output_file, &c);
+    uint64_t distinct = 0, scan_ns = 0, sort_ns = 0;
+    for (size_t pass = 0; pass < passes && status == 0; ++pass) {
+        c.lo = c.num_parts * pass / passes;
+        c.hi = c.num_parts * (pass + 1) / passes;
+        uint64_t t0 = now_ns();
+        dna_parallel_for(c.num_tasks, count_task, &c);
+        uint64_t t1 = now_ns();
+        if (c.failed) {
+            fprintf(stderr, "Failed to count k-mers: out of memory or unreadable input\n");
+            status = -1;
+            break;
+        }
+        for (size_t i = c.lo; i < c.hi; ++i) {
+            distinct += c.parts[i].used;
+        }
+        dna_parallel_for(c.hi - c.lo, finish_task, &c);
+        table_append(&table, &c, c.lo, c.hi);
+        for (size_t i = c.lo; i < c.hi; ++i) {
+            free(c.parts[i].slots);
+            c.parts[i].slots = NULL;
+        }
+        status = table.status;
+        scan_ns += t1 - t0;
+        sort_ns += now_ns() - t1;
+    }
+    if (table_close(&table, &c) != 0) {
+        status = -1;
+    }
+    if (status == 0) {
+        fprintf(stderr, "%llu k-mers, %llu distinct, %llu written in %zu pass%s; counted in %.2f s, sorted and "
+                "written in %.2f s\n", (unsigned long long)(c.total / passes), (unsigned long long)distinct,
+                (unsigned long long)table.entries, passes, passes > 1 ? "es" : "", scan_ns / 1e9, sort_ns / 1e9);
+    }
+
+    for (size_t i = 0; i < c.num_parts; ++i) {
+        pthread_mutex_destroy(&c.parts[i].lock);
+        free(c.parts[i].slots);
+    }
+    pthread_mutex_destroy(&c.lock);
+    free(c.parts);
+    dna_close_mmap(h);
+    return status == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,14 +1,35 @@
 import numpy as np
 
+HEADER_MAGIC = b"DNA2"
+HEADER_SIZE = 64
+
+def _layout(filename, num_elements):
+    """
+    Return (num_elements, payload offset) for a packed file. Files with a
+    `dna_array.h` header supply their own length; legacy files need `num_elements`.
+    """
+    with open(filename, "rb") as f:
+        raw = f.read(HEADER_SIZE)
+    if (len(raw) == HEADER_SIZE and raw[:4] == HEADER_MAGIC and
+            int.from_bytes(raw[4:6], "little") == 1 and int.from_bytes(raw[6:8], "little") == HEADER_SIZE):
+        if int.from_bytes(raw[8:12], "little") & 0x4:
+            raise ValueError("File has compressed blocks: open it with dna_array.PackedArrayMmap.")
+        stored = int.from_bytes(raw[16:24], "little")
+        return (stored if num_elements is None else num_elements), HEADER_SIZE
+    if num_elements is None:
+        raise ValueError("Headerless file: `num_elements` is required.")
+    return num_elements, 0
+
 ## 0. Unpacking the packed 2-bit data step by step into usable integers
 ## Speed: slow
 class PackedArrayMemmap:
-    def __init__(self, filename, num_elements):
+    def __init__(self, filename, num_elements=None):
         self.filename = filename
+        num_elements, offset = _layout(filename, num_elements)
         self.num_elements = num_elements
         self.bytes_per_element = 2  # Each element is 2 bits
         self.bytes_in_file = (num_elements + 3) // 4  # Total bytes in packed file
-        self.memmap = np.memmap(filename, dtype=np.uint8, mode='r', shape=(self.bytes_in_file,))
+        self.memmap = np.memmap(filename, dtype=np.uint8, mode='r', offset=offset, shape=(self.bytes_in_file,))
         self.cache = None  # Cache to store recently unpacked data
         self.cache_range = None  # (start, stop) range of cached indices
 
@@ -88,11 +109,12 @@ class PackedArrayMemmap:
 ## This eliminates the need to unpack data repeatedly during each access:
 ## Speed: fast
 class PackedArrayMemmapPreload:
-    def __init__(self, filename, num_elements):
+    def __init__(self, filename, num_elements=None):
         self.filename = filename
+        num_elements, offset = _layout(filename, num_elements)
         self.num_elements = num_elements
         self.bytes_in_file = (num_elements + 3) // 4  # Calculate number of bytes
-        self.memmap = np.memmap(filename, dtype=np.uint8, mode='r', shape=(self.bytes_in_file,))
+        self.memmap = np.memmap(filename, dtype=np.uint8, mode='r', offset=offset, shape=(self.bytes_in_file,))
         self.unpacked_array = self._unpack_all()  # Unpack entire file into memory
 
     def __len__(self):
@@ -125,12 +147,13 @@ class PackedArrayMemmapPreload:
 ## This avoids repeated byte-by-byte unpacking for overlapping ranges.
 ## Speed: intermediate
 class PackedArrayMemmapBatch:
-    def __init__(self, filename, num_elements, batch_size=10):
+    def __init__(self, filename, num_elements=None, batch_size=10):
         self.filename = filename
+        num_elements, offset = _layout(filename, num_elements)
         self.num_elements = num_elements
         self.batch_size = batch_size
         self.bytes_in_file = (num_elements + 3) // 4
-        self.memmap = np.memmap(filename, dtype=np.uint8, mode='r', shape=(self.bytes_in_file,))
+        self.memmap = np.memmap(filename, dtype=np.uint8, mode='r', offset=offset, shape=(self.bytes_in_file,))
         self.cache = None
         self.cache_range = None
 
@@ -116,6 +116,17 @@ toc = time.time()
 print(f"PackedArrayMemmapNaive - Time elapse: {toc - tic} secs.")
 
 
+from dna_array import PackedArrayMmap
+a = PackedArrayMmap("output_large.bin", 32_000_000)
+tic = time.time()
+idxs = np.random.randint(0, 32_000_000 - 10_000, 10000)
+for idx in idxs:
+  b = a[idx: idx + 10000]
+toc = time.time()
+print(f"PackedArrayMmap (C) - Time elapse: {toc - tic} secs.")
+a.close()
+
+
 #np.memmap - Time elapse: 0.02609539031982422 secs.
 #PackedArrayMemmap - Time elapse: 0.25661396980285645 secs.
 #PackedArrayMemmapPreload - Time elapse: 0.003321409225463867 secs.